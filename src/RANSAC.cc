@@ -25,6 +25,11 @@
 
 #include "RANSAC.hh"
 #include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
 
 // small typedef for the maximal value of uint32_t, used to 
 // avoid having to define __STDC_LIMIT_MACROS 
@@ -33,19 +38,6 @@
 // to speed up the computation, we avoid to recompute log(0.05f) but store it
 #define LOG_5_PER -2.99573
 
-// initialize static variables
-ransac_computation_type RANSAC::computation_type = P6pt;
-double RANSAC::error = 1.0;
-bool RANSAC::silent = false;
-bool RANSAC::measure_time = true;
-double RANSAC::max_time = 10.0; // 10 seconds
-bool RANSAC::stop_after_n_secs = false;
-uint32_t RANSAC::max_number_of_LO_samples = 0;
-float RANSAC::t_M = -1.0f;
-uint32_t RANSAC::nb_lo_steps = 0;
-
-ransac_variant RANSAC::inner_RANSAC_type = SPRT_LO_RANSAC;
-
 // SPRT: Lookup table for starting values for h_i
 // SPRT: depending on the values of epsilon (first dimension), 
 // SPRT: epsilon_i (second dimension) and delta_i (third dimension). 
@@ -127,6 +119,23 @@ const float SPRT_h_i_val[8][8][10] = { 1.0f, 1.0f, 1.0f, 1.0015f, 1.0249f, 0.0f,
 
 RANSAC::RANSAC()
 {
+  focal_length = 0.0;
+  initialize();
+  nb_SPRT_tests = 100;
+  epsilon_i.resize(nb_SPRT_tests,0.0f);
+  delta_i.resize(nb_SPRT_tests,0.0f);
+  A_i.resize(nb_SPRT_tests,0.0f);
+  h_i.resize(nb_SPRT_tests,0.0f);
+  k_i.resize(nb_SPRT_tests,0);
+}
+
+//-----------------------------------
+
+
+RANSAC::RANSAC( const ransac_config &config_ )
+  : config( config_ )
+{
+  focal_length = 0.0;
   initialize();
   nb_SPRT_tests = 100;
   epsilon_i.resize(nb_SPRT_tests,0.0f);
@@ -152,32 +161,52 @@ RANSAC::~RANSAC()
 //-----------------------------------
 
 
-void RANSAC::apply_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t nb_correspondences, const float min_inlier_ratio )
+void RANSAC::apply_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t nb_correspondences, const float min_inlier_ratio, const std::vector< float > *correspondence_scores )
 {
   //initialize counting variables and various parameters
   initialize();
   
   //start measuring time
-  if( measure_time )
+  if( config.measure_time )
   {
     RANSAC_timer.Init();
     RANSAC_timer.Start();
   }
   
+  // the sampling stops at the deadline of the caller or after max_time seconds, whichever comes first
+  run_deadline = deadline;
+  if( config.stop_after_n_secs )
+    run_deadline = Deadline::Earliest( run_deadline, Deadline::FromNow( config.max_time ) );
+  
   // use all correspondences
   correspondence_indices.resize(nb_correspondences);
   for( uint32_t i=0; i<nb_correspondences; ++i )
     correspondence_indices[i] = i;
+  
+  // for PROSAC, the correspondences are ordered by their quality (best first)
+  if( correspondence_scores != 0 && correspondence_scores->size() >= nb_correspondences )
+  {
+    const std::vector< float > &scores = *correspondence_scores;
+    std::stable_sort( correspondence_indices.begin(), correspondence_indices.end(), [&scores]( uint32_t a, uint32_t b ){ return scores[a] < scores[b]; } );
+    progressive_sampling = true;
+  }
+  
+  // convert them once for the evaluation of the hypotheses
+  prepare_correspondences( c1, c2 );
+  
   //apply RANSAC procedure
   
-  if( !silent )
+  if( !config.silent )
     std::cout << "[RANSAC] Applying RANSAC on " << nb_correspondences << " correspondences " << std::endl;
   
-  switch( inner_RANSAC_type )
+  switch( config.inner_RANSAC_type )
   {
     case SPRT_LO_RANSAC:
     {
-      unified_SPRT_LO_RANSAC( c1, c2, min_inlier_ratio );
+      if( config.nb_threads > 1 )
+        parallel_SPRT_LO_RANSAC( c1, c2, min_inlier_ratio );
+      else
+        unified_SPRT_LO_RANSAC( c1, c2, min_inlier_ratio );
       break;
     }
     
@@ -185,13 +214,13 @@ void RANSAC::apply_RANSAC( const std::vector< float > &c1, const std::vector< fl
       break;
   }
   
-  if( measure_time )
+  if( config.measure_time )
   {
     RANSAC_timer.Stop();
     elapsed_time = RANSAC_timer.GetElapsedTime();
   }
   
-  if( !silent )
+  if( !config.silent )
   {
     std::cout << "[RANSAC] Applying RANSAC took " << RANSAC_timer.GetElapsedTimeAsString() << std::endl;
   }
@@ -203,6 +232,14 @@ void RANSAC::apply_RANSAC( const std::vector< float > &c1, const std::vector< fl
 //-----------------------------------
 
 
+void RANSAC::set_config( const ransac_config &config_ )
+{
+  config = config_;
+}
+
+//-----------------------------------
+
+
 void RANSAC::set_minimal_consensus_size( const uint32_t size)
 {
   minimal_consensus_set_size = size;
@@ -211,11 +248,28 @@ void RANSAC::set_minimal_consensus_size( const uint32_t size)
 //-----------------------------------
 
 
+void RANSAC::set_focal_length( const double focal )
+{
+  focal_length = focal;
+}
+
+//-----------------------------------
+
+
+void RANSAC::set_deadline( const Deadline &deadline_ )
+{
+  deadline = deadline_;
+}
+
+//-----------------------------------
+
+
 void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, const float min_inlier_ratio )
 {
   //initialization
   size_inlier_set = 0;
   uint32_t nb_correspondences = (uint32_t) correspondence_indices.size();
+  hypothesis_workspace &ws = workspace;
 
   if( nb_correspondences >= number_of_samples )
   {
@@ -227,7 +281,7 @@ void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::
     inlier_ratio = std::max( min_inlier_ratio, ((float) number_of_samples) / ((float) nb_correspondences) );
     uint32_t max_steps = get_max_ransac_steps( inlier_ratio );
 	
-    if(!silent) 
+    if(!config.silent) 
 	  std::cout << "[RANSAC] initial inlier ratio : " << inlier_ratio << " resulting in at most " << max_steps << " steps " << std::endl;
 
     size_inlier_set = number_of_samples-1;
@@ -236,7 +290,7 @@ void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::
     
     std::vector<uint32_t> randomly_choosen_corr_indices, LO_randomly_choosen_corr_indices;
     randomly_choosen_corr_indices.resize( number_of_samples, 0 );
-    LO_randomly_choosen_corr_indices.resize( max_number_of_LO_samples, 0 );
+    LO_randomly_choosen_corr_indices.resize( LO_samples_max, 0 );
     
     //actual SPRT RANSAC algorithm
     
@@ -248,26 +302,29 @@ void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::
     int current_test = 0;
     int old_test = -1;
     
-    // handle timing. Need to split into two parts due to nummerics
-    double elapsed_time_total = 0.0;
-    double elapsed_time_sec = 0.0;
-    double old_time = 0.0;
-    double sum_time = 0.0;
-    int old_mins = 0;
-    int elapsed_mins = 0;
+    // the clock is only read every few samples, depending on the time needed per sample
+    DeadlineChecker deadline_checker( run_deadline );
     uint32_t nb_LO_samples;
     uint32_t counter = 0;
-    Timer time_out_timer;
-    time_out_timer.Init();
-    time_out_timer.Start();
     
     float eval_1 = delta_i[0] / epsilon_i[0];
     float eval_0 = (1.0f-delta_i[0]) / (1.0f-epsilon_i[0]);
+    // the likelihood ratio is updated once per block of correspondences, so we precompute the powers of eval_1 and eval_0
+    float eval_1_pow[ REPROJECTION_BLOCK_SIZE + 1 ], eval_0_pow[ REPROJECTION_BLOCK_SIZE + 1 ];
+    eval_1_pow[0] = eval_0_pow[0] = 1.0f;
+    for( int i=1; i<=REPROJECTION_BLOCK_SIZE; ++i )
+    {
+      eval_1_pow[i] = eval_1_pow[i-1] * eval_1;
+      eval_0_pow[i] = eval_0_pow[i-1] * eval_0;
+    }
     float lambda = 1.0f;
     float delta_hat = delta_i[0];
     float old_ratio = inlier_ratio;
     float nb_rejected = 1.0f;
     bool bad_model = false;
+    
+    prosac_state prosac;
+    init_prosac( prosac, nb_correspondences );
 	
     taken_samples = 0;
     k_i[0] = 0;
@@ -277,36 +334,12 @@ void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::
     
       for( ; taken_samples < max_steps/*0.01*/;)
       {
-		if( stop_after_n_secs )
+		if( deadline_checker.Expired() )
 		{
-		  elapsed_time_sec = time_out_timer.GetElapsedTime();
-		  time_out_timer.Stop();
-		  time_out_timer.Restart();
-		  if( elapsed_time_sec >= 1.0 )
-		  {
-			elapsed_time_total += elapsed_time_sec;
-			elapsed_time_sec = 0.0;
-			time_out_timer.Stop();
-			time_out_timer.Start();
-			elapsed_mins = int(floor(elapsed_time_total)) / 60;
-			if( elapsed_mins > old_mins && elapsed_mins > 0 )
-			{
-			  std::cout << "[RANSAC] elapsed time so far " << elapsed_time_total << " s " << std::endl;
-			  old_mins = elapsed_mins;
-			}
-		  }
-		  old_time = sum_time;
-		  sum_time = elapsed_time_sec + elapsed_time_total;
-		  if( sum_time >= max_time )
-		  {
-			std::cout << "[RANSAC] Warning: RANSAC reached time limit of " << max_time << " s and was stopped" << std::endl;
-			break;
-		  }
-		  if( old_time == sum_time && old_time > 0.0 )
-		  {
-			std::cout << "[RANSAC] Warning: Time did not change value (possibly due to nummerical reasons), so we abort after " << old_time << " s" << std::endl;
-			break;
-		  }
+		  time_limit_reached = true;
+		  if( !config.silent )
+			std::cout << "[RANSAC] Warning: RANSAC reached its time limit after " << taken_samples << " samples and was stopped" << std::endl;
+		  break;
 		}
 		++taken_samples;
 		k_i[current_test] += 1;
@@ -319,131 +352,128 @@ void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::
 		}
 	
 		//take a random sample from the set of correspondences
-		random_number_gen.generate_pseudorandom_numbers_unique( (uint32_t) 0, (uint32_t) ( nb_correspondences - 1 ), number_of_samples, randomly_choosen_corr_indices );
+		draw_sample( random_number_gen, prosac, taken_samples, randomly_choosen_corr_indices );
 		
 			  
 		//add the correspondences
-		clear_solver();
+		clear_solver( ws );
 		for(std::vector<uint32_t>::iterator itc = randomly_choosen_corr_indices.begin(); itc !=  randomly_choosen_corr_indices.end(); ++itc)
 		{
-		  add_correspondence(c1,c2,correspondence_indices[*itc]);
+		  add_correspondence( ws, c1, c2, correspondence_indices[*itc]);
 		}
 		
 			  
-		//compute hypothesis
-		if(!solve_system())
-		  continue;
+		//compute hypotheses (a minimal solver might return several of them)
+		uint32_t nb_hypotheses = solve_system( ws, true );
 		
-		//compute number of inlier to the hypothesis, evaluate the current SPRT test
-		inlier_found = 0;
-		lambda = 1.0f;
-		bad_model = false;
-		for(std::vector< uint32_t >::const_iterator it = correspondence_indices.begin() ; it != correspondence_indices.end(); ++it )
+		for( uint32_t hypothesis = 0; hypothesis < nb_hypotheses; ++hypothesis )
 		{
-		  if(evaluate_correspondece(c1,c2,*it))
-		  {
-			lambda *= eval_1;
-			++inlier_found;
-		  }
-		  else
-		  {
-			lambda *= eval_0;
-		  }
-		  if( lambda > A_i[current_test] )
-		  {
-			bad_model = true;
-			break;
-		  }
-		}
-	
-		if( bad_model )
-		{
-		  // check if we have to design a new test
-		  nb_rejected += 1.0f;
-		  delta_hat = delta_hat *(nb_rejected-1.0f) / nb_rejected + float(inlier_found)/(float(nb_correspondences) * nb_rejected);
+		  if( !select_hypothesis( ws, hypothesis ) )
+			continue;
 		  
-		  if( fabs( delta_hat - delta_i[current_test] ) > 0.05f )
+		  //compute number of inlier to the hypothesis, evaluate the current SPRT test after each block of correspondences
+		  inlier_found = 0;
+		  lambda = 1.0f;
+		  bad_model = false;
+		  for( uint32_t block = 0; block < nb_blocks; ++block )
 		  {
-			++current_test;
-			k_i[current_test] = 0;
-			epsilon_i[current_test] = epsilon_i[current_test-1];
-			delta_i[current_test] = delta_hat;
-			A_i[current_test] = sprt_compute_A( epsilon_i[current_test], delta_hat );
+			uint32_t nb_block_inlier = count_inliers_in_mask( evaluate_block( ws, block ) );
+			uint32_t block_size = std::min( (uint32_t) REPROJECTION_BLOCK_SIZE, nb_correspondences - block * REPROJECTION_BLOCK_SIZE );
+			inlier_found += nb_block_inlier;
+			lambda *= eval_1_pow[ nb_block_inlier ] * eval_0_pow[ block_size - nb_block_inlier ];
+			if( lambda > A_i[current_test] )
+			{
+			  bad_model = true;
+			  break;
+			}
 		  }
-		  
-		  continue;
-		}
-		
-
-		//compare found inliers to the biggest set of correspondences found so far
-		if(inlier_found > size_inlier_set )
-		{
-		  //store hypothesis and update inlier ratio
-		  store_hypothesis();
-		  
-		  
-		  // compute inlier
-		  inlier.clear();
-		  for( std::vector< uint32_t >::const_iterator it = correspondence_indices.begin() ; it != correspondence_indices.end(); ++it )
+	  
+		  if( bad_model )
 		  {
-			if(evaluate_correspondece(c1,c2,*it))
-			  inlier.push_back( *it );  
+			// check if we have to design a new test
+			nb_rejected += 1.0f;
+			delta_hat = delta_hat *(nb_rejected-1.0f) / nb_rejected + float(inlier_found)/(float(nb_correspondences) * nb_rejected);
+			
+			if( fabs( delta_hat - delta_i[current_test] ) > 0.05f )
+			{
+			  ++current_test;
+			  k_i[current_test] = 0;
+			  epsilon_i[current_test] = epsilon_i[current_test-1];
+			  delta_i[current_test] = delta_hat;
+			  A_i[current_test] = sprt_compute_A( epsilon_i[current_test], delta_hat );
+			}
+			
+			continue;
 		  }
+		  
 
-		  //do Local Optimization (LO)-steps (if possible!)
-		  nb_LO_samples = std::max( number_of_samples, std::min( inlier_found / 2, max_number_of_LO_samples ));
-		  for( uint32_t lo_steps = 0; lo_steps < nb_lo_steps; ++lo_steps )
+		  //compare found inliers to the biggest set of correspondences found so far
+		  if(inlier_found > size_inlier_set )
 		  {
-			random_number_gen.generate_pseudorandom_numbers_unique( (uint32_t) 0, (uint32_t) (inlier.size() - 1), nb_LO_samples, LO_randomly_choosen_corr_indices );
-			//generate hypothesis
-			//add the correspondences
-			clear_solver();
+			//store hypothesis and update inlier ratio
+			store_hypothesis( ws );
+			
 			
-			for( counter = 0; counter < nb_LO_samples; ++counter )
+			// compute inlier
+			inlier.clear();
+			get_inliers_of_hypothesis( ws, &inlier );
+
+			//do Local Optimization (LO)-steps (if possible!)
+			nb_LO_samples = std::max( number_of_samples, std::min( inlier_found / 2, LO_samples_max ));
+			// the local optimization of P3P uses the DLT of P6pt, which needs at least 6 correspondences
+			if( used_computation_type == P3P )
+			  nb_LO_samples = std::max( nb_LO_samples, (uint32_t) 6 );
+			for( uint32_t lo_steps = 0; lo_steps < config.nb_lo_steps && nb_LO_samples <= inlier.size(); ++lo_steps )
 			{
-			  add_correspondence(c1,c2,inlier[LO_randomly_choosen_corr_indices[counter]]);
+			  random_number_gen.generate_pseudorandom_numbers_unique( (uint32_t) 0, (uint32_t) (inlier.size() - 1), nb_LO_samples, LO_randomly_choosen_corr_indices );
+			  //generate hypothesis
+			  //add the correspondences
+			  clear_solver( ws );
+			  
+			  for( counter = 0; counter < nb_LO_samples; ++counter )
+			  {
+				add_correspondence( ws, c1, c2, inlier[LO_randomly_choosen_corr_indices[counter]]);
+			  }
+			  
+			  //compute hypothesis
+			  if( solve_system( ws, false ) == 0 )
+				continue;
+			  
+			  //compute inlier to the hypothesis
+			  new_found_inlier = get_inliers_of_hypothesis( ws, 0 );
+			  
+			  //update found model if new best hypothesis
+			  if( new_found_inlier > inlier_found )
+			  {
+				inlier_found = new_found_inlier;
+				store_hypothesis( ws );
+			  }
 			}
 			
-			//compute hypothesis
-			if(!solve_system())
-			  continue;
+			old_ratio = inlier_ratio;
+			inlier_ratio = std::max( inlier_ratio, (float) inlier_found / (float) nb_correspondences );
+			max_steps = get_max_ransac_steps( inlier_ratio );
+			size_inlier_set = inlier_found;
 			
-			//compute inlier to the hypothesis
-			new_found_inlier = 0;
-			for(std::vector< uint32_t >::const_iterator it = correspondence_indices.begin(); it != correspondence_indices.end(); ++it )
-			{
-			  if(evaluate_correspondece(c1,c2,*it))
-			++new_found_inlier;
-			}
+	  // 	  std::cout << projection_matrix << std::endl << std::endl;
 			
-			//update found model if new best hypothesis
-			if( new_found_inlier > inlier_found )
+			// design a new test if needed
+			// the check must be done to avoid designing a test for an inlier ratio below the specified minimal inlier ratio
+			if( old_ratio < inlier_ratio )
 			{
-			  inlier_found = new_found_inlier;
-			  store_hypothesis();
+			  ++current_test;
+			  k_i[current_test] = 0;
+			  epsilon_i[current_test] = inlier_ratio;
+			  delta_i[current_test] = delta_hat;
+			  A_i[current_test] = sprt_compute_A(inlier_ratio, delta_hat);
 			}
 		  }
-		  
-		  old_ratio = inlier_ratio;
-		  inlier_ratio = std::max( inlier_ratio, (float) inlier_found / (float) nb_correspondences );
-		  max_steps = get_max_ransac_steps( inlier_ratio );
-		  size_inlier_set = inlier_found;
-		  
-	// 	  std::cout << projection_matrix << std::endl << std::endl;
-		  
-		  // design a new test if needed
-		  // the check must be done to avoid designing a test for an inlier ratio below the specified minimal inlier ratio
-		  if( old_ratio < inlier_ratio )
-		  {
-			++current_test;
-			k_i[current_test] = 0;
-			epsilon_i[current_test] = inlier_ratio;
-			delta_i[current_test] = delta_hat;
-			A_i[current_test] = sprt_compute_A(inlier_ratio, delta_hat);
-		  }
 		}
       }
       
+      if( time_limit_reached )
+		break;
+      
       // adjust the number of steps SPRT RANSAC has to take 
       if( old_test != current_test )
       {
@@ -455,12 +485,309 @@ void RANSAC::unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::
     }
     
       
-    if( !silent )
+    if( !config.silent )
       std::cout << "[RANSAC] SPRT-LO-RANSAC took " << taken_samples << " samples using " << current_test+1 << " SPRTs, found " << size_inlier_set << " inlier ( " << inlier_ratio << " % ) " << std::endl;
   }
 }
 
 
+//-----------------------------------
+
+void RANSAC::parallel_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, const float min_inlier_ratio )
+{
+  //initialization
+  size_inlier_set = 0;
+  taken_samples = 0;
+  uint32_t nb_correspondences = (uint32_t) correspondence_indices.size();
+  
+  if( nb_correspondences < number_of_samples )
+    return;
+  
+  // compute the inlier ratio and the maximum number of steps that RANSAC has to take 
+  inlier_ratio = std::max( min_inlier_ratio, ((float) number_of_samples) / ((float) nb_correspondences) );
+  uint32_t max_steps = get_max_ransac_steps( inlier_ratio );
+  
+  if(!config.silent) 
+    std::cout << "[RANSAC] initial inlier ratio : " << inlier_ratio << " resulting in at most " << max_steps << " steps, using " << config.nb_threads << " threads " << std::endl;
+  
+  size_inlier_set = number_of_samples-1;
+  
+  // initialize the 0-th SPRT test
+  epsilon_i[0] = inlier_ratio;
+  delta_i[0] = 0.01f;
+  A_i[0] = sprt_compute_A( epsilon_i[0], delta_i[0] );
+  k_i[0] = 0;
+  
+  // as in the sequential version, the likelihood ratio is computed with the values of the 0-th test
+  float eval_1 = delta_i[0] / epsilon_i[0];
+  float eval_0 = (1.0f-delta_i[0]) / (1.0f-epsilon_i[0]);
+  float eval_1_pow[ REPROJECTION_BLOCK_SIZE + 1 ], eval_0_pow[ REPROJECTION_BLOCK_SIZE + 1 ];
+  eval_1_pow[0] = eval_0_pow[0] = 1.0f;
+  for( int i=1; i<=REPROJECTION_BLOCK_SIZE; ++i )
+  {
+    eval_1_pow[i] = eval_1_pow[i-1] * eval_1;
+    eval_0_pow[i] = eval_0_pow[i-1] * eval_0;
+  }
+  
+  ////
+  // The state shared by all threads. The number of samples taken, the bound on the number of samples,
+  // the size of the best inlier set and the threshold of the current SPRT are read without locking.
+  // All other SPRT values and the best hypothesis are only accessed while holding the mutex.
+  std::mutex mutex;
+  std::atomic< uint32_t > shared_taken_samples( 0 );
+  std::atomic< uint32_t > shared_max_steps( max_steps );
+  std::atomic< uint32_t > shared_size_inlier_set( size_inlier_set );
+  std::atomic< float > shared_A( A_i[0] );
+  std::atomic< bool > stop( false );
+  int current_test = 0;
+  int old_test = -1;
+  float delta_hat = delta_i[0];
+  float nb_rejected = 1.0f;
+  
+  // every thread draws its samples from its own stream of random numbers. The calling thread continues
+  // the stream of random_number_gen, the seeds of the other threads are drawn from it (pairwise distinct)
+  std::vector< uint32_t > thread_seeds( config.nb_threads, 0 );
+  for( uint32_t t=1; t<config.nb_threads; ++t )
+  {
+    do
+      thread_seeds[t] = random_number_gen.generate_pseudorandom_number();
+    while( std::find( thread_seeds.begin() + 1, thread_seeds.begin() + t, thread_seeds[t] ) != thread_seeds.begin() + t );
+  }
+  
+  auto worker = [&]( uint32_t thread_id )
+  {
+    hypothesis_workspace ws;
+    ws.solverP3P.setFocalLength( focal_length );
+    
+    // the state of the generator is kept per thread, so seeding in the calling thread would restart random_number_gen
+    std::unique_ptr< Util::Math::PRNG_u32i > thread_rng;
+    if( thread_id > 0 )
+      thread_rng.reset( new Util::Math::PRNG_u32i( thread_seeds[thread_id] ) );
+    Util::Math::PRNG_u32i &rng = ( thread_id > 0 ) ? *thread_rng : random_number_gen;
+    prosac_state prosac;
+    init_prosac( prosac, nb_correspondences );
+    
+    std::vector< uint32_t > sample( number_of_samples, 0 ), LO_sample( LO_samples_max, 0 ), sample_inlier;
+    
+    // the inlier counts of the hypotheses of a sample rejected by the SPRT (a minimal solver returns at most 4)
+    uint32_t rejected_inlier[4];
+    
+    DeadlineChecker deadline_checker( run_deadline );
+    
+    while( !stop.load() )
+    {
+      if( deadline_checker.Expired() )
+      {
+        if( !stop.exchange( true ) )
+        {
+          time_limit_reached = true;
+          if( !config.silent )
+            std::cout << "[RANSAC] Warning: RANSAC reached its time limit after " << shared_taken_samples.load() << " samples and was stopped" << std::endl;
+        }
+        break;
+      }
+      
+      // claim the next sample
+      uint32_t sample_nb = shared_taken_samples.load();
+      if( sample_nb >= shared_max_steps.load() )
+      {
+        // adjust the number of steps SPRT RANSAC has to take 
+        std::lock_guard< std::mutex > lock( mutex );
+        if( shared_taken_samples.load() >= shared_max_steps.load() )
+        {
+          if( old_test != current_test )
+          {
+            old_test = current_test;
+            shared_max_steps = SPRT_get_max_sprt_ransac_steps( inlier_ratio, current_test );
+          }
+          else
+            stop = true;
+        }
+        continue;
+      }
+      if( !shared_taken_samples.compare_exchange_weak( sample_nb, sample_nb + 1 ) )
+        continue;
+      ++sample_nb;
+      
+      //take a random sample from the set of correspondences
+      draw_sample( rng, prosac, sample_nb, sample );
+      
+      clear_solver( ws );
+      for( uint32_t i=0; i<number_of_samples; ++i )
+        add_correspondence( ws, c1, c2, correspondence_indices[sample[i]] );
+      
+      uint32_t nb_hypotheses = solve_system( ws, true );
+      
+      uint32_t nb_rejected_hypotheses = 0;
+      uint32_t best_inlier_found = 0;
+      ProjMatrix best_hypothesis;
+      
+      for( uint32_t hypothesis = 0; hypothesis < nb_hypotheses; ++hypothesis )
+      {
+        if( !select_hypothesis( ws, hypothesis ) )
+          continue;
+        
+        //compute number of inlier to the hypothesis, evaluate the current SPRT test after each block of correspondences
+        uint32_t inlier_found = 0;
+        float lambda = 1.0f;
+        float A = shared_A.load();
+        bool bad_model = false;
+        for( uint32_t block = 0; block < nb_blocks; ++block )
+        {
+          uint32_t nb_block_inlier = count_inliers_in_mask( evaluate_block( ws, block ) );
+          uint32_t block_size = std::min( (uint32_t) REPROJECTION_BLOCK_SIZE, nb_correspondences - block * REPROJECTION_BLOCK_SIZE );
+          inlier_found += nb_block_inlier;
+          lambda *= eval_1_pow[ nb_block_inlier ] * eval_0_pow[ block_size - nb_block_inlier ];
+          if( lambda > A )
+          {
+            bad_model = true;
+            break;
+          }
+        }
+        
+        if( bad_model )
+        {
+          rejected_inlier[ nb_rejected_hypotheses++ ] = inlier_found;
+          continue;
+        }
+        
+        if( inlier_found <= shared_size_inlier_set.load() || inlier_found <= best_inlier_found )
+          continue;
+        
+        best_inlier_found = inlier_found;
+        ws.solverP6pt.getProjectionMatrix( best_hypothesis );
+        
+        //do Local Optimization (LO)-steps (if possible!) on the inliers of this hypothesis
+        sample_inlier.clear();
+        get_inliers_of_hypothesis( ws, &sample_inlier );
+        uint32_t nb_LO_samples = std::max( number_of_samples, std::min( inlier_found / 2, LO_samples_max ));
+        // the local optimization of P3P uses the DLT of P6pt, which needs at least 6 correspondences
+        if( used_computation_type == P3P )
+          nb_LO_samples = std::max( nb_LO_samples, (uint32_t) 6 );
+        for( uint32_t lo_steps = 0; lo_steps < config.nb_lo_steps && nb_LO_samples <= sample_inlier.size(); ++lo_steps )
+        {
+          rng.generate_pseudorandom_numbers_unique( (uint32_t) 0, (uint32_t) (sample_inlier.size() - 1), nb_LO_samples, LO_sample );
+          clear_solver( ws );
+          for( uint32_t i = 0; i < nb_LO_samples; ++i )
+            add_correspondence( ws, c1, c2, sample_inlier[LO_sample[i]] );
+          
+          if( solve_system( ws, false ) == 0 )
+            continue;
+          
+          uint32_t new_found_inlier = get_inliers_of_hypothesis( ws, 0 );
+          if( new_found_inlier > best_inlier_found )
+          {
+            best_inlier_found = new_found_inlier;
+            ws.solverP6pt.getProjectionMatrix( best_hypothesis );
+          }
+        }
+      }
+      
+      ////
+      // update the shared state
+      std::lock_guard< std::mutex > lock( mutex );
+      
+      k_i[current_test] += 1;
+      
+      for( uint32_t i=0; i<nb_rejected_hypotheses; ++i )
+      {
+        // check if we have to design a new test
+        nb_rejected += 1.0f;
+        delta_hat = delta_hat *(nb_rejected-1.0f) / nb_rejected + float(rejected_inlier[i])/(float(nb_correspondences) * nb_rejected);
+        
+        if( fabs( delta_hat - delta_i[current_test] ) > 0.05f )
+        {
+          ++current_test;
+          k_i[current_test] = 0;
+          epsilon_i[current_test] = epsilon_i[current_test-1];
+          delta_i[current_test] = delta_hat;
+          A_i[current_test] = sprt_compute_A( epsilon_i[current_test], delta_hat );
+          shared_A = A_i[current_test];
+        }
+      }
+      
+      //compare found inliers to the biggest set of correspondences found so far
+      if( best_inlier_found > size_inlier_set )
+      {
+        projection_matrix = best_hypothesis;
+        
+        float old_ratio = inlier_ratio;
+        inlier_ratio = std::max( inlier_ratio, (float) best_inlier_found / (float) nb_correspondences );
+        shared_max_steps = get_max_ransac_steps( inlier_ratio );
+        size_inlier_set = best_inlier_found;
+        shared_size_inlier_set = best_inlier_found;
+        
+        // design a new test if needed
+        if( old_ratio < inlier_ratio )
+        {
+          ++current_test;
+          k_i[current_test] = 0;
+          epsilon_i[current_test] = inlier_ratio;
+          delta_i[current_test] = delta_hat;
+          A_i[current_test] = sprt_compute_A(inlier_ratio, delta_hat);
+          shared_A = A_i[current_test];
+        }
+      }
+    }
+  };
+  
+  std::vector< std::thread > workers;
+  for( uint32_t t=1; t<config.nb_threads; ++t )
+    workers.push_back( std::thread( worker, t ) );
+  worker( 0 );
+  for( size_t t=0; t<workers.size(); ++t )
+    workers[t].join();
+  
+  taken_samples = shared_taken_samples.load();
+  
+  if( !config.silent )
+    std::cout << "[RANSAC] SPRT-LO-RANSAC took " << taken_samples << " samples using " << current_test+1 << " SPRTs, found " << size_inlier_set << " inlier ( " << inlier_ratio << " % ) " << std::endl;
+}
+
+//-----------------------------------
+
+void RANSAC::init_prosac( prosac_state &state, uint32_t nb_correspondences )
+{
+  // T_n is the expected number of samples drawn from the n best correspondences out of T_N samples in total
+  const double T_N = 200000.0;
+  state.n = number_of_samples;
+  state.T_n_prime = 1;
+  state.T_n = T_N;
+  for( uint32_t i=0; i<number_of_samples; ++i )
+    state.T_n *= double( number_of_samples - i ) / double( nb_correspondences - i );
+}
+
+//-----------------------------------
+
+void RANSAC::draw_sample( Util::Math::PRNG_u32i &rng, prosac_state &state, uint32_t sample_nb, std::vector< uint32_t > &sample )
+{
+  uint32_t nb_correspondences = (uint32_t) correspondence_indices.size();
+  
+  if( !progressive_sampling )
+  {
+    rng.generate_pseudorandom_numbers_unique( (uint32_t) 0, (uint32_t) ( nb_correspondences - 1 ), number_of_samples, sample );
+    return;
+  }
+  
+  // PROSAC: enlarge the set of the n best correspondences according to the growth function
+  while( state.n < nb_correspondences && state.T_n_prime < sample_nb )
+  {
+    double T_n_plus_1 = state.T_n * double( state.n + 1 ) / double( state.n + 1 - number_of_samples );
+    state.T_n_prime += (uint32_t) ceil( T_n_plus_1 - state.T_n );
+    state.T_n = T_n_plus_1;
+    ++state.n;
+  }
+  
+  if( state.T_n_prime >= sample_nb )
+  {
+    // the sample contains the n-th best correspondence and number_of_samples-1 better ones
+    rng.generate_pseudorandom_numbers_unique( (uint32_t) 0, state.n - 2, number_of_samples - 1, sample );
+    sample[number_of_samples-1] = state.n - 1;
+  }
+  else
+    rng.generate_pseudorandom_numbers_unique( (uint32_t) 0, state.n - 1, number_of_samples, sample );
+}
+
 //-----------------------------------
 
 void RANSAC::compute_final_correspondences( const std::vector< float > &c1, const std::vector< float > &c2, std::vector< uint32_t > &indices )
@@ -481,21 +808,19 @@ void RANSAC::compute_final_correspondences( const std::vector< float > &c1, cons
   size_inlier_set = 0;
   
  
-  set_hypothesis();
+  set_hypothesis( workspace );
   
+  // the correspondences have been converted in the order given by indices
+  assert( indices.size() == correspondence_indices.size() );
+  size_inlier_set = get_inliers_of_hypothesis( workspace, &inlier_correspondences );
   
-  for(std::vector< uint32_t >::const_iterator it = indices.begin() ; it != indices.end(); ++it )
-  {
-    if(evaluate_correspondece(c1,c2,*it))
-    {
-      inlier_correspondences.push_back( *it );
-      ++size_inlier_set;
-    }
-  }
+  // report the inliers in the order of the input, independent of a reordering for PROSAC
+  if( progressive_sampling )
+    std::sort( inlier_correspondences.begin(), inlier_correspondences.end() );
 
   inlier_ratio = float(size_inlier_set)/float(nb_correspondences);
   
-  if( !silent )
+  if( !config.silent )
   {
     std::cout << "[RANSAC] Percentage Inlier found on all (reduced) correspondences : " << (float) inlier_ratio << std::endl;
     std::cout << "[RANSAC] Inlier found on set of (reduced) correspondences : " << size_inlier_set << std::endl;
@@ -507,14 +832,20 @@ void RANSAC::compute_final_correspondences( const std::vector< float > &c1, cons
 
 void RANSAC::initialize()
 {
-  if( computation_type == P6pt )
+  // P3P needs to know the focal length of the camera, otherwise we fall back to P6pt
+  used_computation_type = config.computation_type;
+  if( used_computation_type == P3P && focal_length <= 0.0 )
+    used_computation_type = P6pt;
+  workspace.solverP3P.setFocalLength( focal_length );
+  
+  if( used_computation_type == P6pt || used_computation_type == P3P )
   {
     index_multiplicator = 3;
   }
   else
     index_multiplicator = 2;
   //clear solvers
-  clear_solver();
+  clear_solver( workspace );
 
   //clear resulting correspondences
   correspondence_indices.clear();
@@ -525,62 +856,91 @@ void RANSAC::initialize()
   outlier.clear();
 
   //reset counting variables
+  progressive_sampling = false;
+  nb_blocks = 0;
   size_inlier_set = 0;
   inlier_ratio = 0.0;
   taken_samples = 0;
   elapsed_time = 0.0;
   initialization_time = 0.0;
+  time_limit_reached = false;
 	  
 	  
   //set parameters
   SPRT_m_s = 1.0f;
-  switch( computation_type )
+  switch( used_computation_type )
   {
     case P6pt:
     {
       minimal_consensus_set_size = number_of_samples = 6;
       break;
     }
+    
+    case P3P:
+    {
+      minimal_consensus_set_size = number_of_samples = 3;
+      // P3P returns up to 4 poses per sample, we assume 1.7 on average (an estimate, not a measured value)
+      SPRT_m_s = 1.7f;
+      break;
+    }
   }
   
-  if( max_number_of_LO_samples == 0 )
+  // the values used by this instance, derived from its parameters
+  LO_samples_max = config.max_number_of_LO_samples;
+  SPRT_t_M = config.t_M;
+  
+  if( LO_samples_max == 0 )
   {
-    switch( computation_type )
+    switch( used_computation_type )
     {
       case P6pt:
+      case P3P:
       {
-		max_number_of_LO_samples = 12; // NOTE: This does not have to be an optimal setting
+		LO_samples_max = 12; // NOTE: This does not have to be an optimal setting
 		break;
       }
     }
   }
   
-  if( max_number_of_LO_samples == 0 )
+  // the local optimization uses the DLT of P6pt for both solvers, which needs at least 6 correspondences,
+  // the buffers for the LO samples are sized by LO_samples_max
+  LO_samples_max = std::max( LO_samples_max, (uint32_t) 6 );
+  
+  // a negative value of t_M requests the automatic assignment
+  if( SPRT_t_M < 0.0f )
   {
-    switch( computation_type )
+    switch( used_computation_type )
     {
       case P6pt:
+      case P3P:
       {
-		t_M = 200.0f;
+		SPRT_t_M = 200.0f;
 		break;
       }
     }
   }
   
-  internat_error = error;
+  internat_error = config.error;
   
 }
 
 
 //-----------------------------------
 
-void RANSAC::clear_solver()
+void RANSAC::clear_solver( hypothesis_workspace &ws )
 {
-  switch(computation_type)
+  switch(used_computation_type)
   {
     case P6pt:
     {
-      solverP6pt.clear();
+      ws.solverP6pt.clear();
+      break;
+    }
+    
+    case P3P:
+    {
+      ws.solverP3P.clear();
+      ws.solverP6pt.clear();
       break;
     }
     
@@ -593,15 +953,25 @@ void RANSAC::clear_solver()
 
 //-----------------------------------
 
-void RANSAC::add_correspondence( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t index )
+void RANSAC::add_correspondence( hypothesis_workspace &ws, const std::vector< float > &c1, const std::vector< float > &c2, uint32_t index )
 {
 //   std::cout << " add " << index << std::endl;
   uint32_t real_index = index * index_multiplicator;
-  switch(computation_type)
+  switch(used_computation_type)
   {
     case P6pt:
     {
-      solverP6pt.addCorrespondence(Util::CorrSolver::Vector2D(c1[2*index], c1[2*index+1]), Util::CorrSolver::Vector3D(c2[real_index], c2[real_index+1], c2[real_index+2]) );
+      ws.solverP6pt.addCorrespondence(Util::CorrSolver::Vector2D(c1[2*index], c1[2*index+1]), Util::CorrSolver::Vector3D(c2[real_index], c2[real_index+1], c2[real_index+2]) );
+      break;
+    }
+    
+    case P3P:
+    {
+      // the minimal samples are solved by P3P, the samples of the local optimization by P6pt
+      Util::CorrSolver::Vector2D p2d( c1[2*index], c1[2*index+1] );
+      Util::CorrSolver::Vector3D p3d( c2[real_index], c2[real_index+1], c2[real_index+2] );
+      ws.solverP3P.addCorrespondence( p2d, p3d );
+      ws.solverP6pt.addCorrespondence( p2d, p3d );
       break;
     }
     
@@ -614,45 +984,128 @@ void RANSAC::add_correspondence( const std::vector< float > &c1, const std::vect
 
 //-----------------------------------
 
-bool RANSAC::evaluate_correspondece( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t index )
+void RANSAC::prepare_correspondences( const std::vector< float > &c1, const std::vector< float > &c2 )
 {
-  uint32_t real_index = index * index_multiplicator;
-  switch(computation_type)
+  uint32_t nb_correspondences = (uint32_t) correspondence_indices.size();
+  nb_blocks = ( nb_correspondences + REPROJECTION_BLOCK_SIZE - 1 ) / REPROJECTION_BLOCK_SIZE;
+  size_t padded_size = size_t( nb_blocks ) * REPROJECTION_BLOCK_SIZE;
+  
+  // 5 arrays (x, y, X, Y, Z) plus some space to align the first one to 64 bytes
+  soa_buffer.resize( 5 * padded_size + 16 );
+  float *aligned = soa_buffer.empty() ? 0 : &soa_buffer[0];
+  while( ( (uintptr_t) aligned ) % 64 != 0 )
+    ++aligned;
+  soa_x = aligned;
+  soa_y = soa_x + padded_size;
+  soa_X = soa_y + padded_size;
+  soa_Y = soa_X + padded_size;
+  soa_Z = soa_Y + padded_size;
+  
+  // the 3D points are stored relative to their center to reduce the rounding errors of single precision
+  soa_center[0] = soa_center[1] = soa_center[2] = 0.0;
+  for( uint32_t i=0; i<nb_correspondences; ++i )
   {
-    
-    case P6pt:
+    uint32_t real_index = correspondence_indices[i] * index_multiplicator;
+    for( int j=0; j<3; ++j )
+      soa_center[j] += c2[real_index+j];
+  }
+  if( nb_correspondences > 0 )
+  {
+    for( int j=0; j<3; ++j )
+      soa_center[j] /= double( nb_correspondences );
+  }
+  
+  for( uint32_t i=0; i<nb_correspondences; ++i )
+  {
+    uint32_t index = correspondence_indices[i];
+    uint32_t real_index = index * index_multiplicator;
+    soa_x[i] = c1[2*index];
+    soa_y[i] = c1[2*index+1];
+    soa_X[i] = float( c2[real_index] - soa_center[0] );
+    soa_Y[i] = float( c2[real_index+1] - soa_center[1] );
+    soa_Z[i] = float( c2[real_index+2] - soa_center[2] );
+  }
+  
+  // the padding is never classified as inlier
+  for( size_t i=nb_correspondences; i<padded_size; ++i )
+  {
+    soa_x[i] = soa_y[i] = std::numeric_limits< float >::quiet_NaN();
+    soa_X[i] = soa_Y[i] = soa_Z[i] = 0.0f;
+  }
+}
+
+//-----------------------------------
+
+
+void RANSAC::prepare_hypothesis( hypothesis_workspace &ws )
+{
+  // the hypotheses of all computation types are evaluated by the P6pt solver.
+  // Move the origin to the center of the 3D points, i.e., P' = P * [ I c ; 0 1 ]
+  ProjMatrix P;
+  ws.solverP6pt.getProjectionMatrix( P );
+  for( int r=0; r<3; ++r )
+  {
+    double t = P(r,3);
+    for( int c=0; c<3; ++c )
     {
-      Util::CorrSolver::Vector3D p3d( c2[real_index], c2[real_index+1], c2[real_index+2] );
-	  
-      if( ( (p3d - cam_position_tmp) | cam_orientation_tmp ) >= 0.0 )
-		return (solverP6pt.evaluateCorrespondence(Util::CorrSolver::Vector2D(c1[2*index], c1[2*index+1]), p3d ) <= internat_error);
-	  
-      break;
+      ws.current_hypothesis.P[4*r+c] = float( P(r,c) );
+      t += P(r,c) * soa_center[c];
     }
-    
-    default:
+    ws.current_hypothesis.P[4*r+3] = float( t );
+    ws.current_hypothesis.position[r] = float( ws.cam_position_tmp[r] - soa_center[r] );
+    ws.current_hypothesis.orientation[r] = float( ws.cam_orientation_tmp[r] );
+  }
+  ws.current_hypothesis.threshold = float( internat_error );
+}
+
+//-----------------------------------
+
+
+uint32_t RANSAC::get_inliers_of_hypothesis( const hypothesis_workspace &ws, std::vector< uint32_t > *inliers )
+{
+  uint32_t nb_inliers = 0;
+  for( uint32_t block = 0; block < nb_blocks; ++block )
+  {
+    uint32_t mask = evaluate_block( ws, block );
+    nb_inliers += count_inliers_in_mask( mask );
+    if( inliers != 0 )
     {
-      return false;
-      break;
+      for( uint32_t i=0; mask != 0; ++i, mask >>= 1 )
+      {
+        if( mask & 1u )
+          inliers->push_back( correspondence_indices[ block * REPROJECTION_BLOCK_SIZE + i ] );
+      }
     }
   }
-  return false;
+  return nb_inliers;
 }
 
 //-----------------------------------
 
 
-bool RANSAC::solve_system()
+uint32_t RANSAC::solve_system( hypothesis_workspace &ws, const bool minimal_sample )
 {
   bool solved = false;
-  switch(computation_type)
+  switch(used_computation_type)
   {
+    case P3P:
+    {
+      if( minimal_sample )
+		return (uint32_t) ws.solverP3P.computePoses();
+      
+      // the local optimization uses the DLT of P6pt
+    }
+    // fall through
+    
     case P6pt:
     {
-      solved = solverP6pt.computeLinearNew();
+      solved = ws.solverP6pt.computeLinearNew();
+      
+      if( solved )
+		solved = ws.solverP6pt.getPositionAndOrientation( ws.cam_position_tmp, ws.cam_orientation_tmp );
       
       if( solved )
-		solved = solverP6pt.getPositionAndOrientation( cam_position_tmp, cam_orientation_tmp );
+		prepare_hypothesis( ws );
 
       break;
     }
@@ -663,19 +1116,47 @@ bool RANSAC::solve_system()
       break;
     }
   }
-  return solved;
+  return solved ? 1 : 0;
 }
 
 //-----------------------------------
 
 
-void RANSAC::store_hypothesis( const bool get_epipoles )
+bool RANSAC::select_hypothesis( hypothesis_workspace &ws, uint32_t i )
+{
+  switch(used_computation_type)
+  {
+    case P3P:
+    {
+      // evaluate the pose with the P6pt solver
+      ProjMatrix pose;
+      ws.solverP3P.getProjectionMatrix( (int) i, pose );
+      ws.solverP6pt.setProjectionMatrix( pose );
+      if( !ws.solverP6pt.getPositionAndOrientation( ws.cam_position_tmp, ws.cam_orientation_tmp ) )
+		return false;
+      prepare_hypothesis( ws );
+      return true;
+    }
+    
+    default:
+    {
+      // the hypothesis computed by solve_system is already the current one
+      return true;
+    }
+  }
+}
+
+//-----------------------------------
+
+
+void RANSAC::store_hypothesis( hypothesis_workspace &ws, const bool get_epipoles )
 {  
-  switch(computation_type)
+  switch(used_computation_type)
   {
     case P6pt:
+    case P3P:
     {
-      solverP6pt.getProjectionMatrix( projection_matrix );
+      ws.solverP6pt.getProjectionMatrix( projection_matrix );
       break;
     }
     
@@ -688,14 +1169,16 @@ void RANSAC::store_hypothesis( const bool get_epipoles )
 
 //-----------------------------------
 
-void RANSAC::set_hypothesis()
+void RANSAC::set_hypothesis( hypothesis_workspace &ws )
 {
-  switch(computation_type)
+  switch(used_computation_type)
   {
     case P6pt:
+    case P3P:
     {
-      solverP6pt.setProjectionMatrix( projection_matrix );
-      solverP6pt.getPositionAndOrientation( cam_position_tmp, cam_orientation_tmp );
+      ws.solverP6pt.setProjectionMatrix( projection_matrix );
+      ws.solverP6pt.getPositionAndOrientation( ws.cam_position_tmp, ws.cam_orientation_tmp );
+      prepare_hypothesis( ws );
       break;
     }
     
@@ -1149,7 +1632,7 @@ uint32_t RANSAC::SPRT_get_max_sprt_ransac_steps( float epsilon, int l, int nb_sa
 float RANSAC::sprt_compute_A( float eps, float delta )
 {
   float Pg = 1.0f;
-  switch(computation_type)
+  switch(used_computation_type)
   {
     case P6pt:
     {
@@ -1157,6 +1640,12 @@ float RANSAC::sprt_compute_A( float eps, float delta )
       break;
     }
     
+    case P3P:
+    {
+      Pg = eps * eps * eps;
+      break;
+    }
+    
     default:
     {
       break;
@@ -1165,7 +1654,7 @@ float RANSAC::sprt_compute_A( float eps, float delta )
   float a = 1.0f - delta;
   float b = 1.0f - eps;
   float C = a * log(a/b) + delta * log(delta/eps);
-  a = t_M * C / SPRT_m_s + 1.0f;
+  a = SPRT_t_M * C / SPRT_m_s + 1.0f;
   float A_0 = a;
   float A_1 = a + log(A_0);
   while( fabs( A_1 - A_0 ) > 1e-6 )
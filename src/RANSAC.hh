@@ -37,6 +37,8 @@
 #include "math/projmatrix.hh"
 #include "solver/solverbase.hh"
 #include "solver/solverproj.hh"
+#include "solver/solverp3p.hh"
+#include "solver/reprojection_kernels.hh"
 #include "math/pseudorandomnrgen.hh"
 #include "timer.hh"
 #include <ctime>
@@ -64,8 +66,46 @@ enum ransac_variant{
   SPRT_LO_RANSAC = 2
 };
 
+//! P6pt estimates a projection matrix from 6 correspondences (DLT), P3P the pose of a camera with
+//! known focal length from 3 correspondences. P3P falls back to P6pt if no focal length is given.
 enum ransac_computation_type{
-  P6pt = 4
+  P6pt = 4,
+  P3P = 5
+};
+
+//! The parameters of RANSAC. Every instance of RANSAC has its own copy, so several
+//! instances can be used in parallel threads, possibly with different settings.
+struct ransac_config
+{
+  //! error threshold for inlier<->outlier classification
+  double error;
+  
+  //! the type of spatial verification to be performerd
+  ransac_computation_type computation_type;
+  
+  //! the RANSAC type used. Per default set to SPRT_LO_RANSAC
+  ransac_variant inner_RANSAC_type;
+  
+  //! the number of Local Optimization steps LO-RANSAC should take 
+  uint32_t nb_lo_steps;
+  
+  //! print information, measure time
+  bool silent, measure_time;
+  
+  //! stop RANSAC after finite amount of time?
+  double max_time; // maximal time after which RANSAC is stopped
+  bool stop_after_n_secs;
+  
+  //! the maximum number of samples taken in the local optimization step (at least 6 are used). Set to 0 (default) for an automatic, computation-type dependent assignment.
+  uint32_t max_number_of_LO_samples;
+  
+  //! The t_M variable for the SPRT, specifying the cost of generating a hypothesis relative to evaluating a correspondence. Set to -1 (default) for an automatic, computation-type dependent assignment.
+  float t_M;
+  
+  //! the number of threads drawing and evaluating samples in a single call of apply_RANSAC
+  uint32_t nb_threads;
+  
+  ransac_config() : error( 1.0 ), computation_type( P6pt ), inner_RANSAC_type( SPRT_LO_RANSAC ), nb_lo_steps( 0 ), silent( false ), measure_time( true ), max_time( 10.0 ), stop_after_n_secs( false ), max_number_of_LO_samples( 0 ), t_M( -1.0f ), nb_threads( 1 ) {}
 };
 
 
@@ -81,8 +121,20 @@ class RANSAC
   public:
     RANSAC();
     
+    //! constructor specifying the parameters of this instance
+    RANSAC( const ransac_config &config );
+    
     ~RANSAC();
     
+    //! set the parameters used by the following calls of apply_RANSAC
+    void set_config( const ransac_config &config );
+    
+    //! get the parameters of this instance
+    const ransac_config& get_config() const
+    {
+      return config;
+    }
+    
     /**
      * standard RANSAC with iterative refinement
      * parameters:
@@ -94,33 +146,37 @@ class RANSAC
      *                        (c1.size() = 2*nb_correspondences and c2.size() = 3*nb_correspondences for 
      *                        2D<->3D correspondences).
      *   min_inlier_ratio - assumed minimal inlier-ratio
+     *   correspondence_scores - optional quality score for every correspondence, smaller values are better
+     *                           (e.g., the SIFT ratio of the matches). If given, the samples are drawn
+     *                           progressively from the best correspondences first as in PROSAC, see
+     *                           Chum, O. and Matas, J.: Matching with PROSAC - Progressive Sample Consensus, CVPR 2005
+     *                           The termination criterion is still given by the SPRT.
     **/
-    void apply_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t nb_correspondences, const float min_inlier_ratio = 0.2f );
+    void apply_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t nb_correspondences, const float min_inlier_ratio = 0.2f, const std::vector< float > *correspondence_scores = 0 );
     
     //! minimal size of the inlier set of an accepted solution
     void set_minimal_consensus_size( const uint32_t );
     
-    //! error threshold for inlier<->outlier classification
-    static double error;
-    
-    //! the type of spatial verification to be performerd
-    static ransac_computation_type computation_type;
+    //! set the focal length (in pixels) of the query camera, needed by P3P. If the focal length is 
+    //! not positive (default), this instance uses P6pt instead of P3P.
+    void set_focal_length( const double focal );
     
-    //! the number of Local Optimization steps LO-RANSAC should take 
-    static uint32_t nb_lo_steps;
+    //! set an absolute deadline (e.g., for the localization of the whole query image) at which 
+    //! the following calls of apply_RANSAC stop drawing samples and return the best model found
+    //! so far. Combined with max_time if stop_after_n_secs is set. Not set per default.
+    void set_deadline( const Deadline &deadline );
     
-    //! print information, measure time
-    static bool silent, measure_time;
-    
-    //! stop RANSAC after finite amount of time?
-    static double max_time; // maximal time after which RANSAC is stopped
-    static bool stop_after_n_secs;
-    
-    //! the maximum number of samples taken in the local optimization step. 
-    static uint32_t max_number_of_LO_samples;
+    //! was the last call of apply_RANSAC stopped by the time limit or the deadline?
+    bool reached_time_limit()
+    {
+      return time_limit_reached;
+    }
     
-    //! The t_M variable for the SPRT, specifying the cost of generating a hypothesis relative to evaluating a correspondence. Set to -1 (default) for an automatic, computation-type dependent assignment.
-    static float t_M;
+    //! get the computation type used by the last call of apply_RANSAC
+    ransac_computation_type get_used_computation_type()
+    {
+      return used_computation_type;
+    }
     
     //! get the projection matrix computed by RANSAC
     ProjMatrix& get_projection_matrix()
@@ -149,9 +205,6 @@ class RANSAC
       return inlier_correspondences.size();
     }
     
-      
-    //! the RANSAC type used. Per default set to SPRT_LO_RANSAC
-    static ransac_variant inner_RANSAC_type;
     
     //! get the number of steps needed by RANSAC (not including local optimization steps)
     uint32_t get_nb_ransac_steps()
@@ -171,25 +224,77 @@ class RANSAC
        
 
   private: 
+    //! the state needed to compute and evaluate hypotheses. The sequential RANSAC uses the
+    //! member workspace, every thread of the parallel RANSAC has its own one.
+    struct hypothesis_workspace
+    {
+      //! solvers for different geometric models. The hypotheses computed by P3P are 
+      //! evaluated by the P6pt solver, which also handles the local optimization for P3P
+      Util::CorrSolver::SolverProj solverP6pt;
+      Util::CorrSolver::SolverP3P solverP3P;
+      
+      //! position and orientation of the camera of the current hypothesis
+      Util::CorrSolver::Vector3D cam_orientation_tmp, cam_position_tmp;
+      
+      //! the current hypothesis prepared for the evaluation
+      reprojection_hypothesis current_hypothesis;
+    };
+    
+    //! the state of the progressive sampling (PROSAC)
+    struct prosac_state
+    {
+      uint32_t n; // the samples are drawn from the n best correspondences
+      uint32_t T_n_prime;
+      double T_n;
+    };
+    
 	//! Implementation of WaldSaC (SPRT Ransac), see O. Chum and J. Matas. PAMI, Vol. 30, No. 8. 2008
     void unified_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, const float min_inlier_ratio = 0.2f );
     
+    //! The same algorithm with config.nb_threads threads drawing and evaluating samples concurrently.
+    //! The number of samples, the best hypothesis and the SPRT are shared by all threads.
+    void parallel_SPRT_LO_RANSAC( const std::vector< float > &c1, const std::vector< float > &c2, const float min_inlier_ratio = 0.2f );
+    
+    // initializes the progressive sampling for nb_correspondences correspondences
+    void init_prosac( prosac_state &state, uint32_t nb_correspondences );
+    
+    // draws the sample_nb-th sample (starting with 1), uniformly or progressively (PROSAC)
+    void draw_sample( Util::Math::PRNG_u32i &rng, prosac_state &state, uint32_t sample_nb, std::vector< uint32_t > &sample );
     
     void compute_final_correspondences( const std::vector< float > &c1, const std::vector< float > &c2, std::vector< uint32_t > &indices );  
    
     void initialize();
     
-    void clear_solver();
+    void clear_solver( hypothesis_workspace &ws );
+    
+    void add_correspondence( hypothesis_workspace &ws, const std::vector< float > &c1, const std::vector< float > &c2, uint32_t index );
     
-    void add_correspondence( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t index );
+    // converts the correspondences given by correspondence_indices into the aligned single precision arrays used to evaluate the hypotheses
+    void prepare_correspondences( const std::vector< float > &c1, const std::vector< float > &c2 );
     
-    bool evaluate_correspondece( const std::vector< float > &c1, const std::vector< float > &c2, uint32_t index );
+    // converts the current hypothesis of the solver for the evaluation
+    void prepare_hypothesis( hypothesis_workspace &ws );
     
-    bool solve_system();
+    // returns a bit mask of the inliers to the current hypothesis in the given block of correspondences
+    inline uint32_t evaluate_block( const hypothesis_workspace &ws, uint32_t block )
+    {
+      uint32_t offset = block * REPROJECTION_BLOCK_SIZE;
+      return g_reprojection_inliers( ws.current_hypothesis, soa_x + offset, soa_y + offset, soa_X + offset, soa_Y + offset, soa_Z + offset );
+    }
     
-    void store_hypothesis( const bool get_epipoles = false );
+    // returns the number of inliers to the current hypothesis and appends them to inliers (if not 0)
+    uint32_t get_inliers_of_hypothesis( const hypothesis_workspace &ws, std::vector< uint32_t > *inliers );
     
-    void set_hypothesis();
+    // computes the hypotheses for the current sample and returns their number. If minimal_sample is false,
+    // the (non-minimal) sample of the local optimization is used and at most one hypothesis is computed
+    uint32_t solve_system( hypothesis_workspace &ws, const bool minimal_sample );
+    
+    // makes the i-th hypothesis computed by solve_system the current one
+    bool select_hypothesis( hypothesis_workspace &ws, uint32_t i );
+    
+    void store_hypothesis( hypothesis_workspace &ws, const bool get_epipoles = false );
+    
+    void set_hypothesis( hypothesis_workspace &ws );
     
     // compute the maximal number of steps needed by RANSAC 
     uint32_t get_max_ransac_steps( float inlier_ratio );
@@ -203,26 +308,48 @@ class RANSAC
     // SPRT: compute the decision threshold A, see Chum, Matas. Optimal Randomized RANSAC. PAMI, Vol. 30, No. 8. 2008
     float sprt_compute_A( float eps, float delta );
     
+    //! the parameters of this instance
+    ransac_config config;
+    
     uint32_t size_inlier_set;
     uint32_t taken_samples;
     double elapsed_time;
     double initialization_time;
     float inlier_ratio;
     float SPRT_m_s; // mean number of models per sample
+    float SPRT_t_M; // the value of t_M used by this instance
+    uint32_t LO_samples_max; // the value of max_number_of_LO_samples used by this instance
     uint32_t random_sample;
     
     // the number of LO samples is the maximal number of correspondences choosen in the LO-step (not necessarily minimal)
     uint32_t nr_ransac_steps, number_preliminary_matches, number_of_samples, minimal_consensus_set_size;
     
-    //! solvers for different geometric models
-    Util::CorrSolver::SolverProj solverP6pt;
+    //! the computation type used by this instance and the focal length needed for P3P
+    ransac_computation_type used_computation_type;
+    double focal_length;
+    
+    //! the workspace of the sequential RANSAC
+    hypothesis_workspace workspace;
     
     //! timer for stopping calculation time of algorithms
     Timer RANSAC_timer;
     
+    //! the deadline set by the caller and the one of the current call of apply_RANSAC (including max_time)
+    Deadline deadline, run_deadline;
+    bool time_limit_reached;
+    
     //! the estimated hypothetes
     ProjMatrix projection_matrix;
-    Util::CorrSolver::Vector3D cam_orientation_tmp, cam_position_tmp;
+    
+    //! the correspondences in single precision as structure of arrays, padded to a multiple of
+    //! REPROJECTION_BLOCK_SIZE. The 3D points are given relative to soa_center.
+    std::vector< float > soa_buffer;
+    float *soa_x, *soa_y, *soa_X, *soa_Y, *soa_Z;
+    double soa_center[3];
+    uint32_t nb_blocks;
+    
+    //! draw the samples progressively (PROSAC), correspondence_indices is then sorted by the scores
+    bool progressive_sampling;
     
     //! different kinds of correspondence sets computed through RANSAC
     std::vector< uint32_t > correspondence_indices;
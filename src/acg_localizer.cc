@@ -41,10 +41,13 @@
 #include <cmath>
 #include <sstream>
 #include <stdio.h>
+#include <mutex>
 
 // includes for classes dealing with SIFT-features
 #include "features/SIFT_loader.hh"
 #include "features/visual_words_handler.hh"
+#include "features/SIFT_distance.hh"
+#include "features/localization_database.hh"
 
 // stopwatch
 #include "timer.hh"
@@ -63,7 +66,8 @@
 // simple vector class for 3D points
 #include <OpenMesh/Core/Geometry/VectorT.hh>
 
-const uint64_t sift_dim = 128;
+// parallel processing of the query images
+#include "query_processing.hh"
 
 ////
 // Classes to handle the two nearest neighbors (nn) of a descriptor.
@@ -264,44 +268,6 @@ class nearest_neighbors_float
     float dist1, dist2;
 };
 
-////
-// functions to compute the squared distances between two SIFT-vectors
-// there are different ways how the SIFT-vectors are stored, for each there is 
-// one function
-////
-
-// First descriptor is stored in an array, while the second descriptor is stored in a vector (concatenation of vector entries)
-// The second descriptor begins at position index*128
-inline int compute_squared_SIFT_dist( const unsigned char * const v1, std::vector< unsigned char > &v2, uint32_t index )
-{
-  uint64_t index_( index );
-  index_ *= sift_dim;
-  int dist = 0;
-  int x = 0;
-  for( uint64_t i=0; i<sift_dim; ++i )
-  {
-    x = int( v1[i] ) - int( v2[index_+i] );
-    dist += x*x;
-  }
-  return dist;
-}
-
-// same in case that one descriptors consists of floating point values
-inline float compute_squared_SIFT_dist_float( const unsigned char * const v1, std::vector< float > &v2, uint32_t index )
-{
-  size_t index_( index );
-  index_ *= sift_dim;
-  float dist = 0;
-  float x = 0;
-  for( int i=0; i<sift_dim; ++i )
-  {
-    x = float( v1[i] ) - v2[index_+i];
-    dist += x*x;
-  }
-  return dist;
-}
-
-
 // function to sort (2D feature, visual word) point pairs for the prioritized search.
 inline bool cmp_priorities( const std::pair< uint32_t, uint32_t >& a, const std::pair< uint32_t, uint32_t >& b )
 {
@@ -324,6 +290,473 @@ float min_inlier = 0.2f;
 // stop RANSAC if 60 seconds have passed
 double ransac_max_time = 60.0; 
 
+// the parameters of RANSAC, set once in main() and only read afterwards
+ransac_config ransac_parameters;
+
+////
+// the model and the parameters shared by all query images,
+// they are not modified while the query images are localized
+////
+
+// the 3D points, their descriptors and the assignments of (point id, descriptor id) pairs to visual words
+localization_database loc_db;
+
+// the visual words and their search tree
+visual_words_handler vw_handler;
+
+// the visual words handler uses internal buffers, so only one thread at a time can assign visual words
+std::mutex vw_handler_mutex;
+
+// the way the descriptors are stored (see usage)
+int mode = 0;
+
+// stop the correspondence search after finding that many correspondences (0 = no early termination)
+size_t max_cor_early_term = 0;
+
+// the latency budget of a single query in seconds, not limited if 0
+double query_latency_budget = 0.0;
+
+// the results of localizing a single query image
+struct query_result
+{
+  uint32_t nb_features;
+  uint32_t nb_inlier;
+  uint32_t nb_corr;
+  double vw_time;
+  double corr_time;
+  double RANSAC_time;
+  double total_time;
+  
+  // true if the latency budget (or the time limit of RANSAC) stopped the localization early
+  bool deadline_reached;
+  
+  // the output generated while localizing the image, used when several threads localize images in parallel
+  std::ostringstream log;
+};
+
+//---------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+////
+// Localizes a single query image, given by the filename of its keyfile. All stages stop at the
+// deadline of the latency budget. All output is written to out, the results are stored in result.
+////
+
+void localize_query( const std::string &key_filename, std::ostream &out, query_result &result )
+{
+  // the budget includes loading the features. The correspondence search stops at its deadline and
+  // needs fewer correspondences for early termination (if enabled) once time runs short
+  latency_budget budget( query_latency_budget );
+  
+  // load the features
+  SIFT_loader key_loader;
+  key_loader.load_features( key_filename.c_str(), LOWE );
+  
+  SIFT_descriptor_view descriptors = key_loader.get_descriptor_view();
+  std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
+  
+  uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
+  
+ 
+  // center the keypoints around the center of the image
+  // first we need to get the dimensions of the image which we obtain from its exif tag
+  // (together with the focal length, if available)
+  int img_width, img_height;
+  float focal_length;
+  std::string jpg_filename( key_filename );
+  jpg_filename.replace( jpg_filename.size()-3,3,"jpg");
+  exif_reader::open_exif( jpg_filename.c_str() );
+  img_width = exif_reader::get_image_width();
+  img_height = exif_reader::get_image_height();
+  focal_length = exif_reader::get_focal_length_in_pixels();
+  exif_reader::close_exif();
+  
+  for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
+  {
+    keypoints[j].x -= (img_width-1.0)/2.0f; 
+    keypoints[j].y = (img_height-1.0)/2.0f - keypoints[j].y; 
+  }
+  
+  out << " loaded " << nb_loaded_keypoints << " descriptors from " << key_filename << std::endl;
+  
+  ////
+  // assign the descriptors to the visual words   
+  Timer timer;
+  timer.Init();
+  timer.Start();
+  
+  std::vector< uint32_t > computed_visual_words( nb_loaded_keypoints, 0 );
+  
+  std::set< size_t > unique_vw;
+  unique_vw.clear();
+
+  {
+    std::lock_guard< std::mutex > lock( vw_handler_mutex );
+    // the query might have waited for the lock so long that there is no time left to search
+    if( budget.search_time_left() )
+    {
+      vw_handler.set_nb_paths( 10 );
+      vw_handler.assign_visual_words_uchar( descriptors.data, nb_loaded_keypoints, computed_visual_words );
+    }
+  }
+  
+  timer.Stop();
+  
+  for( size_t j=0; j<nb_loaded_keypoints; ++j )
+    unique_vw.insert( computed_visual_words[j] );
+  
+  out << " assigned visual words in " << timer.GetElapsedTimeAsString() << " to " << unique_vw.size() << " unique vw" << std::endl;
+  
+  result.nb_features = nb_loaded_keypoints;
+  result.vw_time = timer.GetElapsedTime();
+  
+  ////
+  // establish 2D-3D correspondences by using the vw to compute pairwise nearest neighbors
+  timer.Init();
+  timer.Start();
+
+  Timer all_timer;
+  all_timer.Init();
+  all_timer.Start();
+  
+  uint32_t max_corr = 0;
+  
+  // sort the 2D points in ascending order of the number of 3D points belonging to their respective visual words
+  std::vector< std::pair< uint32_t, uint32_t > > priorities( nb_loaded_keypoints );
+  for( size_t j=0; j<nb_loaded_keypoints; ++j )
+  {
+    priorities[j].first = j;
+    priorities[j].second = loc_db.get_nb_entries_for_vw( computed_visual_words[j] );
+  }
+  
+  std::sort( priorities.begin(), priorities.end(), cmp_priorities );
+
+
+  // we store for each 3D point the corresponding 2D feature as well as the squared distance
+  // this is needed in case that two 2D features are assigned to one 3D point, because
+  // we only want to keep the correspondence to the 2D point with the most similar descriptor
+  // i.e. the smallest Euclidean distance in descriptor space
+  std::map< uint32_t, std::pair< uint32_t, int > > corr_3D_to_2D;
+  corr_3D_to_2D.clear();
+  
+  std::map< uint32_t, nearest_neighbors >::iterator map_it_2D;
+  std::map< uint32_t, nearest_neighbors_float >::iterator map_it_2D_float;
+  std::map< uint32_t, nearest_neighbors_multiple >::iterator map_it_2D_multple;
+  std::map< uint32_t, std::pair< uint32_t, int > >::iterator map_it_3D;
+  
+  // the SIFT ratio of the match found for each 2D feature, used to guide the sampling of RANSAC
+  std::vector< float > feature_ratios( nb_loaded_keypoints, 1.0f );
+
+  // compute nearest neighbors
+  // we do a single case distinction wether the database consists of unsigned char descriptors or floating point descriptors
+  // while resulting in ugly code, it should improve run-time since we do not need to make the distinction multiple times
+  uint32_t nb_comparisons = 0;
+  uint32_t nb_considered_points = 0;
+  if( mode == 0 )
+  {
+    for( size_t j=0; j<nb_loaded_keypoints; ++j )
+    {
+      if( !budget.search_time_left() )
+      {
+        nb_considered_points = j;
+        break;
+      }
+      
+      uint32_t j_index = priorities[j].first;
+      uint32_t assignment = uint32_t( computed_visual_words[j_index] );
+      
+      nearest_neighbors nn;
+      
+      size_t nb_poss_assignments = loc_db.get_nb_entries_for_vw( assignment );
+      
+      if( nb_poss_assignments > 0 )
+      {
+        // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
+        const vw_entry *vw_entries = loc_db.get_entries_for_vw( assignment );
+        const unsigned char *vw_descriptors = loc_db.get_descriptors_for_vw_uchar( assignment );
+        
+        nb_comparisons += nb_poss_assignments;
+        
+        for( size_t k=0; k<nb_poss_assignments; ++k )
+        {
+          uint32_t point_id = vw_entries[k].point_id;
+          
+          int dist = compute_squared_SIFT_dist( descriptors[j_index], vw_descriptors + 128 * k );
+          
+          nn.update( point_id, dist );
+        }
+      }
+      
+      // check if we have found a correspondence
+      if( nn.dist1 >= 0 )
+      {
+        if( nn.dist2 >= 0 )
+        {
+          if( nn.get_ratio() < nn_ratio )
+          {
+            feature_ratios[j_index] = nn.get_ratio();
+            
+            // we found one, so we need check for mutual nearest neighbors
+            map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
+      
+            if( map_it_3D != corr_3D_to_2D.end() )
+            {
+              if( map_it_3D->second.second > nn.dist1 )
+              {
+                map_it_3D->second.first = j_index;
+                map_it_3D->second.second = nn.dist1;
+              }
+            }
+            else
+            {
+              corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
+            }
+          }
+        }
+      }
+      
+      // stop the search if enough correspondences are found
+      if( max_cor_early_term > 0 && corr_3D_to_2D.size() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
+      {
+        nb_considered_points = j+1;
+        break;
+      }
+    }
+  }
+  else if( mode == 1 )
+  {
+    // floating point
+    for( size_t j=0; j<nb_loaded_keypoints; ++j )
+    {
+      if( !budget.search_time_left() )
+      {
+        nb_considered_points = j;
+        break;
+      }
+      
+      uint32_t j_index = priorities[j].first;
+      uint32_t assignment = uint32_t( computed_visual_words[j_index] );
+      
+      nearest_neighbors_float nn;
+      
+      size_t nb_poss_assignments = loc_db.get_nb_entries_for_vw( assignment );
+      
+      if( nb_poss_assignments > 0 )
+      {
+        // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
+        const vw_entry *vw_entries = loc_db.get_entries_for_vw( assignment );
+        const float *vw_descriptors = loc_db.get_descriptors_for_vw_float( assignment );
+        nb_comparisons += nb_poss_assignments;
+        
+        for( size_t k=0; k<nb_poss_assignments; ++k )
+        {
+          uint32_t point_id = vw_entries[k].point_id;
+          
+          float dist = compute_squared_SIFT_dist_float( descriptors[j_index], vw_descriptors + 128 * k );
+          
+          nn.update( point_id, dist );
+        }
+      }
+      
+      // check if we have found a correspondence
+      if( nn.dist1 >= 0.0 )
+      {
+        if( nn.dist2 >= 0.0 )
+        {
+          if( nn.get_ratio() < nn_ratio )
+          {
+            feature_ratios[j_index] = nn.get_ratio();
+            
+            // we found one, so we need check for mutual nearest neighbors
+            map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
+      
+            if( map_it_3D != corr_3D_to_2D.end() )
+            {
+              if( map_it_3D->second.second > nn.dist1 )
+              {
+                map_it_3D->second.first = j_index;
+                map_it_3D->second.second = nn.dist1;
+              }
+            }
+            else
+            {
+              corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
+            }
+          }
+        }
+      }
+      
+      if( max_cor_early_term > 0 && corr_3D_to_2D.size() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
+      {
+        nb_considered_points = j+1;
+        break;
+      }
+    }
+  }
+  else if( mode == 2 )
+  {
+    for( size_t j=0; j<nb_loaded_keypoints; ++j )
+    {
+      if( !budget.search_time_left() )
+      {
+        nb_considered_points = j;
+        break;
+      }
+      
+      uint32_t j_index = priorities[j].first;
+      uint32_t assignment = uint32_t( computed_visual_words[j_index] );
+      
+      nearest_neighbors_multiple nn;
+      
+      size_t nb_poss_assignments = loc_db.get_nb_entries_for_vw( assignment );
+      
+      if( nb_poss_assignments > 0 )
+      {
+        // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
+        const vw_entry *vw_entries = loc_db.get_entries_for_vw( assignment );
+        const unsigned char *vw_descriptors = loc_db.get_descriptors_for_vw_uchar( assignment );
+        nb_comparisons += nb_poss_assignments;
+        
+        for( size_t k=0; k<nb_poss_assignments; ++k )
+        {
+          uint32_t point_id = vw_entries[k].point_id;
+          
+          int dist = compute_squared_SIFT_dist( descriptors[j_index], vw_descriptors + 128 * k );
+          
+          nn.update( point_id, dist );
+        }
+      }
+      
+      // check if we have found a correspondence
+      if( nn.dist1 >= 0 )
+      {
+        if( nn.dist2 >= 0 )
+        {
+          if( nn.get_ratio() < nn_ratio )
+          {
+            feature_ratios[j_index] = nn.get_ratio();
+            
+            // we found one, so we need check for mutual nearest neighbors
+            map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
+      
+            if( map_it_3D != corr_3D_to_2D.end() )
+            {
+              if( map_it_3D->second.second > nn.dist1 )
+              {
+                map_it_3D->second.first = j_index;
+                map_it_3D->second.second = nn.dist1;
+              }
+            }
+            else
+            {
+              corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
+            }
+          }
+        }
+      }
+      
+      if( max_cor_early_term > 0 && corr_3D_to_2D.size() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
+      {
+        nb_considered_points = j+1;
+        break;
+      }
+    }
+  }
+  
+  if( nb_considered_points == 0 && !budget.search_deadline_reached() )
+    nb_considered_points = nb_loaded_keypoints;
+  
+  if( budget.search_deadline_reached() )
+    out << " reached the deadline of the correspondence search after " << corr_3D_to_2D.size() << " correspondences " << std::endl;
+  
+  
+
+  ////
+  // compute and store the correspondences such that we can easily hand them over to RANSAC
+  
+  // the 2D and 3D positions of features and points are simply concatenated into 2 vectors
+  std::vector< float > c2D, c3D, corr_ratios;
+  c2D.clear();
+  c3D.clear();
+  corr_ratios.clear();
+  
+  // furthermore, we want to store the ids of the 2D features and the 3D points3D
+  // first the 2D, then the 3D point
+  std::vector< std::pair< uint32_t, uint32_t > > final_correspondences;
+  final_correspondences.clear();
+  
+  // get the correspondences
+  for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D )
+  {
+    c2D.push_back(keypoints[map_it_3D->second.first].x);
+    c2D.push_back(keypoints[map_it_3D->second.first].y);
+    
+    c3D.push_back( loc_db.get_point( map_it_3D->first )[0] );
+    c3D.push_back( loc_db.get_point( map_it_3D->first )[1] );
+    c3D.push_back( loc_db.get_point( map_it_3D->first )[2] );
+    
+    corr_ratios.push_back( feature_ratios[map_it_3D->second.first] );
+    
+    final_correspondences.push_back( std::make_pair( map_it_3D->second.first, map_it_3D->first ) );
+  }
+  
+  timer.Stop();
+  out << " computed correspondences in " << timer.GetElapsedTimeAsString() << ", considering " << nb_considered_points << " features " << std::endl;
+  result.corr_time = timer.GetElapsedTime();
+  
+  
+  ////
+  // do the pose verification using RANSAC
+  
+  uint32_t nb_corr = c2D.size() / 2;
+  RANSAC ransac_solver( ransac_parameters );
+  ransac_solver.set_focal_length( focal_length );
+  ransac_solver.set_deadline( budget.get_deadline() );
+  
+  out << " applying RANSAC on " << nb_corr << " correspondences " << std::endl;
+  if( focal_length > 0.0f )
+    out << " using P3P with a focal length of " << focal_length << " pixels " << std::endl;
+  timer.Init();
+  timer.Start();
+  ransac_solver.apply_RANSAC( c2D, c3D, nb_corr, std::max( float( minimal_RANSAC_solution ) / float( nb_corr ), min_inlier ), &corr_ratios ); 
+  timer.Stop();
+  result.RANSAC_time = timer.GetElapsedTime();
+  
+  all_timer.Stop();
+  
+  // output the solution:
+  out << "#### found solution ####" << std::endl;
+  out << " needed time: " << all_timer.GetElapsedTimeAsString() << std::endl;
+
+  // get the solution from RANSAC
+  std::vector< uint32_t > inlier;
+  inlier.assign( ransac_solver.get_inliers().begin(), ransac_solver.get_inliers().end()  );
+  
+  result.nb_inlier = inlier.size();
+  result.nb_corr = nb_corr;
+  result.total_time = all_timer.GetElapsedTime();
+  result.deadline_reached = budget.search_deadline_reached() || ransac_solver.reached_time_limit();
+  if( result.deadline_reached )
+    out << " WARNING: the localization was stopped early, the pose is the best one found so far " << std::endl;
+  
+  // get the computed projection matrix
+  Util::Math::ProjMatrix proj_matrix = ransac_solver.get_projection_matrix();
+  
+  // decompose the projection matrix
+  Util::Math::Matrix3x3 Rot, K;
+  proj_matrix.decompose( K, Rot );
+  proj_matrix.computeInverse();
+  proj_matrix.computeCenter();
+  out << " camera calibration: " << K << std::endl;
+  out << " camera rotation: " << Rot << std::endl;
+  out << " camera position: " << proj_matrix.m_center << std::endl;
+  
+  out << "#########################" << std::endl;
+  
+  // clean up
+  keypoints.clear();
+  inlier.clear();
+}
+
 //---------------------------------------------------------------------------------------------------------------------------------------------------------------
 
 ////
@@ -332,6 +765,26 @@ double ransac_max_time = 60.0;
 
 int main (int argc, char **argv)
 {
+  // optional number of threads used to localize the query images in parallel
+  uint32_t nb_threads = 1;
+  std::string option_value;
+  if( extract_option( argc, argv, "--threads", option_value ) )
+    nb_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional number of threads used to draw and evaluate the RANSAC samples of a single query image
+  uint32_t nb_ransac_threads = 1;
+  if( extract_option( argc, argv, "--ransac-threads", option_value ) )
+    nb_ransac_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional number of threads used by FLANN to search for the features of a single query image
+  uint32_t nb_flann_threads = 1;
+  if( extract_option( argc, argv, "--flann-threads", option_value ) )
+    nb_flann_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional latency budget of a single query, given in milliseconds
+  if( extract_option( argc, argv, "--latency-budget-ms", option_value ) )
+    query_latency_budget = std::max( 0.0, atof( option_value.c_str() ) ) / 1000.0;
+  
   if( argc < 10 )
   {
     std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
@@ -341,6 +794,7 @@ int main (int argc, char **argv)
     std::cout << " -                               2011 by Torsten Sattler (tsattler@cs.rwth-aachen.de)                                     - " << std::endl;
     std::cout << " -                                                                                                                        - " << std::endl;
     std::cout << " - usage: acg_localizer list nb_trees nb_cluster clusters descriptors mode in_ratio max_corr results                      - " << std::endl;
+    std::cout << " -                 [--threads N] [--ransac-threads N] [--flann-threads N] [--latency-budget-ms T]                         - " << std::endl;
     std::cout << " - Parameters:                                                                                                            - " << std::endl;
     std::cout << " -  list                                                                                                                  - " << std::endl;
     std::cout << " -     List containing the filenames of all the .key files that should be used as query. It is assumed that the           - " << std::endl;
@@ -356,6 +810,7 @@ int main (int argc, char **argv)
     std::cout << " -                                                                                                                        - " << std::endl;
     std::cout << " -  clusters                                                                                                              - " << std::endl;
     std::cout << " -     The cluster centers (visual words), stored in a textfile consisting of nb_clusters * 128 floating point values.    - " << std::endl;
+    std::cout << " -     Alternatively, a binary vocabulary file generated by build_vocabulary_tree.                                        - " << std::endl;
     std::cout << " -                                                                                                                        - " << std::endl;
     std::cout << " -  descriptors                                                                                                           - " << std::endl;
     std::cout << " -     The assignments assigning descriptors (and 3D points) to visual words, computed by compute_desc_assignments.       - " << std::endl;
@@ -377,6 +832,24 @@ int main (int argc, char **argv)
     std::cout << " -       #inliers #(correspondences found) (time needed to compute the visual words, in seconds) (time needed for linear  - " << std::endl;
     std::cout << " -       search, in seconds) (time needed for RANSAC, in seconds) (total time needed, in seconds)                         - " << std::endl;
     std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --threads N (optional)                                                                                                - " << std::endl;
+    std::cout << " -     Localize N query images in parallel (default: 1). The model is shared by all threads and the results are          - " << std::endl;
+    std::cout << " -     written in the order of the list.                                                                                  - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --ransac-threads N (optional)                                                                                         - " << std::endl;
+    std::cout << " -     Draw and evaluate the RANSAC samples of a query image with N threads (default: 1). This reduces the time           - " << std::endl;
+    std::cout << " -     needed for difficult queries, it can be combined with --threads.                                                   - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --flann-threads N (optional)                                                                                          - " << std::endl;
+    std::cout << " -     Assign the features of a query image to visual words with N threads (default: 1). The                              - " << std::endl;
+    std::cout << " -     assignments do not depend on N, it can be combined with --threads and --ransac-threads.                            - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --latency-budget-ms T (optional)                                                                                      - " << std::endl;
+    std::cout << " -     Localize every query image within T milliseconds, starting when its features are loaded. Word assignment,          - " << std::endl;
+    std::cout << " -     correspondence search and RANSAC share this deadline, 25% of T are reserved for RANSAC. When time runs short,      - " << std::endl;
+    std::cout << " -     fewer correspondences are needed for early termination (max_corr > 0). If the deadline is reached, the best        - " << std::endl;
+    std::cout << " -     pose found so far is used and the query is marked as stopped early (not limited by default).                       - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
     std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
     return -1;
   }
@@ -388,7 +861,7 @@ int main (int argc, char **argv)
   uint32_t nb_clusters = (uint32_t) atoi( argv[3] );
   std::string cluster_file( argv[4] );
   std::string vw_assignments( argv[5] );
-  int mode = atoi( argv[6] );
+  mode = atoi( argv[6] );
   if( mode < 0 || mode > 2 )
   {
     std::cerr << " ERROR: unknown mode " << mode << std::endl;
@@ -399,8 +872,9 @@ int main (int argc, char **argv)
   min_inlier = atof( argv[7] );
   
   std::cout << " Assumed minimal inlier-ratio: " << min_inlier << std::endl;
+  std::cout << " Descriptor distances computed using the " << get_SIFT_dist_implementation() << " implementation " << std::endl;
   
-  size_t max_cor_early_term = (size_t) atoi( argv[8] );
+  max_cor_early_term = (size_t) atoi( argv[8] );
   
   if( max_cor_early_term > 0 )
     std::cout << " Early termination after finding " << max_cor_early_term << " correspondences " << std::endl;
@@ -421,7 +895,6 @@ int main (int argc, char **argv)
   
   ////
   // load the visual words and their tree 
-  visual_words_handler vw_handler;
   vw_handler.set_nb_trees( nb_trees );
   vw_handler.set_nb_visual_words( nb_clusters );
   vw_handler.set_branching( 10 );
@@ -441,99 +914,34 @@ int main (int argc, char **argv)
   
   std::cout << "* Loading and parsing the assignments ... " << std::endl;
   
-  // store the 3D positions of the 3D points
-  std::vector< OpenMesh::Vec3f > points3D;
-  
-  // store the descriptors in a vector simply by concatenating their entries
-  // depending on the mode, either unsigned char entries or floating point entries are used
-  std::vector< unsigned char > all_descriptors;
-  std::vector< float > all_descriptors_float;
+  // The 3D points, their descriptors and the assignments of (point id, descriptor id) pairs to visual words
+  // are memory mapped from the file generated by compute_desc_assignments and are used in place.
+  // Depending on the mode, the descriptors are stored either as unsigned chars or as floats.
+  if( !loc_db.load( vw_assignments ) )
+  {
+    std::cerr << " ERROR: Cannot read the visual word assignments " << vw_assignments << std::endl;
+    return -1;
+  }
   
-  // for every visual word, store a vector of (3D point id, descriptor id) pairs, where the 3D point id
-  // is the index of the 3D point in points3D and the descriptor id is the position of the first entry of the corresponding 
-  // descriptor in all_descriptors / all_descriptors_float
-  std::vector< std::vector< std::pair< uint32_t, uint32_t > > > vw_points_descriptors(nb_clusters);
+  if( loc_db.get_nb_visual_words() != nb_clusters )
+  {
+    std::cerr << " ERROR: Number of clusters differs! " << loc_db.get_nb_visual_words() << " " << nb_clusters << std::endl;
+    return -1;
+  }
   
-  // store per visual word the number of (point, descriptor) pairs store in it
-  std::vector< uint32_t > nb_points_per_vw(nb_clusters,0);
+  if( ( mode == 1 ) != ( loc_db.get_descriptor_type() == LOC_DB_FLOAT ) )
+  {
+    std::cerr << " ERROR: The descriptors stored in " << vw_assignments << " do not match mode " << mode << std::endl;
+    return -1;
+  }
   
   // number of non-empty visual words, the number of 3D points and the total number of descriptors
-  uint32_t nb_non_empty_vw, nb_3D_points, nb_descriptors;
+  uint32_t nb_non_empty_vw = loc_db.get_nb_non_empty_visual_words();
+  uint32_t nb_3D_points = loc_db.get_nb_points();
+  uint32_t nb_descriptors = loc_db.get_nb_descriptors();
   
-  for( uint32_t i=0; i<nb_clusters; ++i )
-    vw_points_descriptors[i].clear();
-  
-  // load the assignments from a file generated by compute_desc_assignments
-  {
-    std::ifstream ifs( vw_assignments.c_str(), std::ios::in | std::ios::binary  );
-    
-    if ( !ifs )
-    {
-      std::cerr << " ERROR: Cannot read the visual word assignments " << vw_assignments << std::endl;
-      return -1;
-    }
-    
-    uint32_t nb_clusts;
-    ifs.read(( char* ) &nb_3D_points, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_clusts, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_non_empty_vw, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_descriptors, sizeof( uint32_t ) );
-
-    if( nb_clusts != nb_clusters )
-      std::cerr << " WARNING: Number of clusters differs! " << nb_clusts << " " << nb_clusters << std::endl;
-    
-    std::cout << "  Number of non-empty clusters: " << nb_non_empty_vw << " number of points : " << nb_3D_points << " number of descriptors: " << nb_descriptors << std::endl;
-    
-    // read the 3D points and their visibility polygons
-    points3D.resize(nb_3D_points);
-    if( mode == 0 || mode == 2 )
-      all_descriptors.resize(128*nb_descriptors);
-    else
-      all_descriptors_float.resize(128*nb_descriptors);
-    
-    
-    // load the points
-    float *point_data = new float[3];
-    for( uint32_t i=0; i<nb_3D_points; ++i )
-    {
-      ifs.read(( char* ) point_data, 3 * sizeof( float ) );
-      for( int j=0; j<3; ++j )
-        points3D[i][j] = point_data[j];
-    }
-    delete [] point_data;
-       
-    // load the descriptors
-    int tmp_int;
-    uint64_t index = 0;
-    for( uint32_t i=0; i<nb_descriptors; ++i, index += sift_dim )
-    {
-      for( uint64_t j=0; j<sift_dim; ++j )
-      {
-        if( mode == 0 || mode == 2 )
-          ifs.read(( char* ) &all_descriptors[index+j], sizeof( unsigned char ) );
-        else
-          ifs.read(( char* ) &all_descriptors_float[index+j], sizeof( float ) );
-      }
-    }
-    
-    // now we load the assignments of the pairs (point_id, descriptor_id) to the visual words
-    for( uint32_t i=0; i<nb_non_empty_vw; ++i )
-    {
-      uint32_t id, nb_pairs;
-      ifs.read(( char* ) &id, sizeof( uint32_t ) );
-      ifs.read(( char* ) &nb_pairs, sizeof( uint32_t ) );
-      vw_points_descriptors[id].resize( nb_pairs );
-      nb_points_per_vw[id] = nb_pairs;
-      for( uint32_t j=0; j<nb_pairs; ++j )
-      {
-        ifs.read(( char* ) &vw_points_descriptors[id][j].first, sizeof( uint32_t ) );
-        ifs.read(( char* ) &vw_points_descriptors[id][j].second, sizeof( uint32_t ) );
-      }
-    }
-    ifs.close();
-    
-    std::cout << "  done loading and parsing the assignments " << std::endl;
-  }
+  std::cout << "  Number of non-empty clusters: " << nb_non_empty_vw << " number of points : " << nb_3D_points << " number of descriptors: " << nb_descriptors << std::endl;
+  std::cout << "  done loading and parsing the assignments " << std::endl;
   
 
   
@@ -576,387 +984,77 @@ int main (int argc, char **argv)
   double mean_nb_correspondences_rejected = 0.0;
   double mean_nb_features_accepted = 0.0;
   double mean_nb_features_rejected = 0.0;
-  double vw_time = 0.0;
-  double corr_time = 0.0;
-  double RANSAC_time = 0.0;
   double avrg_RANSAC_time_registered = 0.0;
   double avrg_RANSAC_time_rejected = 0.0;
   
   // the number of registered images
   uint32_t registered = 0;
   
-  // store all assignments of 2D features to visual words in one large vector (resized if necessary)
-  // preallocated for speed
-  std::vector< uint32_t > computed_visual_words( 50000, 0 );
+  // the number of images whose localization was stopped early
+  uint32_t nb_stopped_early = 0;
+  
+  // the RANSAC parameters are the same for all images, every RANSAC instance gets its own copy
+  // P3P is used for all images whose focal length is known from the exif tag, P6pt for all others
+  ransac_parameters.computation_type = P3P;
+  ransac_parameters.stop_after_n_secs = true;
+  ransac_parameters.max_time = ransac_max_time;
+  ransac_parameters.error = 10.0f; // for P6pt and P3P this is the SQUARED reprojection error in pixels
+  ransac_parameters.nb_threads = nb_ransac_threads;
+  if( nb_ransac_threads > 1 )
+    std::cout << " Using " << nb_ransac_threads << " threads in RANSAC " << std::endl;
   
+  vw_handler.set_nb_threads( (int) nb_flann_threads );
+  if( nb_flann_threads > 1 )
+    std::cout << " Using " << nb_flann_threads << " threads to search with FLANN " << std::endl;
+  if( query_latency_budget > 0.0 )
+    std::cout << " Latency budget of " << query_latency_budget * 1000.0 << " ms per query " << std::endl;
   
-  for( uint32_t i=0; i<nb_keyfiles; ++i, N+=1.0 )
+  if( nb_threads > 1 )
   {
-    std::cout << std::endl << " --------- " << i+1 << " / " << nb_keyfiles << " --------- " << std::endl;
-    
-    // load the features
-    SIFT_loader key_loader;
-    key_loader.load_features( key_filenames[i].c_str(), LOWE );
-    
-    std::vector< unsigned char* >& descriptors = key_loader.get_descriptors();
-    std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
-    
-    uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
-    
-   
-    // center the keypoints around the center of the image
-    // first we need to get the dimensions of the image which we obtain from its exif tag
-    int img_width, img_height;
-    std::string jpg_filename( key_filenames[i] );
-    jpg_filename.replace( jpg_filename.size()-3,3,"jpg");
-    exif_reader::open_exif( jpg_filename.c_str() );
-    img_width = exif_reader::get_image_width();
-    img_height = exif_reader::get_image_height();
-    exif_reader::close_exif();
-    
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
+    std::cout << " Localizing up to " << nb_threads << " query images in parallel " << std::endl;
+    // the output of RANSAC would be interleaved
+    ransac_parameters.silent = true;
+  }
+  
+  std::vector< query_result > query_results( nb_keyfiles );
+  
+  // localize the query images, the results are written and the statistics are updated in the order of the list
+  process_queries( nb_keyfiles, nb_threads, [&]( uint32_t i, uint32_t )
+  {
+    std::ostream &out = ( nb_threads > 1 ) ? query_results[i].log : std::cout;
+    out << std::endl << " --------- " << i+1 << " / " << nb_keyfiles << " --------- " << std::endl;
+    localize_query( key_filenames[i], out, query_results[i] );
+  },
+  [&]( uint32_t i )
+  {
+    query_result &result = query_results[i];
+    if( nb_threads > 1 )
     {
-      keypoints[j].x -= (img_width-1.0)/2.0f; 
-      keypoints[j].y = (img_height-1.0)/2.0f - keypoints[j].y; 
+      std::cout << result.log.str();
+      result.log.str( "" );
     }
     
-    std::cout << " loaded " << nb_loaded_keypoints << " descriptors from " << key_filenames[i] << std::endl;
-    
-    ////
-    // assign the descriptors to the visual words   
-    Timer timer;
-    timer.Init();
-    timer.Start();
-    
-    if( computed_visual_words.size() < nb_loaded_keypoints )
-      computed_visual_words.resize( nb_loaded_keypoints );
-
-    
-    std::set< size_t > unique_vw;
-    unique_vw.clear();
-
-    vw_handler.set_nb_paths( 10 );
-    vw_handler.assign_visual_words_ucharv( descriptors, nb_loaded_keypoints, computed_visual_words );
-    
-    timer.Stop();
-    
-    for( size_t j=0; j<nb_loaded_keypoints; ++j )
-      unique_vw.insert( computed_visual_words[j] );
+    uint32_t nb_inlier = result.nb_inlier;
+    uint32_t nb_corr = result.nb_corr;
+    uint32_t nb_loaded_keypoints = result.nb_features;
+    double corr_time = result.corr_time;
+    double RANSAC_time = result.RANSAC_time;
     
-    std::cout << " assigned visual words in " << timer.GetElapsedTimeAsString() << " to " << unique_vw.size() << " unique vw" << std::endl;
+    ofs_details << nb_inlier << " " << nb_corr << " " << result.vw_time << " " << corr_time << " " << RANSAC_time << " " << result.total_time << std::endl;
     
-    avrg_vw_time = avrg_vw_time * N / (N+1.0) + timer.GetElapsedTime() / (N+1.0);
+    avrg_vw_time = avrg_vw_time * N / (N+1.0) + result.vw_time / (N+1.0);
     avrg_nb_features = avrg_nb_features * N / (N+1.0) + double(nb_loaded_keypoints) / (N+1.0);
-    vw_time = timer.GetElapsedTime();
-    
-    ////
-    // establish 2D-3D correspondences by using the vw to compute pairwise nearest neighbors
-    timer.Init();
-    timer.Start();
-
-    Timer all_timer;
-    all_timer.Init();
-    all_timer.Start();
-    
-    uint32_t max_corr = 0;
-    
-    // sort the 2D points in ascending order of the number of 3D points belonging to their respective visual words
-    std::vector< std::pair< uint32_t, uint32_t > > priorities( nb_loaded_keypoints );
-    for( size_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      priorities[j].first = j;
-      priorities[j].second = nb_points_per_vw[computed_visual_words[j]];
-    }
-    
-    std::sort( priorities.begin(), priorities.end(), cmp_priorities );
-
-
-    // we store for each 3D point the corresponding 2D feature as well as the squared distance
-    // this is needed in case that two 2D features are assigned to one 3D point, because
-    // we only want to keep the correspondence to the 2D point with the most similar descriptor
-    // i.e. the smallest Euclidean distance in descriptor space
-    std::map< uint32_t, std::pair< uint32_t, int > > corr_3D_to_2D;
-    corr_3D_to_2D.clear();
-    
-    std::map< uint32_t, nearest_neighbors >::iterator map_it_2D;
-    std::map< uint32_t, nearest_neighbors_float >::iterator map_it_2D_float;
-    std::map< uint32_t, nearest_neighbors_multiple >::iterator map_it_2D_multple;
-    std::map< uint32_t, std::pair< uint32_t, int > >::iterator map_it_3D;
-
-    // compute nearest neighbors
-    // we do a single case distinction wether the database consists of unsigned char descriptors or floating point descriptors
-    // while resulting in ugly code, it should improve run-time since we do not need to make the distinction multiple times
-    uint32_t nb_comparisons = 0;
-    uint32_t nb_considered_points = 0;
-    if( mode == 0 )
-    {
-      for( size_t j=0; j<nb_loaded_keypoints; ++j )
-      {
-        uint32_t j_index = priorities[j].first;
-        uint32_t assignment = uint32_t( computed_visual_words[j_index] );
-        
-        nearest_neighbors nn;
-        
-        if( vw_points_descriptors[assignment].size() > 0 )
-        {
-          // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
-          size_t nb_poss_assignments = vw_points_descriptors[assignment].size();
-          
-          nb_comparisons += nb_poss_assignments;
-          
-          for( size_t k=0; k<nb_poss_assignments; ++k )
-          {
-            uint32_t point_id = vw_points_descriptors[assignment][k].first;
-            uint32_t desc_id = vw_points_descriptors[assignment][k].second;
-            
-            int dist = compute_squared_SIFT_dist( descriptors[j_index], all_descriptors, desc_id );
-            
-            nn.update( point_id, dist );
-          }
-        }
-        
-        // check if we have found a correspondence
-        if( nn.dist1 >= 0 )
-        {
-          if( nn.dist2 >= 0 )
-          {
-            if( nn.get_ratio() < nn_ratio )
-            {
-              // we found one, so we need check for mutual nearest neighbors
-              map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
-        
-              if( map_it_3D != corr_3D_to_2D.end() )
-              {
-                if( map_it_3D->second.second > nn.dist1 )
-                {
-                  map_it_3D->second.first = j_index;
-                  map_it_3D->second.second = nn.dist1;
-                }
-              }
-              else
-              {
-                corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
-              }
-            }
-          }
-        }
-        
-        // stop the search if enough correspondences are found
-        if( max_cor_early_term > 0 && corr_3D_to_2D.size() >= max_cor_early_term )
-        {
-          nb_considered_points = j+1;
-          break;
-        }
-      }
-    }
-    else if( mode == 1 )
-    {
-      // floating point
-      for( size_t j=0; j<nb_loaded_keypoints; ++j )
-      {
-        uint32_t j_index = priorities[j].first;
-        uint32_t assignment = uint32_t( computed_visual_words[j_index] );
-        
-        nearest_neighbors_float nn;
-        
-        if( vw_points_descriptors[assignment].size() > 0 )
-        {
-          // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
-          size_t nb_poss_assignments = vw_points_descriptors[assignment].size();
-          nb_comparisons += nb_poss_assignments;
-          
-          for( size_t k=0; k<nb_poss_assignments; ++k )
-          {
-            uint32_t point_id = vw_points_descriptors[assignment][k].first;
-            uint32_t desc_id = vw_points_descriptors[assignment][k].second;
-            
-            float dist = compute_squared_SIFT_dist_float( descriptors[j_index], all_descriptors_float, desc_id );
-            
-            nn.update( point_id, dist );
-          }
-        }
-        
-        // check if we have found a correspondence
-        if( nn.dist1 >= 0.0 )
-        {
-          if( nn.dist2 >= 0.0 )
-          {
-            if( nn.get_ratio() < nn_ratio )
-            {
-              // we found one, so we need check for mutual nearest neighbors
-              map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
-        
-              if( map_it_3D != corr_3D_to_2D.end() )
-              {
-                if( map_it_3D->second.second > nn.dist1 )
-                {
-                  map_it_3D->second.first = j_index;
-                  map_it_3D->second.second = nn.dist1;
-                }
-              }
-              else
-              {
-                corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
-              }
-            }
-          }
-        }
-        
-        if( max_cor_early_term > 0 && corr_3D_to_2D.size() >= max_cor_early_term )
-        {
-          nb_considered_points = j+1;
-          break;
-        }
-      }
-    }
-    else if( mode == 2 )
-    {
-      for( size_t j=0; j<nb_loaded_keypoints; ++j )
-      {
-        uint32_t j_index = priorities[j].first;
-        uint32_t assignment = uint32_t( computed_visual_words[j_index] );
-        
-        nearest_neighbors_multiple nn;
-        
-        if( vw_points_descriptors[assignment].size() > 0 )
-        {
-          // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
-          size_t nb_poss_assignments = vw_points_descriptors[assignment].size();
-          nb_comparisons += nb_poss_assignments;
-          
-          for( size_t k=0; k<nb_poss_assignments; ++k )
-          {
-            uint32_t point_id = vw_points_descriptors[assignment][k].first;
-            uint32_t desc_id = vw_points_descriptors[assignment][k].second;
-            
-            
-            int dist = compute_squared_SIFT_dist( descriptors[j_index], all_descriptors, desc_id );
-            
-            nn.update( point_id, dist );
-          }
-        }
-        
-        // check if we have found a correspondence
-        if( nn.dist1 >= 0 )
-        {
-          if( nn.dist2 >= 0 )
-          {
-            if( nn.get_ratio() < nn_ratio )
-            {
-              // we found one, so we need check for mutual nearest neighbors
-              map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
-        
-              if( map_it_3D != corr_3D_to_2D.end() )
-              {
-                if( map_it_3D->second.second > nn.dist1 )
-                {
-                  map_it_3D->second.first = j_index;
-                  map_it_3D->second.second = nn.dist1;
-                }
-              }
-              else
-              {
-                corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
-              }
-            }
-          }
-        }
-        
-        if( max_cor_early_term > 0 && corr_3D_to_2D.size() >= max_cor_early_term )
-        {
-          nb_considered_points = j+1;
-          break;
-        }
-      }
-    }
-    
-    if( nb_considered_points == 0 )
-      nb_considered_points = nb_loaded_keypoints;
-    
-    
-
-    ////
-    // compute and store the correspondences such that we can easily hand them over to RANSAC
-    
-    // the 2D and 3D positions of features and points are simply concatenated into 2 vectors
-    std::vector< float > c2D, c3D;
-    c2D.clear();
-    c3D.clear();
-    
-    // furthermore, we want to store the ids of the 2D features and the 3D points3D
-    // first the 2D, then the 3D point
-    std::vector< std::pair< uint32_t, uint32_t > > final_correspondences;
-    final_correspondences.clear();
-    
-    // get the correspondences
-    for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D )
-    {
-      c2D.push_back(keypoints[map_it_3D->second.first].x);
-      c2D.push_back(keypoints[map_it_3D->second.first].y);
-      
-      c3D.push_back( points3D[map_it_3D->first][0] );
-      c3D.push_back( points3D[map_it_3D->first][1] );
-      c3D.push_back( points3D[map_it_3D->first][2] );
-      
-      final_correspondences.push_back( std::make_pair( map_it_3D->second.first, map_it_3D->first ) );
-    }
-    
-    timer.Stop();
-    std::cout << " computed correspondences in " << timer.GetElapsedTimeAsString() << ", considering " << nb_considered_points << " features " << std::endl;
-    corr_time = timer.GetElapsedTime();
-    
-    
-    ////
-    // do the pose verification using RANSAC
-    
-    uint32_t nb_corr = c2D.size() / 2;
-    RANSAC::computation_type = P6pt;
-    RANSAC::stop_after_n_secs = true;
-    RANSAC::max_time = ransac_max_time;
-    RANSAC::error = 10.0f; // for P6pt this is the SQUARED reprojection error in pixels
-    RANSAC ransac_solver;
-    
-    
-    std::cout << " applying RANSAC on " << nb_corr << " correspondences " << std::endl;
-    timer.Init();
-    timer.Start();
-    ransac_solver.apply_RANSAC( c2D, c3D, nb_corr, std::max( float( minimal_RANSAC_solution ) / float( nb_corr ), min_inlier ) ); 
-    timer.Stop();
-    RANSAC_time = timer.GetElapsedTime();
-    
-    all_timer.Stop();
-    
-    // output the solution:
-    std::cout << "#### found solution ####" << std::endl;
-    std::cout << " needed time: " << all_timer.GetElapsedTimeAsString() << std::endl;
-
-    // get the solution from RANSAC
-    std::vector< uint32_t > inlier;
-    inlier.assign( ransac_solver.get_inliers().begin(), ransac_solver.get_inliers().end()  );
-    
-    // get the computed projection matrix
-    Util::Math::ProjMatrix proj_matrix = ransac_solver.get_projection_matrix();
-    
-    // decompose the projection matrix
-    Util::Math::Matrix3x3 Rot, K;
-    proj_matrix.decompose( K, Rot );
-    proj_matrix.computeInverse();
-    proj_matrix.computeCenter();
-    std::cout << " camera calibration: " << K << std::endl;
-    std::cout << " camera rotation: " << Rot << std::endl;
-    std::cout << " camera position: " << proj_matrix.m_center << std::endl;
-        
-    ofs_details << inlier.size() << " " << nb_corr << " " << vw_time << " " << corr_time << " " << RANSAC_time << " " << all_timer.GetElapsedTime() << std::endl;
-    
-    std::cout << "#########################" << std::endl;
+    N += 1.0;
+    if( result.deadline_reached )
+      ++nb_stopped_early;
     
     // determine whether the image was registered or not
     // also update the statistics about timing, ...
-    if( inlier.size() >= minimal_RANSAC_solution )
+    if( nb_inlier >= minimal_RANSAC_solution )
     {
       double N_reg = registered;
-      avrg_reg_time = avrg_reg_time * N_reg / (N_reg+1.0) + all_timer.GetElapsedTime() / (N_reg+1.0);
-      mean_inlier_ratio_accepted = mean_inlier_ratio_accepted * N_reg / (N_reg+1.0) + double(inlier.size()) / (double( nb_corr ) * (N_reg+1.0));
+      avrg_reg_time = avrg_reg_time * N_reg / (N_reg+1.0) + result.total_time / (N_reg+1.0);
+      mean_inlier_ratio_accepted = mean_inlier_ratio_accepted * N_reg / (N_reg+1.0) + double(nb_inlier) / (double( nb_corr ) * (N_reg+1.0));
       mean_nb_correspondences_accepted = mean_nb_correspondences_accepted * N_reg / (N_reg+1.0) + double(nb_corr) / (N_reg+1.0);
       mean_nb_features_accepted = mean_nb_features_accepted * N_reg / (N_reg+1.0) + double(nb_loaded_keypoints) / (N_reg+1.0);
       avrg_cor_computation_time_accepted = avrg_cor_computation_time_accepted * N_reg /(N_reg+1.0) + corr_time / (N_reg+1.0);
@@ -965,8 +1063,8 @@ int main (int argc, char **argv)
     }
     else
     {
-      avrg_reject_time = avrg_reject_time * N_reject / (N_reject+1.0) + all_timer.GetElapsedTime() / (N_reject+1.0);
-      mean_inlier_ratio_rejected = mean_inlier_ratio_rejected * N_reject / (N_reject+1.0) + double(inlier.size()) / (double( nb_corr ) * (N_reject+1.0));
+      avrg_reject_time = avrg_reject_time * N_reject / (N_reject+1.0) + result.total_time / (N_reject+1.0);
+      mean_inlier_ratio_rejected = mean_inlier_ratio_rejected * N_reject / (N_reject+1.0) + double(nb_inlier) / (double( nb_corr ) * (N_reject+1.0));
       mean_nb_correspondences_rejected = mean_nb_correspondences_rejected * N_reject / (N_reject+1.0) + double(nb_corr) / (N_reject+1.0);
       mean_nb_features_rejected = mean_nb_features_rejected * N_reject / (N_reject+1.0) + double(nb_loaded_keypoints) / (N_reject+1.0);
       avrg_cor_computation_time_rejected = avrg_cor_computation_time_rejected * N_reject /(N_reject+1.0) + corr_time / (N_reject+1.0);
@@ -974,24 +1072,11 @@ int main (int argc, char **argv)
       N_reject += 1.0;
     }
     
-    // clean up
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      if( descriptors[j] != 0 )
-        delete [] descriptors[j];
-      descriptors[j] = 0;
-    }
-
-    descriptors.clear();
-    keypoints.clear();
-    inlier.clear();
-    
     // display statistics
     std::cout << std::endl << std::endl << " registered so far: " << registered << " / " << i+1 << std::endl;
     std::cout << " average time needed to compute the correspondences: registered: " << avrg_cor_computation_time_accepted << " rejected: " << avrg_cor_computation_time_rejected << std::endl;
     std::cout << "avrg. registration time: " << avrg_reg_time << " ( " << registered << " , avrg. inlier-ratio: " << mean_inlier_ratio_accepted << ", avrg. nb correspondences : " << mean_nb_correspondences_accepted << " ) avrg. rejection time: " << avrg_reject_time << " ( " << N_reject << ", avrg. inlier-ratio : " << mean_inlier_ratio_rejected << " avrg. nb correspondences : " << mean_nb_correspondences_rejected << " ) " << std::endl << std::endl;
-  
-  }
+  } );
   
   ofs_details.close();
   
@@ -1015,6 +1100,8 @@ int main (int argc, char **argv)
   std::cout << " avrg. time for RANSAC (rejected)                                             : " << avrg_RANSAC_time_rejected << std::endl;
   std::cout << " minimum inlier-ratio for RANSAC                                              : " << min_inlier << std::endl;
   std::cout << " stop after n correspondences                                                 : " << max_cor_early_term << std::endl;
+  if( query_latency_budget > 0.0 )
+    std::cout << " queries stopped by the latency budget                                        : " << nb_stopped_early << " ( budget " << query_latency_budget * 1000.0 << " ms ) " << std::endl;
   std::cout << " model consists of                                                            : " << nb_descriptors << " ";
   if (mode == 0 || mode == 2)
     std::cout << "unsigned char descriptors " << std::endl;
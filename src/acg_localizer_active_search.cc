@@ -45,10 +45,13 @@
 #include <time.h>
 #include <stdlib.h>
 #include <queue>
+#include <mutex>
 
 // includes for classes dealing with SIFT-features
 #include "features/SIFT_loader.hh"
 #include "features/visual_words_handler.hh"
+#include "features/SIFT_distance.hh"
+#include "features/localization_database.hh"
 
 // stopwatch
 #include "timer.hh"
@@ -60,6 +63,8 @@
 // tools to parse a bundler reconstruction
 #include "sfm/parse_bundler.hh"
 #include "sfm/bundler_camera.hh"
+#include "sfm/scene_graph.hh"
+#include "sfm/point_neighborhoods.hh"
 
 // RANSAC
 #include "RANSAC.hh"
@@ -74,7 +79,11 @@
 // simple vector class for 3D points
 #include <OpenMesh/Core/Geometry/VectorT.hh>
 
-const uint64_t sift_dim = 128;
+// parallel processing of the query images
+#include "query_processing.hh"
+
+// server mode
+#include "localization_server.hh"
 
 ////
 // Classes to handle the two nearest neighbors (nn) of a descriptor.
@@ -302,46 +311,252 @@ struct match_struct
   match_struct( const match_struct &other ) : feature_id(other.feature_id), matching_cost(other.matching_cost), matching_type(other.matching_type) {}
 };
 
-////
-// functions
-////
-
-////
-// functions to compute the squared distances between two SIFT-vectors
-// there are different ways how the SIFT-vectors are stored, for each there is 
-// one function
-////
-
-// First descriptor is stored in an array, while the second descriptor is stored in a vector (concatenation of vector entries)
-// The second descriptor begins at position index*128
-inline int compute_squared_SIFT_dist( const unsigned char * const v1, std::vector< unsigned char > &v2, uint32_t index )
+// Scheduler deciding which matching possibility is handled next. The entries added with push() are
+// returned in ascending order of their matching cost, entries with the same cost in the order in which
+// they were added (a binary heap ordered by cost and insertion number, i.e., O(log n) per push and pop).
+// Entries added with push_next() are returned before all other entries, in the order in which they were
+// added. This allows to implement all prioritization strategies without a linked list that has to
+// be traversed to insert new entries.
+class match_scheduler
 {
-  uint64_t index_( index );
-  index_ *= sift_dim;
-  int dist = 0;
-  int x = 0;
-  for( uint64_t i=0; i<sift_dim; ++i )
-  {
-    x = int( v1[i] ) - int( v2[index_+i] );
-    dist += x*x;
-  }
-  return dist;
-}
+  public:
+    match_scheduler( ) : mNextPos( 0 ), mNbPushed( 0 ) {}
+    
+    //! removes all entries
+    void clear( )
+    {
+      mHeap.clear();
+      mNext.clear();
+      mNextPos = 0;
+      mNbPushed = 0;
+    }
+    
+    //! reserves memory for n entries
+    void reserve( size_t n )
+    {
+      mHeap.reserve( n );
+    }
+    
+    //! adds an entry, it is returned according to its matching cost
+    void push( const match_struct &m )
+    {
+      mHeap.push_back( scheduled_match( m, mNbPushed ) );
+      ++mNbPushed;
+      std::push_heap( mHeap.begin(), mHeap.end(), cmp_later );
+    }
+    
+    //! adds an entry that is returned before all entries added by push()
+    void push_next( const match_struct &m )
+    {
+      mNext.push_back( m );
+    }
+    
+    //! returns true if there are no entries left
+    bool empty( ) const
+    {
+      return ( mNextPos == mNext.size() ) && mHeap.empty();
+    }
+    
+    //! removes the next entry and returns it, the scheduler must not be empty
+    match_struct pop( )
+    {
+      if( mNextPos < mNext.size() )
+      {
+        match_struct m( mNext[mNextPos] );
+        ++mNextPos;
+        if( mNextPos == mNext.size() )
+        {
+          mNext.clear();
+          mNextPos = 0;
+        }
+        return m;
+      }
+      
+      std::pop_heap( mHeap.begin(), mHeap.end(), cmp_later );
+      match_struct m( mHeap.back().match );
+      mHeap.pop_back();
+      return m;
+    }
+    
+  private:
+    
+    struct scheduled_match
+    {
+      match_struct match;
+      
+      // the number of entries added before this one, used to break ties
+      uint64_t insertion_nb;
+      
+      scheduled_match( const match_struct &m, uint64_t n ) : match( m ), insertion_nb( n ) {}
+    };
+    
+    // returns true if a has to be handled after b (std::push_heap keeps the largest element on top)
+    static bool cmp_later( const scheduled_match &a, const scheduled_match &b )
+    {
+      if( a.match.matching_cost != b.match.matching_cost )
+        return a.match.matching_cost > b.match.matching_cost;
+      return a.insertion_nb > b.insertion_nb;
+    }
+    
+    std::vector< scheduled_match > mHeap;
+    std::vector< match_struct > mNext;
+    size_t mNextPos;
+    uint64_t mNbPushed;
+};
 
-// same in case that one descriptors consists of floating point values
-inline float compute_squared_SIFT_dist_float( const unsigned char * const v1, std::vector< float > &v2, uint32_t index )
+// Per-query bookkeeping of the 3D points and visual words, stored in flat arrays indexed by the
+// point (visual word) id. Instead of clearing the arrays for every query, each entry stores the
+// number of the query (epoch) in which it was last written, an entry is only valid if its epoch
+// equals the current one. Starting a new query thus only increments the epoch. The points that have
+// obtained a correspondence are additionally kept in a list, such that all correspondences can be
+// enumerated without traversing the arrays. The context is meant to be reused by all queries
+// handled by the same thread.
+class query_context
 {
-  size_t index_( index );
-  index_ *= sift_dim;
-  float dist = 0;
-  float x = 0;
-  for( int i=0; i<sift_dim; ++i )
-  {
-    x = float( v1[i] ) - v2[index_+i];
-    dist += x*x;
-  }
-  return dist;
-}
+  public:
+    query_context( ) : mEpoch( 0 ), mNbCorrespondences( 0 ) {}
+    
+    //! prepares the context for a new query on nb_points 3D points and nb_words visual words
+    void start_query( uint32_t nb_points, uint32_t nb_words )
+    {
+      if( mPoints.size() < nb_points )
+        mPoints.resize( nb_points );
+      if( mWordEpochs.size() < nb_words )
+        mWordEpochs.resize( nb_words, 0 );
+      
+      ++mEpoch;
+      if( mEpoch == 0 )
+      {
+        // the epoch counter wrapped around, so old entries could become valid again
+        std::fill( mPoints.begin(), mPoints.end(), point_state() );
+        std::fill( mWordEpochs.begin(), mWordEpochs.end(), 0 );
+        mEpoch = 1;
+      }
+      
+      mCorrespondingPoints.clear();
+      mNbCorrespondences = 0;
+    }
+    
+    //! returns true if the point was already used (or promised to be used) for matching
+    bool is_used( uint32_t point ) const
+    {
+      return mPoints[point].used_epoch == mEpoch;
+    }
+    
+    void mark_used( uint32_t point )
+    {
+      mPoints[point].used_epoch = mEpoch;
+    }
+    
+    //! returns true if a correspondence for the point exists
+    bool has_correspondence( uint32_t point ) const
+    {
+      return mPoints[point].corr_epoch == mEpoch;
+    }
+    
+    //! returns the feature corresponding to the point, only valid if has_correspondence( point )
+    uint32_t get_feature( uint32_t point ) const
+    {
+      return mPoints[point].feature;
+    }
+    
+    //! returns the squared SIFT distance of the correspondence, only valid if has_correspondence( point )
+    int get_distance( uint32_t point ) const
+    {
+      return mPoints[point].dist;
+    }
+    
+    //! returns the SIFT ratio of the correspondence, only valid if has_correspondence( point )
+    float get_ratio( uint32_t point ) const
+    {
+      return mPoints[point].ratio;
+    }
+    
+    //! adds a correspondence for the point or replaces the existing one
+    void set_correspondence( uint32_t point, uint32_t feature, int dist, float ratio )
+    {
+      point_state &p = mPoints[point];
+      if( p.corr_epoch != mEpoch )
+      {
+        p.corr_epoch = mEpoch;
+        ++mNbCorrespondences;
+        if( p.listed_epoch != mEpoch )
+        {
+          p.listed_epoch = mEpoch;
+          mCorrespondingPoints.push_back( point );
+        }
+      }
+      p.feature = feature;
+      p.dist = dist;
+      p.ratio = ratio;
+    }
+    
+    //! removes the correspondence of the point, the point must have a correspondence
+    void remove_correspondence( uint32_t point )
+    {
+      // the point stays in the list until get_correspondences() is called
+      mPoints[point].corr_epoch = 0;
+      --mNbCorrespondences;
+    }
+    
+    //! returns the number of correspondences
+    uint32_t get_nb_correspondences( ) const
+    {
+      return mNbCorrespondences;
+    }
+    
+    //! returns the points that have a correspondence, in ascending order of their ids
+    const std::vector< uint32_t >& get_correspondences( )
+    {
+      std::sort( mCorrespondingPoints.begin(), mCorrespondingPoints.end() );
+      
+      size_t nb_kept = 0;
+      for( size_t i=0; i<mCorrespondingPoints.size(); ++i )
+      {
+        uint32_t point = mCorrespondingPoints[i];
+        if( mPoints[point].corr_epoch == mEpoch )
+          mCorrespondingPoints[nb_kept++] = point;
+        else
+          mPoints[point].listed_epoch = 0;
+      }
+      mCorrespondingPoints.resize( nb_kept );
+      
+      return mCorrespondingPoints;
+    }
+    
+    //! marks a visual word as used by the query, returns true if it was not marked before
+    bool mark_word( uint32_t word )
+    {
+      if( mWordEpochs[word] == mEpoch )
+        return false;
+      mWordEpochs[word] = mEpoch;
+      return true;
+    }
+    
+  private:
+    
+    struct point_state
+    {
+      uint32_t used_epoch;
+      uint32_t corr_epoch;
+      uint32_t listed_epoch;
+      uint32_t feature;
+      int dist;
+      float ratio;
+      
+      point_state( ) : used_epoch( 0 ), corr_epoch( 0 ), listed_epoch( 0 ), feature( 0 ), dist( 0 ), ratio( 1.0f ) {}
+    };
+    
+    std::vector< point_state > mPoints;
+    std::vector< uint32_t > mWordEpochs;
+    std::vector< uint32_t > mCorrespondingPoints;
+    uint32_t mEpoch;
+    uint32_t mNbCorrespondences;
+};
+
+////
+// functions
+////
 
 // generic comparison function, using < to compare the second entry of two pairs
 template <typename first_type, typename second_type >
@@ -361,20 +576,17 @@ inline bool cmp_priorities( const match_struct &a, const match_struct &b )
 // check whether two sets have a common element or not
 // sets are assumed to be stored in ascending order
 // run time is in O( m + n ), where n and m are the sizes of the two sets
-bool set_intersection_test( const std::set< uint32_t > &a, const std::set< uint32_t > &b )
+bool set_intersection_test( const uint32_t *a, uint32_t size_a, const uint32_t *b, uint32_t size_b )
 {
-  std::set< uint32_t >::const_iterator it_a = a.begin();
-  std::set< uint32_t >::const_iterator it_b = b.begin();
+  const uint32_t *a_end = a + size_a;
+  const uint32_t *b_end = b + size_b;
   
-  std::set< uint32_t >::const_iterator it_a_end = a.end();
-  std::set< uint32_t >::const_iterator it_b_end = b.end();
-  
-  while( ( it_a != it_a_end ) && ( it_b != it_b_end ) )
+  while( ( a != a_end ) && ( b != b_end ) )
   {
-    if( *it_a < *it_b )
-      ++it_a;
-    else if( *it_b < *it_a )
-      ++it_b;
+    if( *a < *b )
+      ++a;
+    else if( *b < *a )
+      ++b;
     else // equal, that is the set has a common element
       return true;
   }
@@ -401,6 +613,9 @@ float min_inlier = 0.2f;
 // stop RANSAC if 60 seconds have passed
 double ransac_max_time = 60.0; 
 
+// the parameters of RANSAC, set once in main() and only read afterwards
+ransac_config ransac_parameters;
+
 // the number of nearest neighbors to search for in 3D
 int N_3D = 200;
 
@@ -419,1701 +634,1694 @@ bool filter_points = false;
 // The number of correspondences to find before the search is terminated
 size_t max_cor_early_term = 100;
 
+// the strategy to combine 2D-to-3D and 3D-to-2D matching (see usage)
+int prioritization_strategy = 0;
+
+// the latency budget of a single query in seconds, not limited if 0
+double query_latency_budget = 0.0;
+
+////
+// the model shared by all query images, it is not modified while the query images are localized
+////
+
+// the visual words and their search tree
+visual_words_handler vw_handler;
+
+// the visual words handler uses internal buffers, so only one thread at a time can assign visual words
+std::mutex vw_handler_mutex;
+
+// for every visual word at the finest level the id of its parents at levels 2 and 3
+uint32_t *parents_at_level_2 = 0;
+uint32_t *parents_at_level_3 = 0;
+
+// the 3D points, their descriptors and the assignments of (point id, descriptor id) pairs to visual words
+localization_database loc_db;
+
+// the 3D points in double precision, as required by the kd-trees
+ANNcoord** points3D = 0;
+
+// the connected component of every 3D point and the images observing it
+scene_graph visibility_graph;
+
+// for every connected component the number of its points, the ids of its points and its kd-tree
+std::vector< uint32_t > nb_points_per_component;
+std::vector< uint32_t* > indices_per_component;
+std::vector< ANNkd_tree* > kd_trees;
+
+// the precomputed neighborhoods of the 3D points, used instead of the kd-trees if they are loaded
+point_neighborhoods neighborhoods;
+bool use_precomputed_neighborhoods = false;
+
+// ANN stores the state of a search in global variables, so only one thread at a time can search the kd-trees
+std::mutex ann_mutex;
+
+// the results of localizing a single query image
+struct query_result
+{
+  uint32_t nb_features;
+  uint32_t nb_inlier;
+  uint32_t nb_corr;
+  double vw_time;
+  double corr_time;
+  double RANSAC_time;
+  double total_time;
+  
+  // true if the latency budget (or the time limit of RANSAC) stopped the localization early
+  bool deadline_reached;
+  
+  // the estimated pose: the projection matrix (with computed center) and its decomposition
+  Util::Math::ProjMatrix proj_matrix;
+  Util::Math::Matrix3x3 calibration;
+  Util::Math::Matrix3x3 rotation;
+  
+  // the output generated while localizing the image, used when several threads localize images in parallel
+  std::ostringstream log;
+};
+
 //---------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-int main (int argc, char **argv)
+////
+// Finds the candidates for 3D-to-2D matching around a 3D point, i.e., its (at most) max_neighbors <= N_3D nearest
+// neighbors in its connected component, sorted by their distance to the point. They are either taken from the
+// precomputed neighborhoods or found using the kd-tree of the component. In the latter case they are
+// stored in buffer, which has to provide space for N_3D entries (as do indices and distances).
+// Returns the number of neighbors, neighbors is set to the first of them.
+////
+
+uint32_t find_3D_neighbors( uint32_t point, uint32_t max_neighbors, ANNidxArray indices, ANNdistArray distances, uint32_t *buffer, const uint32_t* &neighbors )
 {
-  
-  if( argc < 12 )
+  if( use_precomputed_neighborhoods )
   {
-    std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -        Localization method. Implementation of the localization framework proposed in the ECCV 2011 paper               - " << std::endl;
-    std::cout << " -          T. Sattler, B. Leibe, L. Kobbelt. Improving Image-Based Localization by Active Correspondence Search.         - " << std::endl;
-    std::cout << " -                               2012 by Torsten Sattler (tsattler@cs.rwth-aachen.de)                                     - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " - usage: acg_localizer_active_search list bundle_file nb_cluster clusters descriptors prioritization_strategy results    - " << std::endl;
-    std::cout << " -                        N_3D ransac_pre_filter filter_points image_set_cover nb_cams_set_cover                          - " << std::endl;
-    std::cout << " - Parameters:                                                                                                            - " << std::endl;
-    std::cout << " -  list                                                                                                                  - " << std::endl;
-    std::cout << " -     List containing the filenames of all the .key files that should be used as query. It is assumed that the           - " << std::endl;
-    std::cout << " -     corresponding images have the same filename except of ending in .jpg.                                              - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  bundle_file                                                                                                           - " << std::endl;
-    std::cout << " -     The bundle.out file generated by Bundler.                                                                          - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  nb_cluster                                                                                                            - " << std::endl;
-    std::cout << " -     The number of clusters in the file containing the cluster centers. The number of cluster must be the same          - " << std::endl;
-    std::cout << " -     as for the assignments computed by compute_desc_assignments.                                                       - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  clusters                                                                                                              - " << std::endl;
-    std::cout << " -     The cluster centers (visual words), stored in a textfile consisting of nb_clusters * 128 floating point values.    - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  descriptors                                                                                                           - " << std::endl;
-    std::cout << " -     The assignments assigning descriptors (and 3D points) to visual words. It is assumed that all descriptors          - " << std::endl;
-    std::cout << " -     are stored as unsigned char values and that every visual word contains at most one descriptor for every 3D point,  - " << std::endl;
-    std::cout << " -     i.e., the integer mean strategy is used to represent 3D points.                                                    - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  prioritization_strategy                                                                                               - " << std::endl;
-    std::cout << " -     The strategy to combine 2D-to-3D and 3D-to-2D matching (see the paper for details):                                - " << std::endl;
-    std::cout << " -      0 - Combined                                                                                                      - " << std::endl;
-    std::cout << " -      1 - Direct                                                                                                        - " << std::endl;
-    std::cout << " -      2 - Afterwards                                                                                                    - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  results                                                                                                               - " << std::endl;
-    std::cout << " -     The program will write the results of the localization into a text file of name \"results\". It has the following  - " << std::endl;
-    std::cout << " -     format, where every line in the file belongs to one query image and has the format                                 - " << std::endl;
-    std::cout << " -       #inliers #(correspondences found) (time needed to compute the visual words, in seconds) (time needed for linear  - " << std::endl;
-    std::cout << " -       search, in seconds) (time needed for RANSAC, in seconds) (total time needed, in seconds)                         - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  N_3D                                                                                                                  - " << std::endl;
-    std::cout << " -     Specifies the number of nearest neighbors in 3D that are used as candidates for 3D-to-2D matching                  - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  ransac_pre_filter                                                                                                     - " << std::endl;
-    std::cout << " -     Set to 0 to use not filter, set to 1 to use the RANSAC Pre-Filter described in the paper.                          - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  filter_points                                                                                                         - " << std::endl;
-    std::cout << " -     Set to 1 to use the images in the reconstruction (or the set cover, see below) to filter the 3D points obtained    - " << std::endl;
-    std::cout << " -     by nn-search in 3D: A point is accepted if it is visible with the 3D point triggering the search in at least one   - " << std::endl;
-    std::cout << " -     image. Set to 0 to disable the filtering.                                                                          - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << " -  image_set_cover                                                                                                       - " << std::endl;
-    std::cout << " -     Set to 0 to use the original images from the reconstruction or to 1 to first compute a set cover that for every    - " << std::endl;
-    std::cout << " -     image computes the nearest K images (in 3D) and selects those cameras for which the viewing direction differs      - " << std::endl;
-    std::cout << " -     by less than 60° to the current camera to belong to the same set of cameras. Afterwards we compute a set cover     - " << std::endl;
-    std::cout << " -     for those sets. You can specify the value for K with the parameter nb_cams_set_cover (default: 10).                - " << std::endl;
-    std::cout << " -                                                                                                                        - " << std::endl;
-    std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
-    return 1;
+    neighbors = neighborhoods.get_neighbors_for_point( point );
+    
+    // unfiltered neighborhoods can contain more points than needed, filtered ones are computed for N_3D
+    uint32_t nb_neighbors = neighborhoods.get_nb_neighbors_for_point( point );
+    if( neighborhoods.is_filtered() && max_neighbors >= (uint32_t) N_3D )
+      return nb_neighbors;
+    return std::min( nb_neighbors, max_neighbors );
   }
   
- 
-  // rocketcluster
-  std::string keylist( argv[1] );
-  std::string bundle_file( argv[2] );
-  uint32_t nb_clusters = (uint32_t) atoi( argv[3] );
-  std::string cluster_file( argv[4] );
-  std::string vw_assignments( argv[5] );
-  int prioritization_strategy = atoi( argv[6] );
-  if( prioritization_strategy != 0 && prioritization_strategy != 1 && prioritization_strategy != 2 )
+  uint32_t cc_id = visibility_graph.get_component_ids()[ point ];
+  
+  // ANN will throw an exception if we search for more points than contained in the connected component, so 
+  // we have to adjust the number of points we search for
+  int N3D_ = std::min( (int) max_neighbors, (int) nb_points_per_component[ cc_id ] );
   {
-    std::cerr << " ERROR: Unknown prioritization strategy " << prioritization_strategy << ", aborting" << std::endl;
-    return -1;
+    std::lock_guard< std::mutex > lock( ann_mutex );
+    kd_trees[ cc_id ]->annkSearch( points3D[point], N3D_, indices, distances );
   }
-  std::string outfile(argv[7] );
   
-  std::cout << " Assumed minimal inlier-ratio: " << min_inlier << std::endl;
-  std::cout << " Early termination after finding " << max_cor_early_term << " correspondences " << std::endl;
+  uint32_t nb_neighbors = 0;
+  for( int kk=0; kk<N3D_; ++kk )
+  {
+    if( indices[kk] < 0 )
+      break;
     
+    buffer[ nb_neighbors ] = indices_per_component[ cc_id ][ indices[kk] ];
+    ++nb_neighbors;
+  }
   
-  N_3D = (uint32_t) atoi( argv[8] );
-  std::cout << " Query expansion includes the next " << N_3D << " features " << std::endl;
+  neighbors = buffer;
+  return nb_neighbors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+////
+// Localizes a single query image, given by its features, its size and its focal length in pixels
+// (not positive if unknown). The keypoints are given in the coordinate system of the image and are
+// centered around the center of the image. All stages stop at the deadline of the latency budget.
+// Once time runs short, the correspondence search needs fewer correspondences for early termination
+// and considers fewer 3D neighbors. All output is written to out, the results are stored in result.
+////
+
+void localize_features( std::vector< SIFT_keypoint > &keypoints, const SIFT_descriptor_view &descriptors, int img_width, int img_height, float focal_length, latency_budget &budget, std::ostream &out, query_result &result )
+{
+  // the results of the nearest neighbor search in 3D
+  ANNidxArray indices = new ANNidx[ N_3D ];
+  ANNdistArray distances = new ANNdist[ N_3D ];
+  uint32_t *neighbor_buffer = new uint32_t[ N_3D ];
+  const uint32_t *neighbors_3D = 0;
   
-  ransac_filter = atoi( argv[9] );
-  std::cout << " RANSAC prefilter: " << ransac_filter << std::endl;
+  // precomputed neighborhoods might already be filtered based on co-visibility
+  bool check_visibility = filter_points && !( use_precomputed_neighborhoods && neighborhoods.is_filtered() );
   
-  filter_points = (bool) atoi( argv[10] );
-  if( filter_points )
-    std::cout << " Filtering 3D points before 3D-to-2D matching " << std::endl;
-  else
-    std::cout << " NOT Filtering 3D points before 3D-to-2D matching " << std::endl;
+  uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
   
-  use_image_set_cover = (bool) atoi( argv[11] );
-
-  if( argc >= 13 )
-    consider_K_nearest_cams = (uint32_t) atoi( argv[12] );
+  // center the keypoints around the center of the image
+  for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
+  {
+    keypoints[j].x -= (img_width-1.0)/2.0f; 
+    keypoints[j].y = (img_height-1.0)/2.0f - keypoints[j].y; 
+  }
   
-  if( use_image_set_cover )
-    std::cout << " Using set covers instead of normal images with " << consider_K_nearest_cams << " nearest cams" << std::endl;
-  else
-    std::cout << " Using the original images " << std::endl;
+  // assign the descriptors to the visual words   
   
-  ////
-  // load the visual words and their tree 
-  visual_words_handler vw_handler;
-  vw_handler.set_nb_trees( 1 );
-  vw_handler.set_nb_visual_words( nb_clusters );
-  vw_handler.set_branching( 10 );
+  Timer timer;
+  timer.Init();
+  timer.Start();
   
-  // store for every visual word at the finest level the id of its parents at levels 2 and 3
-  uint32_t *parents_at_level_2 = new uint32_t[ nb_clusters ];
-  uint32_t *parents_at_level_3 = new uint32_t[ nb_clusters ];
+ 
+  std::vector< uint32_t > computed_visual_words( nb_loaded_keypoints, 0 );
+  
+  // per-query state of the 3D points and visual words, reused by all queries of this thread
+  static thread_local query_context context;
+  context.start_query( loc_db.get_nb_points(), loc_db.get_nb_visual_words() );
   
-  for( uint32_t i=0; i<nb_clusters; ++i )
   {
-    parents_at_level_2[i] = parents_at_level_3[i] = nb_clusters;
+    std::lock_guard< std::mutex > lock( vw_handler_mutex );
+    // the query might have waited for the lock so long that there is no time left to search
+    if( budget.search_time_left() )
+    {
+      vw_handler.set_nb_paths( 1 );
+      vw_handler.assign_visual_words_uchar( descriptors.data, nb_loaded_keypoints, computed_visual_words );
+    }
   }
   
-  vw_handler.set_method(std::string("flann"));
-  vw_handler.set_flann_type(std::string("hkmeans"));
-    
-  if( !vw_handler.create_flann_search_index( cluster_file ) )
+  timer.Stop();
+  
+  uint32_t nb_unique_vw = 0;
+  for( size_t j=0; j<nb_loaded_keypoints; ++j )
   {
-    std::cout << " ERROR: Could not load the cluster centers from " << cluster_file << std::endl;;
-    return -1;
-  }
-    
-  {
-    // get the ids of the parents that we need
-    int *parent_ids = new int[nb_clusters];
-    for( uint32_t i=0; i<nb_clusters; ++i )
-      parent_ids[i] = -1;
-    
-    vw_handler.get_parents_at_level_L( 2, parent_ids );
-    
-    // copy that to the real data structures
-    uint32_t counter = 0;
-    for( uint32_t i=0; i<nb_clusters; ++i )
-    {
-      if( parent_ids[i] == -1 )
-      {
-        std::cout << " uhoh, this should not happen!" << std::endl;
-        ++counter;
-      }
-      else
-      {
-        parents_at_level_2[i] = (uint32_t) parent_ids[i];
-        if( parents_at_level_2[i] < 0 || parents_at_level_2[i] >= 100 )
-          std::cout << " WARNING: OUT OF RANGE: " << parents_at_level_2[i] << " from " << parent_ids[i] << std::endl;
-      }
-    }
-    if( counter == nb_clusters )
-    {
-      std::cerr << " Some ERROR in getting the parents from level 2, stopping here " << std::endl;
-      return -1;
-    }
-    
-    for( uint32_t i=0; i<nb_clusters; ++i )
-      parent_ids[i] = -1;
-    
-    vw_handler.get_parents_at_level_L( 3, parent_ids );
-    
-    // copy that
-    counter = 0;
-    for( uint32_t i=0; i<nb_clusters; ++i )
-    {
-      if( parent_ids[i] == -1 )
-      {
-        std::cout << " uhoh, this should not happen!" << std::endl;
-        ++counter;
-      }
-      else
-      {
-        parents_at_level_3[i] = (uint32_t) parent_ids[i];
-        if( parents_at_level_3[i] < 0 || parents_at_level_3[i] >= 1000 )
-          std::cout << " WARNING: OUT OF RANGE: " << parents_at_level_3[i] << " from " << parent_ids[i] << std::endl;
-      }
-    }
-    if( counter == nb_clusters )
-    {
-      std::cerr << " Some ERROR in getting the parents from level 3, stopping here " << std::endl;
-      return -1;
-    }
+    if( context.mark_word( computed_visual_words[j] ) )
+      ++nb_unique_vw;
   }
- 
-  std::cout << "  done " << std::endl;
-    
   
-  ////
-  // load the assignments of the 3D points to the visual words
+  out << " assigned visual words in " << timer.GetElapsedTimeAsString() << " to " << nb_unique_vw << " unique vw" << std::endl;
+  result.nb_features = nb_loaded_keypoints;
+  result.vw_time = timer.GetElapsedTime();
   
-  std::cout << "* Loading and parsing the assignments ... " << std::endl;
+      
+  ////
+  // establish 2D-3D correspondences by using the vw to compute pairwise nearest neighbors
+  timer.Init();
+  timer.Start();
+  Timer all_timer;
+  all_timer.Init();
+  all_timer.Start();   
+  
+  // first, compute for every feature in the image its visual word in the coarser vocabulary
+  // compute the lower dimensions
+  int low_dim_choosen = 0;
+  int nb_low_dim = 100;
+  
+  if( nb_loaded_keypoints > 5000 )
+  {
+    low_dim_choosen = 1;
+    nb_low_dim = 1000;
+  }
   
-  ANNcoord** points3D = 0;
+  // for every visual word on level 2 or 3 (so at max 1000 visual words)
+  // store the ids of the 2D features that are mapped to that visual word
+  std::vector< std::vector< uint32_t > > features_per_vw( nb_low_dim );
   
-  // store for every visual word a list of (point id, descriptor id) pairs
-  std::vector< std::vector< std::pair< uint32_t, uint32_t > > > vw_points_descriptors(nb_clusters);
   
-  // store all descriptors in a single vector
-  std::vector< unsigned char > all_descriptors;
+    
+  if( low_dim_choosen == 0 )
+  {
+    for( size_t j=0; j<nb_loaded_keypoints; ++j )
+      features_per_vw[ parents_at_level_2[ computed_visual_words[j] ] ].push_back( j );
+  }
+  else
+  {
+    for( size_t j=0; j<nb_loaded_keypoints; ++j )
+      features_per_vw[ parents_at_level_3[ computed_visual_words[j] ] ].push_back( j );
+  }
+    
+ 
+  // store the correspondences for RANSAC, the SIFT ratios are used to guide its sampling
+  std::vector< float > c2D, c3D, corr_ratios;
+  c2D.clear();
+  c3D.clear();
+  corr_ratios.clear();
   
-  // for visual word, remember the number of points assigned to it
-  std::vector< uint32_t > nb_points_per_vw(nb_clusters,0);
+  std::vector< std::pair< uint32_t, uint32_t > > final_correspondences; // first the 2D, then the 3D point
+  final_correspondences.clear();
   
+  uint32_t max_corr = 0;
+  uint32_t no_nn = 0;
+  uint32_t no_sn_neighbor = 0;
+  uint32_t failed_ratio = 0;
   
-  uint32_t nb_non_empty_vw, nb_3D_points, nb_descriptors;
   
-  // for every point, store its descriptor ids and the ids of the visual words this descriptors belong to
-  std::vector< std::vector< uint32_t > > desc_per_point;
-  std::vector< std::vector< uint32_t > > vws_per_point;
+  // compute the priorities, the features are handled in ascending order of their matching cost
   
-  for( uint32_t i=0; i<nb_clusters; ++i )
-    vw_points_descriptors[i].clear();
+  match_scheduler priorities;
+  priorities.reserve( nb_loaded_keypoints );
   
-  {
-    std::ifstream ifs( vw_assignments.c_str(), std::ios::in | std::ios::binary  );
-    
-    if ( !ifs )
-    {
-      std::cerr << " ERROR: Cannot read the visual word assignments " << vw_assignments << std::endl;;
-      return 1;
-    }
-    
-    uint32_t nb_clusts;
-    ifs.read(( char* ) &nb_3D_points, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_clusts, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_non_empty_vw, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_descriptors, sizeof( uint32_t ) );
-    if( nb_clusts != nb_clusters )
-    {
-      std::cerr << " WARNING: Number of clusters differs! " << nb_clusts << " " << nb_clusters << std::endl;
-    }
-    
-    std::cout << "  Number of non-empty clusters: " << nb_non_empty_vw << " number of points : " << nb_3D_points << " number of descriptors: " << nb_descriptors << std::endl;
-    
-    // read the 3D points and their visibility polygons
-    points3D = new ANNcoord*[nb_3D_points];
-    all_descriptors.resize(128*nb_descriptors);
-    
-    
-    // load the points
-    float *point_data = new float[3];
-    for( uint32_t i=0; i<nb_3D_points; ++i )
-    {
-      points3D[i] = new ANNcoord[3];
-      ifs.read(( char* ) point_data, 3 * sizeof( float ) );
-      for( int j=0; j<3; ++j )
-        points3D[i][j] = (ANNcoord) point_data[j];
-    }
-    delete [] point_data;
-     
-    desc_per_point.resize( nb_3D_points );
-    vws_per_point.resize( nb_3D_points );
-    for( uint32_t i=0; i<nb_3D_points; ++i )
-    {
-      desc_per_point[i].clear();
-      vws_per_point[i].clear();
-    }
-    
-    // load the descriptors
-    int tmp_int;
-    for( uint32_t i=0; i<nb_descriptors; ++i )
-    {
-      for( uint32_t j=0; j<128; ++j )
-        ifs.read(( char* ) &all_descriptors[128*i+j], sizeof( unsigned char ) );
-    }
-    
-    // now we load the assignments of the pairs (point_id, descriptor_id) to the visual words
-    for( uint32_t i=0; i<nb_non_empty_vw; ++i )
-    {
-      uint32_t id, nb_pairs;
-      ifs.read(( char* ) &id, sizeof( uint32_t ) );
-      ifs.read(( char* ) &nb_pairs, sizeof( uint32_t ) );
-      vw_points_descriptors[id].resize( nb_pairs );
-      nb_points_per_vw[id] = nb_pairs;
-      for( uint32_t j=0; j<nb_pairs; ++j )
-      {
-        ifs.read(( char* ) &vw_points_descriptors[id][j].first, sizeof( uint32_t ) );
-        ifs.read(( char* ) &vw_points_descriptors[id][j].second, sizeof( uint32_t ) );
-        
-        // for every 3D point, remember the indices of its descriptors
-        desc_per_point[ vw_points_descriptors[id][j].first ].push_back( vw_points_descriptors[id][j].second );
-        vws_per_point[ vw_points_descriptors[id][j].first ].push_back( id );
-      }
-    }
-    
-    ifs.close();
-    
-    
-    
-    std::cout << "  done loading and parsing the assignments " << std::endl;
-  }
+  for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
+    priorities.push( match_struct( j, loc_db.get_nb_entries_for_vw( computed_visual_words[j] ), true ) );
   
-  ////
-  // load information about the 3D points: 
-  // the connected component it belongs to and the ids of the images it is observed in
-  // we obtain all these information by parsing a Bundler file
-   
-  // for every 3D point, store the id of its connected component and the ids of the images that see the point 
-  std::vector< uint32_t > connected_component_id_per_point( nb_3D_points, 0 );
-  std::vector< std::set< uint32_t > > images_per_point( nb_3D_points );
+  // keep track which 2D features are used for correspondences
+  std::vector< bool > feature_in_correspondence( nb_loaded_keypoints, false );
   
-  for( uint32_t i=0; i<nb_3D_points; ++i )
-    images_per_point[i].clear();
+  // keep track which 2D features are used for 3D-to-2D correspondences and 
+  // to which point they match. This is needed to be able to override 3D-to-2D
+  // correspondences with new 3D-to-2D correspondences.
+  // To signal that a feature is not part of a 3D-to-2D correspondence, we use
+  // UINT32_MAX
+  std::vector< uint32_t > point_per_feature( nb_loaded_keypoints, UINT32_MAX );
   
-  {
-    // parse the reconstruction
-    parse_bundler parser;
-    if( !parser.parse_data( bundle_file.c_str(), 0 ) )
-    {
-      std::cerr << " ERROR: Could not parse the bundler file " << bundle_file << std::endl;
-      return -1;
-    }
-    uint32_t nb_cameras = parser.get_number_of_cameras();
-    uint32_t nb_points_bundler = parser.get_number_of_points();
-    std::vector< feature_3D_info >& feature_infos = parser.get_feature_infos();
-    
-    if( nb_points_bundler != nb_3D_points )
-    {
-      std::cerr << " ERROR: The number of points in the binary file ( " << nb_3D_points << " ) and in the reconstruction ( " << nb_points_bundler << " ) differ!" << std::endl;
-      return -1;
-    }
-    
-    // compute the connected components
-    std::cout << "  Computing connected components " << std::endl;
-    // for every camera, get the corresponding keypoint ids
-    std::vector< std::vector< uint32_t > > cam_keys( nb_cameras );
-    for( uint32_t i=0; i<nb_cameras; ++i )
-      cam_keys[i].clear();
+  // the context keeps track which 3D points have been used in the query expansion and
+  // stores for each 3D point the corresponding 2D feature as well as the squared distance
 
+  // compute nearest neighbors using 2D-to-3D and 3D-to-2D matching
 
-    for( uint32_t i=0; i<nb_points_bundler; ++i )
-    {
-      for( size_t j=0; j<feature_infos[i].view_list.size(); ++j )
-        cam_keys[ feature_infos[i].view_list[j].camera ].push_back( i );
-    }
-      
-    std::vector< int > cam_ccs( nb_cameras, -1 );
-    std::vector< int > point_ccs( nb_points_bundler, -1 );
-    int nb_ccs = 0;
-    
-    std::queue< uint32_t > remaining_points;
-    
-    for( uint32_t i=0; i<nb_points_bundler; ++i )
-      remaining_points.push(i);
-      
-    while( !remaining_points.empty() )
+  uint32_t nb_considered_points = 0;
+  uint32_t nb_considered_points_counter = 0;
+  if( prioritization_strategy == 0 || prioritization_strategy == 1 )
+  {
+    while( !priorities.empty() )
     {
-      uint32_t cur_point = remaining_points.front();
-      
-      remaining_points.pop();
-      
-      if( point_ccs[ cur_point] != -1 )
-        continue;
+      if( !budget.search_time_left() )
+      {
+        nb_considered_points = nb_considered_points_counter;
+        break;
+      }
       
-      std::queue< uint32_t > recursive_points;
+      match_struct current_match = priorities.pop();
+//         out << current_match.feature_id << " " << current_match.matching_type << " " << current_match.matching_cost << std::endl;
+      // check the matching type, and handle the different matching directions accordingly
+      if( current_match.matching_type )
+      {
         
-      // create a new connected component
-      point_ccs[cur_point] = nb_ccs;
-      ++nb_ccs;
+        ////
+        // 2D-to-3D matching, similar to the ICCV 2011 paper
       
-      for( size_t j=0; j<feature_infos[cur_point].view_list.size(); ++j )
-      {
-        uint32_t cam_id = feature_infos[cur_point].view_list[j].camera;
-        if( cam_ccs[cam_id] != -1 && cam_ccs[cam_id] != point_ccs[cur_point] )
-          std::cout << " ERROR: ambigous ids for camera! " <<std::endl;
+        uint32_t j_index = current_match.feature_id;
+        
+        if( feature_in_correspondence[ j_index ] )
+          continue;
+        
+        uint32_t assignment = uint32_t( computed_visual_words[j_index] );
+        
+        ++nb_considered_points_counter;
+        
+        nearest_neighbors nn;
         
-        if( cam_ccs[ cam_id ] == -1 )
+        if( current_match.matching_cost > 0 )
         {
-          cam_ccs[ cam_id ] = point_ccs[ cur_point ];
-          for( size_t k=0; k<cam_keys[ cam_id ].size(); ++k )
+          // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
+          size_t nb_poss_assignments = loc_db.get_nb_entries_for_vw( assignment );
+          const vw_entry *vw_entries = loc_db.get_entries_for_vw( assignment );
+          const unsigned char *vw_descriptors = loc_db.get_descriptors_for_vw_uchar( assignment );
+          
+          for( size_t k=0; k<nb_poss_assignments; ++k )
           {
-            if( point_ccs[ cam_keys[ cam_id ][k] ] != -1 && point_ccs[ cam_keys[ cam_id ][k] ] != point_ccs[ cur_point ] )
-          std::cout << " ERROR: ambigous ids for point " <<std::endl;
+            uint32_t point_id = vw_entries[k].point_id;
             
-            if( point_ccs[ cam_keys[ cam_id ][k] ] == -1 )
-          recursive_points.push( cam_keys[ cam_id ][k] );
+            int dist = compute_squared_SIFT_dist( descriptors[j_index], vw_descriptors + 128 * k );
+            
+            nn.update( point_id, dist );
           }
         }
-      }
       
-      while( !recursive_points.empty() )
-      {
-        uint32_t c = recursive_points.front();
-        recursive_points.pop();
-        
-        if( point_ccs[c] != -1 && point_ccs[c] != point_ccs[ cur_point ] )
-          std::cout << " ERROR: ambigous ids for point " <<std::endl;
-        
-        if( point_ccs[c] == -1 )
+        // check if we have found a correspondence
+        if( nn.dist1 >= 0 )
         {
-          // create a new connected component
-          point_ccs[c] = point_ccs[cur_point];
-          
-          for( size_t j=0; j<feature_infos[c].view_list.size(); ++j )
+          if( nn.dist2 >= 0 )
           {
-            uint32_t cam_id = feature_infos[c].view_list[j].camera;
-            if( cam_ccs[cam_id] != -1 && cam_ccs[cam_id] != point_ccs[cur_point] )
-              std::cout << " ERROR: ambigous ids for camera! " <<std::endl;
-            
-            if( cam_ccs[ cam_id ] == -1 )
+            if( nn.get_ratio() < nn_ratio_2D_to_3D )
             {
-              cam_ccs[ cam_id ] = point_ccs[ cur_point ];
-              for( size_t k=0; k<cam_keys[ cam_id ].size(); ++k )
+              // we found one, so we need check for mutual nearest neighbors
+                          
+              if( context.has_correspondence( nn.nn_idx1 ) )
+              {
+                // a correspondence to the same 3D point already exists
+                // so we have to check whether we have to update it or not
+                if( context.get_distance( nn.nn_idx1 ) > nn.dist1 )
+                {
+                  feature_in_correspondence[ context.get_feature( nn.nn_idx1 ) ] = false;
+                  
+                  context.set_correspondence( nn.nn_idx1, j_index, nn.dist1, nn.get_ratio() );
+                  
+                  feature_in_correspondence[j_index ] = true;
+                }
+              }
+              else
               {
-                if( point_ccs[ cam_keys[ cam_id ][k] ] != -1 && point_ccs[ cam_keys[ cam_id ][k] ] != point_ccs[ cur_point ] )
-                  std::cout << " ERROR: ambigous ids for point " <<std::endl;
+                context.set_correspondence( nn.nn_idx1, j_index, nn.dist1, nn.get_ratio() );
+                feature_in_correspondence[ j_index ] = true;
+                context.mark_used( nn.nn_idx1 );
+                
+                // avoid query expansion if we are not going to use it anyways
+                if( context.get_nb_correspondences() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
+                {
+                  nb_considered_points = nb_considered_points_counter;
+                  break;
+                }
+                
+                //// START ACTIVE SEARCH
+                // we only have to do the nn query in 3D space if we have 
+                // found a new correspondence, not updated an old one (should be happening seldomly anyways)
                 
-                if( point_ccs[ cam_keys[ cam_id ][k] ] == -1 )
-                  recursive_points.push( cam_keys[ cam_id ][k] );
+                // find the nearest neighbors in 3D
+                uint32_t nb_neighbors_3D = find_3D_neighbors( nn.nn_idx1, (uint32_t) budget.scale_search_effort( (size_t) N_3D, 1 ), indices, distances, neighbor_buffer, neighbors_3D );
+                
+                ////
+                // find new matching possibilities and insert them into the correct position 
+                // in the list
+                std::vector< match_struct > new_matching_possibilities;
+                new_matching_possibilities.clear();
+                
+
+                for( uint32_t kk=0; kk<nb_neighbors_3D; ++kk )
+                {
+                  uint32_t candidate_point = neighbors_3D[kk];
+                  
+                  // check if we have already used or visited this 3D point (or promise to visit it later on
+                  if( !context.is_used( candidate_point ) )
+                  {
+                    // visibility filter
+                    if( check_visibility && ( !set_intersection_test( visibility_graph.get_images_for_point( candidate_point ), visibility_graph.get_nb_images_for_point( candidate_point ), visibility_graph.get_images_for_point( nn.nn_idx1 ), visibility_graph.get_nb_images_for_point( nn.nn_idx1 ) ) ) )
+                      continue;
+                    
+                    // promise that we will (eventually) look at this 3D point
+                    context.mark_used( candidate_point );
+                                          
+                    ////
+                    // compute the matching cost of this particular 3D point
+                    // therefore, we have to identify to which visual words (on a higher level)
+                    // the descriptors of this point are assigned how many times
+                    
+                    match_struct new_match( candidate_point, 0, false );
+                    
+                    if( low_dim_choosen == 0 )
+                    {
+                      for(const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws)
+                        new_match.matching_cost += features_per_vw[ parents_at_level_2[ it_vws->vw_id ] ].size();
+                    }
+                    else
+                    {
+                      for(const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws)
+                        new_match.matching_cost += features_per_vw[ parents_at_level_3[ it_vws->vw_id ] ].size();
+                    }
+                    
+                    // push back the new matching possibilities
+                    new_matching_possibilities.push_back( new_match );
+                  }
+                }
+                
+                ////
+                // insert the list of new matching possibilities into our prioritization search structure
+                
+                // depending on the prioritization_strategy we either handle all new matching possibilities directly after the 
+                // current entry (prioritization_strategy == 1), sorted by their costs, or insert them in a sorted fashion 
+                // (prioritization_strategy == 0)
+                
+                if( prioritization_strategy == 0 )
+                {
+                  for( std::vector< match_struct >::const_iterator to_insert_it = new_matching_possibilities.begin(); to_insert_it != new_matching_possibilities.end(); ++to_insert_it )
+                    priorities.push( *to_insert_it );
+                }
+                else
+                {
+                  std::stable_sort( new_matching_possibilities.begin(), new_matching_possibilities.end(), cmp_priorities );
+                  
+                  for( std::vector< match_struct >::const_iterator to_insert_it = new_matching_possibilities.begin(); to_insert_it != new_matching_possibilities.end(); ++to_insert_it )
+                    priorities.push_next( *to_insert_it );
+                }
+                
+                new_matching_possibilities.clear();
+                
+                //// STOP ACTIVE SEARCH
               }
             }
           }
         }
       }
-    }
-    std::cout << "   Found " << nb_ccs << " connected components " << std::endl;
-      
-    // check if all non-empty images and all points belong to a connected component
-    for( uint32_t i=0; i<nb_points_bundler; ++i )
-    {
-      if( point_ccs[i] == -1 || point_ccs[i] >= nb_ccs )
-      {
-        std::cout << " ERROR : Point " << i << " has connected component id " << point_ccs[i] << std::endl;
-        return -1;
-      }
-    }
-      
-    for( uint32_t i=0; i<nb_cameras; ++i )
-    {
-      if( (cam_ccs[i] == -1 || cam_ccs[i] >= nb_ccs) && (cam_keys[i].size() > 0 ) )
-      {
-        std::cout << " ERROR : Non-empty camera " << i << " has connected component id " << cam_ccs[i] << std::endl;
-        return -1;
-      }
-      
-      // check if any of the points visible in this camera has a different conncected component id
-      for( size_t k=0; k<cam_keys[ i ].size(); ++k )
-      {
-        if( point_ccs[ cam_keys[i][k] ] != cam_ccs[i] )
-        {
-          std::cerr << " ERROR : Found point " << cam_keys[i][k] << " in camera " << i << " that belongs to component " << point_ccs[ cam_keys[i][k] ] << " while the camera belongs to component " << cam_ccs[i] << std::endl;
-          return -1;
-        }
-      }
-      
-      if( use_image_set_cover )
-        std::sort( cam_keys[i].begin(), cam_keys[i].end() );
       else
-        cam_keys[i].clear();
-    }
-      
-    ////
-    // if we want to represent the set of images with a smaller set, we now compute it
-    
-    // recall for every image by which other images it is covered
-    std::vector< std::set< uint32_t > > image_covered_by;
-    image_covered_by.clear();
-    std::vector< std::set< uint32_t > > images_covered_by_image;
-    images_covered_by_image.clear(); 
-    
-    if( use_image_set_cover )
-    {
-      image_covered_by.resize( nb_cameras );
-      
-      images_covered_by_image.resize( nb_cameras );
-      
-      std::cout << "  Computing the set cover for all images, each image covers itself and (at most) the " << consider_K_nearest_cams << " images that have the largest number of 3D points in common with it " << std::endl;
-      
-      for( uint32_t i=0; i<nb_cameras; ++i )
-      {
-        images_covered_by_image[i].clear();
-        images_covered_by_image[i].insert(i);
-      }
-      
-      ////
-      // now add cameras that are close in 3D and have a similar viewing direction (angle between directions beneath 60°)
-      std::vector< OpenMesh::Vec3f > camera_positions( nb_cameras );
-      std::vector< OpenMesh::Vec3f > cam_viewing_dirs( nb_cameras );
-      
-      std::vector< bundler_camera > &bundle_cams = parser.get_cameras();
-      
-      for( uint32_t i=0; i<nb_cameras; ++i )
       {
-        camera_positions[i] = bundle_cams[i].get_cam_position_f();
-        cam_viewing_dirs[i] = bundle_cams[i].get_cam_global_vec_f( OpenMesh::Vec3d( 0.0, 0.0, -1.0 ) );
-      }
-      
-      for( uint32_t i=0; i<nb_cameras; ++i )
-      {
-        std::vector< std::pair< uint32_t, float > > cameras_distances( nb_cameras );
+        ////
+        // 3D-to-2D correspondence, handle it accordingly
+        uint32_t candidate_point = current_match.feature_id;
         
-        for( uint32_t j=0; j<nb_cameras; ++j )
+        // check if we have already found a correspondence for that 3D point
+        // if so, we don't need to find a new one since it was found during
+        // 2D-to-3D matching which we trust more
+        if( context.has_correspondence( candidate_point ) )
+          continue;
+          
+        
+        uint32_t nb_desc_for_point = loc_db.get_nb_entries_for_point( candidate_point );
+        std::vector< uint32_t > low_dim_vw_ids( nb_desc_for_point );
+        
+            
+        // map all descriptors of that point to the lower dimensional descriptors
+        std::vector< uint32_t > low_dim_vw;
+        low_dim_vw.reserve( nb_desc_for_point );
+        
+        uint32_t counter = 0;
+        if( low_dim_choosen == 0 )
+        {
+          for( const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws, ++counter )
+          {
+            low_dim_vw_ids[counter] = parents_at_level_2[ it_vws->vw_id ];
+            low_dim_vw.push_back( parents_at_level_2[ it_vws->vw_id ] );
+          }
+        }
+        else
         {
-          cameras_distances[j].first = j;
-          cameras_distances[j].second = ( camera_positions[i] - camera_positions[j] ).length();
+          for( const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws, ++counter )
+          {
+            low_dim_vw_ids[counter] = parents_at_level_3[ it_vws->vw_id ];
+            low_dim_vw.push_back( parents_at_level_3[ it_vws->vw_id ] );
+          }
         }
         
-        std::sort( cameras_distances.begin(), cameras_distances.end(), cmp_second_entry_less< uint32_t, float > );
+        // every lower dimensional visual word is handled once, in ascending order
+        std::sort( low_dim_vw.begin(), low_dim_vw.end() );
+        low_dim_vw.erase( std::unique( low_dim_vw.begin(), low_dim_vw.end() ), low_dim_vw.end() );
+
         
-        // now pick the 10 nearest cameras looking in a similar direction out of the nearest 20
-        // cameras from the same connected component
-        uint32_t counter = 0;
-        uint32_t found = 0;
-        for( uint32_t j=0; j<nb_cameras && counter<consider_K_nearest_cams /*&& found<5*/; ++j )
+        // try to find a new correspondence
+        nearest_neighbors_multiple nn_exp;
+        for( std::vector< uint32_t >::const_iterator activated_vw = low_dim_vw.begin(); activated_vw != low_dim_vw.end(); ++activated_vw )
         {
-          // take care that the camera we are looking at is not camera i but is in the 
-          // same connected component!
-          if( cameras_distances[j].first == i || cam_ccs[i] != cam_ccs[ cameras_distances[j].first ] )
-            continue;
-          
-          // remember we only want to look at the 20 nearest cameras and pick at most 10 from them
-          ++counter;
-          
-          if( ( cam_viewing_dirs[i] | cam_viewing_dirs[ cameras_distances[j].first ] ) >= 0.5f )
+          counter = 0;
+          for( const point_entry *it_desc = loc_db.get_entries_for_point( candidate_point ); it_desc != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_desc, ++counter )
           {
-            images_covered_by_image[i].insert( cameras_distances[j].first );
-            ++found;
+            if( low_dim_vw_ids[counter] != *activated_vw )
+              continue;
+            
+            const unsigned char *point_descriptor = loc_db.get_descriptor_uchar( it_desc->desc_id );
+            
+            for( std::vector< uint32_t >::const_iterator feature_it = features_per_vw[ *activated_vw ].begin(); feature_it != features_per_vw[ * activated_vw ].end(); ++feature_it )
+            {
+              int dist = compute_squared_SIFT_dist( descriptors[*feature_it], point_descriptor );
+              
+              nn_exp.update( *feature_it, dist );
+            }
           }
         }
         
+        if( nn_exp.dist1 >= 0 )
+        {
+          if( nn_exp.dist2 >= 0 )
+          {
+            if( nn_exp.get_ratio() < nn_ratio_3D_to_2D )
+            {
+              // we don't want to overwrite 2D-to-3D correspondence, only 3D-to-2D correspondence 
+              if( !feature_in_correspondence[ nn_exp.nn_idx1 ] )
+              {
+                // no existing correspondence
+                context.set_correspondence( candidate_point, nn_exp.nn_idx1, nn_exp.dist1, nn_exp.get_ratio() );
+                feature_in_correspondence[ nn_exp.nn_idx1 ] = true;
+                point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
+              }
+              else if( point_per_feature[ nn_exp.nn_idx1 ] != UINT32_MAX )
+              {
+                // only 3D-to-2D correspondence
+                // overwrite if the absolute SIFT distance is smaller 
+                
+                // first, we have to get the corresponding 3D point
+                uint32_t old_point = point_per_feature[ nn_exp.nn_idx1 ];
+                
+                // this has to exist, otherwise we would not have labeled it as having a correspondence
+                if( context.get_distance( old_point ) > nn_exp.dist1 )
+                {
+                  // update the correspondence
+                  
+                  // which means we first have to remove the old one
+                  context.remove_correspondence( old_point );
+                  
+                  point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
+                  
+                  context.set_correspondence( candidate_point, nn_exp.nn_idx1, nn_exp.dist1, nn_exp.get_ratio() );
+                }
+              }
+            }
+          }
+        }
+      }
+      
+//         out << " "  << context.get_nb_correspondences() << std::endl;
+      
+      if( context.get_nb_correspondences() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
+      {
+        nb_considered_points = nb_considered_points_counter;
+        break;
+      }
+    }
+  }
+  else if( prioritization_strategy == 2 )
+  {
+    ////
+    // first perform 2D-to-3D matching, then 3D-to-2D matching until enough correspondences are found
+    while( !priorities.empty() )
+    {
+      if( !budget.search_time_left() )
+      {
+        nb_considered_points = nb_considered_points_counter;
+        break;
       }
       
-      camera_positions.clear();
-      cam_viewing_dirs.clear();
+      match_struct current_match = priorities.pop();
       
       ////
-      // now we compute the set cover
+      // 2D-to-3D matching, similar to ICCV 2011 version
+        
+      uint32_t j_index = current_match.feature_id;
+      
+      // testing whether a correspondence is already part of a correspondence
+      // is not necessary for pure 2D-to-3D matching, but we will later need
+      // the information for 3D-to-2D matching
       
-      // for every image, track how many new images it can cover
-      std::vector< std::pair< uint32_t, uint32_t > > nb_new_images_covered( nb_cameras );
+      uint32_t assignment = uint32_t( computed_visual_words[j_index] );
       
-      for( uint32_t i=0; i<nb_cameras; ++i )
+      ++nb_considered_points_counter;
+      
+      nearest_neighbors nn;
+
+
+      if( current_match.matching_cost > 0 )
+      {
+        // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
+        size_t nb_poss_assignments = loc_db.get_nb_entries_for_vw( assignment );
+        const vw_entry *vw_entries = loc_db.get_entries_for_vw( assignment );
+        const unsigned char *vw_descriptors = loc_db.get_descriptors_for_vw_uchar( assignment );
+        
+        for( size_t k=0; k<nb_poss_assignments; ++k )
+        {
+          uint32_t point_id = vw_entries[k].point_id;
+          
+          int dist = compute_squared_SIFT_dist( descriptors[j_index], vw_descriptors + 128 * k );
+          
+          nn.update( point_id, dist );
+        }
+      }
+    
+      // check if we have found a correspondence
+      if( nn.dist1 >= 0 )
+      {
+        if( nn.dist2 >= 0 )
+        {
+          if( nn.get_ratio() < nn_ratio_2D_to_3D )
+          {
+            // we found one, so we need check for mutual nearest neighbors
+                  
+            if( context.has_correspondence( nn.nn_idx1 ) )
+            {
+              // a correspondence to the same 3D point already exists
+              // so we have to check whether we have to update it or not
+              if( context.get_distance( nn.nn_idx1 ) > nn.dist1 )
+              {
+                feature_in_correspondence[ context.get_feature( nn.nn_idx1 ) ] = false;
+                
+                context.set_correspondence( nn.nn_idx1, j_index, nn.dist1, nn.get_ratio() );
+                
+                feature_in_correspondence[j_index ] = true;
+              }
+            }
+            else
+            {
+              context.set_correspondence( nn.nn_idx1, j_index, nn.dist1, nn.get_ratio() );
+              feature_in_correspondence[ j_index ] = true;
+              context.mark_used( nn.nn_idx1 );
+            }
+          }
+        }
+      }
+
+      if( context.get_nb_correspondences() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
       {
-        image_covered_by[i].clear();
-        nb_new_images_covered[i].first = i;
-        nb_new_images_covered[i].second = images_covered_by_image[i].size();
+        nb_considered_points = nb_considered_points_counter;
+        break;
       }
+    }
+    
+    ////
+    // check whether we have to compute correspondences from 3D-to-2D
+    if( context.get_nb_correspondences() < budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) && !budget.search_deadline_reached() )
+    {
+      ////
+      // perform the nn search in 3D to get new potential matches
       
-      // map image ids to a smaller range
-      std::vector< int > new_image_ids( nb_cameras, -1 );
-      int size_set_cover = 0;
+      match_scheduler point_to_image_matches;
       
-      while( !nb_new_images_covered.empty() )
+      const std::vector< uint32_t > &corr_points = context.get_correspondences();
+      for( size_t i=0; i<corr_points.size(); ++i )
+      {
+        uint32_t point = corr_points[i];
+        
+        if( !budget.search_time_left() )
+          break;
+        
+        //// START ACTIVE SEARCH
+        uint32_t nb_neighbors_3D = find_3D_neighbors( point, (uint32_t) budget.scale_search_effort( (size_t) N_3D, 1 ), indices, distances, neighbor_buffer, neighbors_3D );
+        
+        ////
+        // find new matching possibilities and insert them into the correct position 
+        // in the list
+
+        for( uint32_t kk=0; kk<nb_neighbors_3D; ++kk )
+        {
+          uint32_t candidate_point = neighbors_3D[kk];
+          
+          // check if we have already used or visited this 3D point (or promise to visit it later on
+          if( !context.is_used( candidate_point ) )
+          {
+            // visibility filter
+            if( check_visibility && ( !set_intersection_test( visibility_graph.get_images_for_point( candidate_point ), visibility_graph.get_nb_images_for_point( candidate_point ), visibility_graph.get_images_for_point( point ), visibility_graph.get_nb_images_for_point( point ) ) ) )
+              continue;
+            
+            // promise that we will (eventually) look at this 3D point
+            context.mark_used( candidate_point );
+            
+            ////
+            // compute the matching cost of this particular 3D point
+            // therefore, we have to identify to which visual words (on a higher level)
+            // the descriptors of this point are assigned how many times
+            
+            match_struct new_match( candidate_point, 0, false );
+            
+            if( low_dim_choosen == 0 )
+            {
+              for( const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws )
+                new_match.matching_cost += features_per_vw[ parents_at_level_2[ it_vws->vw_id ] ].size();
+            }
+            else
+            {
+              for( const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws )
+                new_match.matching_cost += features_per_vw[ parents_at_level_3[ it_vws->vw_id ] ].size();
+            }
+            
+            // push back the new matching possibilities
+            point_to_image_matches.push( new_match );
+          }
+        }
+      }
+    
+      //// STOP ACTIVE SEARCH
+
+      ////
+      // do the 3D-to-2D matching, in ascending number of search cost
+      while( !point_to_image_matches.empty() )
       {
-        std::sort( nb_new_images_covered.begin(), nb_new_images_covered.end(), cmp_second_entry_less< uint32_t, uint32_t > );
-        if( nb_new_images_covered.back().second == 0 )
+        if( !budget.search_time_left() )
           break;
         
-        uint32_t cam_id_ = nb_new_images_covered.back().first;
+        match_struct current_match = point_to_image_matches.pop();
+        
+        ////
+        // 3D-to-2D correspondence, handle it accordingly
+        uint32_t candidate_point = current_match.feature_id;
         
-        // add new image to set cover
-        new_image_ids[ cam_id_ ] = size_set_cover;
+        // check if we have already found a correspondence for that 3D point
+        // if so, we don't need to find a new one since it was found during
+        // 2D-to-3D matching which we trust more
+        if( context.has_correspondence( candidate_point ) )
+          continue;
+          
         
-        // markt its images as covered
-        for( std::set< uint32_t >::const_iterator it = images_covered_by_image[ cam_id_ ].begin(); it != images_covered_by_image[ cam_id_ ].end(); ++it )
-          image_covered_by[ *it ].insert( (uint32_t) size_set_cover );
+        uint32_t nb_desc_for_point = loc_db.get_nb_entries_for_point( candidate_point );
+        std::vector< uint32_t > low_dim_vw_ids( nb_desc_for_point );
         
-        ++size_set_cover;
+            
+        // map all descriptors of that point to the lower dimensional descriptors
+        std::vector< uint32_t > low_dim_vw;
+        low_dim_vw.reserve( nb_desc_for_point );
         
-        // pop first element
-        nb_new_images_covered.pop_back();
+        uint32_t counter = 0;
+
+        if( low_dim_choosen == 0 )
+        {
+          for( const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws, ++counter )
+          {
+            low_dim_vw_ids[counter] = parents_at_level_2[ it_vws->vw_id ];
+            low_dim_vw.push_back( parents_at_level_2[ it_vws->vw_id ] );
+          }
+        }
+        else
+        {
+          for( const point_entry *it_vws = loc_db.get_entries_for_point( candidate_point ); it_vws != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_vws, ++counter )
+          {
+            low_dim_vw_ids[counter] = parents_at_level_3[ it_vws->vw_id ];
+            low_dim_vw.push_back( parents_at_level_3[ it_vws->vw_id ] );
+          }
+        }
         
-        // recompute the nb of new images each image can cover
-        for( std::vector< std::pair< uint32_t, uint32_t > >::iterator it = nb_new_images_covered.begin(); it != nb_new_images_covered.end(); ++it )
+        // every lower dimensional visual word is handled once, in ascending order
+        std::sort( low_dim_vw.begin(), low_dim_vw.end() );
+        low_dim_vw.erase( std::unique( low_dim_vw.begin(), low_dim_vw.end() ), low_dim_vw.end() );
+          
+        // try to find a new correspondence
+        nearest_neighbors_multiple nn_exp;
+        for( std::vector< uint32_t >::const_iterator activated_vw = low_dim_vw.begin(); activated_vw != low_dim_vw.end(); ++activated_vw )
+        {
+          counter = 0;
+          for( const point_entry *it_desc = loc_db.get_entries_for_point( candidate_point ); it_desc != loc_db.get_entries_for_point( candidate_point ) + loc_db.get_nb_entries_for_point( candidate_point ); ++it_desc, ++counter )
+          {
+            if( low_dim_vw_ids[counter] != *activated_vw )
+              continue;
+            
+            const unsigned char *point_descriptor = loc_db.get_descriptor_uchar( it_desc->desc_id );
+            
+            for( std::vector< uint32_t >::const_iterator feature_it = features_per_vw[ *activated_vw ].begin(); feature_it != features_per_vw[ * activated_vw ].end(); ++feature_it )
+            {
+              int dist = compute_squared_SIFT_dist( descriptors[*feature_it], point_descriptor );
+              
+              nn_exp.update( *feature_it, dist );
+            }
+          }
+        }
+          
+        if( nn_exp.dist1 >= 0 )
         {
-          it->second = 0;
-          for( std::set< uint32_t >::const_iterator it2 = images_covered_by_image[ it->first ].begin(); it2 != images_covered_by_image[ it->first ].end(); ++it2 )
+          if( nn_exp.dist2 >= 0 )
           {
-            if( image_covered_by[ *it2 ].empty() )
-          it->second += 1;
+            if( nn_exp.get_ratio() < nn_ratio_3D_to_2D )
+            {
+              // we don't want to overwrite 2D-to-3D correspondence, only 3D-to-2D correspondence 
+              if( !feature_in_correspondence[ nn_exp.nn_idx1 ] )
+              {
+                // no existing correspondence
+                context.set_correspondence( candidate_point, nn_exp.nn_idx1, nn_exp.dist1, nn_exp.get_ratio() );
+                feature_in_correspondence[ nn_exp.nn_idx1 ] = true;
+                point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
+              }
+              else if( point_per_feature[ nn_exp.nn_idx1 ] != UINT32_MAX )
+              {
+                // only 3D-to-2D correspondence
+                // overwrite if the absolute SIFT distance is smaller 
+                
+                // first, we have to get the corresponding 3D point
+                uint32_t old_point = point_per_feature[ nn_exp.nn_idx1 ];
+                
+                // this has to exist, otherwise we would not have labeled it as having a correspondence
+                if( context.get_distance( old_point ) > nn_exp.dist1 )
+                {
+                  // update the correspondence
+                  
+                  // which means we first have to remove the old one
+                  context.remove_correspondence( old_point );
+                  
+                  point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
+                  
+                  context.set_correspondence( candidate_point, nn_exp.nn_idx1, nn_exp.dist1, nn_exp.get_ratio() );
+                }
+                
+              }
+            }
           }
         }
+          
+        if( context.get_nb_correspondences() >= budget.scale_search_effort( max_cor_early_term, minimal_RANSAC_solution ) )
+        {
+          nb_considered_points = nb_considered_points_counter;
+          break;
+        }
       }
-      
-      nb_new_images_covered.clear();
-      
-      std::cout << "   Set cover contains " << size_set_cover << " cameras out of " << nb_cameras << std::endl;
-    }
-    else
-    {
-      image_covered_by.clear();
-      images_covered_by_image.clear(); 
     }
-      
-    // copy the information
-    for( uint32_t i=0; i<nb_points_bundler; ++i )
-      connected_component_id_per_point[i] = point_ccs[i];
+  }
+  
+  if( budget.search_deadline_reached() )
+    out << " reached the deadline of the correspondence search after " << context.get_nb_correspondences() << " correspondences " << std::endl;
+
+  
+  if( nb_considered_points == 0 )
+    nb_considered_points = nb_loaded_keypoints;
+  
+  
+  ////
+  // Establish the correspondences needed for RANSAC-based pose estimation
+  
+  if( ransac_filter == 1 )  
+  {
+    ////
+    // Apply the RANSAC Pre-filter
+    uint32_t max_set_size = 0;
+   
+    const std::vector< uint32_t > &corr_points = context.get_correspondences();
+    uint32_t nb_found_corr = (uint32_t) corr_points.size();
+    
+    // map found points to index range 0...N (actually the other direction)
+    std::vector< uint32_t > index_to_point( nb_found_corr, 0 );
+    
+    // go through all points found as correspondences, establish edges in the form of images
+    std::map< uint32_t, std::list< uint32_t > > image_edges;
+    image_edges.clear();
     
-    cam_ccs.clear();
-    point_ccs.clear();
+    uint32_t point_counter = 0;
     
+    std::map< uint32_t, std::list< uint32_t > >::iterator it;
     
-    std::cout << "  Reading the images per 3D point " << std::endl;
-    for( uint32_t i=0; i<nb_points_bundler; ++i )
+    for( ; point_counter < nb_found_corr; ++point_counter )
     {
-      images_per_point[i].clear();
+      uint32_t point = corr_points[ point_counter ];
       
-      for( size_t j=0; j<feature_infos[i].view_list.size(); ++j )
+      index_to_point[ point_counter ] = point;
+      
+      const uint32_t *images_point = visibility_graph.get_images_for_point( point );
+      const uint32_t *images_point_end = images_point + visibility_graph.get_nb_images_for_point( point );
+      for( const uint32_t *it_images_point = images_point; it_images_point != images_point_end; ++it_images_point )
       {
-        if( use_image_set_cover )
+        it = image_edges.find( *it_images_point );
+        
+        if( it != image_edges.end() )
+          it->second.push_back( point_counter );
+        else
         {
-          uint32_t cam_id_ = feature_infos[i].view_list[j].camera;
-          for( std::set< uint32_t >::const_iterator it = image_covered_by[ cam_id_ ].begin(); it != image_covered_by[ cam_id_ ].end(); ++it )
-            images_per_point[i].insert( *it );
+          std::list< uint32_t > new_edge( 1, point_counter );
+          image_edges.insert( std::make_pair( *it_images_point, new_edge ) );
         }
-        else
-          images_per_point[i].insert( feature_infos[i].view_list[j].camera );
       }
+    }
+    
+    ////
+    // now find connected components, for every point, keep track which points belong to which connected component
+    // also keep track of which images have been used
+    
+    std::vector< int > cc_per_corr( nb_found_corr, -1 );
+    int current_cc = -1;
+    int max_cc = -1;
+    uint32_t size_current_cc = 0;
+    
+    std::set< uint32_t >::const_iterator img_it;
+    
+    for( point_counter = 0; point_counter < nb_found_corr; ++point_counter )
+    {
+      if( cc_per_corr[ point_counter ] < 0 )
+      {
+        // start new cc
+        ++current_cc;
+        size_current_cc = 0;
       
-      if( images_per_point[i].size() == 0 )
-        std::cout << " WARNING: Point " << i << " is visible in no image!" << std::endl;
+        std::queue< uint32_t > point_queue;
+        point_queue.push( point_counter );
+        
+        // breadth first search for remaining points in connected component
+        while( !point_queue.empty() )
+        {
+          uint32_t curr_point_id = point_queue.front();
+          point_queue.pop();
+          
+          if( cc_per_corr[ curr_point_id ] < 0 )
+          {
+            cc_per_corr[ curr_point_id ] = current_cc;
+            ++size_current_cc;
+            
+            // add all points in images visible by this point
+            const uint32_t *images_point = visibility_graph.get_images_for_point( index_to_point[ curr_point_id ] );
+            const uint32_t *images_point_end = images_point + visibility_graph.get_nb_images_for_point( index_to_point[ curr_point_id ] );
+            for( const uint32_t *it_images_point = images_point; it_images_point != images_point_end; ++it_images_point )
+            {
+              it = image_edges.find( *it_images_point );
+              
+              for( std::list< uint32_t >::const_iterator p_it = it->second.begin(); p_it != it->second.end(); ++p_it )
+              {
+                if( cc_per_corr[ *p_it ] < 0 )
+                  point_queue.push( *p_it );
+              }
+              
+              // clear the image, we do not the this multi-edge anymore
+              it->second.clear();
+            }
+          }
+        }
+        
+        if( size_current_cc > max_set_size )
+        {
+          max_set_size = size_current_cc;
+          max_cc = current_cc;
+        }
+       
+      }
     }
     
-    // clean up
-    if( use_image_set_cover )
+    
+    ////
+    // now generate the correspondences
+    
+    c2D.reserve( 2*max_set_size );
+    c3D.reserve( 3*max_set_size );
+    corr_ratios.reserve( max_set_size );
+    
+    point_counter = 0;
+    for( ; point_counter < nb_found_corr; ++point_counter )
     {
-      for( uint32_t i=0; i<nb_cameras; ++i )
+      if( cc_per_corr[ point_counter ] == max_cc )
       {
-        image_covered_by[i].clear();
-        images_covered_by_image[i].clear();
+        uint32_t point = corr_points[ point_counter ];
+        
+        c2D.push_back(keypoints[context.get_feature( point )].x);
+        c2D.push_back(keypoints[context.get_feature( point )].y);
+        
+        c3D.push_back( points3D[point][0] );
+        c3D.push_back( points3D[point][1] );
+        c3D.push_back( points3D[point][2] );
+        
+        corr_ratios.push_back( context.get_ratio( point ) );
+        
+        final_correspondences.push_back( std::make_pair( context.get_feature( point ), point ) );
       }
-      image_covered_by.clear();
-      images_covered_by_image.clear();
     }
+ 
+  }
+  else
+  {
+    // normal correspondence computation
+    // get the correspondences
+    const std::vector< uint32_t > &corr_points = context.get_correspondences();
+    for( size_t i=0; i<corr_points.size(); ++i )
+    {
+      uint32_t point = corr_points[i];
       
-    parser.clear();
-    feature_infos.clear();
+      c2D.push_back(keypoints[context.get_feature( point )].x);
+      c2D.push_back(keypoints[context.get_feature( point )].y);
+      
+      c3D.push_back( points3D[point][0] );
+      c3D.push_back( points3D[point][1] );
+      c3D.push_back( points3D[point][2] );
+      
+      corr_ratios.push_back( context.get_ratio( point ) );
+      
+      final_correspondences.push_back( std::make_pair( context.get_feature( point ), point ) );
+    }
   }
+    
+  timer.Stop();
+  out << " computed correspondences in " << timer.GetElapsedTimeAsString() << ", considering " << nb_considered_points << " features " << " ( " << double(nb_considered_points) / double(nb_loaded_keypoints) * 100.0 << " % ) " << std::endl;
+  result.corr_time = timer.GetElapsedTime();
   
-  
+ 
   ////
-  // create the kd-trees for the 3D points to enable search in 3D, one for each connected component
+  // do the pose verification using RANSAC
+    
+  RANSAC ransac_solver( ransac_parameters );
+  ransac_solver.set_focal_length( focal_length );
+  ransac_solver.set_deadline( budget.get_deadline() );
   
-  // get the number of connected components
-  uint32_t nb_connected_components = *std::max_element( connected_component_id_per_point.begin(), connected_component_id_per_point.end() );
-  nb_connected_components += 1;
+  uint32_t nb_corr = c2D.size() / 2;
   
-  std::cout << " * creating kd-trees for 3D points, one for each of the " << nb_connected_components << " connected components " << std::endl;
+
+  out << " applying RANSAC on " << nb_corr << " correspondences out of " << context.get_nb_correspondences() << std::endl;
+  if( focal_length > 0.0f )
+    out << " using P3P with a focal length of " << focal_length << " pixels " << std::endl;
+  timer.Init();
+  timer.Start();
+  ransac_solver.apply_RANSAC( c2D, c3D, nb_corr, std::max( float( minimal_RANSAC_solution ) / float( nb_corr ), min_inlier ), &corr_ratios ); 
+  timer.Stop();
+  result.RANSAC_time = timer.GetElapsedTime();
+  
+  all_timer.Stop();
+  
+  // output the solution:
+  out << "#### found solution ####" << std::endl;
+  out << " needed time: " << all_timer.GetElapsedTimeAsString() << std::endl;
+  
+  // get the solution from RANSAC
+  std::vector< uint32_t > inlier;
+  
+  inlier.assign( ransac_solver.get_inliers().begin(), ransac_solver.get_inliers().end()  );
+  
+  Util::Math::ProjMatrix &proj_matrix = result.proj_matrix;
+  proj_matrix = ransac_solver.get_projection_matrix();
+  
+  // decompose the projection matrix
+  Util::Math::Matrix3x3 &Rot = result.rotation, &K = result.calibration;
+  proj_matrix.decompose( K, Rot );
+  proj_matrix.computeInverse();
+  proj_matrix.computeCenter();
+  out << " camera calibration: " << K << std::endl;
+  out << " camera rotation: " << Rot << std::endl;
+  out << " camera position: " << proj_matrix.m_center << std::endl;
+  
+  result.nb_inlier = inlier.size();
+  result.nb_corr = nb_corr;
+  result.total_time = all_timer.GetElapsedTime();
+  result.deadline_reached = budget.search_deadline_reached() || ransac_solver.reached_time_limit();
+  if( result.deadline_reached )
+    out << " WARNING: the localization was stopped early, the pose is the best one found so far " << std::endl;
+  
+  out << "#########################" << std::endl;
+  
+  // clean up
+  inlier.clear();
   
-  // for every connected component, get the number of points in it
-  std::vector< uint32_t > nb_points_per_component( nb_connected_components, 0 );
-  for( std::vector< uint32_t >::const_iterator it = connected_component_id_per_point.begin(); it != connected_component_id_per_point.end(); ++it )
-    nb_points_per_component[ *it ] += 1;
+  delete [] indices;
+  delete [] distances;
+  delete [] neighbor_buffer;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+////
+// Localizes a single query image, given by the filename of its keyfile.
+// All output is written to out, the results are stored in result.
+////
+
+void localize_query( const std::string &key_filename, std::ostream &out, query_result &result )
+{
+  // the budget includes loading the features
+  latency_budget budget( query_latency_budget );
   
-  // for every connected component, get pointers to its 3D points
-  double **points_per_component[ nb_connected_components ];
-  uint32_t *indices_per_component[ nb_connected_components ];
+  // load the features
+  SIFT_loader key_loader;
+  key_loader.load_features( key_filename.c_str(), LOWE );
   
-  // store pointers to the appropriate points
-  {
-    std::vector< uint32_t > cc_point_counter( nb_connected_components, 0 );
-    
-    for( uint32_t i=0; i<nb_connected_components; ++i )
-    {
-      points_per_component[i] = new double*[ nb_points_per_component[i] ];
-      indices_per_component[i] = new uint32_t[ nb_points_per_component[i] ];
-    }
-    
-    for( uint32_t i=0; i<nb_3D_points; ++i )
-    {
-      uint32_t cc_id = connected_component_id_per_point[i];
-      points_per_component[ cc_id ][ cc_point_counter[ cc_id ] ] = points3D[i];
-      indices_per_component[ cc_id ][ cc_point_counter[ cc_id ] ] = i;
-      cc_point_counter[ cc_id ] += 1;
-    }
-  }
+  SIFT_descriptor_view descriptors = key_loader.get_descriptor_view();
+  std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
   
-  // create the trees
-  ANNkd_tree *kd_trees[ nb_connected_components ];
+  uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
   
-  for( uint32_t i=0; i<nb_connected_components; ++i )
-  {
-    int nb_points_3D_int = (int) nb_points_per_component[i];
-    kd_trees[i] = new ANNkd_tree( points_per_component[i], nb_points_3D_int, 3 );
-  }
+  // get the dimensions of the image, needed to center the keypoints, and the focal length (if available)
+  int img_width, img_height;
+  float focal_length;
+  std::string jpg_filename( key_filename );
+  jpg_filename.replace( jpg_filename.size()-3,3,"jpg");
+  exif_reader::open_exif( jpg_filename.c_str() );
+  img_width = exif_reader::get_image_width();
+  img_height = exif_reader::get_image_height();
+  focal_length = exif_reader::get_focal_length_in_pixels();
+  exif_reader::close_exif();
   
-  int nb_points_3D_int = (int) nb_3D_points;
-  ANNkd_tree *kd_tree = new ANNkd_tree( points3D, nb_points_3D_int, 3 );
+  out << " loaded " << nb_loaded_keypoints << " descriptors from " << key_filename << std::endl;
   
-  // and the search structures
-  annMaxPtsVisit( 0 );
-  
-  ANNidxArray indices = new ANNidx[ N_3D ];
-  ANNdistArray distances = new ANNdist[ N_3D ];
+  localize_features( keypoints, descriptors, img_width, img_height, focal_length, budget, out, result );
   
-  std::cout << "  done " << std::endl;
- 
+  // clean up
+  keypoints.clear();
+}
+
+//---------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int main (int argc, char **argv)
+{
+  // optional number of threads used to localize the query images in parallel
+  uint32_t nb_threads = 1;
+  std::string option_value;
+  if( extract_option( argc, argv, "--threads", option_value ) )
+    nb_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional number of threads used to draw and evaluate the RANSAC samples of a single query image
+  uint32_t nb_ransac_threads = 1;
+  if( extract_option( argc, argv, "--ransac-threads", option_value ) )
+    nb_ransac_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional number of threads used by FLANN to search for the features of a single query image
+  uint32_t nb_flann_threads = 1;
+  if( extract_option( argc, argv, "--flann-threads", option_value ) )
+    nb_flann_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional socket on which the localization requests are received (server mode)
+  std::string server_socket;
+  extract_option( argc, argv, "--server", server_socket );
+  
+  // optional neighborhoods of the 3D points precomputed by compute_point_neighborhoods
+  std::string neighborhoods_file;
+  extract_option( argc, argv, "--neighborhoods", neighborhoods_file );
+  
+  // optional latency budget of a single query, given in milliseconds
+  if( extract_option( argc, argv, "--latency-budget-ms", option_value ) )
+    query_latency_budget = std::max( 0.0, atof( option_value.c_str() ) ) / 1000.0;
   
-  ////
-  // now load the filenames of the query images
-  std::vector< std::string > key_filenames;
-  key_filenames.clear();
+  if( argc < 12 )
   {
-    std::ifstream ifs( keylist.c_str(), std::ios::in );
-    std::string tmp_string;
-    
-    while( !ifs.eof() )
-    {
-      tmp_string = "";
-      ifs >> tmp_string;
-      if( !tmp_string.empty() )
-      {
-        key_filenames.push_back(tmp_string);
-      }
-    }
-    ifs.close();
-    std::cout << " done loading " << key_filenames.size() << " keyfile names " << std::endl;
+    std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -        Localization method. Implementation of the localization framework proposed in the ECCV 2011 paper               - " << std::endl;
+    std::cout << " -          T. Sattler, B. Leibe, L. Kobbelt. Improving Image-Based Localization by Active Correspondence Search.         - " << std::endl;
+    std::cout << " -                               2012 by Torsten Sattler (tsattler@cs.rwth-aachen.de)                                     - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " - usage: acg_localizer_active_search list bundle_file nb_cluster clusters descriptors prioritization_strategy results    - " << std::endl;
+    std::cout << " -                        N_3D ransac_pre_filter filter_points image_set_cover nb_cams_set_cover                          - " << std::endl;
+    std::cout << " -                        [--threads N] [--ransac-threads N] [--server socket] [--neighborhoods file]                     - " << std::endl;
+    std::cout << " -                        [--latency-budget-ms T] [--flann-threads N]                                                     - " << std::endl;
+    std::cout << " - Parameters:                                                                                                            - " << std::endl;
+    std::cout << " -  list                                                                                                                  - " << std::endl;
+    std::cout << " -     List containing the filenames of all the .key files that should be used as query. It is assumed that the           - " << std::endl;
+    std::cout << " -     corresponding images have the same filename except of ending in .jpg.                                              - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  bundle_file                                                                                                           - " << std::endl;
+    std::cout << " -     The bundle.out file generated by Bundler.                                                                          - " << std::endl;
+    std::cout << " -     Alternatively, the visibility information precomputed by compute_scene_graph.                                      - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  nb_cluster                                                                                                            - " << std::endl;
+    std::cout << " -     The number of clusters in the file containing the cluster centers. The number of cluster must be the same          - " << std::endl;
+    std::cout << " -     as for the assignments computed by compute_desc_assignments.                                                       - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  clusters                                                                                                              - " << std::endl;
+    std::cout << " -     The cluster centers (visual words), stored in a textfile consisting of nb_clusters * 128 floating point values.    - " << std::endl;
+    std::cout << " -     Alternatively, a binary vocabulary file generated by build_vocabulary_tree.                                        - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  descriptors                                                                                                           - " << std::endl;
+    std::cout << " -     The assignments assigning descriptors (and 3D points) to visual words. It is assumed that all descriptors          - " << std::endl;
+    std::cout << " -     are stored as unsigned char values and that every visual word contains at most one descriptor for every 3D point,  - " << std::endl;
+    std::cout << " -     i.e., the integer mean strategy is used to represent 3D points.                                                    - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  prioritization_strategy                                                                                               - " << std::endl;
+    std::cout << " -     The strategy to combine 2D-to-3D and 3D-to-2D matching (see the paper for details):                                - " << std::endl;
+    std::cout << " -      0 - Combined                                                                                                      - " << std::endl;
+    std::cout << " -      1 - Direct                                                                                                        - " << std::endl;
+    std::cout << " -      2 - Afterwards                                                                                                    - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  results                                                                                                               - " << std::endl;
+    std::cout << " -     The program will write the results of the localization into a text file of name \"results\". It has the following  - " << std::endl;
+    std::cout << " -     format, where every line in the file belongs to one query image and has the format                                 - " << std::endl;
+    std::cout << " -       #inliers #(correspondences found) (time needed to compute the visual words, in seconds) (time needed for linear  - " << std::endl;
+    std::cout << " -       search, in seconds) (time needed for RANSAC, in seconds) (total time needed, in seconds)                         - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  N_3D                                                                                                                  - " << std::endl;
+    std::cout << " -     Specifies the number of nearest neighbors in 3D that are used as candidates for 3D-to-2D matching                  - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  ransac_pre_filter                                                                                                     - " << std::endl;
+    std::cout << " -     Set to 0 to use not filter, set to 1 to use the RANSAC Pre-Filter described in the paper.                          - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  filter_points                                                                                                         - " << std::endl;
+    std::cout << " -     Set to 1 to use the images in the reconstruction (or the set cover, see below) to filter the 3D points obtained    - " << std::endl;
+    std::cout << " -     by nn-search in 3D: A point is accepted if it is visible with the 3D point triggering the search in at least one   - " << std::endl;
+    std::cout << " -     image. Set to 0 to disable the filtering.                                                                          - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  image_set_cover                                                                                                       - " << std::endl;
+    std::cout << " -     Set to 0 to use the original images from the reconstruction or to 1 to first compute a set cover that for every    - " << std::endl;
+    std::cout << " -     image computes the nearest K images (in 3D) and selects those cameras for which the viewing direction differs      - " << std::endl;
+    std::cout << " -     by less than 60° to the current camera to belong to the same set of cameras. Afterwards we compute a set cover     - " << std::endl;
+    std::cout << " -     for those sets. You can specify the value for K with the parameter nb_cams_set_cover (default: 10).                - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --threads N (optional)                                                                                                - " << std::endl;
+    std::cout << " -     Localize N query images in parallel (default: 1). The model is shared by all threads and the results are          - " << std::endl;
+    std::cout << " -     written in the order of the list.                                                                                  - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --ransac-threads N (optional)                                                                                         - " << std::endl;
+    std::cout << " -     Draw and evaluate the RANSAC samples of a query image with N threads (default: 1). This reduces the time           - " << std::endl;
+    std::cout << " -     needed for difficult queries, it can be combined with --threads.                                                   - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --flann-threads N (optional)                                                                                          - " << std::endl;
+    std::cout << " -     Assign the features of a query image to visual words with N threads (default: 1). The                              - " << std::endl;
+    std::cout << " -     assignments do not depend on N, it can be combined with --threads and --ransac-threads.                            - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --server socket (optional)                                                                                            - " << std::endl;
+    std::cout << " -     Do not localize the images in the list but keep the model in memory and answer localization requests received      - " << std::endl;
+    std::cout << " -     on the Unix domain socket socket (see localization_server.hh for the protocol). Up to N (see --threads) clients    - " << std::endl;
+    std::cout << " -     are served in parallel. For every request, a line is appended to the results file. The server runs until it is     - " << std::endl;
+    std::cout << " -     terminated, the list is ignored.                                                                                   - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --neighborhoods file (optional)                                                                                       - " << std::endl;
+    std::cout << " -     Use the neighborhoods of the 3D points precomputed by compute_point_neighborhoods instead of searching the         - " << std::endl;
+    std::cout << " -     N_3D nearest neighbors in kd-trees. If the neighborhoods were filtered (filter_points), they have to be computed   - " << std::endl;
+    std::cout << " -     with the same values of N_3D, image_set_cover and nb_cams_set_cover.                                               - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --latency-budget-ms T (optional)                                                                                      - " << std::endl;
+    std::cout << " -     Localize every query image within T milliseconds, starting when its features are loaded (or received).             - " << std::endl;
+    std::cout << " -     Word assignment, correspondence search and RANSAC share this deadline, 25% of T are reserved for RANSAC.           - " << std::endl;
+    std::cout << " -     When time runs short, fewer correspondences are needed for early termination and fewer than N_3D neighbors         - " << std::endl;
+    std::cout << " -     are considered. If the deadline is reached, the best pose found so far is returned and the query is marked         - " << std::endl;
+    std::cout << " -     as stopped early (not limited by default).                                                                         - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
+    return 1;
   }
   
-  uint32_t nb_keyfiles = key_filenames.size();
-  
-  ////
-  // do the actual localization
-  double avrg_reg_time = 0.0;
-  double avrg_reject_time = 0.0;
-  double avrg_vw_time = 0.0;
-  double avrg_nb_features = 0.0;
-  double avrg_cor_computation_time_accepted = 0.0;
-  double avrg_cor_computation_time_rejected = 0.0;
-  double N = 0.0;
-  double N_reject = 0.0;
-  double mean_inlier_ratio_accepted = 0.0;
-  double mean_inlier_ratio_rejected = 0.0;
-  double mean_nb_correspondences_accepted = 0.0;
-  double mean_nb_correspondences_rejected = 0.0;
-  double mean_nb_features_accepted = 0.0;
-  double mean_nb_features_rejected = 0.0;
-  double vw_time = 0.0;
-  double corr_time = 0.0;
-  double RANSAC_time = 0.0;
-  double avrg_RANSAC_time_registered = 0.0;
-  double avrg_RANSAC_time_rejected = 0.0;
-  double mean_assignment_time_QE = 0.0;
-  double mean_QE_time = 0.0;
-  
-  
-  
-  
-  std::ofstream ofs( outfile.c_str(), std::ios::out );
-    
-  if( !ofs.is_open() )
+ 
+  // rocketcluster
+  std::string keylist( argv[1] );
+  std::string bundle_file( argv[2] );
+  uint32_t nb_clusters = (uint32_t) atoi( argv[3] );
+  std::string cluster_file( argv[4] );
+  std::string vw_assignments( argv[5] );
+  prioritization_strategy = atoi( argv[6] );
+  if( prioritization_strategy != 0 && prioritization_strategy != 1 && prioritization_strategy != 2 )
   {
-    std::cerr << " Could not write results to " << outfile << std::endl;
-    return 1;
+    std::cerr << " ERROR: Unknown prioritization strategy " << prioritization_strategy << ", aborting" << std::endl;
+    return -1;
   }
+  std::string outfile(argv[7] );
   
+  std::cout << " Assumed minimal inlier-ratio: " << min_inlier << std::endl;
+  std::cout << " Descriptor distances computed using the " << get_SIFT_dist_implementation() << " implementation " << std::endl;
+  std::cout << " Early termination after finding " << max_cor_early_term << " correspondences " << std::endl;
+    
   
-  uint32_t registered = 0;
+  N_3D = (uint32_t) atoi( argv[8] );
+  std::cout << " Query expansion includes the next " << N_3D << " features " << std::endl;
+  
+  ransac_filter = atoi( argv[9] );
+  std::cout << " RANSAC prefilter: " << ransac_filter << std::endl;
+  
+  filter_points = (bool) atoi( argv[10] );
+  if( filter_points )
+    std::cout << " Filtering 3D points before 3D-to-2D matching " << std::endl;
+  else
+    std::cout << " NOT Filtering 3D points before 3D-to-2D matching " << std::endl;
   
-  std::vector< uint32_t > computed_visual_words( 50000, 0 );
-  std::vector< uint32_t > computed_visual_words_low_dim( 50000,0 );
+  use_image_set_cover = (bool) atoi( argv[11] );
 
+  if( argc >= 13 )
+    consider_K_nearest_cams = (uint32_t) atoi( argv[12] );
+  
+  if( use_image_set_cover )
+    std::cout << " Using set covers instead of normal images with " << consider_K_nearest_cams << " nearest cams" << std::endl;
+  else
+    std::cout << " Using the original images " << std::endl;
   
   ////
-  // for every visual word on level 2 or 3 (so at max 1000 visual words)
-  // store the ids of the 2D features that are mapped to that visual word
-  std::vector< std::vector< uint32_t > > features_per_vw( 1000 );
-  for( int i=0; i<1000; ++i )
-    features_per_vw[i].resize(100);
+  // load the visual words and their tree 
+  vw_handler.set_nb_trees( 1 );
+  vw_handler.set_nb_visual_words( nb_clusters );
+  vw_handler.set_branching( 10 );
   
+  // store for every visual word at the finest level the id of its parents at levels 2 and 3
+  parents_at_level_2 = new uint32_t[ nb_clusters ];
+  parents_at_level_3 = new uint32_t[ nb_clusters ];
   
-  for( uint32_t i=0; i<nb_keyfiles; ++i, N+=1.0 )
+  for( uint32_t i=0; i<nb_clusters; ++i )
   {
-    std::cout << std::endl << " --------- " << i+1 << " / " << nb_keyfiles << " --------- " << std::endl;
-    
-    SIFT_loader key_loader;
-    std::cout << key_filenames[i] << std::endl;
-    key_loader.load_features( key_filenames[i].c_str(), LOWE );
-    
-    std::vector< unsigned char* >& descriptors = key_loader.get_descriptors();
-    std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
-    
-    uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
-    
-   
-    // center the keypoints around the center of the image
-    // first we need to get the dimensions of the image
-    int img_width, img_height;
-    std::string jpg_filename( key_filenames[i] );
-    jpg_filename.replace( jpg_filename.size()-3,3,"jpg");
-    exif_reader::open_exif( jpg_filename.c_str() );
-    img_width = exif_reader::get_image_width();
-    img_height = exif_reader::get_image_height();
-    exif_reader::close_exif();
-    
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      keypoints[j].x -= (img_width-1.0)/2.0f; 
-      keypoints[j].y = (img_height-1.0)/2.0f - keypoints[j].y; 
-    }
+    parents_at_level_2[i] = parents_at_level_3[i] = nb_clusters;
+  }
+  
+  vw_handler.set_method(std::string("flann"));
+  vw_handler.set_flann_type(std::string("hkmeans"));
     
-    std::cout << " loaded " << nb_loaded_keypoints << " descriptors" << std::endl;
+  if( !vw_handler.create_flann_search_index( cluster_file ) )
+  {
+    std::cout << " ERROR: Could not load the cluster centers from " << cluster_file << std::endl;;
+    return -1;
+  }
     
-    // assign the descriptors to the visual words   
+  {
+    // get the ids of the parents that we need
+    int *parent_ids = new int[nb_clusters];
+    for( uint32_t i=0; i<nb_clusters; ++i )
+      parent_ids[i] = -1;
     
-    Timer timer;
-    timer.Init();
-    timer.Start();
+    vw_handler.get_parents_at_level_L( 2, parent_ids );
     
-   
-    if( computed_visual_words.size() < nb_loaded_keypoints )
+    // copy that to the real data structures
+    uint32_t counter = 0;
+    for( uint32_t i=0; i<nb_clusters; ++i )
     {
-      computed_visual_words.resize( nb_loaded_keypoints );
-      computed_visual_words_low_dim.resize( nb_loaded_keypoints );
+      if( parent_ids[i] == -1 )
+      {
+        std::cout << " uhoh, this should not happen!" << std::endl;
+        ++counter;
+      }
+      else
+      {
+        parents_at_level_2[i] = (uint32_t) parent_ids[i];
+        if( parents_at_level_2[i] < 0 || parents_at_level_2[i] >= 100 )
+          std::cout << " WARNING: OUT OF RANGE: " << parents_at_level_2[i] << " from " << parent_ids[i] << std::endl;
+      }
     }
-    
-    
-    std::set< size_t > unique_vw;
-    unique_vw.clear();
-    
-    vw_handler.set_nb_paths( 1 );
-    vw_handler.assign_visual_words_ucharv( descriptors, nb_loaded_keypoints, computed_visual_words );
-    
-    timer.Stop();
-    
-    for( size_t j=0; j<nb_loaded_keypoints; ++j )
-      unique_vw.insert( computed_visual_words[j] );
-    
-    std::cout << " assigned visual words in " << timer.GetElapsedTimeAsString() << " to " << unique_vw.size() << " unique vw" << std::endl;
-    avrg_vw_time = avrg_vw_time * N / (N+1.0) + timer.GetElapsedTime() / (N+1.0);
-    avrg_nb_features = avrg_nb_features * N / (N+1.0) + double(nb_loaded_keypoints) / (N+1.0);
-    vw_time = timer.GetElapsedTime();
-    
-        
-    ////
-    // establish 2D-3D correspondences by using the vw to compute pairwise nearest neighbors
-    timer.Init();
-    timer.Start();
-    Timer all_timer;
-    all_timer.Init();
-    all_timer.Start();   
-    
-    // first, compute for every feature in the image its visual word in the coarser vocabulary
-    // compute the lower dimensions
-    int low_dim_choosen = 0;
-    int nb_low_dim = 100;
-    
-    if( nb_loaded_keypoints > 5000 )
+    if( counter == nb_clusters )
     {
-      low_dim_choosen = 1;
-      nb_low_dim = 1000;
+      std::cerr << " Some ERROR in getting the parents from level 2, stopping here " << std::endl;
+      return -1;
     }
     
-    for( int j=0; j<nb_low_dim; ++j )
-      features_per_vw[j].clear();
+    for( uint32_t i=0; i<nb_clusters; ++i )
+      parent_ids[i] = -1;
     
+    vw_handler.get_parents_at_level_L( 3, parent_ids );
     
-      
-    if( low_dim_choosen == 0 )
-    {
-      for( size_t j=0; j<nb_loaded_keypoints; ++j )
-        features_per_vw[ parents_at_level_2[ computed_visual_words[j] ] ].push_back( j );
-    }
-    else
+    // copy that
+    counter = 0;
+    for( uint32_t i=0; i<nb_clusters; ++i )
     {
-      for( size_t j=0; j<nb_loaded_keypoints; ++j )
-        features_per_vw[ parents_at_level_3[ computed_visual_words[j] ] ].push_back( j );
+      if( parent_ids[i] == -1 )
+      {
+        std::cout << " uhoh, this should not happen!" << std::endl;
+        ++counter;
+      }
+      else
+      {
+        parents_at_level_3[i] = (uint32_t) parent_ids[i];
+        if( parents_at_level_3[i] < 0 || parents_at_level_3[i] >= 1000 )
+          std::cout << " WARNING: OUT OF RANGE: " << parents_at_level_3[i] << " from " << parent_ids[i] << std::endl;
+      }
     }
-      
-   
-    // store the correspondences for RANSAC
-    std::vector< float > c2D, c3D;
-    c2D.clear();
-    c3D.clear();
-    
-    std::vector< std::pair< uint32_t, uint32_t > > final_correspondences; // first the 2D, then the 3D point
-    final_correspondences.clear();
-    
-    uint32_t max_corr = 0;
-    uint32_t no_nn = 0;
-    uint32_t no_sn_neighbor = 0;
-    uint32_t failed_ratio = 0;
-    
-    
-    // compute the priorities
-    
-    std::list< match_struct > priorities( nb_loaded_keypoints );
-    std::list< match_struct >::iterator priorities_it = priorities.begin();
-    
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j, ++priorities_it )
+    if( counter == nb_clusters )
     {
-      priorities_it->feature_id = j;
-      priorities_it->matching_cost = nb_points_per_vw[computed_visual_words[j]];
-      priorities_it->matching_type = true;
-    }
-    
-    // keep track which 2D features are used for correspondences
-    std::vector< bool > feature_in_correspondence( nb_loaded_keypoints, false );
-    
-    // keep track which 2D features are used for 3D-to-2D correspondences and 
-    // to which point they match. This is needed to be able to override 3D-to-2D
-    // correspondences with new 3D-to-2D correspondences.
-    // To signal that a feature is not part of a 3D-to-2D correspondence, we use
-    // UINT32_MAX
-    std::vector< uint32_t > point_per_feature( nb_loaded_keypoints, UINT32_MAX );
-    
-    // keep track which 3D points have been used in the query expansion
-    std::set< uint32_t > used_3D_points;
-    used_3D_points.clear();
-    
-    priorities.sort( cmp_priorities );
-
-    
-    // similarly, we store for each 3D point the corresponding 2D feature as well as the squared distance
-    std::map< uint32_t, std::pair< uint32_t, int > > corr_3D_to_2D;
-    corr_3D_to_2D.clear();
-    
-    std::map< uint32_t, nearest_neighbors >::iterator map_it_2D;
-    std::map< uint32_t, nearest_neighbors_float >::iterator map_it_2D_float;
-    std::map< uint32_t, nearest_neighbors_multiple >::iterator map_it_2D_multple;
-    std::map< uint32_t, std::pair< uint32_t, int > >::iterator map_it_3D;
-
-    // compute nearest neighbors using 2D-to-3D and 3D-to-2D matching
-
-    uint32_t nb_considered_points = 0;
-    uint32_t nb_considered_points_counter = 0;
-    if( prioritization_strategy == 0 || prioritization_strategy == 1 )
-    {
-      for( priorities_it = priorities.begin(); priorities_it != priorities.end(); ++priorities_it )
-      {
-//         std::cout << priorities_it->feature_id << " " << priorities_it->matching_type << " " << priorities_it->matching_cost << std::endl;
-        // check the matching type, and handle the different matching directions accordingly
-        if( priorities_it->matching_type )
-        {
-          
-          ////
-          // 2D-to-3D matching, similar to the ICCV 2011 paper
-        
-          uint32_t j_index = priorities_it->feature_id;
-          
-          if( feature_in_correspondence[ j_index ] )
-            continue;
-          
-          uint32_t assignment = uint32_t( computed_visual_words[j_index] );
-          
-          ++nb_considered_points_counter;
-          
-          nearest_neighbors nn;
-          
-          if( priorities_it->matching_cost > 0 )
-          {
-            // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
-            size_t nb_poss_assignments = vw_points_descriptors[assignment].size();
-            
-            for( size_t k=0; k<nb_poss_assignments; ++k )
-            {
-              uint32_t point_id = vw_points_descriptors[assignment][k].first;
-              uint32_t desc_id = vw_points_descriptors[assignment][k].second;
-              
-              int dist = compute_squared_SIFT_dist( descriptors[j_index], all_descriptors, desc_id );
-              
-              nn.update( point_id, dist );
-            }
-          }
-        
-          // check if we have found a correspondence
-          if( nn.dist1 >= 0 )
-          {
-            if( nn.dist2 >= 0 )
-            {
-              if( nn.get_ratio() < nn_ratio_2D_to_3D )
-              {
-                // we found one, so we need check for mutual nearest neighbors
-                map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
-              
-                if( map_it_3D != corr_3D_to_2D.end() )
-                {
-                  // a correspondence to the same 3D point already exists
-                  // so we have to check whether we have to update it or not
-                  if( map_it_3D->second.second > nn.dist1 )
-                  {
-                    feature_in_correspondence[ map_it_3D->second.first ] = false;
-                    
-                    map_it_3D->second.first = j_index;
-                    map_it_3D->second.second = nn.dist1;
-                    
-                    feature_in_correspondence[j_index ] = true;
-                  }
-                }
-                else
-                {
-                  corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
-                  feature_in_correspondence[ j_index ] = true;
-                  used_3D_points.insert( nn.nn_idx1 );
-                  
-                  // avoid query expansion if we are not going to use it anyways
-                  if( corr_3D_to_2D.size() >= max_cor_early_term )
-                  {
-                    nb_considered_points = nb_considered_points_counter;
-                    break;
-                  }
-                  
-                  //// START ACTIVE SEARCH
-                  // we only have to do the nn query in 3D space if we have 
-                  // found a new correspondence, not updated an old one (should be happening seldomly anyways)
-                  
-                  // find the nearest neighbors in 3D
-                  // ANN will throw an exception if we search for more points than contained in the connected component, so 
-                  // we have to adjust the number of points we search for
-                  int N3D_ = std::min( N_3D, (int) nb_points_per_component[ connected_component_id_per_point[ nn.nn_idx1 ] ] );
-                  kd_trees[ connected_component_id_per_point[ nn.nn_idx1 ] ]->annkSearch( points3D[nn.nn_idx1], N3D_, indices, distances );
-                  
-                  ////
-                  // find new matching possibilities and insert them into the correct position 
-                  // in the list
-                  std::list< match_struct > new_matching_possibilities;
-                  new_matching_possibilities.clear();
-                  
-
-                  for( int kk=0; kk<N3D_; ++kk )
-                  {
-                    if( indices[kk] < 0 )
-                      break;
-                                      
-                    uint32_t candidate_point = indices_per_component[ connected_component_id_per_point[ nn.nn_idx1 ] ][ indices[kk] ];
-                    
-                    // check if we have already used or visited this 3D point (or promise to visit it later on
-                    if( used_3D_points.find( candidate_point ) == used_3D_points.end() )
-                    {
-                      // visibility filter
-                      if( filter_points && ( !set_intersection_test( images_per_point[candidate_point], images_per_point[ nn.nn_idx1 ] ) ) )
-                        continue;
-                      
-                      // promise that we will (eventually) look at this 3D point
-                      used_3D_points.insert(candidate_point);
-                                            
-                      ////
-                      // compute the matching cost of this particular 3D point
-                      // therefore, we have to identify to which visual words (on a higher level)
-                      // the descriptors of this point are assigned how many times
-                      
-                      match_struct new_match( candidate_point, 0, false );
-                      
-                      if( low_dim_choosen == 0 )
-                      {
-                        for(std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws)
-                          new_match.matching_cost += features_per_vw[ parents_at_level_2[ *it_vws ] ].size();
-                      }
-                      else
-                      {
-                        for(std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws)
-                          new_match.matching_cost += features_per_vw[ parents_at_level_3[ *it_vws ] ].size();
-                      }
-                      
-                      // push back the new matching possibilities
-                      new_matching_possibilities.push_back( new_match );
-                    }
-                  }
-                  
-                  ////
-                  // insert the list of new matching possibilities into our prioritization search structure
-                  // to do so efficiently, we sort the new list and use insertion sort to update the prioritization scheme
-                  
-                  // sort
-                  new_matching_possibilities.sort( cmp_priorities );
-                  
-                  // depending on the prioritization_strategy we either insert all new matching possibilities directly after the next 
-                  // entry in the current prioritization list (prioritization_strategy == 1) or use insertion sort to insert it in a
-                  // sorted fashion (prioritization_strategy == 0)
-                  
-                  if( prioritization_strategy == 0 )
-                  {
-                    // insertion sort: Notice that we start with the NEXT entry in the current prioritization list
-                    // since we are nearly done with the old one
-                    std::list< match_struct >::iterator insertion_it = priorities_it;
-                    ++insertion_it;
-                    
-                    std::list< match_struct >::iterator to_insert_it = new_matching_possibilities.begin();
-                    
-                    while( to_insert_it != new_matching_possibilities.end() )
-                    {
-                      if( insertion_it == priorities.end() )
-                      {
-                        priorities.insert( insertion_it, to_insert_it, new_matching_possibilities.end() );
-                        break;
-                      }
-                      
-                      if( insertion_it->matching_cost > to_insert_it->matching_cost )
-                      {
-                        priorities.insert( insertion_it, *to_insert_it );
-                        ++to_insert_it;
-                      }
-                      else
-                        ++insertion_it;
-                    }
-                  }
-                  else
-                  {
-                    std::list< match_struct >::iterator insertion_it = priorities_it;
-                    ++insertion_it;
-                    
-                    priorities.insert( insertion_it, new_matching_possibilities.begin(), new_matching_possibilities.end() );
-                  }
-                  
-                  new_matching_possibilities.clear();
-                  
-                  //// STOP ACTIVE SEARCH
-                }
-              }
-            }
-          }
-        }
-        else
-        {
-          ////
-          // 3D-to-2D correspondence, handle it accordingly
-          uint32_t candidate_point = priorities_it->feature_id;
-          
-          // check if we have already found a correspondence for that 3D point
-          // if so, we don't need to find a new one since it was found during
-          // 2D-to-3D matching which we trust more
-          if( corr_3D_to_2D.find( candidate_point ) != corr_3D_to_2D.end() )
-            continue;
-            
-          
-          uint32_t nb_desc_for_point = (uint32_t) desc_per_point[ candidate_point ].size();
-          std::vector< uint32_t > low_dim_vw_ids( nb_desc_for_point );
-          
-              
-          // map all descriptors of that point to the lower dimensional descriptors
-          std::set< uint32_t > low_dim_vw;
-          low_dim_vw.clear();
-          
-          uint32_t counter = 0;
-          if( low_dim_choosen == 0 )
-          {
-            for( std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws, ++counter )
-            {
-              low_dim_vw_ids[counter] = parents_at_level_2[ *it_vws ];
-              low_dim_vw.insert( parents_at_level_2[ *it_vws ] );
-            }
-          }
-          else
-          {
-            for( std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws, ++counter )
-            {
-              low_dim_vw_ids[counter] = parents_at_level_3[ *it_vws ];
-              low_dim_vw.insert( parents_at_level_3[ *it_vws ] );
-            }
-          }
-
-          
-          // try to find a new correspondence
-          nearest_neighbors_multiple nn_exp;
-          uint64_t descriptor_index(0);
-          for( std::set< uint32_t >::const_iterator activated_vw = low_dim_vw.begin(); activated_vw != low_dim_vw.end(); ++activated_vw )
-          {
-            counter = 0;
-            for( std::vector< uint32_t >::const_iterator it_desc = desc_per_point[ candidate_point].begin(); it_desc != desc_per_point[ candidate_point].end(); ++it_desc, ++counter )
-            {
-              if( low_dim_vw_ids[counter] != *activated_vw )
-                continue;
-              
-              descriptor_index = (*it_desc) * sift_dim;
-              
-              for( std::vector< uint32_t >::const_iterator feature_it = features_per_vw[ *activated_vw ].begin(); feature_it != features_per_vw[ * activated_vw ].end(); ++feature_it )
-              {
-                int dist = 0;
-                int x = 0;
-                for( uint64_t jj=0; jj<128; ++jj )
-                {
-                  x = ( (int) descriptors[*feature_it][jj] ) - ( (int) all_descriptors[ descriptor_index + jj ] );
-                  dist += x*x;
-                }
-                
-                nn_exp.update( *feature_it, dist );
-              }
-            }
-          }
-          
-          if( nn_exp.dist1 >= 0 )
-          {
-            if( nn_exp.dist2 >= 0 )
-            {
-              if( nn_exp.get_ratio() < nn_ratio_3D_to_2D )
-              {
-                // we don't want to overwrite 2D-to-3D correspondence, only 3D-to-2D correspondence 
-                if( !feature_in_correspondence[ nn_exp.nn_idx1 ] )
-                {
-                  // no existing correspondence
-                  corr_3D_to_2D.insert( std::make_pair( candidate_point, std::make_pair( nn_exp.nn_idx1, nn_exp.dist1 ) ) );
-                  feature_in_correspondence[ nn_exp.nn_idx1 ] = true;
-                  point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
-                }
-                else if( point_per_feature[ nn_exp.nn_idx1 ] != UINT32_MAX )
-                {
-                  // only 3D-to-2D correspondence
-                  // overwrite if the absolute SIFT distance is smaller 
-                  
-                  // first, we to get an iterator to the corresponding 3D point
-                  map_it_3D = corr_3D_to_2D.find( point_per_feature[ nn_exp.nn_idx1 ] );
-                  
-                  // this has to exist, otherwise we would not have labeled it as having a correspondence
-                  if( map_it_3D->second.second > nn_exp.dist1 )
-                  {
-                    // update the correspondence
-                    
-                    // which means we first have to remove the old one
-                    corr_3D_to_2D.erase( map_it_3D );
-                    
-                    point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
-                    
-                    corr_3D_to_2D.insert( std::make_pair( candidate_point, std::make_pair( nn_exp.nn_idx1, nn_exp.dist1 ) ) );
-                  }
-                }
-              }
-            }
-          }
-        }
-        
-//         std::cout << " "  << corr_3D_to_2D.size() << std::endl;
-        
-        if( corr_3D_to_2D.size() >= max_cor_early_term )
-        {
-          nb_considered_points = nb_considered_points_counter;
-          break;
-        }
-      }
-    }
-    else if( prioritization_strategy == 2 )
-    {
-      ////
-      // first perform 2D-to-3D matching, then 3D-to-2D matching until enough correspondences are found
-      for( priorities_it = priorities.begin(); priorities_it != priorities.end(); ++priorities_it )
-      {
-        ////
-        // 2D-to-3D matching, similar to ICCV 2011 version
-          
-        uint32_t j_index = priorities_it->feature_id;
-        
-        // testing whether a correspondence is already part of a correspondence
-        // is not necessary for pure 2D-to-3D matching, but we will later need
-        // the information for 3D-to-2D matching
-        
-        uint32_t assignment = uint32_t( computed_visual_words[j_index] );
-        
-        ++nb_considered_points_counter;
-        
-        nearest_neighbors nn;
-
-
-        if( priorities_it->matching_cost > 0 )
-        {
-          // find nearest neighbor for 2D feature, update nearest neighbor information for 3D points if necessary
-          size_t nb_poss_assignments = vw_points_descriptors[assignment].size();
-          
-          for( size_t k=0; k<nb_poss_assignments; ++k )
-          {
-            uint32_t point_id = vw_points_descriptors[assignment][k].first;
-            uint32_t desc_id = vw_points_descriptors[assignment][k].second;
-                
-            int dist = compute_squared_SIFT_dist( descriptors[j_index], all_descriptors, desc_id );
-            
-            nn.update( point_id, dist );
-          }
-        }
-      
-        // check if we have found a correspondence
-        if( nn.dist1 >= 0 )
-        {
-          if( nn.dist2 >= 0 )
-          {
-            if( nn.get_ratio() < nn_ratio_2D_to_3D )
-            {
-              // we found one, so we need check for mutual nearest neighbors
-              map_it_3D = corr_3D_to_2D.find( nn.nn_idx1 );
-        
-              if( map_it_3D != corr_3D_to_2D.end() )
-              {
-                // a correspondence to the same 3D point already exists
-                // so we have to check whether we have to update it or not
-                if( map_it_3D->second.second > nn.dist1 )
-                {
-                  feature_in_correspondence[ map_it_3D->second.first ] = false;
-                  
-                  map_it_3D->second.first = j_index;
-                  map_it_3D->second.second = nn.dist1;
-                  
-                  feature_in_correspondence[j_index ] = true;
-                }
-              }
-              else
-              {
-                corr_3D_to_2D.insert( std::make_pair( nn.nn_idx1, std::make_pair( j_index, nn.dist1 ) ) );
-                feature_in_correspondence[ j_index ] = true;
-                used_3D_points.insert( nn.nn_idx1 );
-              }
-            }
-          }
-        }
-
-        if( corr_3D_to_2D.size() >= max_cor_early_term )
-        {
-          nb_considered_points = nb_considered_points_counter;
-          break;
-        }
-      }
-      
-      ////
-      // check whether we have to compute correspondences from 3D-to-2D
-      if( corr_3D_to_2D.size() < max_cor_early_term )
-      {
-        ////
-        // perform the nn search in 3D to get new potential matches
-        
-        std::list< match_struct > point_to_image_matches;
-        point_to_image_matches.clear();
-        
-        for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D )
-        {
-          //// START ACTIVE SEARCH
-          int N3D_ = std::min( N_3D, (int) nb_points_per_component[ connected_component_id_per_point[ map_it_3D->first ] ] );
-          kd_trees[ connected_component_id_per_point[ map_it_3D->first ] ]->annkSearch( points3D[map_it_3D->first], N3D_, indices, distances );
-          
-          ////
-          // find new matching possibilities and insert them into the correct position 
-          // in the list
-
-          for( int kk=0; kk<N3D_; ++kk )
-          {
-            if( indices[kk] < 0 )
-              break;
-            
-            uint32_t candidate_point = indices_per_component[ connected_component_id_per_point[ map_it_3D->first ] ][ indices[kk] ];
-            
-            // check if we have already used or visited this 3D point (or promise to visit it later on
-            if( used_3D_points.find( candidate_point ) == used_3D_points.end() )
-            {
-              // visibility filter
-              if( filter_points && ( !set_intersection_test( images_per_point[candidate_point], images_per_point[ map_it_3D->first ] ) ) )
-                continue;
-              
-              // promise that we will (eventually) look at this 3D point
-              used_3D_points.insert(candidate_point);
-              
-              ////
-              // compute the matching cost of this particular 3D point
-              // therefore, we have to identify to which visual words (on a higher level)
-              // the descriptors of this point are assigned how many times
-              
-              match_struct new_match( candidate_point, 0, false );
-              
-              if( low_dim_choosen == 0 )
-              {
-                for( std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws )
-                  new_match.matching_cost += features_per_vw[ parents_at_level_2[ *it_vws ] ].size();
-              }
-              else
-              {
-                for( std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws )
-                  new_match.matching_cost += features_per_vw[ parents_at_level_3[ *it_vws ] ].size();
-              }
-              
-              // push back the new matching possibilities
-              point_to_image_matches.push_back( new_match );
-            }
-          }
-        }
-      
-        // sort the list in ascending number of search cost
-        point_to_image_matches.sort( cmp_priorities );
-        //
-        //// STOP ACTIVE SEARCH
-
-        ////
-        // do the 3D-to-2D matching
-        for( priorities_it = point_to_image_matches.begin(); priorities_it != point_to_image_matches.end(); ++priorities_it )
-        {
-          ////
-          // 3D-to-2D correspondence, handle it accordingly
-          uint32_t candidate_point = priorities_it->feature_id;
-          
-          // check if we have already found a correspondence for that 3D point
-          // if so, we don't need to find a new one since it was found during
-          // 2D-to-3D matching which we trust more
-          if( corr_3D_to_2D.find( candidate_point ) != corr_3D_to_2D.end() )
-            continue;
-            
-          
-          uint32_t nb_desc_for_point = (uint32_t) desc_per_point[ candidate_point ].size();
-          std::vector< uint32_t > low_dim_vw_ids( nb_desc_for_point );
-          
-              
-          // map all descriptors of that point to the lower dimensional descriptors
-          std::set< uint32_t > low_dim_vw;
-          low_dim_vw.clear();
-          
-          uint32_t counter = 0;
-
-          if( low_dim_choosen == 0 )
-          {
-            for( std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws, ++counter )
-            {
-              low_dim_vw_ids[counter] = parents_at_level_2[ *it_vws ];
-              low_dim_vw.insert( parents_at_level_2[ *it_vws ] );
-            }
-          }
-          else
-          {
-            for( std::vector< uint32_t >::const_iterator it_vws = vws_per_point[ candidate_point].begin(); it_vws != vws_per_point[ candidate_point].end(); ++it_vws, ++counter )
-            {
-              low_dim_vw_ids[counter] = parents_at_level_3[ *it_vws ];
-              low_dim_vw.insert( parents_at_level_3[ *it_vws ] );
-            }
-          }
-            
-          // try to find a new correspondence
-          nearest_neighbors_multiple nn_exp;
-          for( std::set< uint32_t >::const_iterator activated_vw = low_dim_vw.begin(); activated_vw != low_dim_vw.end(); ++activated_vw )
-          {
-            counter = 0;
-            for( std::vector< uint32_t >::const_iterator it_desc = desc_per_point[ candidate_point].begin(); it_desc != desc_per_point[ candidate_point].end(); ++it_desc, ++counter )
-            {
-              if( low_dim_vw_ids[counter] != *activated_vw )
-                continue;
-              
-              for( std::vector< uint32_t >::const_iterator feature_it = features_per_vw[ *activated_vw ].begin(); feature_it != features_per_vw[ * activated_vw ].end(); ++feature_it )
-              {
-                int dist = 0;
-                int x = 0;
-                for( uint32_t jj=0; jj<128; ++jj )
-                {
-                  x = ( (int) descriptors[*feature_it][jj] ) - ( (int) all_descriptors[ *it_desc + jj ] );
-                  dist += x*x;
-                }
-                
-                nn_exp.update( *feature_it, dist );
-              }
-            }
-          }
-            
-          if( nn_exp.dist1 >= 0 )
-          {
-            if( nn_exp.dist2 >= 0 )
-            {
-              if( nn_exp.get_ratio() < nn_ratio_3D_to_2D )
-              {
-                // we don't want to overwrite 2D-to-3D correspondence, only 3D-to-2D correspondence 
-                if( !feature_in_correspondence[ nn_exp.nn_idx1 ] )
-                {
-                  // no existing correspondence
-                  corr_3D_to_2D.insert( std::make_pair( candidate_point, std::make_pair( nn_exp.nn_idx1, nn_exp.dist1 ) ) );
-                  feature_in_correspondence[ nn_exp.nn_idx1 ] = true;
-                  point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
-                }
-                else if( point_per_feature[ nn_exp.nn_idx1 ] != UINT32_MAX )
-                {
-                  // only 3D-to-2D correspondence
-                  // overwrite if the absolute SIFT distance is smaller 
-                  
-                  // first, we to get an iterator to the corresponding 3D point
-                  map_it_3D = corr_3D_to_2D.find( point_per_feature[ nn_exp.nn_idx1 ] );
-                  
-                  // this has to exist, otherwise we would not have labeled it as having a correspondence
-                  if( map_it_3D->second.second > nn_exp.dist1 )
-                  {
-                    // update the correspondence
-                    
-                    // which means we first have to remove the old one
-                    corr_3D_to_2D.erase( map_it_3D );
-                    
-                    point_per_feature[ nn_exp.nn_idx1 ] = candidate_point;
-                    
-                    corr_3D_to_2D.insert( std::make_pair( candidate_point, std::make_pair( nn_exp.nn_idx1, nn_exp.dist1 ) ) );
-                  }
-                  
-                }
-              }
-            }
-          }
-            
-          if( corr_3D_to_2D.size() >= max_cor_early_term )
-          {
-            nb_considered_points = nb_considered_points_counter;
-            break;
-          }
-        }
-      }
+      std::cerr << " Some ERROR in getting the parents from level 3, stopping here " << std::endl;
+      return -1;
+    }
+  }
+ 
+  std::cout << "  done " << std::endl;
+    
+  
+  ////
+  // load the assignments of the 3D points to the visual words
+  
+  std::cout << "* Loading and parsing the assignments ... " << std::endl;
+  
+  // The descriptors and the assignments of (point id, descriptor id) pairs to visual words are
+  // memory mapped from the file generated by compute_desc_assignments and are used in place.
+  // For every point, the database also stores the ids of its descriptors together with the
+  // ids of the visual words these descriptors belong to.
+  uint32_t nb_non_empty_vw, nb_3D_points, nb_descriptors;
+  
+  {
+    if ( !loc_db.load( vw_assignments ) )
+    {
+      std::cerr << " ERROR: Cannot read the visual word assignments " << vw_assignments << std::endl;;
+      return 1;
+    }
+    
+    if( loc_db.get_nb_visual_words() != nb_clusters )
+    {
+      std::cerr << " ERROR: Number of clusters differs! " << loc_db.get_nb_visual_words() << " " << nb_clusters << std::endl;
+      return 1;
     }
-
     
-    if( nb_considered_points == 0 )
-      nb_considered_points = nb_loaded_keypoints;
+    if( loc_db.get_descriptor_type() != LOC_DB_UCHAR )
+    {
+      std::cerr << " ERROR: Active search requires descriptors stored as unsigned chars " << std::endl;
+      return 1;
+    }
     
+    nb_3D_points = loc_db.get_nb_points();
+    nb_non_empty_vw = loc_db.get_nb_non_empty_visual_words();
+    nb_descriptors = loc_db.get_nb_descriptors();
     
-    ////
-    // Establish the correspondences needed for RANSAC-based pose estimation
+    std::cout << "  Number of non-empty clusters: " << nb_non_empty_vw << " number of points : " << nb_3D_points << " number of descriptors: " << nb_descriptors << std::endl;
+    
+    // the kd-trees used for the 3D-to-2D search require the points in double precision
+    points3D = new ANNcoord*[nb_3D_points];
+    
+    for( uint32_t i=0; i<nb_3D_points; ++i )
+    {
+      points3D[i] = new ANNcoord[3];
+      const float *point_data = loc_db.get_point( i );
+      for( int j=0; j<3; ++j )
+        points3D[i][j] = (ANNcoord) point_data[j];
+    }
+    
+    std::cout << "  done loading and parsing the assignments " << std::endl;
+  }
+  
+  ////
+  // load information about the 3D points: 
+  // the connected component it belongs to and the ids of the images it is observed in.
+  // We either load these information from a file precomputed by compute_scene_graph or
+  // obtain them by parsing a Bundler file
+  if( scene_graph::is_scene_graph_file( bundle_file ) )
+  {
+    std::cout << "  Loading the scene graph from " << bundle_file << std::endl;
+    if( !visibility_graph.load( bundle_file ) )
+      return -1;
     
-    if( ransac_filter == 1 )  
+    if( visibility_graph.uses_image_set_cover() != use_image_set_cover || ( use_image_set_cover && visibility_graph.get_nb_cams_set_cover() != consider_K_nearest_cams ) )
     {
-      ////
-      // Apply the RANSAC Pre-filter
-      uint32_t max_set_size = 0;
-     
-      uint32_t nb_found_corr = (uint32_t) corr_3D_to_2D.size();
-      
-      // map found points to index range 0...N (actually the other direction)
-      std::vector< uint32_t > index_to_point( nb_found_corr, 0 );
-      
-      // go through all points found as correspondences, establish edges in the form of images
-      std::map< uint32_t, std::list< uint32_t > > image_edges;
-      image_edges.clear();
-      
-      uint32_t point_counter = 0;
-      
-      std::map< uint32_t, std::list< uint32_t > >::iterator it;
+      std::cerr << " ERROR: The scene graph " << bundle_file << " was computed with image_set_cover " << visibility_graph.uses_image_set_cover() << " and nb_cams_set_cover " << visibility_graph.get_nb_cams_set_cover() << ", please recompute it with compute_scene_graph " << std::endl;
+      return -1;
+    }
+    
+    std::cout << "   " << visibility_graph.get_nb_components() << " connected components, set cover contains " << visibility_graph.get_set_cover_size() << " cameras out of " << visibility_graph.get_nb_cameras() << std::endl;
+  }
+  else
+  {
+    // parse the reconstruction
+    parse_bundler parser;
+    if( !parser.parse_data( bundle_file.c_str(), 0 ) )
+    {
+      std::cerr << " ERROR: Could not parse the bundler file " << bundle_file << std::endl;
+      return -1;
+    }
+    
+    if( !visibility_graph.compute( parser, use_image_set_cover, consider_K_nearest_cams ) )
+      return -1;
       
-      for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D, ++point_counter )
+    parser.clear();
+  }
+  
+  if( visibility_graph.get_nb_points() != nb_3D_points )
+  {
+    std::cerr << " ERROR: The number of points in the binary file ( " << nb_3D_points << " ) and in the reconstruction ( " << visibility_graph.get_nb_points() << " ) differ!" << std::endl;
+    return -1;
+  }
+  
+  // for every 3D point, the id of its connected component
+  const std::vector< uint32_t > &connected_component_id_per_point = visibility_graph.get_component_ids();
+  
+  
+  ////
+  // load the precomputed neighborhoods of the 3D points, they replace the search in the kd-trees
+  if( !neighborhoods_file.empty() )
+  {
+    std::cout << " * loading the neighborhoods of the 3D points from " << neighborhoods_file << std::endl;
+    if( !neighborhoods.load( neighborhoods_file ) )
+      return -1;
+    
+    if( neighborhoods.get_nb_points() != nb_3D_points )
+    {
+      std::cerr << " ERROR: The number of points in the binary file ( " << nb_3D_points << " ) and in the neighborhoods ( " << neighborhoods.get_nb_points() << " ) differ!" << std::endl;
+      return -1;
+    }
+    
+    // filtered neighborhoods can only be used with the same parameters they were computed with
+    if( neighborhoods.is_filtered() )
+    {
+      if( !filter_points || neighborhoods.get_nb_neighbors() != (uint32_t) N_3D || neighborhoods.uses_image_set_cover() != use_image_set_cover || ( use_image_set_cover && neighborhoods.get_nb_cams_set_cover() != consider_K_nearest_cams ) )
       {
-        
-        index_to_point[ point_counter ] = map_it_3D->first;
-        
-        for( std::set< uint32_t >::const_iterator it_images_point = images_per_point[ map_it_3D->first ].begin(); it_images_point != images_per_point[ map_it_3D->first ].end(); ++it_images_point )
-        {
-          it = image_edges.find( *it_images_point );
-          
-          if( it != image_edges.end() )
-            it->second.push_back( point_counter );
-          else
-          {
-            std::list< uint32_t > new_edge( 1, point_counter );
-            image_edges.insert( std::make_pair( *it_images_point, new_edge ) );
-          }
-        }
+        std::cerr << " ERROR: The neighborhoods " << neighborhoods_file << " were filtered using N_3D " << neighborhoods.get_nb_neighbors() << ", image_set_cover " << neighborhoods.uses_image_set_cover() << " and nb_cams_set_cover " << neighborhoods.get_nb_cams_set_cover() << ", please recompute them with compute_point_neighborhoods " << std::endl;
+        return -1;
       }
-      
-      ////
-      // now find connected components, for every point, keep track which points belong to which connected component
-      // also keep track of which images have been used
-      
-      std::vector< int > cc_per_corr( nb_found_corr, -1 );
-      int current_cc = -1;
-      int max_cc = -1;
-      uint32_t size_current_cc = 0;
-      
-      std::set< uint32_t >::const_iterator img_it;
-      
-      for( point_counter = 0; point_counter < nb_found_corr; ++point_counter )
+    }
+    else if( neighborhoods.get_nb_neighbors() < (uint32_t) N_3D )
+    {
+      std::cerr << " ERROR: The neighborhoods " << neighborhoods_file << " only contain " << neighborhoods.get_nb_neighbors() << " neighbors per point, please recompute them with compute_point_neighborhoods " << std::endl;
+      return -1;
+    }
+    
+    use_precomputed_neighborhoods = true;
+    std::cout << "  done " << std::endl;
+  }
+  
+  ////
+  // create the kd-trees for the 3D points to enable search in 3D, one for each connected component
+  // (not needed if the neighborhoods are precomputed)
+  
+  // get the number of connected components
+  uint32_t nb_connected_components = *std::max_element( connected_component_id_per_point.begin(), connected_component_id_per_point.end() );
+  nb_connected_components += 1;
+  
+  // for every connected component, get the number of points in it
+  nb_points_per_component.assign( nb_connected_components, 0 );
+  for( std::vector< uint32_t >::const_iterator it = connected_component_id_per_point.begin(); it != connected_component_id_per_point.end(); ++it )
+    nb_points_per_component[ *it ] += 1;
+  
+  // for every connected component, get pointers to its 3D points
+  std::vector< double** > points_per_component( nb_connected_components, 0 );
+  
+  if( !use_precomputed_neighborhoods )
+  {
+    std::cout << " * creating kd-trees for 3D points, one for each of the " << nb_connected_components << " connected components " << std::endl;
+    
+    indices_per_component.assign( nb_connected_components, 0 );
+    
+    // store pointers to the appropriate points
+    {
+      std::vector< uint32_t > cc_point_counter( nb_connected_components, 0 );
+    
+      for( uint32_t i=0; i<nb_connected_components; ++i )
       {
-        if( cc_per_corr[ point_counter ] < 0 )
-        {
-          // start new cc
-          ++current_cc;
-          size_current_cc = 0;
-        
-          std::queue< uint32_t > point_queue;
-          point_queue.push( point_counter );
-          
-          // breadth first search for remaining points in connected component
-          while( !point_queue.empty() )
-          {
-            uint32_t curr_point_id = point_queue.front();
-            point_queue.pop();
-            
-            if( cc_per_corr[ curr_point_id ] < 0 )
-            {
-              cc_per_corr[ curr_point_id ] = current_cc;
-              ++size_current_cc;
-              
-              // add all points in images visible by this point
-              for( std::set< uint32_t >::const_iterator it_images_point = images_per_point[ index_to_point[ curr_point_id ] ].begin(); it_images_point != images_per_point[ index_to_point[ curr_point_id ] ].end(); ++it_images_point )
-              {
-                it = image_edges.find( *it_images_point );
-                
-                for( std::list< uint32_t >::const_iterator p_it = it->second.begin(); p_it != it->second.end(); ++p_it )
-                {
-                  if( cc_per_corr[ *p_it ] < 0 )
-                    point_queue.push( *p_it );
-                }
-                
-                // clear the image, we do not the this multi-edge anymore
-                it->second.clear();
-              }
-            }
-          }
-          
-          if( size_current_cc > max_set_size )
-          {
-            max_set_size = size_current_cc;
-            max_cc = current_cc;
-          }
-         
-        }
+        points_per_component[i] = new double*[ nb_points_per_component[i] ];
+        indices_per_component[i] = new uint32_t[ nb_points_per_component[i] ];
       }
-      
-      
-      ////
-      // now generate the correspondences
-      
-      c2D.reserve( 2*max_set_size );
-      c3D.reserve( 3*max_set_size );
-      
-      point_counter = 0;
-      for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D, ++point_counter )
+    
+      for( uint32_t i=0; i<nb_3D_points; ++i )
       {
-        if( cc_per_corr[ point_counter ] == max_cc )
-        {
-          c2D.push_back(keypoints[map_it_3D->second.first].x);
-          c2D.push_back(keypoints[map_it_3D->second.first].y);
-          
-          c3D.push_back( points3D[map_it_3D->first][0] );
-          c3D.push_back( points3D[map_it_3D->first][1] );
-          c3D.push_back( points3D[map_it_3D->first][2] );
-          
-          final_correspondences.push_back( std::make_pair( map_it_3D->second.first, map_it_3D->first ) );
-        }
+        uint32_t cc_id = connected_component_id_per_point[i];
+        points_per_component[ cc_id ][ cc_point_counter[ cc_id ] ] = points3D[i];
+        indices_per_component[ cc_id ][ cc_point_counter[ cc_id ] ] = i;
+        cc_point_counter[ cc_id ] += 1;
       }
- 
     }
-    else
+    
+    // create the trees
+    kd_trees.assign( nb_connected_components, 0 );
+    
+    for( uint32_t i=0; i<nb_connected_components; ++i )
     {
-      // normal correspondence computation
-      // get the correspondences
-      for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D )
-      {
-        c2D.push_back(keypoints[map_it_3D->second.first].x);
-        c2D.push_back(keypoints[map_it_3D->second.first].y);
-        
-        c3D.push_back( points3D[map_it_3D->first][0] );
-        c3D.push_back( points3D[map_it_3D->first][1] );
-        c3D.push_back( points3D[map_it_3D->first][2] );
-        
-        final_correspondences.push_back( std::make_pair( map_it_3D->second.first, map_it_3D->first ) );
-      }
+      int nb_points_3D_int = (int) nb_points_per_component[i];
+      kd_trees[i] = new ANNkd_tree( points_per_component[i], nb_points_3D_int, 3 );
     }
-      
-    timer.Stop();
-    std::cout << " computed correspondences in " << timer.GetElapsedTimeAsString() << ", considering " << nb_considered_points << " features " << " ( " << double(nb_considered_points) / double(nb_loaded_keypoints) * 100.0 << " % ) " << std::endl;
-    corr_time = timer.GetElapsedTime();
-    
-   
-    ////
-    // do the pose verification using RANSAC
-      
-    RANSAC::computation_type = P6pt;
-    RANSAC::stop_after_n_secs = true;
-    RANSAC::max_time = ransac_max_time;
-    RANSAC::error = 10.0f; // for P6pt this is the SQUARED reprojection error in pixels
-    RANSAC ransac_solver;
     
-    uint32_t nb_corr = c2D.size() / 2;
+    // and the search structures
+    annMaxPtsVisit( 0 );
     
+    std::cout << "  done " << std::endl;
+  }
   
-    std::cout << " applying RANSAC on " << nb_corr << " correspondences out of " << corr_3D_to_2D.size() << std::endl;
-    timer.Init();
-    timer.Start();
-    ransac_solver.apply_RANSAC( c2D, c3D, nb_corr, std::max( float( minimal_RANSAC_solution ) / float( nb_corr ), min_inlier ) ); 
-    timer.Stop();
-    RANSAC_time = timer.GetElapsedTime();
+  // the RANSAC parameters are the same for all images, every RANSAC instance gets its own copy
+  // P3P is used for all images whose focal length is known from the exif tag, P6pt for all others
+  ransac_parameters.computation_type = P3P;
+  ransac_parameters.stop_after_n_secs = true;
+  ransac_parameters.max_time = ransac_max_time;
+  ransac_parameters.error = 10.0f; // for P6pt and P3P this is the SQUARED reprojection error in pixels
+  ransac_parameters.nb_threads = nb_ransac_threads;
+  if( nb_ransac_threads > 1 )
+    std::cout << " Using " << nb_ransac_threads << " threads in RANSAC " << std::endl;
+  
+  vw_handler.set_nb_threads( (int) nb_flann_threads );
+  if( nb_flann_threads > 1 )
+    std::cout << " Using " << nb_flann_threads << " threads to search with FLANN " << std::endl;
+  if( query_latency_budget > 0.0 )
+    std::cout << " Latency budget of " << query_latency_budget * 1000.0 << " ms per query " << std::endl;
+  
+  // the output of RANSAC would be interleaved
+  if( nb_threads > 1 )
+    ransac_parameters.silent = true;
+  
+  ////
+  // in server mode, we answer the requests received on the socket instead of localizing the images in the list
+  if( !server_socket.empty() )
+  {
+    std::ofstream ofs( outfile.c_str(), std::ios::out );
     
-    all_timer.Stop();
+    if( !ofs.is_open() )
+    {
+      std::cerr << " Could not write results to " << outfile << std::endl;
+      return 1;
+    }
     
-    // output the solution:
-    std::cout << "#### found solution ####" << std::endl;
-    std::cout << " needed time: " << all_timer.GetElapsedTimeAsString() << std::endl;
+    // protects the output and the results file
+    std::mutex output_mutex;
+    uint32_t nb_requests = 0;
     
-    // get the solution from RANSAC
-    std::vector< uint32_t > inlier;
+    bool server_ok = run_localization_server( server_socket, nb_threads, [&]( std::vector< SIFT_keypoint > &keypoints, const SIFT_descriptor_view &descriptors, int img_width, int img_height, localization_response &response )
+    {
+      query_result result;
+      latency_budget budget( query_latency_budget );
+      // the requests do not contain a focal length, so P6pt is used
+      localize_features( keypoints, descriptors, img_width, img_height, -1.0f, budget, result.log, result );
+      
+      if( result.deadline_reached )
+        response.status = LOC_SERVER_DEADLINE_REACHED;
+      response.nb_corr = result.nb_corr;
+      response.nb_inlier = result.nb_inlier;
+      response.registered = ( result.nb_inlier >= minimal_RANSAC_solution ) ? 1 : 0;
+      for( int r=0; r<3; ++r )
+      {
+        for( int c=0; c<4; ++c )
+          response.projection_matrix[4*r+c] = result.proj_matrix( r, c );
+        for( int c=0; c<3; ++c )
+        {
+          response.calibration[3*r+c] = result.calibration( r, c );
+          response.rotation[3*r+c] = result.rotation( r, c );
+        }
+        response.position[r] = result.proj_matrix.m_center[r];
+      }
+      response.vw_time = result.vw_time;
+      response.corr_time = result.corr_time;
+      response.RANSAC_time = result.RANSAC_time;
+      response.total_time = result.total_time;
+      
+      std::lock_guard< std::mutex > lock( output_mutex );
+      ++nb_requests;
+      std::cout << std::endl << " --------- request " << nb_requests << " --------- " << std::endl << result.log.str();
+      ofs << result.nb_inlier << " " << result.nb_corr << " " << result.vw_time << " " << result.corr_time << " " << result.RANSAC_time << " " << result.total_time << std::endl;
+    } );
+    
+    ofs.close();
+    return server_ok ? 0 : 1;
+  }
+ 
+  
+  ////
+  // now load the filenames of the query images
+  std::vector< std::string > key_filenames;
+  key_filenames.clear();
+  {
+    std::ifstream ifs( keylist.c_str(), std::ios::in );
+    std::string tmp_string;
     
-    inlier.assign( ransac_solver.get_inliers().begin(), ransac_solver.get_inliers().end()  );
+    while( !ifs.eof() )
+    {
+      tmp_string = "";
+      ifs >> tmp_string;
+      if( !tmp_string.empty() )
+      {
+        key_filenames.push_back(tmp_string);
+      }
+    }
+    ifs.close();
+    std::cout << " done loading " << key_filenames.size() << " keyfile names " << std::endl;
+  }
+  
+  uint32_t nb_keyfiles = key_filenames.size();
+  
+  ////
+  // do the actual localization
+  double avrg_reg_time = 0.0;
+  double avrg_reject_time = 0.0;
+  double avrg_vw_time = 0.0;
+  double avrg_nb_features = 0.0;
+  double avrg_cor_computation_time_accepted = 0.0;
+  double avrg_cor_computation_time_rejected = 0.0;
+  double N = 0.0;
+  double N_reject = 0.0;
+  double mean_inlier_ratio_accepted = 0.0;
+  double mean_inlier_ratio_rejected = 0.0;
+  double mean_nb_correspondences_accepted = 0.0;
+  double mean_nb_correspondences_rejected = 0.0;
+  double mean_nb_features_accepted = 0.0;
+  double mean_nb_features_rejected = 0.0;
+  double avrg_RANSAC_time_registered = 0.0;
+  double avrg_RANSAC_time_rejected = 0.0;
+  double mean_assignment_time_QE = 0.0;
+  double mean_QE_time = 0.0;
+  
+  
+  
+  
+  std::ofstream ofs( outfile.c_str(), std::ios::out );
     
-    Util::Math::ProjMatrix proj_matrix = ransac_solver.get_projection_matrix();
-    Util::Math::ProjMatrix proj_matrix2 = ransac_solver.get_projection_matrix();
+  if( !ofs.is_open() )
+  {
+    std::cerr << " Could not write results to " << outfile << std::endl;
+    return 1;
+  }
+  
+  
+  uint32_t registered = 0;
+  uint32_t nb_stopped_early = 0;
+  
+  if( nb_threads > 1 )
+    std::cout << " Localizing up to " << nb_threads << " query images in parallel " << std::endl;
+  
+  std::vector< query_result > query_results( nb_keyfiles );
+  
+  // localize the query images, the results are written and the statistics are updated in the order of the list
+  process_queries( nb_keyfiles, nb_threads, [&]( uint32_t i, uint32_t )
+  {
+    std::ostream &out = ( nb_threads > 1 ) ? query_results[i].log : std::cout;
+    out << std::endl << " --------- " << i+1 << " / " << nb_keyfiles << " --------- " << std::endl;
+    localize_query( key_filenames[i], out, query_results[i] );
+  },
+  [&]( uint32_t i )
+  {
+    query_result &result = query_results[i];
+    if( nb_threads > 1 )
+    {
+      std::cout << result.log.str();
+      result.log.str( "" );
+    }
     
-    // decompose the projection matrix
-    Util::Math::Matrix3x3 Rot, K;
-    proj_matrix.decompose( K, Rot );
-    proj_matrix.computeInverse();
-    proj_matrix.computeCenter();
-    std::cout << " camera calibration: " << K << std::endl;
-    std::cout << " camera rotation: " << Rot << std::endl;
-    std::cout << " camera position: " << proj_matrix.m_center << std::endl;
+    uint32_t nb_inlier = result.nb_inlier;
+    uint32_t nb_corr = result.nb_corr;
+    uint32_t nb_loaded_keypoints = result.nb_features;
+    double corr_time = result.corr_time;
+    double RANSAC_time = result.RANSAC_time;
     
     // write details to the details file. per line:
     // #inlier #correspondences time for vw time for corr time for ransac
-    ofs << inlier.size() << " " << nb_corr << " " << vw_time << " " << corr_time << " " << RANSAC_time << " " << all_timer.GetElapsedTime() << std::endl;
+    ofs << nb_inlier << " " << nb_corr << " " << result.vw_time << " " << corr_time << " " << RANSAC_time << " " << result.total_time << std::endl;
     
-    std::cout << "#########################" << std::endl;
+    avrg_vw_time = avrg_vw_time * N / (N+1.0) + result.vw_time / (N+1.0);
+    avrg_nb_features = avrg_nb_features * N / (N+1.0) + double(nb_loaded_keypoints) / (N+1.0);
+    if( result.deadline_reached )
+      ++nb_stopped_early;
     
     ////
     // Update statistics
     
-    if( inlier.size() >= minimal_RANSAC_solution )
+    if( nb_inlier >= minimal_RANSAC_solution )
     {
       double N_reg = registered;
-      avrg_reg_time = avrg_reg_time * N_reg / (N_reg+1.0) + all_timer.GetElapsedTime() / (N_reg+1.0);
-      mean_inlier_ratio_accepted = mean_inlier_ratio_accepted * N_reg / (N_reg+1.0) + double(inlier.size()) / (double( nb_corr ) * (N_reg+1.0));
+      avrg_reg_time = avrg_reg_time * N_reg / (N_reg+1.0) + result.total_time / (N_reg+1.0);
+      mean_inlier_ratio_accepted = mean_inlier_ratio_accepted * N_reg / (N_reg+1.0) + double(nb_inlier) / (double( nb_corr ) * (N_reg+1.0));
       mean_nb_correspondences_accepted = mean_nb_correspondences_accepted * N_reg / (N_reg+1.0) + double(nb_corr) / (N_reg+1.0);
       mean_nb_features_accepted = mean_nb_features_accepted * N_reg / (N_reg+1.0) + double(nb_loaded_keypoints) / (N_reg+1.0);
       avrg_cor_computation_time_accepted = avrg_cor_computation_time_accepted * N_reg /(N_reg+1.0) + corr_time / (N_reg+1.0);
@@ -2122,8 +2330,8 @@ int main (int argc, char **argv)
     }
     else
     {
-      avrg_reject_time = avrg_reject_time * N_reject / (N_reject+1.0) + all_timer.GetElapsedTime() / (N_reject+1.0);
-      mean_inlier_ratio_rejected = mean_inlier_ratio_rejected * N_reject / (N_reject+1.0) + double(inlier.size()) / (double( nb_corr ) * (N_reject+1.0));
+      avrg_reject_time = avrg_reject_time * N_reject / (N_reject+1.0) + result.total_time / (N_reject+1.0);
+      mean_inlier_ratio_rejected = mean_inlier_ratio_rejected * N_reject / (N_reject+1.0) + double(nb_inlier) / (double( nb_corr ) * (N_reject+1.0));
       mean_nb_correspondences_rejected = mean_nb_correspondences_rejected * N_reject / (N_reject+1.0) + double(nb_corr) / (N_reject+1.0);
       mean_nb_features_rejected = mean_nb_features_rejected * N_reject / (N_reject+1.0) + double(nb_loaded_keypoints) / (N_reject+1.0);
       avrg_cor_computation_time_rejected = avrg_cor_computation_time_rejected * N_reject /(N_reject+1.0) + corr_time / (N_reject+1.0);
@@ -2131,23 +2339,12 @@ int main (int argc, char **argv)
       N_reject += 1.0;
     }
     
-    // clean up
-    
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      if( descriptors[j] != 0 )
-        delete [] descriptors[j];
-      descriptors[j] = 0;
-    }
-
-    descriptors.clear();
-    keypoints.clear();
-    inlier.clear();
+    N += 1.0;
     
     std::cout << std::endl << std::endl << " registered so far: " << registered << " / " << i+1 << std::endl;
     std::cout << " average time needed to compute the correspondences: registered: " << avrg_cor_computation_time_accepted << " rejected: " << avrg_cor_computation_time_rejected << std::endl;
     std::cout << "avrg. registration time: " << avrg_reg_time << " ( " << registered << " , avrg. inlier-ratio: " << mean_inlier_ratio_accepted << ", avrg. nb correspondences : " << mean_nb_correspondences_accepted << " ) avrg. rejection time: " << avrg_reject_time << " ( " << N_reject << ", avrg. inlier-ratio : " << mean_inlier_ratio_rejected << " avrg. nb correspondences : " << mean_nb_correspondences_rejected << " ) " << std::endl << std::endl;
-  }
+  } );
   
   ////
   // Overall statistics
@@ -2169,6 +2366,8 @@ int main (int argc, char **argv)
   std::cout << " avrg. time for RANSAC (rejected)                       : " << avrg_RANSAC_time_rejected << std::endl;
   std::cout << " minimum inlier-ratio for RANSAC                        : " << min_inlier << std::endl;
   std::cout << " stop after n correspondences                           : " << max_cor_early_term << std::endl;
+  if( query_latency_budget > 0.0 )
+    std::cout << " queries stopped by the latency budget                  : " << nb_stopped_early << " ( budget " << query_latency_budget * 1000.0 << " ms ) " << std::endl;
   std::cout << " model consists of                                      : " << nb_descriptors << " ";
   std::cout << "unsigned char descriptors " << std::endl;
   if( ransac_filter > 0 )
@@ -2192,7 +2391,7 @@ int main (int argc, char **argv)
   ofs.close();
 
   // delete kd-trees
-  for( uint32_t i=0; i<nb_connected_components; ++i )
+  for( uint32_t i=0; i<kd_trees.size(); ++i )
   {
     for( uint32_t j=0; j<nb_points_per_component[i]; ++j )
       points_per_component[i][j] = 0;
@@ -2213,18 +2412,12 @@ int main (int argc, char **argv)
   delete [] points3D;
   points3D = 0;
   
-  for( uint32_t i=0; i<nb_connected_components; ++i )
+  for( uint32_t i=0; i<kd_trees.size(); ++i )
   {
     delete kd_trees[i];
     kd_trees[i] = 0;
   }
   
-  delete kd_tree;
-  kd_tree = 0;
-  
-  delete [] indices;
-  delete [] distances;
-  
   delete [] parents_at_level_2;
   parents_at_level_2 = 0;
   
@@ -2233,10 +2426,7 @@ int main (int argc, char **argv)
   
   annClose();
   
-
-  for( uint32_t i=0; i<nb_3D_points; ++i )
-    images_per_point[i].clear();
-  images_per_point.clear();
+  visibility_graph.clear();
   
   return 0;
 }
@@ -40,10 +40,12 @@
 #include <cmath>
 #include <sstream>
 #include <stdio.h>
+#include <mutex>
 
 // includes for classes dealing with SIFT-features
 #include "features/SIFT_loader.hh"
 #include "features/visual_words_handler.hh"
+#include "features/localization_database.hh"
 
 // stopwatch
 #include "timer.hh"
@@ -65,6 +67,9 @@
 // the ANN library
 #include <ANN/ANN.h>
 
+// parallel processing of the query images
+#include "query_processing.hh"
+
 ////
 // constants
 ////
@@ -78,6 +83,297 @@ float min_inlier = 0.0f;
 // float min_inlier = 0.0f;
 double ransac_max_time = 60.0; // run RANSAC max 1m;
 
+// the parameters of RANSAC, set once in main() and only read afterwards
+ransac_config ransac_parameters;
+
+// the latency budget of a single query in seconds, not limited if 0
+double query_latency_budget = 0.0;
+
+////
+// the model and the parameters shared by all query images,
+// they are not modified while the query images are localized
+////
+
+// the 3D points and the descriptors
+localization_database loc_db;
+
+// the id of the 3D point for every descriptor
+std::vector< uint32_t > point_id_per_descriptor;
+
+// the search structure: flann (methods 0, 3) or ANN (methods 1, 2)
+int method = 0;
+visual_words_handler vw_handler;
+ANNkd_tree *kd_tree = 0;
+
+// both flann (through the internal buffers of the visual words handler) and ANN (through global
+// variables) can only be used by one thread at a time
+std::mutex search_mutex;
+
+// the results of localizing a single query image
+struct query_result
+{
+  uint32_t nb_features;
+  uint32_t nb_inlier;
+  uint32_t nb_corr;
+  double vw_time;
+  double corr_time;
+  double RANSAC_time;
+  double total_time;
+  
+  // true if the latency budget (or the time limit of RANSAC) stopped the localization early
+  bool deadline_reached;
+  
+  // the output generated while localizing the image, used when several threads localize images in parallel
+  std::ostringstream log;
+};
+
+//---------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+////
+// Localizes a single query image, given by the filename of its keyfile. All stages stop at the
+// deadline of the latency budget. All output is written to out, the results are stored in result.
+////
+
+void localize_query( const std::string &key_filename, std::ostream &out, query_result &result )
+{
+  // the budget includes loading the features
+  latency_budget budget( query_latency_budget );
+  
+  // load the features
+  SIFT_loader key_loader;
+  out << key_filename << std::endl;
+  key_loader.load_features( key_filename.c_str(), LOWE );
+  
+  SIFT_descriptor_view descriptors = key_loader.get_descriptor_view();
+  std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
+  
+  uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
+  
+ 
+  // center the keypoints around the center of the image
+  // first we need to get the dimensions of the image
+  int img_width, img_height;
+  float focal_length;
+  std::string jpg_filename( key_filename );
+  jpg_filename.replace( jpg_filename.size()-3,3,"jpg");
+  exif_reader::open_exif( jpg_filename.c_str() );
+  img_width = exif_reader::get_image_width();
+  img_height = exif_reader::get_image_height();
+  focal_length = exif_reader::get_focal_length_in_pixels();
+  exif_reader::close_exif();
+  
+  for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
+  {
+    keypoints[j].x -= (img_width-1.0)/2.0f; 
+    keypoints[j].y = (img_height-1.0)/2.0f - keypoints[j].y; 
+  }
+  
+  out << " loaded " << nb_loaded_keypoints << " descriptors" << std::endl;
+  
+  ////
+  // compute the two nearest neighbors
+
+  Timer timer;
+  timer.Init();
+  timer.Start();
+  
+  // the indices of the 2 nearest neighbors and the squared Euclidean distances to them
+  std::vector< uint32_t > computed_assignments( 2*nb_loaded_keypoints, 0 );
+  std::vector< float > computed_squared_distances( 2*nb_loaded_keypoints, 0 );
+  
+  // the number of features whose nearest neighbors were searched before the deadline of the search
+  uint32_t nb_searched_features = 0;
+  
+  // search for the nearest neighbors
+  std::unique_lock< std::mutex > search_lock( search_mutex );
+  DeadlineChecker search_deadline( budget.get_search_deadline() );
+  // the query might have waited for the search structure so long that there is no time left to search
+  if( search_deadline.Expired() )
+    out << " no time left to search " << std::endl;
+  else if( method == 0 || method == 3 )
+  {
+    vw_handler.k_nn_search_flann_uchar( descriptors.data, nb_loaded_keypoints, computed_assignments, computed_squared_distances );
+    nb_searched_features = nb_loaded_keypoints;
+  }
+  else
+  {
+    ANNcoord ann_query_descriptor[128];
+    ANNidx indices[2];
+    ANNdist distances[2];
+    uint32_t index_ = 0;
+    for( uint32_t j=0; j<nb_loaded_keypoints; ++j, ++nb_searched_features )
+    {
+      if( search_deadline.Expired() )
+        break;
+      
+      index_ = 2*j;
+      if( method == 1 )
+      {
+        for( int k=0; k<128; ++k )
+          ann_query_descriptor[k] = (float) descriptors[j][k];
+      }
+      else if( method == 2 )
+      {
+        float length = 0.0f;
+        for( int k=0; k<128; ++k )
+        {
+          ann_query_descriptor[k] = (float) descriptors[j][k];
+          length += ann_query_descriptor[k] * ann_query_descriptor[k];
+        }
+        length = sqrt( length );
+        for( int k=0; k<128; ++k )
+          ann_query_descriptor[k] /= length;
+      }
+      
+      kd_tree->annkPriSearch(ann_query_descriptor, 2, indices, distances);
+      computed_assignments[index_] = (uint32_t) indices[0];
+      computed_assignments[index_+1] = (uint32_t) indices[1];
+      computed_squared_distances[index_] = distances[0];
+      computed_squared_distances[index_+1] = distances[1];
+    }
+  }
+  search_lock.unlock();
+  
+  timer.Stop();
+  
+  out << " computed 2-nn in " << timer.GetElapsedTimeAsString() << std::endl;
+  bool search_deadline_reached = ( nb_searched_features < nb_loaded_keypoints );
+  if( search_deadline_reached )
+    out << " reached the deadline of the search after " << nb_searched_features << " features " << std::endl;
+  result.nb_features = nb_loaded_keypoints;
+  result.vw_time = timer.GetElapsedTime();
+  
+  ////
+  // establish 2D-3D correspondences by using the computed nearest neighbors
+  timer.Init();
+  timer.Start();
+  Timer all_timer;
+  all_timer.Init();
+  all_timer.Start();
+  
+  // we store for each 3D point the corresponding 2D feature as well as the squared distance
+  // this is needed in case that two 2D features are assigned to one 3D point, because
+  // we only want to keep the correspondence to the 2D point with the most similar descriptor
+  // i.e. the smallest Euclidean distance in descriptor space
+  std::map< uint32_t, std::pair< uint32_t, float > > corr_3D_to_2D;
+  corr_3D_to_2D.clear();
+  
+  std::map< uint32_t, std::pair< uint32_t, float > >::iterator map_it_3D;
+  
+  for( size_t j=0; j<nb_searched_features; ++j )
+  {
+    uint32_t index = 2*j;
+    uint32_t nn = point_id_per_descriptor[computed_assignments[ index ]];
+    // compute the SIFT-ratio
+    float ratio = computed_squared_distances[index] / computed_squared_distances[index+1];
+    
+    if( ratio < nn_ratio )
+    {
+      // we found one, so we need check for mutual nearest neighbors
+      map_it_3D = corr_3D_to_2D.find( nn );
+    
+      if( map_it_3D != corr_3D_to_2D.end() )
+      {
+        if( map_it_3D->second.second > computed_squared_distances[index] )
+        {
+          map_it_3D->second.first = j;
+          map_it_3D->second.second = computed_squared_distances[index];
+        }
+      }
+      else
+      {
+        corr_3D_to_2D.insert( std::make_pair( nn, std::make_pair( j, computed_squared_distances[index] ) ) );
+      }
+    }
+  }
+
+  ////
+  // compute and store the correspondences such that we can easily hand them over to RANSAC
+  
+  // store the correspondences for RANSAC
+  // the SIFT ratios of the matches are used to guide the sampling of RANSAC
+  std::vector< float > c2D, c3D, corr_ratios;
+  c2D.clear();
+  c3D.clear();
+  corr_ratios.clear();
+  
+  std::vector< std::pair< uint32_t, uint32_t > > final_correspondences; // first the 2D, then the 3D point
+  final_correspondences.clear();
+  
+  // the 2D and 3D positions of features and points are simply concatenated into 2 vectors
+  for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D )
+  {
+    c2D.push_back(keypoints[map_it_3D->second.first].x);
+    c2D.push_back(keypoints[map_it_3D->second.first].y);
+    
+    c3D.push_back( loc_db.get_point( map_it_3D->first )[0] );
+    c3D.push_back( loc_db.get_point( map_it_3D->first )[1] );
+    c3D.push_back( loc_db.get_point( map_it_3D->first )[2] );
+    
+    corr_ratios.push_back( computed_squared_distances[2*map_it_3D->second.first] / computed_squared_distances[2*map_it_3D->second.first+1] );
+    
+    final_correspondences.push_back( std::make_pair( map_it_3D->second.first, map_it_3D->first ) );
+  }
+  
+  timer.Stop();
+  out << " computed correspondences in " << timer.GetElapsedTimeAsString() << std::endl;
+  result.corr_time = timer.GetElapsedTime();
+  
+  uint32_t nb_corr = c2D.size() / 2;
+  
+  ////
+  // do the pose verification using RANSAC
+    
+  RANSAC ransac_solver( ransac_parameters );
+  ransac_solver.set_focal_length( focal_length );
+  ransac_solver.set_deadline( budget.get_deadline() );
+ 
+  out << " applying RANSAC on " << nb_corr << std::endl;
+  if( focal_length > 0.0f )
+    out << " using P3P with a focal length of " << focal_length << " pixels " << std::endl;
+  timer.Init();
+  timer.Start();
+  ransac_solver.apply_RANSAC( c2D, c3D, nb_corr, std::min( std::max( float( minimal_RANSAC_solution ) / float( nb_corr ), min_inlier ), 1.0f ), &corr_ratios ); 
+  timer.Stop();
+  result.RANSAC_time = timer.GetElapsedTime();
+  
+  all_timer.Stop();
+  
+  // output the solution:
+  out << "#### found solution ####" << std::endl;
+  out << " needed time: " << all_timer.GetElapsedTimeAsString() << std::endl;
+  
+  // get the solution from RANSAC
+  
+  std::vector< uint32_t > inliers;
+  
+  inliers.assign( ransac_solver.get_inliers().begin(), ransac_solver.get_inliers().end()  );
+  
+  result.nb_inlier = inliers.size();
+  result.nb_corr = nb_corr;
+  result.total_time = all_timer.GetElapsedTime();
+  result.deadline_reached = search_deadline_reached || ransac_solver.reached_time_limit();
+  if( result.deadline_reached )
+    out << " WARNING: the localization was stopped early, the pose is the best one found so far " << std::endl;
+  
+  Util::Math::ProjMatrix proj_matrix = ransac_solver.get_projection_matrix();
+  
+  // decompose the projection matrix
+  Util::Math::Matrix3x3 Rot, K;
+  proj_matrix.decompose( K, Rot );
+  proj_matrix.computeInverse();
+  proj_matrix.computeCenter();
+  out << " camera calibration: " << K << std::endl;
+  out << " camera rotation: " << Rot << std::endl;
+  out << " camera position: " << proj_matrix.m_center << std::endl;
+  
+  out << "#########################" << std::endl;
+  
+  // clean-up
+  keypoints.clear();
+  inliers.clear();
+}
+
 //---------------------------------------------------------------------------------------------------------------------------------------------------------------
 
 ////
@@ -86,6 +382,25 @@ double ransac_max_time = 60.0; // run RANSAC max 1m;
 
 int main (int argc, char **argv)
 {
+  // optional number of threads used to localize the query images in parallel
+  uint32_t nb_threads = 1;
+  std::string option_value;
+  if( extract_option( argc, argv, "--threads", option_value ) )
+    nb_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional number of threads used to draw and evaluate the RANSAC samples of a single query image
+  uint32_t nb_ransac_threads = 1;
+  if( extract_option( argc, argv, "--ransac-threads", option_value ) )
+    nb_ransac_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional number of threads used by FLANN to search for the features of a single query image
+  uint32_t nb_flann_threads = 1;
+  if( extract_option( argc, argv, "--flann-threads", option_value ) )
+    nb_flann_threads = (uint32_t) std::max( 1, atoi( option_value.c_str() ) );
+  
+  // optional latency budget of a single query, given in milliseconds
+  if( extract_option( argc, argv, "--latency-budget-ms", option_value ) )
+    query_latency_budget = std::max( 0.0, atof( option_value.c_str() ) ) / 1000.0;
   
   if( argc < 8 )
   {
@@ -95,6 +410,7 @@ int main (int argc, char **argv)
     std::cout << " -                               2011 by Torsten Sattler (tsattler@cs.rwth-aachen.de)                                     - " << std::endl;
     std::cout << " -                                                                                                                        - " << std::endl;
     std::cout << " - usage: acg_localizer_knn list nb_leafs descriptors desc_mode method min_inlier results                                 - " << std::endl;
+    std::cout << " -                     [--threads N] [--ransac-threads N] [--flann-threads N] [--latency-budget-ms T]                     - " << std::endl;
     std::cout << " - Parameters:                                                                                                            - " << std::endl;
     std::cout << " -  list                                                                                                                  - " << std::endl;
     std::cout << " -     List containing the filenames of all the .key files that should be used as query. It is assumed that the           - " << std::endl;
@@ -121,6 +437,24 @@ int main (int argc, char **argv)
     std::cout << " -     format, where every line in the file belongs to one query image and has the format                                 - " << std::endl;
 	std::cout << " -       #inliers #(correspondences found) (time needed to compute the visual words, in seconds) (time needed to establish- " << std::endl;
 	std::cout << " -       the correspondences, in seconds) (time needed for RANSAC, in seconds)                                            - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --threads N (optional)                                                                                                - " << std::endl;
+    std::cout << " -     Localize N query images in parallel (default: 1). The model is shared by all threads and the results are          - " << std::endl;
+    std::cout << " -     written in the order of the list.                                                                                  - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --ransac-threads N (optional)                                                                                         - " << std::endl;
+    std::cout << " -     Draw and evaluate the RANSAC samples of a query image with N threads (default: 1). This reduces the time           - " << std::endl;
+    std::cout << " -     needed for difficult queries, it can be combined with --threads.                                                   - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --flann-threads N (optional)                                                                                          - " << std::endl;
+    std::cout << " -     Search the nearest neighbors of the features of a query image with N threads (default: 1)                          - " << std::endl;
+    std::cout << " -     if FLANN is used (method 0 or 3). It can be combined with --threads and --ransac-threads.                          - " << std::endl;
+    std::cout << " -                                                                                                                        - " << std::endl;
+    std::cout << " -  --latency-budget-ms T (optional)                                                                                      - " << std::endl;
+    std::cout << " -     Localize every query image within T milliseconds, starting when its features are loaded. The nearest neighbor      - " << std::endl;
+    std::cout << " -     search and RANSAC share this deadline, 25% of T are reserved for RANSAC. With ANN (methods 1 and 2), the search    - " << std::endl;
+    std::cout << " -     stops at its deadline. If the deadline is reached, the best pose found so far is used and the query is marked      - " << std::endl;
+    std::cout << " -     as stopped early (not limited by default).                                                                         - " << std::endl;
     std::cout << "____________________________________________________________________________________________________________________________" << std::endl;
     return -1;
   }
@@ -138,7 +472,7 @@ int main (int argc, char **argv)
     std::cerr << " ERROR: Unknown desc_mode " << desc_mode << ", aborting" << std::endl;
     return -1;
   }
-  int method = atoi( argv[5] );
+  method = atoi( argv[5] );
   if( method < 0 || method > 3 )
   {
     std::cerr << " ERROR: Unknown method " << method << ", aborting" << std::endl;
@@ -167,38 +501,36 @@ int main (int argc, char **argv)
   
   // ANN, we need to create this here so that we can directly load the data into the tree_descriptors
   // array -> save memory since otherwise we would have to copy it
-  ANNkd_tree *kd_tree = 0;
-  ANNidxArray indices = 0;
-  ANNdistArray distances = 0;
   ANNpointArray tree_descriptors = 0;
   int nb_tree_descriptors = 0;
-  ANNcoord *ann_query_descriptor = new ANNcoord[128];
   
   std::cout << "* Loading and parsing the assignments ... " << std::endl;
   
-  std::vector< OpenMesh::Vec3f > points3D;
+  // the 3D points are used directly from the memory mapped file written by compute_desc_assignments,
+  // the descriptors are only read to build the search structure
   std::vector< float > all_descriptors_float;
-  std::vector< uint32_t > point_id_per_descriptor;
   uint32_t nb_non_empty_vw, nb_3D_points, nb_descriptors, nb_cluster;
   
   {
-    std::ifstream ifs( vw_assignments.c_str(), std::ios::in | std::ios::binary  );
-    
-    if ( !ifs )
+    if ( !loc_db.load( vw_assignments ) )
     {
 	  std::cerr << " ERROR: Cannot read the visual word assignments " << vw_assignments << std::endl;;
 	  return -1;
     }
     
-    ifs.read(( char* ) &nb_3D_points, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_cluster, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_non_empty_vw, sizeof( uint32_t ) );
-    ifs.read(( char* ) &nb_descriptors, sizeof( uint32_t ) );
+    if( ( desc_mode == 1 ) != ( loc_db.get_descriptor_type() == LOC_DB_FLOAT ) )
+    {
+      std::cerr << " ERROR: The descriptors stored in " << vw_assignments << " do not match desc_mode " << desc_mode << std::endl;
+      return -1;
+    }
+    
+    nb_3D_points = loc_db.get_nb_points();
+    nb_cluster = loc_db.get_nb_visual_words();
+    nb_non_empty_vw = loc_db.get_nb_non_empty_visual_words();
+    nb_descriptors = loc_db.get_nb_descriptors();
     
     std::cout << " Number of cluster " << nb_cluster << "  Number of non-empty cluster: " << nb_non_empty_vw << " number of points : " << nb_3D_points << " number of descriptors: " << nb_descriptors << std::endl;
     
-    // read the 3D points and their visibility polygons
-    points3D.resize(nb_3D_points);
     if( method == 0 || method == 3 )
       all_descriptors_float.resize(128*nb_descriptors);
     else
@@ -206,18 +538,7 @@ int main (int argc, char **argv)
 
     point_id_per_descriptor.resize(nb_descriptors,0);
     
-    // load the points
-    float *point_data = new float[3];
-    for( uint32_t i=0; i<nb_3D_points; ++i )
-    {
-      ifs.read(( char* ) point_data, 3 * sizeof( float ) );
-      for( int j=0; j<3; ++j )
-		points3D[i][j] = point_data[j];
-    }
-    delete [] point_data;
-       
-    // load the descriptors
-    int tmp_int;
+    // convert the descriptors
     for( uint32_t i=0; i<nb_descriptors; ++i )
     {
       if( method == 1 || method == 2 )
@@ -225,29 +546,18 @@ int main (int argc, char **argv)
       float length = 0.0f;
       for( uint32_t j=0; j<128; ++j )
       {
-		unsigned char entry_char;
-		if( desc_mode == 0 || desc_mode == 2 )
-		{
-		  ifs.read(( char* ) &entry_char, sizeof( unsigned char ) );
-		  if( method == 0 || method == 3 )
-			all_descriptors_float[128*i+j] = float(entry_char);
-		  else
-		  {
-			tree_descriptors[i][j] = float(entry_char);
-			length += tree_descriptors[i][j] * tree_descriptors[i][j];
-		  }
-		}
+		float entry;
+		if( desc_mode == 0 )
+		  entry = float( loc_db.get_descriptor_uchar( i )[j] );
+		else
+		  entry = loc_db.get_descriptor_float( i )[j];
+		
+		if( method == 0 || method == 3 )
+		  all_descriptors_float[128*i+j] = entry;
 		else
 		{
-		  float entry_float;
-		  ifs.read(( char* ) &entry_float, sizeof( float ) );
-		  if( method == 0 || method == 3 )
-			all_descriptors_float[128*i+j] = entry_float;
-		  else
-		  {
-			tree_descriptors[i][j] = entry_float;
-			length += tree_descriptors[i][j] * tree_descriptors[i][j];
-		  }
+		  tree_descriptors[i][j] = entry;
+		  length += tree_descriptors[i][j] * tree_descriptors[i][j];
 		}
       }
       if( method == 2 )
@@ -258,23 +568,15 @@ int main (int argc, char **argv)
       }
     }
     
-    // now we load the assignments of the pairs (point_id, descriptor_id) to the visual words    
-    for( uint32_t i=0; i<nb_non_empty_vw; ++i )
+    // get the 3D point of every descriptor from the assignments of the pairs (point_id, descriptor_id) to the visual words    
+    for( uint32_t i=0; i<nb_cluster; ++i )
     {
-      uint32_t id, nb_pairs;
-      ifs.read(( char* ) &id, sizeof( uint32_t ) );
-      ifs.read(( char* ) &nb_pairs, sizeof( uint32_t ) );
-      uint32_t id_point, id_descriptor;
+      uint32_t nb_pairs = loc_db.get_nb_entries_for_vw( i );
+      const vw_entry *vw_entries = loc_db.get_entries_for_vw( i );
       for( uint32_t j=0; j<nb_pairs; ++j )
-      {
-		ifs.read(( char* ) &id_point, sizeof( uint32_t ) );
-		ifs.read(( char* ) &id_descriptor, sizeof( uint32_t ) );
-		point_id_per_descriptor[id_descriptor] = id_point;
-      }
+		point_id_per_descriptor[vw_entries[j].desc_id] = vw_entries[j].point_id;
     }
     
-    ifs.close();
-    
     std::cout << "  done loading and parsing the assignments " << std::endl;
   }
   
@@ -282,7 +584,6 @@ int main (int argc, char **argv)
   // create the search structure 
   
   // FLANN
-  visual_words_handler vw_handler;
   vw_handler.set_nb_trees( 1 );
   vw_handler.set_nb_visual_words( nb_descriptors );
   vw_handler.set_method(std::string("flann"));
@@ -307,8 +608,6 @@ int main (int argc, char **argv)
   }
   else
   {
-    indices = new ANNidx[2];
-    distances = new ANNdist[2];
     nb_tree_descriptors = int( nb_descriptors );
     
     // create the kd-tree
@@ -363,232 +662,74 @@ int main (int argc, char **argv)
   double mean_nb_correspondences_rejected = 0.0;
   double mean_nb_features_accepted = 0.0;
   double mean_nb_features_rejected = 0.0;
-  double vw_time = 0.0;
-  double corr_time = 0.0;
-  double RANSAC_time = 0.0;
   double avrg_RANSAC_time_registered = 0.0;
   double avrg_RANSAC_time_rejected = 0.0;
-    
-  uint32_t registered = 0;
   
-  // store all indices of the 2 nearest neighbors and the squared Euclidean distacnes to them in two large vectors (resized if necessary)
-  // preallocated for speed
-  std::vector< uint32_t > computed_assignments( 100000, 0 );
-  std::vector< float > computed_squared_distances( 100000, 0 );
+  uint32_t registered = 0;
+  uint32_t nb_stopped_early = 0;
+  
+  // the RANSAC parameters are the same for all images, every RANSAC instance gets its own copy
+  // P3P is used for all images whose focal length is known from the exif tag, P6pt for all others
+  ransac_parameters.computation_type = P3P;
+  ransac_parameters.stop_after_n_secs = true;
+  ransac_parameters.max_time = ransac_max_time;
+  ransac_parameters.error = 10.0f; // for P6pt and P3P this is the SQUARED reprojection error in pixels
+  ransac_parameters.nb_threads = nb_ransac_threads;
+  if( nb_ransac_threads > 1 )
+    std::cout << " Using " << nb_ransac_threads << " threads in RANSAC " << std::endl;
+  
+  vw_handler.set_nb_threads( (int) nb_flann_threads );
+  if( nb_flann_threads > 1 )
+    std::cout << " Using " << nb_flann_threads << " threads to search with FLANN " << std::endl;
+  if( query_latency_budget > 0.0 )
+    std::cout << " Latency budget of " << query_latency_budget * 1000.0 << " ms per query " << std::endl;
+  
+  if( nb_threads > 1 )
+  {
+    std::cout << " Localizing up to " << nb_threads << " query images in parallel " << std::endl;
+    // the output of RANSAC would be interleaved
+    ransac_parameters.silent = true;
+  }
   
+  std::vector< query_result > query_results( nb_keyfiles );
   
-  for( uint32_t i=0; i<nb_keyfiles; ++i, N+=1.0 )
+  // localize the query images, the results are written and the statistics are updated in the order of the list
+  process_queries( nb_keyfiles, nb_threads, [&]( uint32_t i, uint32_t )
   {
-    std::cout << std::endl << " --------- " << i+1 << " / " << nb_keyfiles << " --------- " << std::endl;
-    
-	// load the features
-    SIFT_loader key_loader;
-    std::cout << key_filenames[i] << std::endl;
-    key_loader.load_features( key_filenames[i].c_str(), LOWE );
-    
-    std::vector< unsigned char* >& descriptors = key_loader.get_descriptors();
-    std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
-    
-    uint32_t nb_loaded_keypoints = (uint32_t) keypoints.size();
-    
-   
-    // center the keypoints around the center of the image
-    // first we need to get the dimensions of the image
-    int img_width, img_height;
-    std::string jpg_filename( key_filenames[i] );
-    jpg_filename.replace( jpg_filename.size()-3,3,"jpg");
-    exif_reader::open_exif( jpg_filename.c_str() );
-    img_width = exif_reader::get_image_width();
-    img_height = exif_reader::get_image_height();
-    exif_reader::close_exif();
-    
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      keypoints[j].x -= (img_width-1.0)/2.0f; 
-      keypoints[j].y = (img_height-1.0)/2.0f - keypoints[j].y; 
-    }
-    
-    std::cout << " loaded " << nb_loaded_keypoints << " descriptors" << std::endl;
-    
-	////
-	// compute the two nearest neighbors
-
-    Timer timer;
-    timer.Init();
-    timer.Start();
-	
-	if( computed_assignments.size() < 2*nb_loaded_keypoints )
+    std::ostream &out = ( nb_threads > 1 ) ? query_results[i].log : std::cout;
+    out << std::endl << " --------- " << i+1 << " / " << nb_keyfiles << " --------- " << std::endl;
+    localize_query( key_filenames[i], out, query_results[i] );
+  },
+  [&]( uint32_t i )
+  {
+    query_result &result = query_results[i];
+    if( nb_threads > 1 )
     {
-      computed_assignments.resize( 2*nb_loaded_keypoints );
-      computed_squared_distances.resize( 2*nb_loaded_keypoints );
+      std::cout << result.log.str();
+      result.log.str( "" );
     }
     
-    // search for the nearest neighbors
-    if( method == 0 || method == 3 )
-      vw_handler.k_nn_search_flann_ucharv( descriptors, nb_loaded_keypoints, computed_assignments, computed_squared_distances );
-    else
-    {
-      uint32_t index_ = 0;
-      for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
-      {
-		index_ = 2*j;
-		if( method == 1 )
-		{
-		  for( int k=0; k<128; ++k )
-			ann_query_descriptor[k] = (float) descriptors[j][k];
-		}
-		else if( method == 2 )
-		{
-		  float length = 0.0f;
-		  for( int k=0; k<128; ++k )
-		  {
-			ann_query_descriptor[k] = (float) descriptors[j][k];
-			length += ann_query_descriptor[k] * ann_query_descriptor[k];
-		  }
-		  length = sqrt( length );
-		  for( int k=0; k<128; ++k )
-			ann_query_descriptor[k] /= length;
-		}
-		
-		kd_tree->annkPriSearch(ann_query_descriptor, 2, indices, distances);
-		computed_assignments[index_] = (uint32_t) indices[0];
-		computed_assignments[index_+1] = (uint32_t) indices[1];
-		computed_squared_distances[index_] = distances[0];
-		computed_squared_distances[index_+1] = distances[1];
-      }
-    }
+    uint32_t nb_inlier = result.nb_inlier;
+    uint32_t nb_corr = result.nb_corr;
+    uint32_t nb_loaded_keypoints = result.nb_features;
+    double corr_time = result.corr_time;
+    double RANSAC_time = result.RANSAC_time;
     
-    timer.Stop();
+    ofs_details << nb_inlier << " " << nb_corr << " " << result.vw_time << " " << corr_time << " " << RANSAC_time << std::endl;
     
-    std::cout << " computed 2-nn in " << timer.GetElapsedTimeAsString() << std::endl;
-    avrg_vw_time = avrg_vw_time * N / (N+1.0) + timer.GetElapsedTime() / (N+1.0);
+    avrg_vw_time = avrg_vw_time * N / (N+1.0) + result.vw_time / (N+1.0);
     avrg_nb_features = avrg_nb_features * N / (N+1.0) + double(nb_loaded_keypoints) / (N+1.0);
-    vw_time = timer.GetElapsedTime();
-    
-    ////
-    // establish 2D-3D correspondences by using the computed nearest neighbors
-    timer.Init();
-    timer.Start();
-    Timer all_timer;
-    all_timer.Init();
-    all_timer.Start();
-    
-    // we store for each 3D point the corresponding 2D feature as well as the squared distance
-	// this is needed in case that two 2D features are assigned to one 3D point, because
-	// we only want to keep the correspondence to the 2D point with the most similar descriptor
-	// i.e. the smallest Euclidean distance in descriptor space
-    std::map< uint32_t, std::pair< uint32_t, float > > corr_3D_to_2D;
-    corr_3D_to_2D.clear();
-    
-    std::map< uint32_t, std::pair< uint32_t, float > >::iterator map_it_3D;
-	
-    for( size_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      uint32_t index = 2*j;
-      uint32_t nn = point_id_per_descriptor[computed_assignments[ index ]];
-      // compute the SIFT-ratio
-      float ratio = computed_squared_distances[index] / computed_squared_distances[index+1];
-      
-      if( ratio < nn_ratio )
-      {
-		// we found one, so we need check for mutual nearest neighbors
-		map_it_3D = corr_3D_to_2D.find( nn );
-	  
-		if( map_it_3D != corr_3D_to_2D.end() )
-		{
-		  if( map_it_3D->second.second > computed_squared_distances[index] )
-		  {
-			map_it_3D->second.first = j;
-			map_it_3D->second.second = computed_squared_distances[index];
-		  }
-		}
-		else
-		{
-		  corr_3D_to_2D.insert( std::make_pair( nn, std::make_pair( j, computed_squared_distances[index] ) ) );
-		}
-      }
-    }
-
-    ////
-	// compute and store the correspondences such that we can easily hand them over to RANSAC
-	
-	// store the correspondences for RANSAC
-    std::vector< float > c2D, c3D;
-    c2D.clear();
-    c3D.clear();
-    
-    std::vector< std::pair< uint32_t, uint32_t > > final_correspondences; // first the 2D, then the 3D point
-    final_correspondences.clear();
-	
-	// the 2D and 3D positions of features and points are simply concatenated into 2 vectors
-    for( map_it_3D = corr_3D_to_2D.begin(); map_it_3D != corr_3D_to_2D.end(); ++map_it_3D )
-    {
-      c2D.push_back(keypoints[map_it_3D->second.first].x);
-      c2D.push_back(keypoints[map_it_3D->second.first].y);
-      
-      c3D.push_back( points3D[map_it_3D->first][0] );
-      c3D.push_back( points3D[map_it_3D->first][1] );
-      c3D.push_back( points3D[map_it_3D->first][2] );
-      
-      final_correspondences.push_back( std::make_pair( map_it_3D->second.first, map_it_3D->first ) );
-    }
-    
-    timer.Stop();
-    std::cout << " computed correspondences in " << timer.GetElapsedTimeAsString() << std::endl;
-    corr_time = timer.GetElapsedTime();
-	
-    uint32_t nb_corr = c2D.size() / 2;
-    
-    ////
-    // do the pose verification using RANSAC
-      
-    RANSAC::computation_type = P6pt;
-    RANSAC::stop_after_n_secs = true;
-    RANSAC::max_time = ransac_max_time;
-    RANSAC::error = 10.0f; // for P6pt this is the SQUARED reprojection error in pixels
-    RANSAC ransac_solver;
-   
-    std::cout << " applying RANSAC on " << nb_corr << std::endl;
-    timer.Init();
-    timer.Start();
-    ransac_solver.apply_RANSAC( c2D, c3D, nb_corr, std::min( std::max( float( minimal_RANSAC_solution ) / float( nb_corr ), min_inlier ), 1.0f ) ); 
-    timer.Stop();
-    RANSAC_time = timer.GetElapsedTime();
-    
-    all_timer.Stop();
-    
-    // output the solution:
-    std::cout << "#### found solution ####" << std::endl;
-    std::cout << " needed time: " << all_timer.GetElapsedTimeAsString() << std::endl;
-	
-    // get the solution from RANSAC
-    
-    std::vector< uint32_t > inliers;
-    
-    inliers.assign( ransac_solver.get_inliers().begin(), ransac_solver.get_inliers().end()  );
-    
-    Util::Math::ProjMatrix proj_matrix = ransac_solver.get_projection_matrix();
-    
-    // decompose the projection matrix
-    Util::Math::Matrix3x3 Rot, K;
-    proj_matrix.decompose( K, Rot );
-    proj_matrix.computeInverse();
-    proj_matrix.computeCenter();
-    std::cout << " camera calibration: " << K << std::endl;
-    std::cout << " camera rotation: " << Rot << std::endl;
-    std::cout << " camera position: " << proj_matrix.m_center << std::endl;
-    
-	ofs_details << inliers.size() << " " << nb_corr << " " << vw_time << " " << corr_time << " " << RANSAC_time << std::endl;
-   
-    std::cout << "#########################" << std::endl;
+    N += 1.0;
+    if( result.deadline_reached )
+      ++nb_stopped_early;
     
     // determine whether the image was registered or not
-	// also update the statistics about timing, ...
-    if( inliers.size() >= minimal_RANSAC_solution )
+    // also update the statistics about timing, ...
+    if( nb_inlier >= minimal_RANSAC_solution )
     {
       double N_reg = registered;
-      avrg_reg_time = avrg_reg_time * N_reg / (N_reg+1.0) + all_timer.GetElapsedTime() / (N_reg+1.0);
-      mean_inlier_ratio_accepted = mean_inlier_ratio_accepted * N_reg / (N_reg+1.0) + double(inliers.size()) / (double( nb_corr ) * (N_reg+1.0));
+      avrg_reg_time = avrg_reg_time * N_reg / (N_reg+1.0) + result.total_time / (N_reg+1.0);
+      mean_inlier_ratio_accepted = mean_inlier_ratio_accepted * N_reg / (N_reg+1.0) + double(nb_inlier) / (double( nb_corr ) * (N_reg+1.0));
       mean_nb_correspondences_accepted = mean_nb_correspondences_accepted * N_reg / (N_reg+1.0) + double(nb_corr) / (N_reg+1.0);
       mean_nb_features_accepted = mean_nb_features_accepted * N_reg / (N_reg+1.0) + double(nb_loaded_keypoints) / (N_reg+1.0);
       avrg_cor_computation_time_accepted = avrg_cor_computation_time_accepted * N_reg /(N_reg+1.0) + corr_time / (N_reg+1.0);
@@ -597,8 +738,8 @@ int main (int argc, char **argv)
     }
     else
     {
-      avrg_reject_time = avrg_reject_time * N_reject / (N_reject+1.0) + all_timer.GetElapsedTime() / (N_reject+1.0);
-      mean_inlier_ratio_rejected = mean_inlier_ratio_rejected * N_reject / (N_reject+1.0) + double(inliers.size()) / (double( nb_corr ) * (N_reject+1.0));
+      avrg_reject_time = avrg_reject_time * N_reject / (N_reject+1.0) + result.total_time / (N_reject+1.0);
+      mean_inlier_ratio_rejected = mean_inlier_ratio_rejected * N_reject / (N_reject+1.0) + double(nb_inlier) / (double( nb_corr ) * (N_reject+1.0));
       mean_nb_correspondences_rejected = mean_nb_correspondences_rejected * N_reject / (N_reject+1.0) + double(nb_corr) / (N_reject+1.0);
       mean_nb_features_rejected = mean_nb_features_rejected * N_reject / (N_reject+1.0) + double(nb_loaded_keypoints) / (N_reject+1.0);
       avrg_cor_computation_time_rejected = avrg_cor_computation_time_rejected * N_reject /(N_reject+1.0) + corr_time / (N_reject+1.0);
@@ -606,24 +747,12 @@ int main (int argc, char **argv)
       N_reject += 1.0;
     }
     
-    
-    // clean-up
-    for( uint32_t j=0; j<nb_loaded_keypoints; ++j )
-    {
-      if( descriptors[j] != 0 )
-		delete [] descriptors[j];
-      descriptors[j] = 0;
-    }
-
-    descriptors.clear();
-    keypoints.clear();
-    inliers.clear();
-    
+    // display statistics
     std::cout << std::endl << std::endl << " registered so far: " << registered << " / " << i+1 << std::endl;
     std::cout << " average time needed to compute the correspondences: registered: " << avrg_cor_computation_time_accepted << " rejected: " << avrg_cor_computation_time_rejected << std::endl;
     std::cout << "avrg. registration time: " << avrg_reg_time << " ( " << registered << " , avrg. inlier-ratio: " << mean_inlier_ratio_accepted << ", avrg. nb correspondences : " << mean_nb_correspondences_accepted << " ) avrg. rejection time: " << avrg_reject_time << " ( " << N_reject << ", avrg. inlier-ratio : " << mean_inlier_ratio_rejected << " avrg. nb correspondences : " << mean_nb_correspondences_rejected << " ) " << std::endl << std::endl;
-  
-  }
+
+  } );
   
   ofs_details.close();
   
@@ -643,6 +772,8 @@ int main (int argc, char **argv)
   std::cout << " avrg. time for RANSAC (registered)                     : " << avrg_RANSAC_time_registered << std::endl;
   std::cout << " avrg. time for RANSAC (rejected)                       : " << avrg_RANSAC_time_rejected << std::endl;
   std::cout << " minimum inlier-ratio for RANSAC                        : " << min_inlier << std::endl;
+  if( query_latency_budget > 0.0 )
+    std::cout << " queries stopped by the latency budget                  : " << nb_stopped_early << " ( budget " << query_latency_budget * 1000.0 << " ms ) " << std::endl;
   std::cout << " search model                                           : " << "approximate k-nn visiting " << nb_leafs << " leaf nodes " << std::endl;
   if( method == 2 )
     std::cout << " search model                                           : all vectors normalized to unit length " << std::endl;  
@@ -676,9 +807,6 @@ int main (int argc, char **argv)
     }
   }
   
-  delete [] ann_query_descriptor;
-  ann_query_descriptor = 0;
-  
   annClose();
   
   return 0;
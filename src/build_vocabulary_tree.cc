@@ -0,0 +1,115 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011 by Computer Graphics Group, RWTH Aachen           *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <stdlib.h>
+
+#include "features/visual_words_handler.hh"
+
+int main (int argc, char **argv)
+{
+  if( argc < 4 )
+  {
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -    build_vocabulary_tree - Build the search structure for a set of visual words once and store    - " << std::endl;
+    std::cout << " -                            it together with the cluster centers in a binary vocabulary file.      - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - usage: build_vocabulary_tree clusters nb_clusters outfile [type] [nb_trees]                       - " << std::endl;
+    std::cout << " - Parameters:                                                                                       - " << std::endl;
+    std::cout << " -  clusters                                                                                         - " << std::endl;
+    std::cout << " -     The cluster centers (visual words), stored in a textfile consisting of                        - " << std::endl;
+    std::cout << " -     nb_clusters * 128 floating point values.                                                      - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  nb_clusters                                                                                      - " << std::endl;
+    std::cout << " -     The number of cluster centers stored in the file.                                             - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  outfile                                                                                          - " << std::endl;
+    std::cout << " -     The binary vocabulary file. It contains the FLANN index, the cluster centers and, for         - " << std::endl;
+    std::cout << " -     vocabulary trees, the parents of all visual words at levels 2 and 3 of the tree. It can be    - " << std::endl;
+    std::cout << " -     passed instead of the textfile with the cluster centers to compute_desc_assignments and all   - " << std::endl;
+    std::cout << " -     localization methods, which then load the index instead of building it.                       - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  type                                                                                             - " << std::endl;
+    std::cout << " -     0 - randomized kd-tree(s), as used by acg_localizer (and compute_desc_assignments with        - " << std::endl;
+    std::cout << " -         assignment_type 0).                                                                       - " << std::endl;
+    std::cout << " -     1 - vocabulary tree (hkmeans tree, branching factor 10), as used by                           - " << std::endl;
+    std::cout << " -         acg_localizer_active_search (and compute_desc_assignments with assignment_type 1).        - " << std::endl;
+    std::cout << " -     Default: 1                                                                                    - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  nb_trees                                                                                         - " << std::endl;
+    std::cout << " -     The number of randomized kd-trees to use (only used for type 0). Default: 1                   - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    return 1;
+  }
+  
+  ////
+  // get the parameters
+  std::string cluster_file( argv[1] );
+  uint32_t nb_clusters = (uint32_t) atoi( argv[2] );
+  std::string outfile( argv[3] );
+  
+  int type = 1;
+  if( argc >= 5 )
+    type = atoi( argv[4] );
+  if( type < 0 || type > 1 )
+  {
+    std::cerr << " ERROR: Unknown type " << type << " of the search structure " << std::endl;
+    return 1;
+  }
+  
+  int nb_trees = 1;
+  if( argc >= 6 )
+    nb_trees = atoi( argv[5] );
+  
+  ////
+  // build the search structure, using the same parameters as the localization methods
+  visual_words_handler vw_handler;
+  vw_handler.set_nb_trees( nb_trees );
+  vw_handler.set_nb_visual_words( nb_clusters );
+  vw_handler.set_branching( 10 );
+  
+  vw_handler.set_method(std::string("flann"));
+  if( type == 0 )
+    vw_handler.set_flann_type(std::string("randomkd"));
+  else
+    vw_handler.set_flann_type(std::string("hkmeans"));
+  
+  if( !vw_handler.create_flann_search_index( cluster_file ) )
+  {
+    std::cerr << " ERROR: Could not load the cluster centers from " << cluster_file << std::endl;
+    return 1;
+  }
+  
+  ////
+  // save it
+  if( !vw_handler.save_vocabulary( outfile ) )
+    return 1;
+  
+  return 0;
+}
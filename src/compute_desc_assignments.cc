@@ -38,10 +38,17 @@
 #include <stdio.h>
 #include <map>
 #include <stdlib.h>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "sfm/parse_bundler.hh"
 
 #include "features/visual_words_handler.hh"
+#include "features/SIFT_distance.hh"
+#include "features/localization_database.hh"
 
 
 
@@ -50,7 +57,7 @@
 ////
 
 // computes medoid descriptor from a vector of descriptors. returns the index of the medoids
-uint32_t compute_medoid( std::vector< unsigned char > &desc )
+uint32_t compute_medoid( const std::vector< unsigned char > &desc )
 {
   uint32_t med_id = 0;
   
@@ -63,12 +70,7 @@ uint32_t compute_medoid( std::vector< unsigned char > &desc )
     double cur_dist = 0.0;
     for( uint32_t j=0; j<nb_desc; j+=128 )
     {
-      double dist = 0.0;
-      for( uint32_t k=0; k<128; ++k )
-      {
-        double x = desc[i+k] - desc[j+k];
-        dist += x*x;
-      }
+      double dist = (double) compute_squared_SIFT_dist( &(desc[i]), &(desc[j]) );
       cur_dist += sqrt(dist);
     }
     if( cur_dist < max_dist )
@@ -82,7 +84,7 @@ uint32_t compute_medoid( std::vector< unsigned char > &desc )
 }
 
 // computes the mean descriptor from a vectors of descriptors. the mean is stored in the variable mean
-void compute_mean( std::vector< unsigned char > &desc, std::vector< float > &mean )
+void compute_mean( const std::vector< unsigned char > &desc, std::vector< float > &mean )
 {
   mean.resize( 128, 0 );
   uint32_t N = (uint32_t) desc.size() / 128;
@@ -98,6 +100,245 @@ void compute_mean( std::vector< unsigned char > &desc, std::vector< float > &mea
 }
 
 
+// representatives computed for a single 3D point: the descriptors (unsigned char or float values,
+// depending on the mode) and (visual word, descriptor id) pairs, where 128 * descriptor id is the
+// first entry of the descriptor in descriptors or descriptors_float
+struct point_representatives
+{
+  std::vector< unsigned char > descriptors;
+  std::vector< float > descriptors_float;
+  std::vector< std::pair< uint32_t, uint32_t > > vw_descriptor_idx;
+  
+  void clear()
+  {
+    descriptors.clear();
+    descriptors_float.clear();
+    vw_descriptor_idx.clear();
+  }
+};
+
+// computes the representatives of a 3D point depending on the mode, given the visual words its 
+// descriptors are assigned to. For mode 1, only the mean descriptor is computed.
+void compute_representatives( int mode, const feature_3D_info &info, const uint32_t *assignments, point_representatives &reps )
+{
+  // get the number of views of that point, which coincides with the number of 
+  // descriptors available for that point
+  uint32_t nb_desc_i = (uint32_t) info.view_list.size();
+  
+  reps.clear();
+  
+  // compute representatives depending on the mode chosen by the user
+  if ( mode == 0 )
+  {
+    // compute for each visual word the medoid descriptors and store it
+    // first determine the number of activated vw
+    std::set< size_t > activated_visual_words;
+    activated_visual_words.clear();
+    for( size_t j=0; j<nb_desc_i; ++j )
+		activated_visual_words.insert( assignments[j] );
+    
+    // now we compute the medoid descriptors
+    for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
+    {
+		// gather all descriptors assigned to visual word *it
+		std::vector< unsigned char > visual_word_descriptors;
+		visual_word_descriptors.clear();
+		for( size_t j=0; j<nb_desc_i; ++j )
+		{
+		  if( *it == assignments[j] )
+		  {
+			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
+			  visual_word_descriptors.push_back(info.descriptors[k]);
+		  }
+		}
+		
+		// now compute the medoid
+		uint32_t med_id = compute_medoid( visual_word_descriptors );
+		
+		// get the id of the new medoid descriptor for the (point id, descriptor id) pair
+		uint32_t desc_id = uint32_t( reps.descriptors.size() ) / 128;
+		
+		// add the new descriptor to the set of all used descriptors
+		for( uint32_t k=128*med_id; k<(128*med_id + 128 ); ++k )
+		  reps.descriptors.push_back(visual_word_descriptors[k]);
+
+		// insert the pair
+		reps.vw_descriptor_idx.push_back( std::make_pair( uint32_t( *it ), desc_id ) );
+
+    }
+  }
+  else if( mode == 3 )
+  {
+    // compute the medoid descriptor for the 3D point and assign it to all visual words that one of the 
+    // descriptors is assigned to
+    
+    // first determine the number of unique activated vw
+    std::set< size_t > activated_visual_words;
+    activated_visual_words.clear();
+    for( size_t j=0; j<nb_desc_i; ++j )
+		activated_visual_words.insert( assignments[j] );
+    
+    // compute the medoid
+    uint32_t med_id = compute_medoid( info.descriptors );
+    uint32_t desc_id = uint32_t( reps.descriptors.size() ) / 128;
+    
+    // insert the medoid and add references to it
+    for( uint32_t k=128*med_id; k<(128*med_id + 128 ); ++k )
+		reps.descriptors.push_back(info.descriptors[k]);
+    
+    for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
+		reps.vw_descriptor_idx.push_back( std::make_pair( uint32_t( *it ), desc_id ) );
+  }
+  else if( mode == 4 )
+  {
+    // compute for each visual word the mean descriptors and assign it to all visual words that one of the 
+    // descriptors is assigned to
+	  
+    // first determine the number of activated vw
+    std::set< size_t > activated_visual_words;
+    activated_visual_words.clear();
+    for( size_t j=0; j<nb_desc_i; ++j )
+		activated_visual_words.insert( assignments[j] );
+    
+    // now we compute the mean descriptors belonging to the visual words
+    for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
+    {
+		// gather all descriptors assigned to visual word *it
+		std::vector< unsigned char > visual_word_descriptors;
+		visual_word_descriptors.clear();
+		for( size_t j=0; j<nb_desc_i; ++j )
+		{
+		  if( *it == assignments[j] )
+		  {
+			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
+			  visual_word_descriptors.push_back(info.descriptors[k]);
+		  }
+		}
+		
+		// now compute the mean
+		std::vector< float > mean_descriptor;
+		
+		compute_mean( visual_word_descriptors, mean_descriptor );
+		
+		uint32_t desc_id = uint64_t( reps.descriptors_float.size() ) / 128;
+		
+		// store the descriptor
+		for( uint32_t k=0; k<128; ++k )
+		  reps.descriptors_float.push_back(mean_descriptor[k]);
+
+		reps.vw_descriptor_idx.push_back( std::make_pair( uint32_t( *it ), desc_id ) );
+		
+		mean_descriptor.clear();
+    }
+  }
+  else if( mode == 5 )
+  {
+	  // all descriptors
+	  
+    // first determine the number of activated vw
+    std::set< size_t > activated_visual_words;
+    activated_visual_words.clear();
+    for( size_t j=0; j<nb_desc_i; ++j )
+		activated_visual_words.insert( assignments[j] );
+    
+    // now we assign all descriptors belonging to the visual word to it
+    for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
+    {
+		for( size_t j=0; j<nb_desc_i; ++j )
+		{
+		  if( *it == assignments[j] )
+		  {
+			uint32_t desc_id = uint64_t( reps.descriptors.size() ) / 128;
+			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
+			  reps.descriptors.push_back(info.descriptors[k]);
+			reps.vw_descriptor_idx.push_back( std::make_pair( uint32_t( *it ), desc_id ) );
+		  }
+		}
+    }
+  }
+  else if( mode == 6 )
+  {
+	  // integer mean per visual word
+	  
+    // compute for each visual word the mean descriptors, round it to the next integer and store it
+	  
+    // first determine the number of activated vw
+    std::set< size_t > activated_visual_words;
+    activated_visual_words.clear();
+    for( size_t j=0; j<nb_desc_i; ++j )
+		activated_visual_words.insert( assignments[j] );
+    
+    // now we compute the mean descriptors belonging to the visual words
+    for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
+    {
+		std::vector< unsigned char > visual_word_descriptors;
+		visual_word_descriptors.clear();
+		for( size_t j=0; j<nb_desc_i; ++j )
+		{
+		  if( *it == assignments[j] )
+		  {
+			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
+			  visual_word_descriptors.push_back(info.descriptors[k]);
+		  }
+		}
+		
+		// now compute the mean
+		std::vector< float > mean_descriptor;
+		
+		compute_mean( visual_word_descriptors, mean_descriptor );
+		
+		// round to the nearest integer values
+		std::vector< unsigned char > integer_mean( 128, 0 );
+		for( int k=0; k<128; ++k )
+		{
+		  float bottom =  mean_descriptor[k] - floor( mean_descriptor[k] );
+		  float top =  ceil( mean_descriptor[k] ) - mean_descriptor[k];
+		  if( bottom < top )
+			integer_mean[k] = (unsigned char) floor( mean_descriptor[k] );
+		  else
+			integer_mean[k] = (unsigned char) ceil( mean_descriptor[k] );
+		}
+		
+		uint32_t desc_id = uint64_t( reps.descriptors.size() ) / 128;
+		
+		// store the descriptor
+		for( uint32_t k=0; k<128; ++k )
+		  reps.descriptors.push_back(integer_mean[k]);
+
+		reps.vw_descriptor_idx.push_back( std::make_pair( uint32_t( *it ), desc_id ) );
+		
+		integer_mean.clear();
+		mean_descriptor.clear();
+    }
+  }
+  else if( mode == 1 || mode == 2 )
+  {
+    // compute the mean descriptor
+    std::vector< float > mean_descriptor;
+    compute_mean( info.descriptors, mean_descriptor );
+    
+    // store the descriptor
+    uint32_t desc_id = uint64_t( reps.descriptors_float.size() ) / 128;
+	
+    for( uint32_t k=0; k<128; ++k )
+		reps.descriptors_float.push_back(mean_descriptor[k]);
+    
+    // for mode 1, the visual word of the mean descriptor is computed afterwards for all points of a chunk
+    if( mode == 2 )
+    {
+		// assign the mean descriptor to all the visual words that the descriptors of the point belong to
+		std::set< size_t > activated_visual_words;
+		activated_visual_words.clear();
+		for( size_t j=0; j<nb_desc_i; ++j )
+		  activated_visual_words.insert( assignments[j] );
+		
+		// store the reference to the mean descriptor in all activated visual words
+		for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
+		  reps.vw_descriptor_idx.push_back( std::make_pair( uint32_t( *it ), desc_id ) );
+    }
+  }
+}
+
 int main (int argc, char **argv)
 {
  
@@ -122,15 +363,17 @@ int main (int argc, char **argv)
     std::cout << " -  clusters                                                                                         - " << std::endl;
     std::cout << " -     The cluster centers (visual words), stored in a textfile consisting of                        - " << std::endl;
 	std::cout << " -     nb_clusters * 128 floating point values.                                                      - " << std::endl;
+    std::cout << " -     Alternatively, a binary vocabulary file generated by build_vocabulary_tree.                   - " << std::endl;
     std::cout << " -                                                                                                   - " << std::endl;
     std::cout << " -  out_desc                                                                                         - " << std::endl;
     std::cout << " -     The file the computed descriptor-to-visual word assignments should be saved into.             - " << std::endl;
-    std::cout << " -     The output file is a binary file of the following format:                                     - " << std::endl;
-    std::cout << " -     #points #cluster #non-empty cluster #descriptors (all uint32_t)                               - " << std::endl;
-    std::cout << " -     The 3D points (in total #points * 3 floats).                                                  - " << std::endl;
-    std::cout << " -     The descriptors (in total #descriptors * 128 unsigned chars / floats). (depending on mode)    - " << std::endl;
-    std::cout << " -     The assignments. For every non-empty visual word:                                             - " << std::endl;
-    std::cout << " -       cluster-id #assignments assignments (every assignment is a pair of uint32_t) (all uint32_t) - " << std::endl;
+    std::cout << " -     The output file is a binary file that is memory mapped by the localization methods:           - " << std::endl;
+    std::cout << " -     A header (magic number, version, counts and section offsets), followed by 64 byte aligned     - " << std::endl;
+    std::cout << " -     sections containing the 3D points (#points * 3 floats), the descriptors (128 unsigned chars / - " << std::endl;
+    std::cout << " -     floats each, depending on mode, stored contiguously per visual word), the (3D point,          - " << std::endl;
+    std::cout << " -     descriptor) pairs assigned to every visual word, the (visual word, descriptor) pairs of every - " << std::endl;
+    std::cout << " -     3D point (both stored as offsets + entries) and the position of every descriptor.             - " << std::endl;
+    std::cout << " -     See features/localization_database.hh for details.                                            - " << std::endl;
     std::cout << " -     If the filename of out_desc is \"analyze_assignments\" (without quotation marks) no output is - " << std::endl;
     std::cout << " -     generated and certain tests about the assignments are performed.                              - " << std::endl;
     std::cout << " -                                                                                                   - " << std::endl;
@@ -160,6 +403,12 @@ int main (int argc, char **argv)
     std::cout << " -     file from the Aachen dataset (available on the website), then you have to set this parameter  - " << std::endl;
     std::cout << " -     to 1 since file also contains camera information.                                             - " << std::endl;
     std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  nb_threads (optional)                                                                            - " << std::endl;
+    std::cout << " -     The number of threads used to assign the descriptors to visual words and to compute the       - " << std::endl;
+    std::cout << " -     representative descriptors (default: 1). The 3D points are read from the info file in chunks  - " << std::endl;
+    std::cout << " -     while the previous chunk is processed, and the representative descriptors are written to the  - " << std::endl;
+    std::cout << " -     temporary file out_desc.tmp, so only the points and the assignments need to fit into memory.  - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
     std::cout << "_______________________________________________________________________________________________________" << std::endl;
     return -1;
   }
@@ -192,15 +441,21 @@ int main (int argc, char **argv)
     return -1;
   }
   
+  int nb_threads = 1;
+  if( argc > 9 )
+    nb_threads = std::max( atoi( argv[9] ), 1 );
+  
   ////
-  // load the Bundler data
-  std::cout << "-> parsing the bundler output from " << bundle << std::endl;
-  parse_bundler parser;
-  parser.load_from_binary( bundle.c_str(), bundle_type );
-  std::vector< feature_3D_info >& feature_infos = parser.get_feature_infos();
-  
-  uint32_t nb_points = feature_infos.size();
-  std::cout << "--> done parsing the bundler output " << std::endl;
+  // open the Bundler data. The 3D points are not loaded at once but read in chunks
+  std::cout << "-> reading the 3D points from " << bundle << std::endl;
+  bundler_info_reader reader;
+  if( !reader.open( bundle.c_str(), bundle_type ) )
+  {
+    std::cerr << " ERROR: Could not read the bundler output from " << bundle << std::endl;
+    return -1;
+  }
+  uint32_t nb_points = reader.get_number_of_points();
+  std::cout << "--> " << nb_points << " 3D points, using " << nb_threads << " thread(s) " << std::endl;
  
  
   ////
@@ -209,6 +464,7 @@ int main (int argc, char **argv)
   vw_handler.set_nb_trees( nb_trees );
   vw_handler.set_nb_visual_words( nb_cluster );
   vw_handler.set_branching( 10 );
+  vw_handler.set_nb_threads( nb_threads );
   
   vw_handler.set_method(std::string("flann"));
   if( assignment_type == 0 )
@@ -224,333 +480,169 @@ int main (int argc, char **argv)
   
   
   ////
-  // Compute the assignments to visual words for all descriptors.
-  // To do so, we go through all 3D points and assign their descriptors 
-  // to the visual words. To keep track of the assignments, we use one 
-  // array that stores for every assigned descriptor the id of the visual word
-  // it was assigned to.
-  std::cout << "-> Assigning the descriptors to visual words (this might take a while)" << std::endl;
-  
-  uint32_t total_nb_descriptors = 0;
-  for( uint32_t i=0; i<nb_points; ++i )
-    total_nb_descriptors += (uint32_t) feature_infos[i].view_list.size();
-  
-  // we do the assignments in batches of 10000 descriptors to speed things up
-  uint32_t batch_size = 10000;
-  
-  uint32_t *descriptor_2_vw_assignments = new uint32_t[ total_nb_descriptors ];
-  uint32_t offset = 0;
-  uint32_t selected_desc = 0;
-  uint64_t index1, index2;
-  std::vector< unsigned char > tmp_descriptors( 128 * batch_size );
-  
-  std::vector< uint32_t > cluster_assignments_( batch_size, 0 );
-  
-  // execute the batches
-  uint32_t total_offset = 0;
-  for( uint32_t i=0; i<nb_points; ++i )
+  // The 3D points are processed in chunks of at least 10000 descriptors per thread. While a chunk
+  // is processed, the next one is read from the file. For every chunk, we assign the descriptors to
+  // visual words and compute the representatives of the 3D points in parallel. The representative
+  // descriptors are written to a temporary file, so that we only have to keep the positions of
+  // the 3D points and the assignments in memory.
+  std::cout << "-> Assigning the descriptors to visual words and computing the representative descriptors for every 3D point (this might take a while)" << std::endl;
+  
+  uint32_t chunk_size = 10000 * uint32_t( nb_threads );
+  bool float_descriptors = ( mode == 1 || mode == 2 || mode == 4 );
+  
+  std::string tmp_descriptor_file = desc_output + ".tmp";
+  std::ofstream tmp_ofs( tmp_descriptor_file.c_str(), std::ios::out | std::ios::binary );
+  if( !tmp_ofs.is_open() )
   {
-    uint32_t nb_desc_i = (uint32_t) feature_infos[i].view_list.size();
-    
-    total_offset += nb_desc_i;
-    
-    for( uint32_t j=0; j<nb_desc_i; ++j )
-    {
-      // copy the descriptor
-      index1 = selected_desc * 128;
-      index2 = uint64_t(j)*uint64_t(128);
-      for( uint64_t k=0; k<128; ++k )
-		tmp_descriptors[index1+k] = feature_infos[i].descriptors[index2+k];
-	  
-      ++selected_desc;
-	  
-	  // check if we have selected enough descriptors to do a batch assignment
-      if( (selected_desc == batch_size) || (offset+selected_desc == total_nb_descriptors) || (total_offset+selected_desc == total_nb_descriptors ) )
-      {
-        if( assignment_type == 0 )
-          vw_handler.set_nb_paths( 10 );
-        else
-          vw_handler.set_nb_paths( 1 );
-        
-		vw_handler.assign_visual_words_uchar( tmp_descriptors, selected_desc, cluster_assignments_ );
-	
-		for( uint32_t l=0; l<selected_desc; ++l )
-		{
-		  if( cluster_assignments_[l] > nb_cluster )
-		  {
-			std::cout << cluster_assignments_[l] << " : ";
-			for( uint32_t ll=0; ll<128; ++ll )
-			  std::cout << " " << int(tmp_descriptors[128*l+ll]);
-			std::cout << std::endl;
-		  }
-		  descriptor_2_vw_assignments[offset+l] = cluster_assignments_[l];
-		}
-		
-// 		std::cout << offset << " / " << total_nb_descriptors << std::endl;
-	
-	
-		offset += selected_desc;
-		selected_desc = 0;
-      }
-    } 
+    std::cerr << " ERROR: Could not write to " << tmp_descriptor_file << std::endl;
+    return -1;
   }
-  std::cout << "--> done" << std::endl;  
-
-
-  ////
-  // Now compute the representatives for the 3D points
-  
-  std::cout << "-> Computing the representative descriptors for every 3D point" << std::endl;
-  
   
-  // vectors containing all descriptors (simply concatenating all descriptor entries)
-  // depending on the mode, we use either unsigned char values or float values to represent
-  // descriptor entries
-  std::vector< unsigned char > descriptors;
-  descriptors.clear();
+  // the positions of the 3D points (3 floats each)
+  std::vector< float > points;
+  points.reserve( 3 * (size_t) nb_points );
   
-  std::vector< float > descriptors_float;
-  descriptors_float.clear();
+  // number of representative descriptors written to the temporary file
+  uint32_t nb_descriptors = 0;
   
   // vector containing for every visual word a list of (point id, descriptor id) pairs, where 
-  // point id is the index of the point in feature_infos and 128 * descriptor id is the first entry
-  // of the descriptor belonging to that point in either descriptors or descriptors_float (depending on the mode)
+  // point id is the index of the 3D point and descriptor id is the index of the representative descriptor
+  // in the temporary file
   std::vector< std::vector< std::pair< uint32_t, uint32_t > > > vw_point_descriptor_idx( nb_cluster );
   
   for( uint32_t i=0; i<nb_cluster; ++i )
     vw_point_descriptor_idx[i].clear();
   
+  // reads 3D points into chunk until they contain at least chunk_size descriptors, returns the number of points read.
+  // The elements of chunk are reused, so their memory is only allocated for the first chunks
+  auto read_chunk = [&]( std::vector< feature_3D_info > &chunk )
+  {
+    uint32_t nb_chunk_points = 0, nb_chunk_desc = 0;
+    while( nb_chunk_desc < chunk_size )
+    {
+      if( nb_chunk_points == chunk.size() )
+        chunk.resize( std::max( size_t( 2 * chunk.size() ), size_t( 1024 ) ) );
+      if( !reader.read_point( chunk[nb_chunk_points] ) )
+        break;
+      nb_chunk_desc += (uint32_t) chunk[nb_chunk_points].view_list.size();
+      ++nb_chunk_points;
+    }
+    return nb_chunk_points;
+  };
   
-  offset = 0;
+  std::vector< feature_3D_info > chunks[2];
+  uint32_t nb_chunk_points[2] = { read_chunk( chunks[0] ), 0 };
+  int current = 0;
   
-
-  for( uint32_t i=0; i<nb_points; ++i )
-  { 
-	// get the number of views of that point, which coincides with the number of 
-	// descriptors available for that point
-    uint32_t nb_desc_i = (uint32_t) feature_infos[i].view_list.size();  
+  std::vector< SIFT_descriptor_view > chunk_descriptors;
+  std::vector< uint32_t > cluster_assignments_, assignment_offsets;
+  std::vector< point_representatives > representatives;
+  std::vector< float > mean_descriptors;
+  std::vector< uint32_t > mean_assignments;
+  
+  // id of the first point in the current chunk
+  uint32_t point_offset = 0;
+  
+  while( nb_chunk_points[current] > 0 )
+  {
+    // read the next chunk in the background
+    int next = 1 - current;
+    std::thread reader_thread( [&]() { nb_chunk_points[next] = read_chunk( chunks[next] ); } );
+    
+    std::vector< feature_3D_info > &chunk = chunks[current];
+    uint32_t nb_chunk = nb_chunk_points[current];
+    
+    ////
+    // compute the assignments to visual words for all descriptors of the chunk
+    chunk_descriptors.resize( nb_chunk );
+    for( uint32_t i=0; i<nb_chunk; ++i )
+      chunk_descriptors[i] = SIFT_descriptor_view( chunk[i].descriptors.empty() ? 0 : &(chunk[i].descriptors[0]), (uint32_t) chunk[i].view_list.size() );
+    
+    if( assignment_type == 0 )
+      vw_handler.set_nb_paths( 10 );
+    else
+      vw_handler.set_nb_paths( 1 );
+    
+    vw_handler.assign_visual_words_batch( chunk_descriptors, cluster_assignments_, assignment_offsets );
     
-    // compute representatives depending on the mode chosen by the user
-    if ( mode == 0 )
+    for( uint32_t l=0; l<assignment_offsets[nb_chunk]; ++l )
     {
-      // compute for each visual word the medoid descriptors and store it
-      // first determine the number of activated vw
-      std::set< size_t > activated_visual_words;
-      activated_visual_words.clear();
-      for( size_t j=0; j<nb_desc_i; ++j )
-		activated_visual_words.insert( descriptor_2_vw_assignments[offset+j] );
-      
-      // now we compute the medoid descriptors
-      for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
-      {
-		// gather all descriptors assigned to visual word *it
-		std::vector< unsigned char > visual_word_descriptors;
-		visual_word_descriptors.clear();
-		for( size_t j=0; j<nb_desc_i; ++j )
-		{
-		  if( *it == descriptor_2_vw_assignments[offset+j] )
-		  {
-			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
-			  visual_word_descriptors.push_back(feature_infos[i].descriptors[k]);
-		  }
-		}
-		
-		// now compute the medoid
-		uint32_t med_id = compute_medoid( visual_word_descriptors );
-		
-		// get the id of the new medoid descriptor for the (point id, descriptor id) pair
-		uint32_t desc_id = uint32_t( descriptors.size() ) / 128;
-		
-		// add the new descriptor to the set of all used descriptors
-		for( uint32_t k=128*med_id; k<(128*med_id + 128 ); ++k )
-		  descriptors.push_back(visual_word_descriptors[k]);
-
-		// insert the pair
-		vw_point_descriptor_idx[ *it ].push_back(std::make_pair( i, desc_id ) );
-
-      }
+      if( cluster_assignments_[l] > nb_cluster )
+        std::cout << " WARNING: descriptor assigned to the invalid visual word " << cluster_assignments_[l] << std::endl;
     }
-    else if( mode == 3 )
-    {
-      // compute the medoid descriptor for the 3D point and assign it to all visual words that one of the 
-      // descriptors is assigned to
-      
-      // first determine the number of unique activated vw
-      std::set< size_t > activated_visual_words;
-      activated_visual_words.clear();
-      for( size_t j=0; j<nb_desc_i; ++j )
-		activated_visual_words.insert( descriptor_2_vw_assignments[offset+j] );
-      
-      // compute the medoid
-      uint32_t med_id = compute_medoid( feature_infos[i].descriptors );
-      uint32_t desc_id = uint32_t( descriptors.size() ) / 128;
-      
-      // insert the medoid and add references to it
-      for( uint32_t k=128*med_id; k<(128*med_id + 128 ); ++k )
-		descriptors.push_back(feature_infos[i].descriptors[k]);
-      
-      for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
-		vw_point_descriptor_idx[ *it ].push_back(std::make_pair( i, desc_id ) );
-    }
-    else if( mode == 4 )
+    
+    ////
+    // compute the representatives of the 3D points, the threads fetch the next point to process from a shared counter
+    representatives.resize( nb_chunk );
+    std::atomic< uint32_t > next_point( 0 );
+    auto worker = [&]()
     {
-      // compute for each visual word the mean descriptors and assign it to all visual words that one of the 
-      // descriptors is assigned to
-	  
-      // first determine the number of activated vw
-      std::set< size_t > activated_visual_words;
-      activated_visual_words.clear();
-      for( size_t j=0; j<nb_desc_i; ++j )
-		activated_visual_words.insert( descriptor_2_vw_assignments[offset+j] );
-      
-      // now we compute the mean descriptors belonging to the visual words
-      for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
-      {
-		// gather all descriptors assigned to visual word *it
-		std::vector< unsigned char > visual_word_descriptors;
-		visual_word_descriptors.clear();
-		for( size_t j=0; j<nb_desc_i; ++j )
-		{
-		  if( *it == descriptor_2_vw_assignments[offset+j] )
-		  {
-			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
-			  visual_word_descriptors.push_back(feature_infos[i].descriptors[k]);
-		  }
-		}
-		
-		// now compute the mean
-		std::vector< float > mean_descriptor;
-		
-		compute_mean( visual_word_descriptors, mean_descriptor );
-		
-		uint32_t desc_id = uint64_t( descriptors_float.size() ) / 128;
-		
-		// store the descriptor
-		for( uint32_t k=0; k<128; ++k )
-		  descriptors_float.push_back(mean_descriptor[k]);
-
-		vw_point_descriptor_idx[ *it ].push_back(std::make_pair( i, desc_id ) );
-		
-		mean_descriptor.clear();
-      }
-    }
-    else if( mode == 5 )
+      for( uint32_t i = next_point++; i < nb_chunk; i = next_point++ )
+        compute_representatives( mode, chunk[i], &(cluster_assignments_[0]) + assignment_offsets[i], representatives[i] );
+    };
+    
+    std::vector< std::thread > workers;
+    for( int t=1; t<nb_threads; ++t )
+      workers.push_back( std::thread( worker ) );
+    worker();
+    for( size_t t=0; t<workers.size(); ++t )
+      workers[t].join();
+    
+    // for mode 1, compute the visual words of the mean descriptors
+    if( mode == 1 )
     {
-	  // all descriptors
-	  
-      // first determine the number of activated vw
-      std::set< size_t > activated_visual_words;
-      activated_visual_words.clear();
-      for( size_t j=0; j<nb_desc_i; ++j )
-		activated_visual_words.insert( descriptor_2_vw_assignments[offset+j] );
+      mean_descriptors.resize( 128 * (size_t) nb_chunk );
+      for( uint32_t i=0; i<nb_chunk; ++i )
+        std::copy( representatives[i].descriptors_float.begin(), representatives[i].descriptors_float.end(), mean_descriptors.begin() + 128 * (size_t) i );
       
-      // now we assign all descriptors belonging to the visual word to it
-      for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
-      {
-		for( size_t j=0; j<nb_desc_i; ++j )
-		{
-		  if( *it == descriptor_2_vw_assignments[offset+j] )
-		  {
-			uint32_t desc_id = uint64_t( descriptors.size() ) / 128;
-			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
-			  descriptors.push_back(feature_infos[i].descriptors[k]);
-			vw_point_descriptor_idx[ *it ].push_back(std::make_pair( i, desc_id ) );
-		  }
-		}
-      }
-    }
-    else if( mode == 6 )
-    {
-	  // integer mean per visual word
-	  
-      // compute for each visual word the mean descriptors, round it to the next integer and store it
-	  
-      // first determine the number of activated vw
-      std::set< size_t > activated_visual_words;
-      activated_visual_words.clear();
-      for( size_t j=0; j<nb_desc_i; ++j )
-		activated_visual_words.insert( descriptor_2_vw_assignments[offset+j] );
+      vw_handler.set_nb_paths( 10 );
+      vw_handler.assign_visual_words_float( mean_descriptors, nb_chunk, mean_assignments );
       
-      // now we compute the mean descriptors belonging to the visual words
-      for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
-      {
-		std::vector< unsigned char > visual_word_descriptors;
-		visual_word_descriptors.clear();
-		for( size_t j=0; j<nb_desc_i; ++j )
-		{
-		  if( *it == descriptor_2_vw_assignments[offset+j] )
-		  {
-			for( uint32_t k=uint32_t(j)*128; k < uint32_t(j)*128+128; ++k )
-			  visual_word_descriptors.push_back(feature_infos[i].descriptors[k]);
-		  }
-		}
-		
-		// now compute the mean
-		std::vector< float > mean_descriptor;
-		
-		compute_mean( visual_word_descriptors, mean_descriptor );
-		
-		// round to the nearest integer values
-		std::vector< unsigned char > integer_mean( 128, 0 );
-		for( int k=0; k<128; ++k )
-		{
-		  float bottom =  mean_descriptor[k] - floor( mean_descriptor[k] );
-		  float top =  ceil( mean_descriptor[k] ) - mean_descriptor[k];
-		  if( bottom < top )
-			integer_mean[k] = (unsigned char) floor( mean_descriptor[k] );
-		  else
-			integer_mean[k] = (unsigned char) ceil( mean_descriptor[k] );
-		}
-		
-		uint32_t desc_id = uint64_t( descriptors.size() ) / 128;
-		
-		// store the descriptor
-		for( uint32_t k=0; k<128; ++k )
-		  descriptors.push_back(integer_mean[k]);
-
-		vw_point_descriptor_idx[ *it ].push_back(std::make_pair( i, desc_id ) );
-		
-		integer_mean.clear();
-		mean_descriptor.clear();
-      }
+      for( uint32_t i=0; i<nb_chunk; ++i )
+        representatives[i].vw_descriptor_idx.push_back( std::make_pair( mean_assignments[i], uint32_t( 0 ) ) );
     }
-    else if( mode == 1 || mode == 2 )
+    
+    ////
+    // store the 3D points and their representatives in the order of the points
+    for( uint32_t i=0; i<nb_chunk; ++i )
     {
-      // compute the mean descriptor
-      std::vector< float > mean_descriptor;
-      compute_mean( feature_infos[i].descriptors, mean_descriptor );
+      uint32_t point_id = point_offset + i;
+      points.push_back( chunk[i].point.x );
+      points.push_back( chunk[i].point.y );
+      points.push_back( chunk[i].point.z );
       
-      // store the descriptor
-      uint32_t desc_id = uint64_t( descriptors_float.size() ) / 128;
-	
-      for( uint32_t k=0; k<128; ++k )
-		descriptors_float.push_back(mean_descriptor[k]);
+      const point_representatives &reps = representatives[i];
+      for( size_t j=0; j<reps.vw_descriptor_idx.size(); ++j )
+        vw_point_descriptor_idx[ reps.vw_descriptor_idx[j].first ].push_back( std::make_pair( point_id, nb_descriptors + reps.vw_descriptor_idx[j].second ) );
       
-      if( mode == 1 )
+      if( float_descriptors )
       {
-		std::vector< uint32_t > assignment(1,0);
-		// compute the visual word of the mean descriptor and assign it to the word
-		vw_handler.set_nb_paths( 10 );
-		vw_handler.assign_visual_words_float( mean_descriptor, 1, assignment );
-
-		vw_point_descriptor_idx[ assignment[0] ].push_back(std::make_pair( i, desc_id ) );
+        if( !reps.descriptors_float.empty() )
+          tmp_ofs.write( (const char*) &(reps.descriptors_float[0]), reps.descriptors_float.size() * sizeof( float ) );
+        nb_descriptors += uint32_t( reps.descriptors_float.size() / 128 );
       }
-      else if( mode == 2 )
+      else
       {
-		// assign the mean descriptor to all the visual words that the descriptors of the point belong to
-		std::set< size_t > activated_visual_words;
-		activated_visual_words.clear();
-		for( size_t j=0; j<nb_desc_i; ++j )
-		  activated_visual_words.insert( descriptor_2_vw_assignments[offset+j] );
-		
-		// store the reference to the mean descriptor in all activated visual words
-		for( std::set< size_t >::iterator it = activated_visual_words.begin(); it != activated_visual_words.end(); ++it )
-		  vw_point_descriptor_idx[ *it ].push_back(std::make_pair( i, desc_id ) );
+        if( !reps.descriptors.empty() )
+          tmp_ofs.write( (const char*) &(reps.descriptors[0]), reps.descriptors.size() );
+        nb_descriptors += uint32_t( reps.descriptors.size() / 128 );
       }
     }
     
-    offset += nb_desc_i;
+    point_offset += nb_chunk;
     
+    reader_thread.join();
+    current = next;
+  }
+  
+  reader.close();
+  tmp_ofs.close();
+  
+  if( point_offset != nb_points || !tmp_ofs )
+  {
+    std::cerr << " ERROR: Could only process " << point_offset << " of " << nb_points << " 3D points " << std::endl;
+    unlink( tmp_descriptor_file.c_str() );
+    return -1;
   }
   
   std::cout << " done computing the assignments" << std::endl;
@@ -579,13 +671,11 @@ int main (int argc, char **argv)
     }
     
     
-    offset = 0;    
-    
     std::cout << std::endl << "################ statistics #################" << std::endl;
     std::cout << " #activated vws: " << nb_non_empty_vw << " ( " << double(nb_non_empty_vw)/double(nb_cluster) * 100.0 << " % ) with " << points_per_vw / double(nb_non_empty_vw) << " 3D points on average (for activated polys), max: " << max_polys << std::endl;
     std::cout << " # 3D points : " << nb_points << std::endl;
-    std::cout << " # computed medoid descriptors: " << descriptors.size() / 128 << std::endl;
-    std::cout << " # computed mean descriptors: " << descriptors_float.size() / 128 << std::endl;
+    std::cout << " # computed medoid descriptors: " << ( float_descriptors ? 0 : nb_descriptors ) << std::endl;
+    std::cout << " # computed mean descriptors: " << ( float_descriptors ? nb_descriptors : 0 ) << std::endl;
     std::cout << "################ statistics #################" << std::endl << std::endl;
   }
   
@@ -596,92 +686,62 @@ int main (int argc, char **argv)
   
   // count the number of assignments
   uint32_t nb_assignments = 0;
+  for( uint32_t i=0; i<nb_cluster; ++i )
+    nb_assignments += (uint32_t) vw_point_descriptor_idx[i].size();
+  
   std::cout << "-> saving the descriptor-to-visual word assignments to " << desc_output << std::endl;
   {
-	std::ofstream ofs( desc_output.c_str(), std::ios::out | std::ios::binary );
-	
-	if( !ofs.is_open() )
-	{
-	  std::cerr << " Could not write the descriptors to file " << desc_output << std::endl;
-	  return -1;
-	}
-	
-	uint32_t nb_descriptors = 0;
-	if( mode == 0 || mode == 3 || mode == 5 || mode == 6 )
-	  nb_descriptors = uint32_t( descriptors.size()/128 );
-	else if( mode == 1 || mode == 2 || mode == 4 )
-	  nb_descriptors = uint32_t( descriptors_float.size()/128 );
-	
-	// first write the number of remaining 3D points and the number of vw and the number of non-empty visual words and the number of descriptors
-	ofs.write( (char*) &nb_points, sizeof( uint32_t ) );
-	ofs.write( (char*) &nb_cluster, sizeof( uint32_t ) );
-	ofs.write( (char*) &nb_non_empty_vw, sizeof( uint32_t ) );
-	ofs.write( (char*) &nb_descriptors, sizeof( uint32_t ) );
-	
-	// then the 3D points together
-	for( uint32_t i=0; i<nb_points; ++i )
-	{
-	  float x = feature_infos[i].point.x;
-	  float y = feature_infos[i].point.y;
-	  float z = feature_infos[i].point.z;
-	  ofs.write( (char*) &x, sizeof( float ) );
-	  ofs.write( (char*) &y, sizeof( float ) );
-	  ofs.write( (char*) &z, sizeof( float ) );
-	}
-	
-	// now the descriptors
-	if( mode == 0 || mode == 3 || mode == 5 || mode == 6 )
+	// map the representative descriptors from the temporary file, the operating system only
+	// keeps the parts in memory that are currently copied into the output file
+	size_t descriptor_size = 128 * ( float_descriptors ? sizeof( float ) : sizeof( unsigned char ) );
+	size_t file_size = descriptor_size * (size_t) nb_descriptors;
+	void *descriptors = 0;
+	if( file_size > 0 )
 	{
-	  for( uint32_t i=0; i<uint32_t( descriptors.size() ); ++i )
+	  int fd = open( tmp_descriptor_file.c_str(), O_RDONLY );
+	  if( fd >= 0 )
 	  {
-		unsigned char entry = descriptors[i];
-		ofs.write( (char*) &entry, sizeof( unsigned char ) );
+	    descriptors = mmap( 0, file_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	    close( fd );
 	  }
-		}
-		else if( mode == 1 || mode == 2 || mode == 4 )
-		{
-	  for( uint32_t i=0; i<uint32_t( descriptors_float.size() ); ++i )
+	  if( fd < 0 || descriptors == MAP_FAILED )
 	  {
-		float entry = descriptors_float[i];
-		ofs.write( (char*) &entry, sizeof( float ) );
+	    std::cerr << " ERROR: Could not map the representative descriptors from " << tmp_descriptor_file << std::endl;
+	    unlink( tmp_descriptor_file.c_str() );
+	    return -1;
 	  }
 	}
 	
-	// write out the assignments vw -> ( 3D point id, descriptor id )
-	// format: cluster_id nb_assignments assignments (as pairs of uint32_t )
-	for( uint32_t i=0; i<nb_cluster; ++i )
+	// the file is written in the memory mapped format of localization_database, see features/localization_database.hh
+	bool saved = localization_database::save( desc_output, points, float_descriptors ? LOC_DB_FLOAT : LOC_DB_UCHAR, descriptors, nb_descriptors, vw_point_descriptor_idx );
+	
+	if( descriptors != 0 )
+	  munmap( descriptors, file_size );
+	unlink( tmp_descriptor_file.c_str() );
+	
+	if( !saved )
 	{
-	  uint32_t nb_desc_assignments = (uint32_t) vw_point_descriptor_idx[i].size();
-	  ofs.write( (char*) &i, sizeof( uint32_t ) );
-	  ofs.write( (char*) &nb_desc_assignments, sizeof( uint32_t ) );
-	  for( std::vector< std::pair< uint32_t, uint32_t > >::const_iterator it = vw_point_descriptor_idx[i].begin(); it != vw_point_descriptor_idx[i].end(); ++it )
-	  {
-		uint32_t first = it->first;
-		uint32_t second = it->second;
-		ofs.write( (char*) &first, sizeof( uint32_t ) );
-		ofs.write( (char*) &second, sizeof( uint32_t ) );
-		++nb_assignments;
-	  }
+	  std::cerr << " Could not write the descriptors to file " << desc_output << std::endl;
+	  return -1;
 	}
-	
-	ofs.close();
   }
   std::cout << "--> done " << std::endl;
   
   
   ////
   // display statistics about memory consumption:
+  uint32_t nb_descriptor_values = 128 * nb_descriptors;
   std::cout << "***** Memory requirements ******" << std::endl;
   std::cout << " " << nb_points << " points -> " << nb_points * 3 << " floats -> " << nb_points * uint32_t(3) * uint32_t( sizeof( float ) ) / ( uint32_t(1024) * uint32_t(1024) ) << " MB " << std::endl;
   if( mode == 0 || mode == 3 || mode == 5 || mode == 6 )
-    std::cout << " " << uint32_t( descriptors.size()/128 ) << " descriptors -> " << uint32_t( descriptors.size() ) << " unsigned chars -> " << uint32_t( descriptors.size() ) / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( unsigned char ) << " MB " << std::endl;
+    std::cout << " " << nb_descriptors << " descriptors -> " << nb_descriptor_values << " unsigned chars -> " << nb_descriptor_values / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( unsigned char ) << " MB " << std::endl;
   else if( mode == 1 || mode == 2 || mode == 4  )
-    std::cout << " " << uint32_t( descriptors_float.size()/128 ) << " descriptors -> " << uint32_t( descriptors_float.size() ) << " floats -> " << uint32_t( descriptors_float.size() ) / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( float ) << " MB " << std::endl;
+    std::cout << " " << nb_descriptors << " descriptors -> " << nb_descriptor_values << " floats -> " << nb_descriptor_values / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( float ) << " MB " << std::endl;
   std::cout << " " << nb_assignments << " assignments -> " << nb_assignments * 2 << " uint32_t -> " << nb_assignments * uint32_t(2) * uint32_t( sizeof( uint32_t ) ) / ( uint32_t(1024) * uint32_t(1024) ) << " MB " << std::endl;
   if( mode == 0 || mode == 3 || mode == 5 || mode == 6 )
-    std::cout << " in total : " << nb_assignments * uint32_t(2) * uint32_t( sizeof( uint32_t ) ) / ( uint32_t(1024) * uint32_t(1024) ) + nb_points * uint32_t(3) * uint32_t( sizeof( float ) ) / ( uint32_t(1024) * uint32_t(1024) )  + uint32_t( descriptors.size() ) / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( unsigned char ) << " MB " << std::endl;
+    std::cout << " in total : " << nb_assignments * uint32_t(2) * uint32_t( sizeof( uint32_t ) ) / ( uint32_t(1024) * uint32_t(1024) ) + nb_points * uint32_t(3) * uint32_t( sizeof( float ) ) / ( uint32_t(1024) * uint32_t(1024) )  + nb_descriptor_values / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( unsigned char ) << " MB " << std::endl;
   else if( mode == 1 || mode == 2 || mode == 4 )
-    std::cout << " in total : " << nb_assignments * uint32_t(2) * uint32_t( sizeof( uint32_t ) ) / ( uint32_t(1024) * uint32_t(1024) ) + nb_points * uint32_t(3) * uint32_t( sizeof( float ) ) / ( uint32_t(1024) * uint32_t(1024) )  + uint32_t( descriptors_float.size() ) / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( float ) << " MB " << std::endl;
+    std::cout << " in total : " << nb_assignments * uint32_t(2) * uint32_t( sizeof( uint32_t ) ) / ( uint32_t(1024) * uint32_t(1024) ) + nb_points * uint32_t(3) * uint32_t( sizeof( float ) ) / ( uint32_t(1024) * uint32_t(1024) )  + nb_descriptor_values / ( uint32_t(1024) * uint32_t(1024) ) * sizeof( float ) << " MB " << std::endl;
   
 
   return 0;
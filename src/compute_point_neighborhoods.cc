@@ -0,0 +1,146 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011 by Computer Graphics Group, RWTH Aachen           *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <stdlib.h>
+
+#include <ANN/ANN.h>
+
+#include "features/localization_database.hh"
+#include "sfm/parse_bundler.hh"
+#include "sfm/scene_graph.hh"
+#include "sfm/point_neighborhoods.hh"
+
+int main (int argc, char **argv)
+{
+  if( argc < 6 )
+  {
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -    compute_point_neighborhoods - Precompute the 3D neighborhoods of all points used by            - " << std::endl;
+    std::cout << " -                                  acg_localizer_active_search for 3D-to-2D matching.               - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - usage: compute_point_neighborhoods bundle_file descriptors N_3D filter_points outfile             - " << std::endl;
+    std::cout << " -                                    [image_set_cover] [nb_cams_set_cover]                          - " << std::endl;
+    std::cout << " - Parameters:                                                                                       - " << std::endl;
+    std::cout << " -  bundle_file                                                                                      - " << std::endl;
+    std::cout << " -     The bundle.out file generated by Bundler or the scene graph computed by compute_scene_graph.  - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  descriptors                                                                                      - " << std::endl;
+    std::cout << " -     The assignments computed by compute_desc_assignments, the 3D points are taken from this file. - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  N_3D                                                                                             - " << std::endl;
+    std::cout << " -     The number of nearest neighbors in 3D that are stored for every point.                        - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  filter_points                                                                                    - " << std::endl;
+    std::cout << " -     Set to 1 to only keep the neighbors that are visible together with the point in at least one  - " << std::endl;
+    std::cout << " -     image (or set cover image), set to 0 to keep all neighbors.                                   - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  outfile                                                                                          - " << std::endl;
+    std::cout << " -     Binary file containing the neighborhoods (see sfm/point_neighborhoods.hh). It can be passed to- " << std::endl;
+    std::cout << " -     acg_localizer_active_search with the option --neighborhoods.                                  - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  image_set_cover, nb_cams_set_cover                                                               - " << std::endl;
+    std::cout << " -     See compute_scene_graph, only used if bundle_file is a bundle.out file. Default: 1 and 10     - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - The values of N_3D and filter_points (and the set cover parameters if filter_points is 1) have    - " << std::endl;
+    std::cout << " - to be the same as the ones passed to acg_localizer_active_search. Neighborhoods that are not      - " << std::endl;
+    std::cout << " - filtered can also be used with smaller values of N_3D and with any value of filter_points.        - " << std::endl;
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    return 1;
+  }
+  
+  ////
+  // get the parameters
+  std::string bundle_file( argv[1] );
+  std::string descriptor_file( argv[2] );
+  int N_3D = atoi( argv[3] );
+  bool filter_points = (bool) atoi( argv[4] );
+  std::string outfile( argv[5] );
+  
+  bool use_image_set_cover = true;
+  if( argc >= 7 )
+    use_image_set_cover = (bool) atoi( argv[6] );
+  
+  uint32_t consider_K_nearest_cams = 10;
+  if( argc >= 8 )
+    consider_K_nearest_cams = (uint32_t) atoi( argv[7] );
+  
+  if( N_3D <= 0 )
+  {
+    std::cerr << "ERROR: N_3D has to be positive " << std::endl;
+    return 1;
+  }
+  
+  ////
+  // load the 3D points
+  std::cout << "-> loading the 3D points from " << descriptor_file << std::endl;
+  localization_database loc_db;
+  if( !loc_db.load( descriptor_file ) )
+  {
+    std::cerr << "ERROR: could not load " << descriptor_file << std::endl;
+    return 1;
+  }
+  
+  ////
+  // get the visibility information
+  scene_graph visibility_graph;
+  if( scene_graph::is_scene_graph_file( bundle_file ) )
+  {
+    std::cout << "-> loading the scene graph from " << bundle_file << std::endl;
+    if( !visibility_graph.load( bundle_file ) )
+      return 1;
+  }
+  else
+  {
+    std::cout << "-> parsing bundler data " << std::endl;
+    parse_bundler parser;
+    if( !parser.parse_data( bundle_file.c_str(), 0 ) )
+    {
+      std::cerr << "ERROR: could not parse the bundler file " << bundle_file << std::endl;
+      return 1;
+    }
+    
+    if( !visibility_graph.compute( parser, use_image_set_cover, consider_K_nearest_cams ) )
+      return 1;
+    parser.clear();
+  }
+  
+  ////
+  // compute and save the neighborhoods
+  std::cout << "-> computing the " << N_3D << " nearest neighbors of " << loc_db.get_nb_points() << " points " << std::endl;
+  point_neighborhoods neighborhoods;
+  if( !neighborhoods.compute( loc_db.get_point( 0 ), loc_db.get_nb_points(), visibility_graph, (uint32_t) N_3D, filter_points ) )
+    return 1;
+  annClose();
+  
+  if( !neighborhoods.save( outfile ) )
+    return 1;
+  
+  std::cout << "-> saved the neighborhoods to " << outfile << std::endl;
+  
+  return 0;
+}
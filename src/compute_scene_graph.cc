@@ -0,0 +1,103 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011 by Computer Graphics Group, RWTH Aachen           *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <stdlib.h>
+
+#include "sfm/parse_bundler.hh"
+#include "sfm/scene_graph.hh"
+
+int main (int argc, char **argv)
+{
+  if( argc < 3 )
+  {
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -    compute_scene_graph - Precompute the visibility information used by                            - " << std::endl;
+    std::cout << " -                          acg_localizer_active_search from a Bundler reconstruction.               - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - usage: compute_scene_graph bundle_file outfile [image_set_cover] [nb_cams_set_cover]              - " << std::endl;
+    std::cout << " - Parameters:                                                                                       - " << std::endl;
+    std::cout << " -  bundle_file                                                                                      - " << std::endl;
+    std::cout << " -     The bundle.out file generated by Bundler.                                                     - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  outfile                                                                                          - " << std::endl;
+    std::cout << " -     Binary file containing the connected component of every 3D point, the images (or set cover    - " << std::endl;
+    std::cout << " -     ids) every 3D point is visible in and the set cover ids of all cameras                        - " << std::endl;
+    std::cout << " -     (see sfm/scene_graph.hh). It can be passed instead of the bundle_file to                      - " << std::endl;
+    std::cout << " -     acg_localizer_active_search.                                                                  - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  image_set_cover                                                                                  - " << std::endl;
+    std::cout << " -     Set to 0 to use the original images or to 1 to compute a set cover of the images, see the     - " << std::endl;
+    std::cout << " -     corresponding parameter of acg_localizer_active_search. Default: 1                            - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  nb_cams_set_cover                                                                                - " << std::endl;
+    std::cout << " -     The number of nearest cameras considered for the set cover. Default: 10                       - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - The values of image_set_cover and nb_cams_set_cover have to be the same as the ones passed to     - " << std::endl;
+    std::cout << " - acg_localizer_active_search.                                                                      - " << std::endl;
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    return 1;
+  }
+  
+  ////
+  // get the parameters
+  std::string bundle_file( argv[1] );
+  std::string outfile( argv[2] );
+  
+  bool use_image_set_cover = true;
+  if( argc >= 4 )
+    use_image_set_cover = (bool) atoi( argv[3] );
+  
+  uint32_t consider_K_nearest_cams = 10;
+  if( argc >= 5 )
+    consider_K_nearest_cams = (uint32_t) atoi( argv[4] );
+  
+  ////
+  // parse the reconstruction
+  std::cout << "-> parsing bundler data " << std::endl;
+  parse_bundler parser;
+  if( !parser.parse_data( bundle_file.c_str(), 0 ) )
+  {
+    std::cerr << "ERROR: could not parse the bundler file " << bundle_file << std::endl;
+    return 1;
+  }
+  
+  ////
+  // compute and save the scene graph
+  scene_graph visibility_graph;
+  if( !visibility_graph.compute( parser, use_image_set_cover, consider_K_nearest_cams ) )
+    return 1;
+  parser.clear();
+  
+  if( !visibility_graph.save( outfile ) )
+    return 1;
+  
+  std::cout << "-> saved the scene graph to " << outfile << std::endl;
+  
+  return 0;
+}
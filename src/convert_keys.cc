@@ -0,0 +1,130 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011 by Computer Graphics Group, RWTH Aachen           *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "features/SIFT_loader.hh"
+
+int main (int argc, char **argv)
+{
+  if( argc < 2 )
+  {
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -    convert_keys - Convert keypoint files between the text format of David Lowe's                  - " << std::endl;
+    std::cout << " -                   SIFT binary and a binary format that is much faster to load.                    - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - usage: convert_keys list_keyfiles [to_text]                                                       - " << std::endl;
+    std::cout << " - Parameters:                                                                                       - " << std::endl;
+    std::cout << " -  list_keyfiles                                                                                    - " << std::endl;
+    std::cout << " -     A text file containing the filenames of the keypoint files, one per line. Every file          - " << std::endl;
+    std::cout << " -     is converted in place, i.e., it keeps its name and the .key ending expected by the            - " << std::endl;
+    std::cout << " -     localization methods. See features/SIFT_loader.hh for the binary format.                      - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " -  to_text                                                                                          - " << std::endl;
+    std::cout << " -     Set to 1 to convert binary files back to text files. Default: 0 (convert to binary).          - " << std::endl;
+    std::cout << " -                                                                                                   - " << std::endl;
+    std::cout << " - All programs reading keypoint files detect their format automatically. Files that                 - " << std::endl;
+    std::cout << " - already have the requested format are skipped.                                                    - " << std::endl;
+    std::cout << "_______________________________________________________________________________________________________" << std::endl;
+    return 1;
+  }
+  
+  ////
+  // get the parameters
+  std::string list_keyfiles( argv[1] );
+  
+  bool to_text = false;
+  if( argc >= 3 )
+    to_text = (bool) atoi( argv[2] );
+  
+  SIFT_FORMAT target_format = to_text ? LOWE : LOWE_BINARY;
+  
+  std::ifstream ifs( list_keyfiles.c_str(), std::ios::in );
+  if( !ifs )
+  {
+    std::cerr << "ERROR: cannot read the list of keypoint files " << list_keyfiles << std::endl;
+    return 1;
+  }
+  
+  ////
+  // convert the files one after another
+  uint32_t nb_converted = 0;
+  uint32_t nb_skipped = 0;
+  uint32_t nb_failed = 0;
+  
+  SIFT_loader key_loader;
+  std::string keyfile;
+  while( std::getline( ifs, keyfile ) )
+  {
+    if( keyfile.empty() )
+      continue;
+    
+    SIFT_FORMAT format = SIFT_loader::detect_format( keyfile.c_str() );
+    if( format == UNDEFINED )
+    {
+      std::cerr << "ERROR: cannot read " << keyfile << std::endl;
+      ++nb_failed;
+      continue;
+    }
+    
+    if( format == target_format )
+    {
+      ++nb_skipped;
+      continue;
+    }
+    
+    // never overwrite a file that could not be read completely
+    if( !key_loader.load_features( keyfile.c_str(), format ) )
+    {
+      std::cerr << "ERROR: cannot read " << keyfile << ", the file is not converted " << std::endl;
+      ++nb_failed;
+      continue;
+    }
+    
+    // write to a temporary file first such that the original file is kept if something goes wrong
+    std::string tmp_file = keyfile + ".tmp";
+    bool saved = to_text ? key_loader.save_features_lowe( tmp_file.c_str() ) : key_loader.save_features_binary( tmp_file.c_str() );
+    
+    if( !saved || rename( tmp_file.c_str(), keyfile.c_str() ) != 0 )
+    {
+      std::cerr << "ERROR: could not write " << keyfile << std::endl;
+      remove( tmp_file.c_str() );
+      ++nb_failed;
+    }
+    else
+      ++nb_converted;
+  }
+  ifs.close();
+  key_loader.clear_data();
+  
+  std::cout << "-> converted " << nb_converted << " files, " << nb_skipped << " files already had the requested format, " << nb_failed << " failed " << std::endl;
+  
+  return ( nb_failed > 0 ) ? 1 : 0;
+}
@@ -28,9 +28,16 @@
 #include <sstream>
 #include <stdio.h>
 #include <iostream>
+#include <mutex>
+#include <algorithm>
+
+// protects the global variables of jhead, locked from open_exif to close_exif
+static std::mutex exif_mutex;
 
 void exif_reader::open_exif( const char * filename )
 {
+  exif_mutex.lock();
+  
   // Code directly take from jhead.c
   // Many thanks to Matthias Wandel for writing this 
   // excellent piece of software
@@ -60,6 +67,20 @@ float exif_reader::get_CCD_width()
   return ImageInfo.CCDWidth;
 }
 
+float exif_reader::get_focal_length_in_pixels()
+{
+  float max_dim = (float) std::max( ImageInfo.Width, ImageInfo.Height );
+  
+  if( ImageInfo.FocalLength > 0.0f && ImageInfo.CCDWidth > 0.0f )
+    return ImageInfo.FocalLength / ImageInfo.CCDWidth * max_dim;
+  
+  // a 35mm film is 36mm wide
+  if( ImageInfo.FocalLength35mmEquiv > 0 )
+    return float( ImageInfo.FocalLength35mmEquiv ) / 36.0f * max_dim;
+  
+  return -1.0f;
+}
+
 int exif_reader::get_image_width()
 {
   return ImageInfo.Width;
@@ -154,4 +175,5 @@ int exif_reader::get_image_orientation()
 void exif_reader::close_exif( )
 {
   DiscardData();
+  exif_mutex.unlock();
 }
@@ -29,6 +29,9 @@
  *    Class to read information from the EXIF-tag of an JPEG image.
  *    This class is basically a wrapper for functionality implemented in
  *    the jhead tool by Matthias Wandel (http://www.sentex.ca/~mwandel/jhead/).
+ *    Since jhead stores the information of the image in global variables, only one
+ *    exif tag can be open at a time: open_exif blocks until the tag opened by another
+ *    thread has been closed with close_exif.
  *  
  *  author : Torsten Sattler (tsattler@cs.rwth-aachen.de)
  *  date : 07-26-2010
@@ -41,7 +44,7 @@ class exif_reader
   
   public:
 	
-	//! read the exif tag from a jpeg file
+	//! read the exif tag from a jpeg file, every call has to be followed by a call of close_exif from the same thread
 	static void open_exif( const char * filename );
 
 	//! get the focal length from the exif tag previously open by open_exif
@@ -50,6 +53,10 @@ class exif_reader
 	//! get the width of the CCD from the exif tag, returns -1.0 if not available
 	static float get_CCD_width();
 	
+	//! get the focal length in pixels (with respect to the larger image dimension), computed 
+	//! from the focal length and the CCD width or the 35mm equivalent focal length. Returns -1.0 if not available.
+	static float get_focal_length_in_pixels();
+	
 	//! get the width of the image from the exif tag
 	static int get_image_width();
 	
@@ -76,7 +83,7 @@ class exif_reader
 	**/
 	static int get_image_orientation();
 
-	//! free the memory previously used for reading the exif tag
+	//! free the memory previously used for reading the exif tag, allows other threads to open an exif tag
 	static void close_exif( );
   
 };
@@ -0,0 +1,298 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#include "SIFT_distance.hh"
+
+#ifdef SIFT_DISTANCE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+//---------------------------------------------------
+// scalar implementations
+//---------------------------------------------------
+
+int compute_squared_SIFT_dist_scalar( const unsigned char * const v1, const unsigned char * const v2 )
+{
+  int dist = 0;
+  int x = 0;
+  for( int i=0; i<128; ++i )
+  {
+    x = int( v1[i] ) - int( v2[i] );
+    dist += x*x;
+  }
+  return dist;
+}
+
+//---------------------------------------------------
+
+float compute_squared_SIFT_dist_float_scalar( const unsigned char * const v1, const float * const v2 )
+{
+  float dist = 0;
+  float x = 0;
+  for( int i=0; i<128; ++i )
+  {
+    x = float( v1[i] ) - v2[i];
+    dist += x*x;
+  }
+  return dist;
+}
+
+#ifdef SIFT_DISTANCE_X86_KERNELS
+
+////
+// The unsigned char versions compute |v1 - v2| with saturated subtractions, widen the 
+// differences to 16 bit and use madd to square them and to sum up pairs of them in 32 bit.
+// Since 2 * 255^2 fits into 32 bit (as does 128 * 255^2) the results are exact.
+// The floating point versions convert the unsigned chars to floats and use several accumulators.
+// The descriptors do not need to be aligned.
+////
+
+//---------------------------------------------------
+// SSE2
+//---------------------------------------------------
+
+__attribute__((target("sse2")))
+int compute_squared_SIFT_dist_sse2( const unsigned char * const v1, const unsigned char * const v2 )
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = _mm_setzero_si128();
+  
+  for( int i=0; i<128; i+=16 )
+  {
+    __m128i a = _mm_loadu_si128( (const __m128i*) ( v1 + i ) );
+    __m128i b = _mm_loadu_si128( (const __m128i*) ( v2 + i ) );
+    __m128i d = _mm_or_si128( _mm_subs_epu8( a, b ), _mm_subs_epu8( b, a ) );
+    __m128i d_lo = _mm_unpacklo_epi8( d, zero );
+    __m128i d_hi = _mm_unpackhi_epi8( d, zero );
+    sum = _mm_add_epi32( sum, _mm_madd_epi16( d_lo, d_lo ) );
+    sum = _mm_add_epi32( sum, _mm_madd_epi16( d_hi, d_hi ) );
+  }
+  
+  sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+  sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+  return _mm_cvtsi128_si32( sum );
+}
+
+//---------------------------------------------------
+
+__attribute__((target("sse2")))
+float compute_squared_SIFT_dist_float_sse2( const unsigned char * const v1, const float * const v2 )
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  __m128 sum2 = _mm_setzero_ps();
+  __m128 sum3 = _mm_setzero_ps();
+  
+  for( int i=0; i<128; i+=16 )
+  {
+    __m128i a = _mm_loadu_si128( (const __m128i*) ( v1 + i ) );
+    __m128i a_lo = _mm_unpacklo_epi8( a, zero );
+    __m128i a_hi = _mm_unpackhi_epi8( a, zero );
+    
+    __m128 d0 = _mm_sub_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( a_lo, zero ) ), _mm_loadu_ps( v2 + i ) );
+    __m128 d1 = _mm_sub_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( a_lo, zero ) ), _mm_loadu_ps( v2 + i + 4 ) );
+    __m128 d2 = _mm_sub_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( a_hi, zero ) ), _mm_loadu_ps( v2 + i + 8 ) );
+    __m128 d3 = _mm_sub_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( a_hi, zero ) ), _mm_loadu_ps( v2 + i + 12 ) );
+    
+    sum0 = _mm_add_ps( sum0, _mm_mul_ps( d0, d0 ) );
+    sum1 = _mm_add_ps( sum1, _mm_mul_ps( d1, d1 ) );
+    sum2 = _mm_add_ps( sum2, _mm_mul_ps( d2, d2 ) );
+    sum3 = _mm_add_ps( sum3, _mm_mul_ps( d3, d3 ) );
+  }
+  
+  __m128 sum = _mm_add_ps( _mm_add_ps( sum0, sum1 ), _mm_add_ps( sum2, sum3 ) );
+  sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+  sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+  return _mm_cvtss_f32( sum );
+}
+
+//---------------------------------------------------
+// AVX2
+//---------------------------------------------------
+
+__attribute__((target("avx2")))
+int compute_squared_SIFT_dist_avx2( const unsigned char * const v1, const unsigned char * const v2 )
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sum = _mm256_setzero_si256();
+  
+  for( int i=0; i<128; i+=32 )
+  {
+    __m256i a = _mm256_loadu_si256( (const __m256i*) ( v1 + i ) );
+    __m256i b = _mm256_loadu_si256( (const __m256i*) ( v2 + i ) );
+    __m256i d = _mm256_or_si256( _mm256_subs_epu8( a, b ), _mm256_subs_epu8( b, a ) );
+    __m256i d_lo = _mm256_unpacklo_epi8( d, zero );
+    __m256i d_hi = _mm256_unpackhi_epi8( d, zero );
+    sum = _mm256_add_epi32( sum, _mm256_madd_epi16( d_lo, d_lo ) );
+    sum = _mm256_add_epi32( sum, _mm256_madd_epi16( d_hi, d_hi ) );
+  }
+  
+  __m128i sum128 = _mm_add_epi32( _mm256_castsi256_si128( sum ), _mm256_extracti128_si256( sum, 1 ) );
+  sum128 = _mm_add_epi32( sum128, _mm_shuffle_epi32( sum128, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+  sum128 = _mm_add_epi32( sum128, _mm_shuffle_epi32( sum128, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+  return _mm_cvtsi128_si32( sum128 );
+}
+
+//---------------------------------------------------
+
+__attribute__((target("avx2")))
+float compute_squared_SIFT_dist_float_avx2( const unsigned char * const v1, const float * const v2 )
+{
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  
+  for( int i=0; i<128; i+=16 )
+  {
+    __m256 a0 = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*) ( v1 + i ) ) ) );
+    __m256 a1 = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*) ( v1 + i + 8 ) ) ) );
+    __m256 d0 = _mm256_sub_ps( a0, _mm256_loadu_ps( v2 + i ) );
+    __m256 d1 = _mm256_sub_ps( a1, _mm256_loadu_ps( v2 + i + 8 ) );
+    sum0 = _mm256_add_ps( sum0, _mm256_mul_ps( d0, d0 ) );
+    sum1 = _mm256_add_ps( sum1, _mm256_mul_ps( d1, d1 ) );
+  }
+  
+  __m256 sum = _mm256_add_ps( sum0, sum1 );
+  __m128 sum128 = _mm_add_ps( _mm256_castps256_ps128( sum ), _mm256_extractf128_ps( sum, 1 ) );
+  sum128 = _mm_add_ps( sum128, _mm_movehl_ps( sum128, sum128 ) );
+  sum128 = _mm_add_ss( sum128, _mm_shuffle_ps( sum128, sum128, 1 ) );
+  return _mm_cvtss_f32( sum128 );
+}
+
+//---------------------------------------------------
+// AVX-512BW
+//---------------------------------------------------
+
+__attribute__((target("avx512f,avx512bw")))
+int compute_squared_SIFT_dist_avx512bw( const unsigned char * const v1, const unsigned char * const v2 )
+{
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i sum = _mm512_setzero_si512();
+  
+  for( int i=0; i<128; i+=64 )
+  {
+    __m512i a = _mm512_loadu_si512( (const void*) ( v1 + i ) );
+    __m512i b = _mm512_loadu_si512( (const void*) ( v2 + i ) );
+    __m512i d = _mm512_or_si512( _mm512_subs_epu8( a, b ), _mm512_subs_epu8( b, a ) );
+    __m512i d_lo = _mm512_unpacklo_epi8( d, zero );
+    __m512i d_hi = _mm512_unpackhi_epi8( d, zero );
+    sum = _mm512_add_epi32( sum, _mm512_madd_epi16( d_lo, d_lo ) );
+    sum = _mm512_add_epi32( sum, _mm512_madd_epi16( d_hi, d_hi ) );
+  }
+  
+  // the zero-masking variants are used throughout, the unmasked intrinsics (and _mm512_reduce_add_*)
+  // pass an undefined source register, which GCC reports as uninitialized
+  __m256i sum256 = _mm256_add_epi32( _mm512_maskz_extracti64x4_epi64( 0xF, sum, 0 ), _mm512_maskz_extracti64x4_epi64( 0xF, sum, 1 ) );
+  __m128i sum128 = _mm_add_epi32( _mm256_castsi256_si128( sum256 ), _mm256_extracti128_si256( sum256, 1 ) );
+  sum128 = _mm_add_epi32( sum128, _mm_shuffle_epi32( sum128, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+  sum128 = _mm_add_epi32( sum128, _mm_shuffle_epi32( sum128, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+  return _mm_cvtsi128_si32( sum128 );
+}
+
+//---------------------------------------------------
+
+__attribute__((target("avx512f,avx512bw")))
+float compute_squared_SIFT_dist_float_avx512bw( const unsigned char * const v1, const float * const v2 )
+{
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  
+  for( int i=0; i<128; i+=32 )
+  {
+    // zero-masking conversions, see compute_squared_SIFT_dist_avx512bw
+    __m512 a0 = _mm512_maskz_cvtepi32_ps( 0xFFFF, _mm512_maskz_cvtepu8_epi32( 0xFFFF, _mm_loadu_si128( (const __m128i*) ( v1 + i ) ) ) );
+    __m512 a1 = _mm512_maskz_cvtepi32_ps( 0xFFFF, _mm512_maskz_cvtepu8_epi32( 0xFFFF, _mm_loadu_si128( (const __m128i*) ( v1 + i + 16 ) ) ) );
+    __m512 d0 = _mm512_sub_ps( a0, _mm512_loadu_ps( v2 + i ) );
+    __m512 d1 = _mm512_sub_ps( a1, _mm512_loadu_ps( v2 + i + 16 ) );
+    sum0 = _mm512_add_ps( sum0, _mm512_mul_ps( d0, d0 ) );
+    sum1 = _mm512_add_ps( sum1, _mm512_mul_ps( d1, d1 ) );
+  }
+  
+  __m512d sum = _mm512_castps_pd( _mm512_add_ps( sum0, sum1 ) );
+  __m256 sum256 = _mm256_add_ps( _mm256_castpd_ps( _mm512_maskz_extractf64x4_pd( 0xF, sum, 0 ) ), _mm256_castpd_ps( _mm512_maskz_extractf64x4_pd( 0xF, sum, 1 ) ) );
+  __m128 sum128 = _mm_add_ps( _mm256_castps256_ps128( sum256 ), _mm256_extractf128_ps( sum256, 1 ) );
+  sum128 = _mm_add_ps( sum128, _mm_movehl_ps( sum128, sum128 ) );
+  sum128 = _mm_add_ss( sum128, _mm_shuffle_ps( sum128, sum128, 1 ) );
+  return _mm_cvtss_f32( sum128 );
+}
+
+#endif
+
+//---------------------------------------------------
+// selection of the implementation
+//---------------------------------------------------
+
+static const char *g_SIFT_dist_implementation = "scalar";
+
+static SIFT_dist_uchar_fn select_SIFT_dist_uchar( )
+{
+#ifdef SIFT_DISTANCE_X86_KERNELS
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx512bw" ) && __builtin_cpu_supports( "avx512f" ) )
+  {
+    g_SIFT_dist_implementation = "avx512bw";
+    return compute_squared_SIFT_dist_avx512bw;
+  }
+  if( __builtin_cpu_supports( "avx2" ) )
+  {
+    g_SIFT_dist_implementation = "avx2";
+    return compute_squared_SIFT_dist_avx2;
+  }
+  if( __builtin_cpu_supports( "sse2" ) )
+  {
+    g_SIFT_dist_implementation = "sse2";
+    return compute_squared_SIFT_dist_sse2;
+  }
+#endif
+  return compute_squared_SIFT_dist_scalar;
+}
+
+//---------------------------------------------------
+
+static SIFT_dist_float_fn select_SIFT_dist_float( )
+{
+#ifdef SIFT_DISTANCE_X86_KERNELS
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx512bw" ) && __builtin_cpu_supports( "avx512f" ) )
+    return compute_squared_SIFT_dist_float_avx512bw;
+  if( __builtin_cpu_supports( "avx2" ) )
+    return compute_squared_SIFT_dist_float_avx2;
+  if( __builtin_cpu_supports( "sse2" ) )
+    return compute_squared_SIFT_dist_float_sse2;
+#endif
+  return compute_squared_SIFT_dist_float_scalar;
+}
+
+//---------------------------------------------------
+
+SIFT_dist_uchar_fn g_SIFT_dist_uchar = select_SIFT_dist_uchar();
+SIFT_dist_float_fn g_SIFT_dist_float = select_SIFT_dist_float();
+
+//---------------------------------------------------
+
+const char* get_SIFT_dist_implementation( )
+{
+  return g_SIFT_dist_implementation;
+}
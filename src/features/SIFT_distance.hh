@@ -0,0 +1,80 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+
+#ifndef SIFT_DISTANCE_HH
+#define SIFT_DISTANCE_HH
+
+/**
+ *    Functions to compute squared Euclidean distances between 128-dimensional
+ *    SIFT descriptors. There is a scalar, an SSE2, an AVX2 and an AVX-512BW 
+ *    implementation of each distance. The fastest implementation supported by
+ *    the CPU is selected once at program start (using cpuid). All implementations
+ *    of the unsigned char distance compute exactly the same (integer) results, 
+ *    the floating point implementations only differ in the order of the summation.
+**/
+
+//! type of the functions computing the distance between two descriptors stored as unsigned chars
+typedef int (*SIFT_dist_uchar_fn)( const unsigned char * const v1, const unsigned char * const v2 );
+
+//! type of the functions computing the distance between an unsigned char and a floating point descriptor
+typedef float (*SIFT_dist_float_fn)( const unsigned char * const v1, const float * const v2 );
+
+//! the implementations selected for the current CPU
+extern SIFT_dist_uchar_fn g_SIFT_dist_uchar;
+extern SIFT_dist_float_fn g_SIFT_dist_float;
+
+//! Squared distance between two SIFT descriptors, both stored as arrays of 128 unsigned chars
+inline int compute_squared_SIFT_dist( const unsigned char * const v1, const unsigned char * const v2 )
+{
+  return g_SIFT_dist_uchar( v1, v2 );
+}
+
+//! same in case that one descriptors consists of floating point values
+inline float compute_squared_SIFT_dist_float( const unsigned char * const v1, const float * const v2 )
+{
+  return g_SIFT_dist_float( v1, v2 );
+}
+
+//! returns the name of the selected implementation ("scalar", "sse2", "avx2" or "avx512bw")
+const char* get_SIFT_dist_implementation( );
+
+// the different implementations, the SIMD versions must only be called if supported by the CPU
+int compute_squared_SIFT_dist_scalar( const unsigned char * const v1, const unsigned char * const v2 );
+float compute_squared_SIFT_dist_float_scalar( const unsigned char * const v1, const float * const v2 );
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define SIFT_DISTANCE_X86_KERNELS
+
+int compute_squared_SIFT_dist_sse2( const unsigned char * const v1, const unsigned char * const v2 );
+float compute_squared_SIFT_dist_float_sse2( const unsigned char * const v1, const float * const v2 );
+
+int compute_squared_SIFT_dist_avx2( const unsigned char * const v1, const unsigned char * const v2 );
+float compute_squared_SIFT_dist_float_avx2( const unsigned char * const v1, const float * const v2 );
+
+int compute_squared_SIFT_dist_avx512bw( const unsigned char * const v1, const unsigned char * const v2 );
+float compute_squared_SIFT_dist_float_avx512bw( const unsigned char * const v1, const float * const v2 );
+#endif
+
+#endif
@@ -32,6 +32,9 @@
  *  date : 11-02-2011
 **/ 
 
+#include <stddef.h>
+#include <stdint.h>
+
 class SIFT_keypoint
 {
   public:
@@ -54,8 +57,38 @@ class SIFT_keypoint
 	}
 };
 
+//! Read-only view of SIFT descriptors (128 unsigned chars each) that are stored
+//! contiguously, e.g., by SIFT_loader. The view does not own the descriptors.
+class SIFT_descriptor_view
+{
+  public:
+	const unsigned char *data;
+	uint32_t nb_descriptors;
+	
+	SIFT_descriptor_view( )
+	{
+	  data = 0;
+	  nb_descriptors = 0;
+	}
+	
+	SIFT_descriptor_view( const unsigned char *data_, uint32_t nb_descriptors_ )
+	{
+	  data = data_;
+	  nb_descriptors = nb_descriptors_;
+	}
+	
+	//! returns the i-th descriptor
+	const unsigned char* operator[]( uint32_t i ) const
+	{
+	  return data + 128 * (size_t) i;
+	}
+};
+
+//! formats of files containing SIFT features: the text format of David Lowe's binary
+//! and its binary version (see SIFT_loader.hh)
 enum SIFT_FORMAT{
   LOWE = 0,
+  LOWE_BINARY = 1,
   UNDEFINED = 3
 };
 
@@ -25,12 +25,37 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "SIFT_loader.hh"
 
 
+// rounds an offset up to the next multiple of SIFT_BINARY_ALIGNMENT
+static inline uint64_t align_offset( uint64_t offset )
+{
+  return ( offset + SIFT_BINARY_ALIGNMENT - 1 ) / SIFT_BINARY_ALIGNMENT * SIFT_BINARY_ALIGNMENT;
+}
+
+// computes the offsets of the sections and the size of a binary file with header.nb_features features
+static void compute_binary_layout( SIFT_binary_header &header )
+{
+  header.keypoints_offset = align_offset( sizeof( SIFT_binary_header ) );
+  header.descriptors_offset = align_offset( header.keypoints_offset + uint64_t( header.nb_features ) * 4 * sizeof( float ) );
+  header.file_size = header.descriptors_offset + uint64_t( header.nb_features ) * 128;
+}
+
+
+
 SIFT_loader::SIFT_loader( )
 {
   mNbFeatures = 0;
+  mDescriptorData = 0;
   mKeypoints.clear();
   mDescriptors.clear();
 }
@@ -40,13 +65,39 @@ SIFT_loader::~SIFT_loader( )
   clear_data( );
 }
     
-void SIFT_loader::load_features( const char *filename, SIFT_FORMAT format )
+bool SIFT_loader::load_features( const char *filename, SIFT_FORMAT format )
 {
   clear_data( );
-  bool loaded = load_Lowe_features( filename );
+  
+  if( format == LOWE || format == UNDEFINED )
+    format = detect_format( filename );
+  
+  bool loaded = false;
+  if( format == LOWE_BINARY )
+    loaded = load_binary_features( filename );
+  else if( format == LOWE )
+    loaded = load_Lowe_features( filename );
   
   if( !loaded )
+  {
     std::cerr << "Could not load the features from the given file " << filename << std::endl;
+    clear_data( );
+  }
+  
+  return loaded;
+}
+
+SIFT_FORMAT SIFT_loader::detect_format( const char *filename )
+{
+  FILE *fin = fopen( filename, "rb" );
+  if( fin == NULL )
+    return UNDEFINED;
+  
+  char magic[8];
+  bool is_binary = ( fread( magic, 1, 8, fin ) == 8 && memcmp( magic, SIFT_BINARY_MAGIC, 8 ) == 0 );
+  fclose( fin );
+  
+  return is_binary ? LOWE_BINARY : LOWE;
 }
 
 bool SIFT_loader::save_features_lowe( const char *filename )
@@ -65,6 +116,9 @@ bool SIFT_loader::save_features_lowe( const char *filename )
   if ( !outstream.is_open() )
     return false;
   
+  // use enough digits to recover the keypoints exactly
+  outstream.precision( 9 );
+  
   // save the number of keypoints and the size of the descriptors
   outstream << mNbFeatures << " 128" << std::endl;
   
@@ -88,17 +142,73 @@ bool SIFT_loader::save_features_lowe( const char *filename )
   return true;
 }
 
-
-void SIFT_loader::clear_data( )
+bool SIFT_loader::save_features_binary( const char *filename )
 {
+  SIFT_binary_header header;
+  memset( &header, 0, sizeof( SIFT_binary_header ) );
+  memcpy( header.magic, SIFT_BINARY_MAGIC, 8 );
+  header.version = SIFT_BINARY_VERSION;
+  header.nb_features = mNbFeatures;
+  header.descriptor_size = 128;
+  compute_binary_layout( header );
+  
+  // the file is assembled in memory and written at once
+  std::vector< char > data( header.file_size, 0 );
+  memcpy( &data[0], &header, sizeof( SIFT_binary_header ) );
+  
+  float *keypoints = (float*) ( &data[0] + header.keypoints_offset );
+  unsigned char *descriptors = (unsigned char*) ( &data[0] + header.descriptors_offset );
   for( uint32_t i=0; i<mNbFeatures; ++i )
   {
-    if( mDescriptors[i] != 0 )
-      delete [] mDescriptors[i];
-    mDescriptors[i] = 0;
+    keypoints[4*i] = mKeypoints[i].x;
+    keypoints[4*i+1] = mKeypoints[i].y;
+    keypoints[4*i+2] = mKeypoints[i].scale;
+    keypoints[4*i+3] = mKeypoints[i].orientation;
   }
+  if( mNbFeatures > 0 )
+    memcpy( descriptors, mDescriptorData, 128 * (size_t) mNbFeatures );
+  
+  FILE *fout = fopen( filename, "wb" );
+  if( fout == NULL )
+    return false;
+  
+  bool written = ( fwrite( &data[0], 1, data.size(), fout ) == data.size() );
+  written = ( fclose( fout ) == 0 ) && written;
+  
+  return written;
+}
+
+
+void SIFT_loader::clear_data( )
+{
+  if( mDescriptorData != 0 )
+    free( mDescriptorData );
+  mDescriptorData = 0;
   mKeypoints.clear();
   mDescriptors.clear();
+  mNbFeatures = 0;
+}
+
+bool SIFT_loader::allocate_features( uint32_t nb_features )
+{
+  clear_data( );
+  
+  // allocate at least one row such that the data pointer is always valid
+  void *data = 0;
+  if( posix_memalign( &data, SIFT_BINARY_ALIGNMENT, 128 * std::max( (size_t) nb_features, (size_t) 1 ) ) != 0 )
+  {
+    std::cerr << " ERROR: Could not allocate memory for " << nb_features << " descriptors " << std::endl;
+    return false;
+  }
+  
+  mDescriptorData = (unsigned char*) data;
+  mNbFeatures = nb_features;
+  mKeypoints.resize( mNbFeatures );
+  mDescriptors.resize( mNbFeatures );
+  for( uint32_t i=0; i<mNbFeatures; ++i )
+    mDescriptors[i] = mDescriptorData + 128 * (size_t) i;
+  
+  return true;
 }
     
 uint32_t SIFT_loader::get_nb_features( )
@@ -106,6 +216,11 @@ uint32_t SIFT_loader::get_nb_features( )
   return mNbFeatures;
 }
 
+SIFT_descriptor_view SIFT_loader::get_descriptor_view( ) const
+{
+  return SIFT_descriptor_view( mDescriptorData, mNbFeatures );
+}
+
 std::vector< unsigned char* >& SIFT_loader::get_descriptors( )
 {
   return mDescriptors;
@@ -134,22 +249,18 @@ bool SIFT_loader::load_Lowe_features( const char *filename )
     return false;
   
   // read the number of keypoints and the size of the descriptors
-  uint32_t size_descriptor;
-  instream >> mNbFeatures >> size_descriptor;
+  uint32_t nb_features = 0, size_descriptor = 0;
+  instream >> nb_features >> size_descriptor;
   
-  if( size_descriptor != 128 )
+  if( instream.fail() || size_descriptor != 128 || !allocate_features( nb_features ) )
     return false;
   
   // load the keypoints and their descriptors
-  mKeypoints.resize(mNbFeatures);
-  mDescriptors.resize(mNbFeatures,0);
-  
   double x,y,scale,orientation;
   unsigned int descriptor_element;
   
   for( uint32_t i=0; i<mNbFeatures; ++i )
   {
-    mDescriptors[i] = new unsigned char[128];
     instream >> y >> x >> scale >> orientation;
     mKeypoints[i] = SIFT_keypoint( x, y, scale, orientation );
     
@@ -161,9 +272,58 @@ bool SIFT_loader::load_Lowe_features( const char *filename )
     }
   }
   
+  // a truncated or malformed file leaves the stream in a failed state
+  bool loaded = !instream.fail();
+  
   instream.close();
   
-  return true;
+  return loaded;
 }
 
-
+bool SIFT_loader::load_binary_features( const char *filename )
+{
+  int fd = open( filename, O_RDONLY );
+  if( fd < 0 )
+    return false;
+  
+  struct stat file_stat;
+  if( fstat( fd, &file_stat ) != 0 || (size_t) file_stat.st_size < sizeof( SIFT_binary_header ) )
+  {
+    close( fd );
+    return false;
+  }
+  
+  size_t file_size = (size_t) file_stat.st_size;
+  void *data = mmap( 0, file_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  
+  if( data == MAP_FAILED )
+    return false;
+  
+  // make sure that the header is consistent with the file
+  SIFT_binary_header header;
+  memcpy( &header, data, sizeof( SIFT_binary_header ) );
+  SIFT_binary_header layout = header;
+  compute_binary_layout( layout );
+  
+  bool valid = ( memcmp( header.magic, SIFT_BINARY_MAGIC, 8 ) == 0 && header.version == SIFT_BINARY_VERSION && header.descriptor_size == 128 );
+  valid = valid && layout.keypoints_offset == header.keypoints_offset && layout.descriptors_offset == header.descriptors_offset;
+  valid = valid && header.file_size == layout.file_size && header.file_size <= uint64_t( file_size );
+  
+  valid = valid && allocate_features( header.nb_features );
+  
+  if( valid )
+  {
+    // the descriptors have the same layout in the file and in memory
+    const float *keypoints = (const float*) ( (const char*) data + header.keypoints_offset );
+    for( uint32_t i=0; i<mNbFeatures; ++i )
+      mKeypoints[i] = SIFT_keypoint( keypoints[4*i], keypoints[4*i+1], keypoints[4*i+2], keypoints[4*i+3] );
+    
+    if( mNbFeatures > 0 )
+      memcpy( mDescriptorData, (const unsigned char*) data + header.descriptors_offset, 128 * (size_t) mNbFeatures );
+  }
+  
+  munmap( data, file_size );
+  
+  return valid;
+}
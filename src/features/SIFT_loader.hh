@@ -29,6 +29,22 @@
  *    Class to read SIFT features from the text files generated by
  *    David Lowe's binary ( available at http://www.cs.ubc.ca/~lowe/keypoints/).
  *
+ *    Parsing the text files is slow, so the features can also be stored in a
+ *    binary version of the format (LOWE_BINARY) with the following layout, where
+ *    every section starts at a 64 byte aligned offset:
+ *
+ *      header                 (see SIFT_binary_header)
+ *      keypoints              nb_features * (x, y, scale, orientation) floats
+ *      descriptors            nb_features * 128 unsigned chars
+ *
+ *    The file is mapped into memory and both sections are copied as a whole.
+ *    load_features() recognizes binary files by their magic number, so they can
+ *    keep the .key extension and replace the text files (see convert_keys).
+ *
+ *    The loader owns the descriptors, which are stored in a single 64 byte aligned
+ *    block of nb_features * 128 unsigned chars (see get_descriptor_view()). They
+ *    remain valid until clear_data() is called or new features are loaded.
+ *
  *    IMPORTANT NOTE: The SIFT loader keeps the coordinate systems of the binaries. For example,
  *    the origin of the coordinate system used by David Lowe is in the upper left of the image.
  *  
@@ -41,6 +57,29 @@
 #include "SIFT_keypoint.hh"
 
 
+//! magic number at the beginning of every binary key file
+#define SIFT_BINARY_MAGIC "ACGSIFTK"
+
+//! current version of the binary format
+#define SIFT_BINARY_VERSION 1
+
+//! alignment (in bytes) of all sections in the binary file
+#define SIFT_BINARY_ALIGNMENT 64
+
+//! header of a binary key file, the offsets are given in bytes from the beginning of the file
+struct SIFT_binary_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nb_features;
+  uint32_t descriptor_size;
+  uint32_t reserved;
+  uint64_t keypoints_offset;
+  uint64_t descriptors_offset;
+  uint64_t file_size;
+};
+
+
 class SIFT_loader
 {
   public:
@@ -49,20 +88,37 @@ class SIFT_loader
     
     //! destructor
     ~SIFT_loader( );
+    
+    //! the loader owns the descriptor block, so it cannot be copied
+    SIFT_loader( const SIFT_loader& ) = delete;
+    SIFT_loader& operator=( const SIFT_loader& ) = delete;
 	
-    //! load features from a file with a given format
-    void load_features( const char *filename, SIFT_FORMAT format );
+    //! load features from a file with a given format. For LOWE (and UNDEFINED), the format
+    //! is detected from the file, i.e., binary files are loaded as well.
+    //! Returns false (and leaves no features loaded) if the file could not be read.
+    bool load_features( const char *filename, SIFT_FORMAT format );
+    
+    //! detects the format of a file (LOWE_BINARY if it starts with the magic number, LOWE otherwise).
+    //! Returns UNDEFINED if the file cannot be read.
+    static SIFT_FORMAT detect_format( const char *filename );
 	
     //! save the features loaded to a file in David Lowes Format
     bool save_features_lowe( const char *filename );
     
+    //! save the features loaded to a file in the binary format
+    bool save_features_binary( const char *filename );
+    
     //! clears all data loaded so far
     void clear_data( );
 	
     //! returns the number of features loaded
     uint32_t get_nb_features( );
     
-    //! get access to a vector containg the descriptors (stored as chars)
+    //! get access to the descriptors, stored contiguously (128 unsigned chars each)
+    SIFT_descriptor_view get_descriptor_view( ) const;
+    
+    //! get access to a vector containg pointers to the descriptors (stored as chars).
+    //! The pointers point into the block owned by the loader and must not be deleted.
     std::vector< unsigned char* >& get_descriptors( );
     
     //! get the keypoints
@@ -71,10 +127,16 @@ class SIFT_loader
   private:
     
     std::vector< SIFT_keypoint > mKeypoints;
+    unsigned char *mDescriptorData;
     std::vector< unsigned char* > mDescriptors;
     uint32_t mNbFeatures;
     
+    //! allocates the (uninitialized) descriptors and keypoints for nb_features features
+    bool allocate_features( uint32_t nb_features );
+    
     bool load_Lowe_features( const char *filename );
+    
+    bool load_binary_features( const char *filename );
   
 };
 
@@ -0,0 +1,456 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+
+#define __STDC_LIMIT_MACROS
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <utility>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "localization_database.hh"
+
+
+// rounds an offset up to the next multiple of LOCALIZATION_DB_ALIGNMENT
+static inline uint64_t align_offset( uint64_t offset )
+{
+  return ( offset + uint64_t( LOCALIZATION_DB_ALIGNMENT - 1 ) ) & ~uint64_t( LOCALIZATION_DB_ALIGNMENT - 1 );
+}
+
+// builds the CSR representations of the visual word -> (point, descriptor) and point -> (visual word, descriptor)
+// assignments. The entries of a point are ordered by the id of the visual word.
+// Further computes the row of every descriptor in the descriptor section (row k holds the descriptor of word
+// entry k, descriptors without any entry are appended) and the descriptor id stored in every row.
+// Returns the number of rows.
+static uint64_t fill_indices( const localization_db_header &header, const std::vector< std::vector< std::pair< uint32_t, uint32_t > > > &vw_point_descriptor_idx, std::vector< uint32_t > &word_offsets, std::vector< vw_entry > &word_entries, std::vector< uint32_t > &point_offsets, std::vector< point_entry > &point_entries, std::vector< uint32_t > &descriptor_rows, std::vector< uint32_t > &row_descriptors )
+{
+  uint32_t nb_vw = header.nb_visual_words;
+  uint32_t nb_points = header.nb_points;
+
+  word_offsets.resize( size_t( nb_vw ) + 1 );
+  word_entries.resize( header.nb_assignments );
+  point_offsets.assign( size_t( nb_points ) + 1, 0 );
+  point_entries.resize( header.nb_assignments );
+
+  uint32_t offset = 0;
+  for( uint32_t i=0; i<nb_vw; ++i )
+  {
+    word_offsets[i] = offset;
+    for( std::vector< std::pair< uint32_t, uint32_t > >::const_iterator it = vw_point_descriptor_idx[i].begin(); it != vw_point_descriptor_idx[i].end(); ++it, ++offset )
+    {
+      word_entries[offset].point_id = it->first;
+      word_entries[offset].desc_id = it->second;
+      ++point_offsets[it->first+1];
+    }
+  }
+  word_offsets[nb_vw] = offset;
+
+  for( uint32_t i=0; i<nb_points; ++i )
+    point_offsets[i+1] += point_offsets[i];
+
+  std::vector< uint32_t > fill_pos( point_offsets.begin(), point_offsets.begin() + nb_points );
+  for( uint32_t i=0; i<nb_vw; ++i )
+  {
+    for( uint32_t j=word_offsets[i]; j<word_offsets[i+1]; ++j )
+    {
+      point_entry &e = point_entries[ fill_pos[ word_entries[j].point_id ]++ ];
+      e.vw_id = i;
+      e.desc_id = word_entries[j].desc_id;
+    }
+  }
+
+  // the rows of the descriptors
+  descriptor_rows.assign( header.nb_descriptors, UINT32_MAX );
+  row_descriptors.resize( header.nb_assignments );
+  for( uint32_t j=0; j<offset; ++j )
+  {
+    row_descriptors[j] = word_entries[j].desc_id;
+    if( descriptor_rows[ word_entries[j].desc_id ] == UINT32_MAX )
+      descriptor_rows[ word_entries[j].desc_id ] = j;
+  }
+  for( uint32_t i=0; i<header.nb_descriptors; ++i )
+  {
+    if( descriptor_rows[i] == UINT32_MAX )
+    {
+      descriptor_rows[i] = uint32_t( row_descriptors.size() );
+      row_descriptors.push_back( i );
+    }
+  }
+
+  return uint64_t( row_descriptors.size() );
+}
+
+// writes zeros to the stream until it reaches the given position
+static void write_padding( std::ofstream &ofs, uint64_t position )
+{
+  static const char zeros[LOCALIZATION_DB_ALIGNMENT] = { 0 };
+  uint64_t current = (uint64_t) ofs.tellp();
+  if( current < position )
+    ofs.write( zeros, position - current );
+}
+
+localization_database::localization_database( )
+{
+  mData = 0;
+  mDataSize = 0;
+  mMapped = false;
+  mHeader = 0;
+  mPoints = 0;
+  mDescriptorsUChar = 0;
+  mDescriptorsFloat = 0;
+  mWordOffsets = 0;
+  mWordEntries = 0;
+  mPointOffsets = 0;
+  mPointEntries = 0;
+  mDescriptorRows = 0;
+}
+
+localization_database::~localization_database( )
+{
+  close( );
+}
+
+void localization_database::close( )
+{
+  if( mData != 0 )
+  {
+    if( mMapped )
+      munmap( mData, mDataSize );
+    else
+      free( mData );
+  }
+  mData = 0;
+  mDataSize = 0;
+  mMapped = false;
+  mHeader = 0;
+  mPoints = 0;
+  mDescriptorsUChar = 0;
+  mDescriptorsFloat = 0;
+  mWordOffsets = 0;
+  mWordEntries = 0;
+  mPointOffsets = 0;
+  mPointEntries = 0;
+  mDescriptorRows = 0;
+}
+
+void localization_database::compute_layout( localization_db_header &header )
+{
+  uint64_t desc_size = ( header.descriptor_type == LOC_DB_FLOAT ) ? sizeof( float ) : sizeof( unsigned char );
+
+  header.points_offset = align_offset( sizeof( localization_db_header ) );
+  header.descriptors_offset = align_offset( header.points_offset + uint64_t( header.nb_points ) * 3 * sizeof( float ) );
+  header.word_offsets_offset = align_offset( header.descriptors_offset + header.nb_descriptor_rows * 128 * desc_size );
+  header.word_entries_offset = align_offset( header.word_offsets_offset + ( uint64_t( header.nb_visual_words ) + 1 ) * sizeof( uint32_t ) );
+  header.point_offsets_offset = align_offset( header.word_entries_offset + header.nb_assignments * sizeof( vw_entry ) );
+  header.point_entries_offset = align_offset( header.point_offsets_offset + ( uint64_t( header.nb_points ) + 1 ) * sizeof( uint32_t ) );
+  header.descriptor_rows_offset = align_offset( header.point_entries_offset + header.nb_assignments * sizeof( point_entry ) );
+  header.file_size = header.descriptor_rows_offset + uint64_t( header.nb_descriptors ) * sizeof( uint32_t );
+}
+
+void localization_database::set_pointers( )
+{
+  mHeader = (const localization_db_header*) mData;
+  mPoints = (const float*) ( mData + mHeader->points_offset );
+  if( mHeader->descriptor_type == LOC_DB_FLOAT )
+  {
+    mDescriptorsFloat = (const float*) ( mData + mHeader->descriptors_offset );
+    mDescriptorsUChar = 0;
+  }
+  else
+  {
+    mDescriptorsUChar = (const unsigned char*) ( mData + mHeader->descriptors_offset );
+    mDescriptorsFloat = 0;
+  }
+  mWordOffsets = (const uint32_t*) ( mData + mHeader->word_offsets_offset );
+  mWordEntries = (const vw_entry*) ( mData + mHeader->word_entries_offset );
+  mPointOffsets = (const uint32_t*) ( mData + mHeader->point_offsets_offset );
+  mPointEntries = (const point_entry*) ( mData + mHeader->point_entries_offset );
+  mDescriptorRows = (const uint32_t*) ( mData + mHeader->descriptor_rows_offset );
+}
+
+bool localization_database::load( const std::string &filename )
+{
+  close( );
+
+  int fd = open( filename.c_str(), O_RDONLY );
+  if( fd < 0 )
+  {
+    std::cerr << " [localization_database]: Cannot open " << filename << std::endl;
+    return false;
+  }
+
+  struct stat file_stat;
+  if( fstat( fd, &file_stat ) != 0 )
+  {
+    std::cerr << " [localization_database]: Cannot stat " << filename << std::endl;
+    ::close( fd );
+    return false;
+  }
+
+  size_t file_size = (size_t) file_stat.st_size;
+
+  // check for the magic number, if it is missing the file was written in the old format
+  char magic[8];
+  if( file_size < sizeof( localization_db_header ) || pread( fd, magic, 8, 0 ) != 8 || memcmp( magic, LOCALIZATION_DB_MAGIC, 8 ) != 0 )
+  {
+    ::close( fd );
+    std::cout << " [localization_database]: " << filename << " has no header, parsing it in the old format " << std::endl;
+    return load_legacy( filename );
+  }
+
+  void *data = mmap( 0, file_size, PROT_READ, MAP_SHARED, fd, 0 );
+  ::close( fd );
+
+  if( data == MAP_FAILED )
+  {
+    std::cerr << " [localization_database]: Cannot map " << filename << " into memory " << std::endl;
+    return false;
+  }
+
+  mData = (char*) data;
+  mDataSize = file_size;
+  mMapped = true;
+
+  const localization_db_header *header = (const localization_db_header*) mData;
+
+  if( header->version != LOCALIZATION_DB_VERSION )
+  {
+    std::cerr << " [localization_database]: " << filename << " has version " << header->version << ", expected version " << LOCALIZATION_DB_VERSION << std::endl;
+    close( );
+    return false;
+  }
+
+  // make sure that the sizes stored in the header are consistent with the file
+  localization_db_header layout = *header;
+  compute_layout( layout );
+  if( layout.file_size != header->file_size || header->file_size != uint64_t( file_size ) || layout.descriptor_rows_offset != header->descriptor_rows_offset || header->nb_descriptor_rows < header->nb_descriptors )
+  {
+    std::cerr << " [localization_database]: " << filename << " is corrupted or truncated " << std::endl;
+    close( );
+    return false;
+  }
+
+  set_pointers( );
+
+  return true;
+}
+
+bool localization_database::build_in_memory( localization_db_header header, const float *points, const char *descriptors, const std::vector< std::vector< std::pair< uint32_t, uint32_t > > > &vw_point_descriptor_idx )
+{
+  header.version = LOCALIZATION_DB_VERSION;
+
+  std::vector< uint32_t > word_offsets, point_offsets, descriptor_rows, row_descriptors;
+  std::vector< vw_entry > word_entries;
+  std::vector< point_entry > point_entries;
+  header.nb_descriptor_rows = fill_indices( header, vw_point_descriptor_idx, word_offsets, word_entries, point_offsets, point_entries, descriptor_rows, row_descriptors );
+
+  compute_layout( header );
+
+  void *data = 0;
+  if( posix_memalign( &data, LOCALIZATION_DB_ALIGNMENT, header.file_size ) != 0 )
+  {
+    std::cerr << " [localization_database]: Cannot allocate " << header.file_size << " bytes " << std::endl;
+    return false;
+  }
+
+  mData = (char*) data;
+  mDataSize = header.file_size;
+  mMapped = false;
+
+  uint64_t row_size = 128 * ( ( header.descriptor_type == LOC_DB_FLOAT ) ? sizeof( float ) : sizeof( unsigned char ) );
+
+  memcpy( mData, &header, sizeof( localization_db_header ) );
+  if( header.nb_points > 0 )
+    memcpy( mData + header.points_offset, points, uint64_t( header.nb_points ) * 3 * sizeof( float ) );
+  for( uint64_t i=0; i<header.nb_descriptor_rows; ++i )
+    memcpy( mData + header.descriptors_offset + i * row_size, descriptors + uint64_t( row_descriptors[i] ) * row_size, row_size );
+  memcpy( mData + header.word_offsets_offset, &word_offsets[0], word_offsets.size() * sizeof( uint32_t ) );
+  if( !word_entries.empty() )
+    memcpy( mData + header.word_entries_offset, &word_entries[0], word_entries.size() * sizeof( vw_entry ) );
+  memcpy( mData + header.point_offsets_offset, &point_offsets[0], point_offsets.size() * sizeof( uint32_t ) );
+  if( !point_entries.empty() )
+    memcpy( mData + header.point_entries_offset, &point_entries[0], point_entries.size() * sizeof( point_entry ) );
+  if( !descriptor_rows.empty() )
+    memcpy( mData + header.descriptor_rows_offset, &descriptor_rows[0], descriptor_rows.size() * sizeof( uint32_t ) );
+
+  set_pointers( );
+
+  return true;
+}
+
+bool localization_database::load_legacy( const std::string &filename )
+{
+  std::ifstream ifs( filename.c_str(), std::ios::in | std::ios::binary );
+
+  if( !ifs )
+  {
+    std::cerr << " [localization_database]: Cannot read " << filename << std::endl;
+    return false;
+  }
+
+  // the old format does not store the type of the descriptors, so we have to infer it from the size of the file
+  ifs.seekg( 0, std::ios::end );
+  uint64_t file_size = (uint64_t) ifs.tellg();
+  ifs.seekg( 0, std::ios::beg );
+
+  localization_db_header header;
+  memset( &header, 0, sizeof( localization_db_header ) );
+  memcpy( header.magic, LOCALIZATION_DB_MAGIC, 8 );
+  header.version = LOCALIZATION_DB_VERSION;
+
+  ifs.read(( char* ) &header.nb_points, sizeof( uint32_t ) );
+  ifs.read(( char* ) &header.nb_visual_words, sizeof( uint32_t ) );
+  ifs.read(( char* ) &header.nb_non_empty_visual_words, sizeof( uint32_t ) );
+  ifs.read(( char* ) &header.nb_descriptors, sizeof( uint32_t ) );
+
+  if( !ifs )
+  {
+    std::cerr << " [localization_database]: " << filename << " is truncated " << std::endl;
+    return false;
+  }
+
+  // every visual word has at least an (id, size) entry in the file, so if the file is too small to
+  // hold float descriptors, the descriptors are stored as unsigned chars
+  uint64_t min_size_float = 16 + uint64_t( header.nb_points ) * 12 + uint64_t( header.nb_descriptors ) * 128 * sizeof( float ) + uint64_t( header.nb_non_empty_visual_words ) * 8;
+  header.descriptor_type = ( file_size >= min_size_float ) ? LOC_DB_FLOAT : LOC_DB_UCHAR;
+  uint64_t desc_size = ( header.descriptor_type == LOC_DB_FLOAT ) ? sizeof( float ) : sizeof( unsigned char );
+
+  std::vector< float > points( 3 * size_t( header.nb_points ) );
+  ifs.read(( char* ) &points[0], points.size() * sizeof( float ) );
+
+  std::vector< char > descriptors( size_t( header.nb_descriptors ) * 128 * desc_size );
+  if( !descriptors.empty() )
+    ifs.read( &descriptors[0], descriptors.size() );
+
+  // the writer stores all visual words (including empty ones), but be robust to files that only contain the non-empty ones
+  std::vector< std::vector< std::pair< uint32_t, uint32_t > > > vw_point_descriptor_idx( header.nb_visual_words );
+  std::vector< uint32_t > pair_buffer;
+  header.nb_assignments = 0;
+  for( uint32_t i=0; i<header.nb_visual_words; ++i )
+  {
+    uint32_t id, nb_pairs;
+    ifs.read(( char* ) &id, sizeof( uint32_t ) );
+    ifs.read(( char* ) &nb_pairs, sizeof( uint32_t ) );
+    if( !ifs )
+      break;
+
+    if( id >= header.nb_visual_words )
+    {
+      std::cerr << " [localization_database]: invalid visual word id " << id << " in " << filename << std::endl;
+      return false;
+    }
+
+    pair_buffer.resize( 2 * size_t( nb_pairs ) );
+    if( nb_pairs > 0 )
+      ifs.read(( char* ) &pair_buffer[0], pair_buffer.size() * sizeof( uint32_t ) );
+
+    vw_point_descriptor_idx[id].resize( nb_pairs );
+    for( uint32_t j=0; j<nb_pairs; ++j )
+    {
+      if( pair_buffer[2*j] >= header.nb_points || pair_buffer[2*j+1] >= header.nb_descriptors )
+      {
+        std::cerr << " [localization_database]: invalid assignment of visual word " << id << " in " << filename << std::endl;
+        return false;
+      }
+      vw_point_descriptor_idx[id][j] = std::make_pair( pair_buffer[2*j], pair_buffer[2*j+1] );
+    }
+    header.nb_assignments += nb_pairs;
+  }
+
+  ifs.close();
+
+  return build_in_memory( header, points.empty() ? 0 : &points[0], descriptors.empty() ? 0 : &descriptors[0], vw_point_descriptor_idx );
+}
+
+bool localization_database::save( const std::string &filename, const std::vector< float > &points, int descriptor_type, const void *descriptors, uint32_t nb_descriptors, const std::vector< std::vector< std::pair< uint32_t, uint32_t > > > &vw_point_descriptor_idx )
+{
+  localization_db_header header;
+  memset( &header, 0, sizeof( localization_db_header ) );
+  memcpy( header.magic, LOCALIZATION_DB_MAGIC, 8 );
+  header.version = LOCALIZATION_DB_VERSION;
+  header.descriptor_type = uint32_t( descriptor_type );
+  header.nb_points = uint32_t( points.size() / 3 );
+  header.nb_visual_words = uint32_t( vw_point_descriptor_idx.size() );
+  header.nb_descriptors = nb_descriptors;
+  header.nb_non_empty_visual_words = 0;
+  header.nb_assignments = 0;
+  for( uint32_t i=0; i<header.nb_visual_words; ++i )
+  {
+    if( !vw_point_descriptor_idx[i].empty() )
+      ++header.nb_non_empty_visual_words;
+    header.nb_assignments += vw_point_descriptor_idx[i].size();
+  }
+
+  std::vector< uint32_t > word_offsets, point_offsets, descriptor_rows, row_descriptors;
+  std::vector< vw_entry > word_entries;
+  std::vector< point_entry > point_entries;
+  header.nb_descriptor_rows = fill_indices( header, vw_point_descriptor_idx, word_offsets, word_entries, point_offsets, point_entries, descriptor_rows, row_descriptors );
+
+  compute_layout( header );
+
+  std::ofstream ofs( filename.c_str(), std::ios::out | std::ios::binary );
+
+  if( !ofs.is_open() )
+  {
+    std::cerr << " [localization_database]: Could not write to " << filename << std::endl;
+    return false;
+  }
+
+  uint64_t row_size = 128 * ( ( header.descriptor_type == LOC_DB_FLOAT ) ? sizeof( float ) : sizeof( unsigned char ) );
+
+  ofs.write( (const char*) &header, sizeof( localization_db_header ) );
+  write_padding( ofs, header.points_offset );
+  if( !points.empty() )
+    ofs.write( (const char*) &points[0], points.size() * sizeof( float ) );
+  write_padding( ofs, header.descriptors_offset );
+  for( uint64_t i=0; i<header.nb_descriptor_rows; ++i )
+    ofs.write( (const char*) descriptors + uint64_t( row_descriptors[i] ) * row_size, row_size );
+  write_padding( ofs, header.word_offsets_offset );
+  ofs.write( (const char*) &word_offsets[0], word_offsets.size() * sizeof( uint32_t ) );
+  write_padding( ofs, header.word_entries_offset );
+  if( !word_entries.empty() )
+    ofs.write( (const char*) &word_entries[0], word_entries.size() * sizeof( vw_entry ) );
+  write_padding( ofs, header.point_offsets_offset );
+  ofs.write( (const char*) &point_offsets[0], point_offsets.size() * sizeof( uint32_t ) );
+  write_padding( ofs, header.point_entries_offset );
+  if( !point_entries.empty() )
+    ofs.write( (const char*) &point_entries[0], point_entries.size() * sizeof( point_entry ) );
+  write_padding( ofs, header.descriptor_rows_offset );
+  if( !descriptor_rows.empty() )
+    ofs.write( (const char*) &descriptor_rows[0], descriptor_rows.size() * sizeof( uint32_t ) );
+
+  bool ok = ofs.good();
+  ofs.close();
+
+  if( !ok )
+    std::cerr << " [localization_database]: Error while writing " << filename << std::endl;
+
+  return ok;
+}
@@ -0,0 +1,215 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+
+#ifndef LOCALIZATION_DATABASE_HH
+#define LOCALIZATION_DATABASE_HH
+
+/**
+ *    Class to access the 3D points, their descriptors and the assignments of
+ *    (point, descriptor) pairs to visual words as computed by compute_desc_assignments.
+ *
+ *    The data is stored in a single binary file with the following layout, where
+ *    every section starts at a 64 byte aligned offset:
+ *
+ *      header                 (see localization_db_header)
+ *      points                 nb_points * 3 floats
+ *      descriptors            nb_descriptor_rows * 128 unsigned chars or floats, see below
+ *      word offsets           (nb_visual_words + 1) uint32_t, CSR offsets into the word entries
+ *      word entries           nb_assignments * (point id, descriptor id)
+ *      point offsets          (nb_points + 1) uint32_t, CSR offsets into the point entries
+ *      point entries          nb_assignments * (visual word id, descriptor id)
+ *      descriptor rows        nb_descriptors uint32_t, the row of every descriptor in the descriptor section
+ *
+ *    The descriptors are stored in the order of the word entries, i.e., row k of the
+ *    descriptor section is the descriptor of word entry k, and the descriptors of a
+ *    visual word form one contiguous block that can be scanned linearly during matching.
+ *    A descriptor assigned to several visual words is duplicated, descriptors that are not
+ *    assigned to any visual word are stored after the rows of the word entries.
+ *    Descriptor ids (as stored in the entries) are mapped to rows using the descriptor rows.
+ *
+ *    The file is mapped into memory with mmap and all data is used in place, i.e.,
+ *    loading only costs the page faults of the pages actually touched and several
+ *    processes working on the same model share the page cache.
+ *    Files written by older versions of compute_desc_assignments (without header)
+ *    are still supported, they are parsed into an in-memory copy of the layout above.
+**/
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+
+//! magic number at the beginning of every localization database file
+#define LOCALIZATION_DB_MAGIC "ACGLOCDB"
+
+//! current version of the file format
+#define LOCALIZATION_DB_VERSION 2
+
+//! alignment (in bytes) of all sections in the file
+#define LOCALIZATION_DB_ALIGNMENT 64
+
+//! types of descriptors that can be stored in the database
+enum LOCALIZATION_DB_DESCRIPTOR_TYPE{ LOC_DB_UCHAR = 0, LOC_DB_FLOAT = 1 };
+
+//! header of the file, the offsets are given in bytes from the beginning of the file
+struct localization_db_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t descriptor_type;
+  uint32_t nb_points;
+  uint32_t nb_visual_words;
+  uint32_t nb_non_empty_visual_words;
+  uint32_t nb_descriptors;
+  uint64_t nb_assignments;
+  uint64_t points_offset;
+  uint64_t descriptors_offset;
+  uint64_t word_offsets_offset;
+  uint64_t word_entries_offset;
+  uint64_t point_offsets_offset;
+  uint64_t point_entries_offset;
+  uint64_t file_size;
+  uint64_t nb_descriptor_rows;
+  uint64_t descriptor_rows_offset;
+};
+
+//! entry of the inverted file of a visual word: a 3D point and one of its descriptors
+struct vw_entry
+{
+  uint32_t point_id;
+  uint32_t desc_id;
+};
+
+//! entry of the list of a 3D point: a visual word and the descriptor assigned to it
+struct point_entry
+{
+  uint32_t vw_id;
+  uint32_t desc_id;
+};
+
+
+class localization_database
+{
+  public:
+    //! constructor
+    localization_database( );
+
+    //! destructor
+    ~localization_database( );
+
+    //! Opens a database file. Files in the current format are memory mapped, files in the old
+    //! format (no header) are parsed into memory. Returns false if the file could not be loaded.
+    bool load( const std::string &filename );
+
+    //! unmaps / releases all data
+    void close( );
+
+    //! Writes a database file. points contains 3 * nb_points floats, descriptors points to
+    //! 128 * nb_descriptors unsigned chars or floats (depending on descriptor_type) and
+    //! vw_point_descriptor_idx contains for every visual word the list of (point id, descriptor id) pairs.
+    static bool save( const std::string &filename, const std::vector< float > &points, int descriptor_type, const void *descriptors, uint32_t nb_descriptors, const std::vector< std::vector< std::pair< uint32_t, uint32_t > > > &vw_point_descriptor_idx );
+
+    //! returns true if a database is loaded
+    bool is_loaded( ) const { return mData != 0; }
+
+    //! get the number of 3D points
+    uint32_t get_nb_points( ) const { return mHeader->nb_points; }
+
+    //! get the number of visual words
+    uint32_t get_nb_visual_words( ) const { return mHeader->nb_visual_words; }
+
+    //! get the number of visual words with at least one entry
+    uint32_t get_nb_non_empty_visual_words( ) const { return mHeader->nb_non_empty_visual_words; }
+
+    //! get the number of descriptors
+    uint32_t get_nb_descriptors( ) const { return mHeader->nb_descriptors; }
+
+    //! get the number of (point, descriptor) to visual word assignments
+    uint64_t get_nb_assignments( ) const { return mHeader->nb_assignments; }
+
+    //! get the type of the stored descriptors (LOC_DB_UCHAR or LOC_DB_FLOAT)
+    int get_descriptor_type( ) const { return int( mHeader->descriptor_type ); }
+
+    //! get the coordinates (3 floats) of a 3D point
+    const float* get_point( uint32_t id ) const { return mPoints + 3 * size_t( id ); }
+
+    //! get a descriptor stored as unsigned chars
+    const unsigned char* get_descriptor_uchar( uint32_t id ) const { return mDescriptorsUChar + 128 * size_t( mDescriptorRows[id] ); }
+
+    //! get a descriptor stored as floats
+    const float* get_descriptor_float( uint32_t id ) const { return mDescriptorsFloat + 128 * size_t( mDescriptorRows[id] ); }
+
+    //! get the descriptors (unsigned chars) of all entries of a visual word, the descriptor of
+    //! entry k of get_entries_for_vw( vw ) starts at position 128 * k
+    const unsigned char* get_descriptors_for_vw_uchar( uint32_t vw ) const { return mDescriptorsUChar + 128 * size_t( mWordOffsets[vw] ); }
+
+    //! get the descriptors (floats) of all entries of a visual word, the descriptor of
+    //! entry k of get_entries_for_vw( vw ) starts at position 128 * k
+    const float* get_descriptors_for_vw_float( uint32_t vw ) const { return mDescriptorsFloat + 128 * size_t( mWordOffsets[vw] ); }
+
+    //! get the number of entries of a visual word
+    uint32_t get_nb_entries_for_vw( uint32_t vw ) const { return mWordOffsets[vw+1] - mWordOffsets[vw]; }
+
+    //! get the entries (point id, descriptor id) of a visual word
+    const vw_entry* get_entries_for_vw( uint32_t vw ) const { return mWordEntries + mWordOffsets[vw]; }
+
+    //! get the number of descriptors (and visual words) of a 3D point
+    uint32_t get_nb_entries_for_point( uint32_t point ) const { return mPointOffsets[point+1] - mPointOffsets[point]; }
+
+    //! get the entries (visual word id, descriptor id) of a 3D point
+    const point_entry* get_entries_for_point( uint32_t point ) const { return mPointEntries + mPointOffsets[point]; }
+
+  private:
+
+    //! compute the offsets of all sections and the file size, the counts in the header have to be set
+    static void compute_layout( localization_db_header &header );
+
+    //! builds an in-memory copy of the current layout from descriptors given in the order of their ids
+    bool build_in_memory( localization_db_header header, const float *points, const char *descriptors, const std::vector< std::vector< std::pair< uint32_t, uint32_t > > > &vw_point_descriptor_idx );
+
+    //! set the pointers to the sections, mData and mHeader have to be set
+    void set_pointers( );
+
+    //! loads a file in the format used before the introduction of the header
+    bool load_legacy( const std::string &filename );
+
+    //! the data, either memory mapped or allocated by build_in_memory
+    char *mData;
+    size_t mDataSize;
+    bool mMapped;
+
+    const localization_db_header *mHeader;
+    const float *mPoints;
+    const unsigned char *mDescriptorsUChar;
+    const float *mDescriptorsFloat;
+    const uint32_t *mWordOffsets;
+    const vw_entry *mWordEntries;
+    const uint32_t *mPointOffsets;
+    const point_entry *mPointEntries;
+    const uint32_t *mDescriptorRows;
+};
+
+#endif
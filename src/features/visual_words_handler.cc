@@ -23,8 +23,47 @@
 \*===========================================================================*/ 
 
 #include "visual_words_handler.hh"
+#include <string.h>
+#include <thread>
+#include <functional>
 
 
+extern "C" {
+
+    // single precision matrix multiplication of BLAS
+    void sgemm_( char *transa, char *transb, int *m, int *n, int *k,
+		 float *alpha, const float *a, int *lda, const float *b, int *ldb,
+		 float *beta, float *c, int *ldc );
+
+}
+
+
+// Calls process( first, last ) for consecutive ranges [first,last) of the nb_items items with up to
+// nb_threads threads in parallel, such that every thread processes at least VW_MIN_DESCRIPTORS_PER_THREAD items.
+static void process_in_parallel( size_t nb_items, int nb_threads, const std::function< void ( size_t, size_t ) > &process )
+{
+  size_t nb_ranges = std::min( (size_t) std::max( nb_threads, 1 ), ( nb_items + VW_MIN_DESCRIPTORS_PER_THREAD - 1 ) / VW_MIN_DESCRIPTORS_PER_THREAD );
+  
+  if( nb_ranges <= 1 )
+  {
+    process( 0, nb_items );
+    return;
+  }
+  
+  auto worker = [&]( size_t range )
+  {
+    process( nb_items * range / nb_ranges, nb_items * ( range + 1 ) / nb_ranges );
+  };
+  
+  std::vector< std::thread > workers;
+  for( size_t t=1; t<nb_ranges; ++t )
+    workers.push_back( std::thread( worker, t ) );
+  worker( 0 );
+  for( size_t t=0; t<workers.size(); ++t )
+    workers[t].join();
+}
+
+//---------------------------------------------------
 
 visual_words_handler::visual_words_handler( )
 {
@@ -39,6 +78,7 @@ visual_words_handler::visual_words_handler( )
   mSampleFraction = 0.1f;
   mNbNearestNeighbors = 2;
   mNbVisualWords = 100000;
+  mNbThreads = 1;
   
   mFlannIndex = 0;
   
@@ -67,10 +107,7 @@ visual_words_handler::~visual_words_handler( )
   if( mFlannFeatures.data != 0 )
     mFlannFeatures.free();
   
-  if( mFlannIndex != 0 )
-    delete mFlannIndex;
-  mFlannIndex = 0;
-  
+  clear_index();
 }
 
 //---------------------------------------------------
@@ -100,6 +137,13 @@ void visual_words_handler::set_nb_paths( int nb_path )
 
 //---------------------------------------------------
 
+void visual_words_handler::set_nb_threads( int nb_threads )
+{
+  mNbThreads = std::max( nb_threads, 1 );
+}
+
+//---------------------------------------------------
+
 void visual_words_handler::set_flann_type( const std::string &type )
 {
   if( type == "auto" )
@@ -208,6 +252,7 @@ void visual_words_handler::set_cluster_centers( std::vector< float > &cluster_ce
     }
     index += 128;
   }
+  update_center_norms();
 }
 
 //---------------------------------------------------
@@ -232,6 +277,7 @@ void visual_words_handler::set_cluster_centers( std::string &cluster_file )
   }
   
   ifs.close();
+  update_center_norms();
 }
 
 //---------------------------------------------------
@@ -269,9 +315,7 @@ void visual_words_handler::get_cluster_centers_flann( std::vector< float > &cent
 bool visual_words_handler::load_trees_flann( std::string &cluster_file, std::string &tree_file )
 {
 
-  if( mFlannIndex != 0 )
-    delete [] mFlannIndex;
-  mFlannIndex = 0;
+  clear_index();
   
   // load the clusters from a text file
   {
@@ -340,6 +384,8 @@ bool visual_words_handler::load_trees_flann( std::string &cluster_file, std::str
   
   initialize();
   std::cout << "[Visual_Words_Handler]: Arrays initialized. " << std::endl;
+  build_quantizer();
+  update_center_norms();
   return true;
 }
 
@@ -347,9 +393,7 @@ bool visual_words_handler::load_trees_flann( std::string &cluster_file, std::str
 
 void visual_words_handler::rebuild_flann_index()
 {
-  if( mFlannIndex != 0 )
-    delete [] mFlannIndex;
-  mFlannIndex = 0;
+  clear_index();
   
   std::cout << "[Visual_Words_Handler]: Building the tree... " << std::endl;
 
@@ -374,20 +418,28 @@ void visual_words_handler::rebuild_flann_index()
 	
     }
   }
-  mFlannIndex->buildIndex();
   
-  std::cout << "[Visual_Words_Handler]: Tree built. " << std::endl;
+  // the linear search does not need an index
+  if( mFlannIndex != 0 )
+  {
+    mFlannIndex->buildIndex();
+    std::cout << "[Visual_Words_Handler]: Tree built. " << std::endl;
+  }
   initialize();
   std::cout << "[Visual_Words_Handler]: Arrays initialized. " << std::endl;
+  build_quantizer();
+  update_center_norms();
 }
 
 //---------------------------------------------------
 
 bool visual_words_handler::create_flann_search_index( std::string &cluster_file )
 {
-  if( mFlannIndex != 0 )
-    delete [] mFlannIndex;
-  mFlannIndex = 0;
+  // binary vocabulary files already contain the index
+  if( is_vocabulary_file( cluster_file ) )
+    return load_vocabulary( cluster_file );
+  
+  clear_index();
   
   // load the clusters from a text file
   {
@@ -434,12 +486,18 @@ bool visual_words_handler::create_flann_search_index( std::string &cluster_file
 		break;
     }
   }
-  
-  mFlannIndex->buildIndex();
-  std::cout << "[Visual_Words_Handler]: Tree built. " << std::endl;
+
+  // the linear search does not need an index
+  if( mFlannIndex != 0 )
+  {
+    mFlannIndex->buildIndex();
+    std::cout << "[Visual_Words_Handler]: Tree built. " << std::endl;
+  }
   
   initialize();
   std::cout << "[Visual_Words_Handler]: Arrays initialized. " << std::endl;
+  build_quantizer();
+  update_center_norms();
   return true;
 }
 
@@ -447,9 +505,7 @@ bool visual_words_handler::create_flann_search_index( std::string &cluster_file
 
 bool visual_words_handler::create_flann_search_index( std::vector< float > &cluster_centers )
 {
-  if( mFlannIndex != 0 )
-    delete [] mFlannIndex;
-  mFlannIndex = 0;
+  clear_index();
   
   // copy the clusters
   size_t nb_clusts = cluster_centers.size() / 128;
@@ -496,18 +552,238 @@ bool visual_words_handler::create_flann_search_index( std::vector< float > &clus
     }
   }
 
-  mFlannIndex->buildIndex();
-  std::cout << "[Visual_Words_Handler]: Tree built. " << std::endl;
+  // the linear search does not need an index
+  if( mFlannIndex != 0 )
+  {
+    mFlannIndex->buildIndex();
+    std::cout << "[Visual_Words_Handler]: Tree built. " << std::endl;
+  }
   
   initialize();
   std::cout << "[Visual_Words_Handler]: Arrays initialized. " << std::endl;
+  build_quantizer();
+  update_center_norms();
   return true;
 }
 
 //---------------------------------------------------
 
+bool visual_words_handler::save_vocabulary( const std::string &filename )
+{
+  if( mMethod != 2 || mFlannIndex == 0 )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: There is no flann index that could be saved " << std::endl;
+    return false;
+  }
+  
+  FILE *fout = fopen( filename.c_str(), "wb" );
+  if( fout == NULL )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: Cannot write the vocabulary to " << filename << std::endl;
+    return false;
+  }
+  
+  vocabulary_tree_trailer trailer;
+  memset( &trailer, 0, sizeof( vocabulary_tree_trailer ) );
+  memcpy( trailer.magic, VOCABULARY_TREE_MAGIC, 8 );
+  trailer.version = VOCABULARY_TREE_VERSION;
+  trailer.nb_visual_words = mNbVisualWords;
+  trailer.branching = (uint32_t) mBranching;
+  trailer.nb_trees = (uint32_t) mNbTrees;
+  
+  // the type of the index that was actually built
+  flann::NNIndex< flann::L2< float > > *index_ = mFlannIndex->getIndex();
+  if( index_->getType() == FLANN_INDEX_KMEANS )
+    trailer.flann_index_type = 1;
+  else if( index_->getType() == FLANN_INDEX_KDTREE )
+    trailer.flann_index_type = 2;
+  else
+    trailer.flann_index_type = 0;
+  
+  ////
+  // the index, stored exactly as by flann::Index::save such that it can be read using flann::SavedIndexParams
+  flann::save_header( fout, *index_ );
+  index_->saveIndex( fout );
+  
+  ////
+  // the cluster centers
+  trailer.centers_offset = (uint64_t) ftell( fout );
+  fwrite( mClusterCentersFlann.data, sizeof( float ), size_t( mNbVisualWords ) * 128, fout );
+  
+  ////
+  // for vocabulary trees, the parents of all leaves at the levels used by active search
+  trailer.parents_offset = (uint64_t) ftell( fout );
+  if( trailer.flann_index_type == 1 && dynamic_cast< flann::KMeansIndex< flann::L2< float > >* >( index_ ) != 0 )
+  {
+    flann::KMeansIndex< flann::L2< float > >* tree_ = dynamic_cast< flann::KMeansIndex< flann::L2< float > >* >( index_ );
+    int *parent_ids = new int[mNbVisualWords];
+    for( int L=2; L<=3; ++L )
+    {
+      for( uint32_t i=0; i<mNbVisualWords; ++i )
+        parent_ids[i] = -1;
+      tree_->getClusterCentersOnLevelL( L, parent_ids );
+      
+      fwrite( &L, sizeof( int ), 1, fout );
+      fwrite( parent_ids, sizeof( int ), mNbVisualWords, fout );
+      ++trailer.nb_parent_levels;
+    }
+    delete [] parent_ids;
+    parent_ids = 0;
+    tree_ = 0;
+  }
+  
+  fwrite( &trailer, sizeof( vocabulary_tree_trailer ), 1, fout );
+  
+  bool write_ok = ( ferror( fout ) == 0 );
+  if( fclose( fout ) != 0 )
+    write_ok = false;
+  
+  if( !write_ok )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: Could not write the vocabulary to " << filename << std::endl;
+    return false;
+  }
+  
+  std::cout << "[Visual_Words_Handler]: Saved the vocabulary (" << mNbVisualWords << " visual words, " << trailer.nb_parent_levels << " parent levels) to " << filename << std::endl;
+  return true;
+}
+
+//---------------------------------------------------
+
+bool visual_words_handler::is_vocabulary_file( const std::string &filename )
+{
+  FILE *fin = fopen( filename.c_str(), "rb" );
+  if( fin == NULL )
+    return false;
+  
+  vocabulary_tree_trailer trailer;
+  bool is_vocabulary = false;
+  if( fseek( fin, -long( sizeof( vocabulary_tree_trailer ) ), SEEK_END ) == 0 )
+  {
+    if( fread( &trailer, sizeof( vocabulary_tree_trailer ), 1, fin ) == 1 )
+      is_vocabulary = ( memcmp( trailer.magic, VOCABULARY_TREE_MAGIC, 8 ) == 0 );
+  }
+  fclose( fin );
+  
+  return is_vocabulary;
+}
+
+//---------------------------------------------------
+
+bool visual_words_handler::load_vocabulary( const std::string &filename )
+{
+  clear_index();
+  
+  FILE *fin = fopen( filename.c_str(), "rb" );
+  if( fin == NULL )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: Cannot read the vocabulary from " << filename << std::endl;
+    return false;
+  }
+  
+  ////
+  // read the trailer and check if the vocabulary fits our settings
+  vocabulary_tree_trailer trailer;
+  if( fseek( fin, -long( sizeof( vocabulary_tree_trailer ) ), SEEK_END ) != 0 || fread( &trailer, sizeof( vocabulary_tree_trailer ), 1, fin ) != 1 || memcmp( trailer.magic, VOCABULARY_TREE_MAGIC, 8 ) != 0 )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: " << filename << " is not a vocabulary file " << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  if( trailer.version != VOCABULARY_TREE_VERSION )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: Unsupported version " << trailer.version << " of the vocabulary file " << filename << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  if( trailer.nb_visual_words != mNbVisualWords )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: The vocabulary " << filename << " contains " << trailer.nb_visual_words << " visual words, expected " << mNbVisualWords << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  ////
+  // load the cluster centers and the parent tables
+  std::vector< std::pair< int, std::vector< int > > > parents( trailer.nb_parent_levels );
+  bool read_ok = ( fseek( fin, long( trailer.centers_offset ), SEEK_SET ) == 0 );
+  if( read_ok )
+    read_ok = ( fread( mClusterCentersFlann.data, sizeof( float ), size_t( mNbVisualWords ) * 128, fin ) == size_t( mNbVisualWords ) * 128 );
+  if( read_ok )
+    read_ok = ( fseek( fin, long( trailer.parents_offset ), SEEK_SET ) == 0 );
+  for( uint32_t i=0; i<trailer.nb_parent_levels && read_ok; ++i )
+  {
+    parents[i].second.resize( mNbVisualWords );
+    read_ok = ( fread( &(parents[i].first), sizeof( int ), 1, fin ) == 1 );
+    if( read_ok )
+      read_ok = ( fread( &(parents[i].second[0]), sizeof( int ), mNbVisualWords, fin ) == mNbVisualWords );
+  }
+  fclose( fin );
+  
+  if( !read_ok )
+  {
+    std::cerr << "[Visual_Words_Handler]: ERROR: The vocabulary file " << filename << " is truncated " << std::endl;
+    return false;
+  }
+  
+  ////
+  // get the search index. If the stored one is not of the requested type, we use the stored centers to build a new one
+  if( mMethod == 2 && int( trailer.flann_index_type ) != mFlannIndexType )
+  {
+    std::cout << "[Visual_Words_Handler]: The vocabulary " << filename << " contains an index of type " << trailer.flann_index_type << " instead of " << mFlannIndexType << std::endl;
+    rebuild_flann_index();
+    return true;
+  }
+  
+  if( mMethod == 2 )
+  {
+    std::cout << "[Visual_Words_Handler]: Loading the tree for " << mNbVisualWords << " points from " << filename << std::endl;
+    mFlannIndex = new flann::Index< flann::L2< float > >( mClusterCentersFlann, flann::SavedIndexParams( filename ) );
+    if( mFlannIndex->getIndex() == 0 )
+    {
+      std::cerr << "[Visual_Words_Handler]: ERROR: Could not load the tree from " << filename << std::endl;
+      clear_index();
+      return false;
+    }
+    std::cout << "[Visual_Words_Handler]: Tree loaded. " << std::endl;
+  }
+  
+  mParentsAtLevel.swap( parents );
+  
+  initialize();
+  std::cout << "[Visual_Words_Handler]: Arrays initialized. " << std::endl;
+  build_quantizer();
+  update_center_norms();
+  return true;
+}
+
+//---------------------------------------------------
+
+void visual_words_handler::clear_index()
+{
+  if( mFlannIndex != 0 )
+    delete mFlannIndex;
+  mFlannIndex = 0;
+  mParentsAtLevel.clear();
+  mQuantizer.clear();
+}
+
+//---------------------------------------------------
+
 void visual_words_handler::get_parents_at_level_L( int L, int* &ids )
 {
+  // use the parent tables loaded from a vocabulary file if possible
+  for( size_t i=0; i<mParentsAtLevel.size(); ++i )
+  {
+    if( mParentsAtLevel[i].first == L )
+    {
+      std::copy( mParentsAtLevel[i].second.begin(), mParentsAtLevel[i].second.end(), ids );
+      return;
+    }
+  }
+  
   if( mMethod == 2 && mFlannIndexType == 1 && mFlannIndex != 0 )
   {
     if( dynamic_cast< flann::KMeansIndex< flann::L2< float > >* >( mFlannIndex->getIndex() ) != 0 )
@@ -524,46 +800,26 @@ void visual_words_handler::get_parents_at_level_L( int L, int* &ids )
 //---------------------------------------------------
     
 bool visual_words_handler::assign_visual_words_uchar( std::vector< unsigned char > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments )
+{
+  return assign_visual_words_uchar( descriptors.empty() ? 0 : &descriptors[0], nb_descriptors, assignments );
+}
+
+//---------------------------------------------------
+    
+bool visual_words_handler::assign_visual_words_uchar( const unsigned char *descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments )
 {
   if( assignments.size() < (size_t) nb_descriptors )
     assignments.resize(nb_descriptors);
     
   if( mMethod == 0 )
   {
-    // do a linear search
-    float vec[128];
-    uint32_t index = 0;
-    for( uint32_t i=0; i<nb_descriptors; ++i )
+    // exact search against all cluster centers
+    linear_search( nb_descriptors, [&]( uint32_t i, float *vec )
     {
-      // copy the descriptor
-//       uint32_t index = i*128;
+      const unsigned char *descriptor = descriptors + 128 * (size_t) i;
       for( uint32_t j=0; j<128; ++j )
-	vec[j] = (float) descriptors[index+j];
-      
-      // find the nearest neighbor
-      float max_dist = 1e20f;
-      float dist = 0.0f;
-      float x;
-      uint32_t index2 = 0;
-      for( uint32_t j=0; j<mNbVisualWords; ++j )
-      {
-	dist = 0.0f;
-// 	index2 = j*128;
-	for( uint32_t k=0; k<128; ++k )
-	{
-	  x = vec[k] - mClusterCentersFlann.data[index2+k];
-	  dist += x*x;
-	}
-	
-	if( dist < max_dist )
-	{
-	  max_dist = dist;
-	  assignments[i] = j;
-	}
-	index2 += 128;
-      }
-      index += 128;
-    }
+        vec[j] = (float) descriptor[j];
+    }, assignments.data(), 0 );
     
     return true;
   }
@@ -573,29 +829,28 @@ bool visual_words_handler::assign_visual_words_uchar( std::vector< unsigned char
 //     std::cout << " FLANN : " << nb_descriptors << " paths : " << mNbPath << " index type : " << mFlannIndexType << std::endl;
     if( mFlannIndex == 0 )
       return false;
-    // copy the descriptors
-    resize( nb_descriptors );
-    uint32_t index = 0;
-    for( uint32_t i=0; i<nb_descriptors; ++i )
+    
+    // a vocabulary tree searched along a single path does not need the descriptors as floats
+    if( use_quantizer() )
     {
-      for( uint32_t j=0; j<128; ++j )
+      process_in_parallel( nb_descriptors, mNbThreads, [&]( size_t first, size_t last )
       {
-		mFlannFeatures[i][j] = (float) descriptors[index+j];
-      }
-      index += 128;
+        float dist;
+        for( size_t i=first; i<last; ++i )
+          assignments[i] = mQuantizer.quantize( descriptors + 128 * i, dist );
+      } );
+      return true;
     }
     
+    // copy the descriptors, they are stored contiguously in both arrays
+    resize( nb_descriptors );
+    float *features = mFlannFeatures.data;
+    size_t nb_entries = 128 * (size_t) nb_descriptors;
+    for( size_t i=0; i<nb_entries; ++i )
+      features[i] = (float) descriptors[i];
+    
     // compute the assignments
-    if( mFlannIndexType == 0 )
-    {
-      flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
-    }
-    else
-    {
-      flann::SearchParams params( mNbPath );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
-    }
+    search_flann( mFlannAssignments, mFlannDistances, 1 );
     
     // copy the assignments
     for( uint32_t i=0; i<nb_descriptors; ++i )
@@ -620,38 +875,12 @@ bool visual_words_handler::assign_visual_words_ucharv( std::vector< unsigned cha
   
   if( mMethod == 0 )
   {
-    // do a linear search
-    float vec[128];
-    for( uint32_t i=0; i<nb_descriptors; ++i )
+    // exact search against all cluster centers
+    linear_search( nb_descriptors, [&]( uint32_t i, float *vec )
     {
-      // copy the descriptor
       for( uint32_t j=0; j<128; ++j )
-	vec[j] = (float) descriptors[i][j];
-      
-      // find the nearest neighbor
-      float max_dist = 1e20f;
-      float dist = 0.0f;
-      float x;
-      uint32_t index2 = 0;
-      for( uint32_t j=0; j<mNbVisualWords; ++j )
-      {
-	dist = 0.0f;
-// 	index2 = j*128;
-	for( uint32_t k=0; k<128; ++k )
-	{
-	  x = vec[k] - mClusterCentersFlann.data[index2+k];
-	  dist += x*x;
-	}
-	
-	if( dist < max_dist )
-	{
-	  max_dist = dist;
-	  assignments[i] = j;
-	}
-	index2 += 128;
-      }
-//       std::cout << " Linear: " << i << " -> " << assignments[i] << " dist :  " << max_dist << std::endl;
-    }
+        vec[j] = (float) descriptors[i][j];
+    }, assignments.data(), 0 );
     
     return true;
   }
@@ -661,6 +890,18 @@ bool visual_words_handler::assign_visual_words_ucharv( std::vector< unsigned cha
     if( mFlannIndex == 0 )
       return false;
     
+    // a vocabulary tree searched along a single path does not need the descriptors as floats
+    if( use_quantizer() )
+    {
+      process_in_parallel( nb_descriptors, mNbThreads, [&]( size_t first, size_t last )
+      {
+        float dist;
+        for( size_t i=first; i<last; ++i )
+          assignments[i] = mQuantizer.quantize( descriptors[i], dist );
+      } );
+      return true;
+    }
+    
     // copy the descriptors
     resize( nb_descriptors );
     for( uint32_t i=0; i<nb_descriptors; ++i )
@@ -672,17 +913,72 @@ bool visual_words_handler::assign_visual_words_ucharv( std::vector< unsigned cha
     }
     
     // compute the assignments
-    if( mFlannIndexType == 0 )
+    search_flann( mFlannAssignments, mFlannDistances, 1 );
+    
+    // copy the assignments
+    for( uint32_t i=0; i<nb_descriptors; ++i )
     {
-      flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
+      assignments[i] = (uint32_t) mFlannAssignments.data[i];
     }
-    else
+    
+    return true;
+  }
+  
+  return false;
+}
+
+//---------------------------------------------------
+
+bool visual_words_handler::assign_visual_words_batch( const std::vector< SIFT_descriptor_view > &queries, std::vector< uint32_t > &assignments, std::vector< uint32_t > &offsets )
+{
+  // the assignments of all queries are stored one after another
+  size_t nb_queries = queries.size();
+  offsets.resize( nb_queries + 1 );
+  offsets[0] = 0;
+  for( size_t q=0; q<nb_queries; ++q )
+    offsets[q+1] = offsets[q] + queries[q].nb_descriptors;
+  
+  uint32_t nb_descriptors = offsets[nb_queries];
+  if( assignments.size() < (size_t) nb_descriptors )
+    assignments.resize(nb_descriptors);
+  
+  if( mMethod == 2 )
+  {
+    // FLANN
+    if( mFlannIndex == 0 )
+      return false;
+    
+    if( use_quantizer() )
     {
-      flann::SearchParams params( mNbPath );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
+      process_in_parallel( nb_descriptors, mNbThreads, [&]( size_t first, size_t last )
+      {
+        // find the query containing the first descriptor of the range
+        size_t q = std::upper_bound( offsets.begin(), offsets.end(), (uint32_t) first ) - offsets.begin() - 1;
+        float dist;
+        for( size_t i=first; i<last; ++i )
+        {
+          while( i >= offsets[q+1] )
+            ++q;
+          assignments[i] = mQuantizer.quantize( queries[q][i - offsets[q]], dist );
+        }
+      } );
+      return true;
     }
     
+    // copy the descriptors of all queries
+    resize( nb_descriptors );
+    float *features = mFlannFeatures.data;
+    for( size_t q=0; q<nb_queries; ++q )
+    {
+      size_t nb_entries = 128 * (size_t) queries[q].nb_descriptors;
+      for( size_t i=0; i<nb_entries; ++i )
+        features[i] = (float) queries[q].data[i];
+      features += nb_entries;
+    }
+    
+    // compute the assignments
+    search_flann( mFlannAssignments, mFlannDistances, 1 );
+    
     // copy the assignments
     for( uint32_t i=0; i<nb_descriptors; ++i )
     {
@@ -692,7 +988,16 @@ bool visual_words_handler::assign_visual_words_ucharv( std::vector< unsigned cha
     return true;
   }
   
-  return false;
+  // the other methods do not profit from a batch, assign the queries one after another
+  std::vector< uint32_t > query_assignments;
+  for( size_t q=0; q<nb_queries; ++q )
+  {
+    if( !assign_visual_words_uchar( queries[q].data, queries[q].nb_descriptors, query_assignments ) )
+      return false;
+    std::copy( query_assignments.begin(), query_assignments.begin() + queries[q].nb_descriptors, assignments.begin() + offsets[q] );
+  }
+  
+  return true;
 }
 
 //---------------------------------------------------
@@ -704,41 +1009,11 @@ bool visual_words_handler::assign_visual_words_float( std::vector< float > &desc
   
   if( mMethod == 0 )
   {
-    // do a linear search
-    float vec[128];
-    uint32_t index = 0;
-    for( uint32_t i=0; i<nb_descriptors; ++i )
+    // exact search against all cluster centers
+    linear_search( nb_descriptors, [&]( uint32_t i, float *vec )
     {
-      // copy the descriptor
-//       uint32_t index = i*128;
-      for( uint32_t j=0; j<128; ++j )
-	vec[j] = descriptors[index+j];
-      
-      // find the nearest neighbor
-      float max_dist = 1e20f;
-      float dist = 0.0f;
-      float x;
-      uint32_t index2 = 0;
-      for( uint32_t j=0; j<mNbVisualWords; ++j )
-      {
-	dist = 0.0f;
-// 	index2 = j*128;
-	for( uint32_t k=0; k<128; ++k )
-	{
-	  x = vec[k] - mClusterCentersFlann.data[index2+k];
-	  dist += x*x;
-	}
-	
-	if( dist < max_dist )
-	{
-	  max_dist = dist;
-	  assignments[i] = j;
-	}
-	index2 += 128;
-      }
-      
-      index += 128;
-    }
+      memcpy( vec, &descriptors[128 * (size_t) i], 128 * sizeof( float ) );
+    }, assignments.data(), 0 );
     
     return true;
   }
@@ -762,16 +1037,7 @@ bool visual_words_handler::assign_visual_words_float( std::vector< float > &desc
     }
     
     // compute the assignments
-    if( mFlannIndexType == 0 )
-    {
-      flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
-    }
-    else
-    {
-      flann::SearchParams params( mNbPath );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
-    }
+    search_flann( mFlannAssignments, mFlannDistances, 1 );
     
     // copy the assignments
     for( uint32_t i=0; i<nb_descriptors; ++i )
@@ -790,44 +1056,17 @@ bool visual_words_handler::assign_visual_words_uchar( std::vector< unsigned char
 {
   if( assignments.size() < (size_t) nb_descriptors )
     assignments.resize(nb_descriptors);
+  if( distances.size() < (size_t) nb_descriptors )
+    distances.resize(nb_descriptors);
     
   if( mMethod == 0 )
   {
-    // do a linear search
-    float vec[128];
-    uint32_t index = 0;
-    for( uint32_t i=0; i<nb_descriptors; ++i )
+    // exact search against all cluster centers
+    linear_search( nb_descriptors, [&]( uint32_t i, float *vec )
     {
-      // copy the descriptor
-//       uint32_t index = i*128;
       for( uint32_t j=0; j<128; ++j )
-	vec[j] = (float) descriptors[index+j];
-      
-      // find the nearest neighbor
-      float max_dist = 1e20f;
-      float dist = 0.0f;
-      float x;
-      uint32_t index2 = 0;
-      for( uint32_t j=0; j<mNbVisualWords; ++j )
-      {
-	dist = 0.0f;
-// 	index2 = j*128;
-	for( uint32_t k=0; k<128; ++k )
-	{
-	  x = vec[k] - mClusterCentersFlann.data[index2+k];
-	  dist += x*x;
-	}
-	
-	if( dist < max_dist )
-	{
-	  max_dist = dist;
-	  assignments[i] = j;
-	}
-	index2 += 128;
-      }
-      distances[i] = max_dist;
-      index += 128;
-    }
+        vec[j] = (float) descriptors[128 * (size_t) i + j];
+    }, assignments.data(), distances.data() );
     
     return true;
   }
@@ -837,6 +1076,18 @@ bool visual_words_handler::assign_visual_words_uchar( std::vector< unsigned char
 //     std::cout << " FLANN : " << nb_descriptors << " paths : " << mNbPath << " index type : " << mFlannIndexType << std::endl;
     if( mFlannIndex == 0 )
       return false;
+    
+    // a vocabulary tree searched along a single path does not need the descriptors as floats
+    if( use_quantizer() )
+    {
+      process_in_parallel( nb_descriptors, mNbThreads, [&]( size_t first, size_t last )
+      {
+        for( size_t i=first; i<last; ++i )
+          assignments[i] = mQuantizer.quantize( &descriptors[128 * i], distances[i] );
+      } );
+      return true;
+    }
+    
     // copy the descriptors
     resize( nb_descriptors );
     uint32_t index = 0;
@@ -851,16 +1102,7 @@ bool visual_words_handler::assign_visual_words_uchar( std::vector< unsigned char
     }
     
     // compute the assignments
-    if( mFlannIndexType == 0 )
-    {
-      flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
-    }
-    else
-    {
-      flann::SearchParams params( mNbPath );
-      mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignments, mFlannDistances, 1, params );
-    }
+    search_flann( mFlannAssignments, mFlannDistances, 1 );
     
     // copy the assignments
     for( uint32_t i=0; i<nb_descriptors; ++i )
@@ -881,6 +1123,13 @@ bool visual_words_handler::assign_visual_words_uchar( std::vector< unsigned char
 //---------------------------------------------------
     
 bool visual_words_handler::k_nn_search_flann_uchar( std::vector< unsigned char > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments, std::vector< float > &distances )
+{
+  return k_nn_search_flann_uchar( descriptors.empty() ? 0 : &descriptors[0], nb_descriptors, assignments, distances );
+}
+
+//---------------------------------------------------
+    
+bool visual_words_handler::k_nn_search_flann_uchar( const unsigned char *descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments, std::vector< float > &distances )
 {
   if( mFlannIndex == 0 )
       return false;
@@ -891,29 +1140,15 @@ bool visual_words_handler::k_nn_search_flann_uchar( std::vector< unsigned char >
   
 
   // FLANN
-  // copy the descriptors
+  // copy the descriptors, they are stored contiguously in both arrays
   resize( nb_descriptors );
-  uint32_t index = 0;
-  for( uint32_t i=0; i<nb_descriptors; ++i )
-  {
-    for( uint32_t j=0; j<128; ++j )
-    {
-      mFlannFeatures[i][j] = (float) descriptors[index+j];
-    }
-    index += 128;
-  }
+  float *features = mFlannFeatures.data;
+  size_t nb_entries = 128 * (size_t) nb_descriptors;
+  for( size_t i=0; i<nb_entries; ++i )
+    features[i] = (float) descriptors[i];
   
   // compute the assignments
-  if( mFlannIndexType == 0 )
-  {
-    flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-    mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors, params );
-  }
-  else
-  {
-    flann::SearchParams params( mNbPath );
-    mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors, params );
-  }
+  search_flann( mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors );
   
   // copy the assignments
   uint32_t k = (uint32_t) mNbNearestNeighbors;
@@ -953,16 +1188,7 @@ bool visual_words_handler::k_nn_search_flann_ucharv( std::vector< unsigned char*
   }
   
   // compute the assignments
-  if( mFlannIndexType == 0 )
-  {
-    flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-    mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors, params );
-  }
-  else
-  {
-    flann::SearchParams params( mNbPath );
-    mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors, params );
-  }
+  search_flann( mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors );
   
   // copy the assignments
   uint32_t k = (uint32_t) mNbNearestNeighbors;
@@ -1003,16 +1229,7 @@ bool visual_words_handler::k_nn_search_flann_float( std::vector< float > &descri
   }
   
   // compute the assignments
-  if( mFlannIndexType == 0 )
-  {
-    flann::SearchParams params( FLANN_CHECKS_AUTOTUNED );
-    mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors, params );
-  }
-  else
-  {
-    flann::SearchParams params( mNbPath );
-    mFlannIndex->knnSearch( mFlannFeatures, mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors, params );
-  }
+  search_flann( mFlannAssignmentsKNN, mFlannDistancesKNN, mNbNearestNeighbors );
   
   // copy the assignments
   uint32_t k = (uint32_t) mNbNearestNeighbors;
@@ -1232,6 +1449,126 @@ void visual_words_handler::assign_and_save_prefix_float( std::string &filename,
 }
 
 
+//---------------------------------------------------
+
+void visual_words_handler::search_flann( flann::Matrix< int > &indices, flann::Matrix< float > &distances, int knn )
+{
+  flann::SearchParams params( ( mFlannIndexType == 0 ) ? FLANN_CHECKS_AUTOTUNED : mNbPath );
+  
+  // Every thread searches a consecutive range of the descriptors and writes its results into the
+  // same rows of the result matrices. The search of a descriptor does not depend on the others,
+  // so the results are identical to the ones of a single thread.
+  process_in_parallel( mFlannFeatures.rows, mNbThreads, [&]( size_t first, size_t last )
+  {
+    flann::Matrix< float > queries( mFlannFeatures[first], last - first, mFlannFeatures.cols );
+    flann::Matrix< int > range_indices( indices[first], last - first, indices.cols );
+    flann::Matrix< float > range_distances( distances[first], last - first, distances.cols );
+    mFlannIndex->knnSearch( queries, range_indices, range_distances, knn, params );
+  } );
+}
+
+//---------------------------------------------------
+
+void visual_words_handler::build_quantizer( )
+{
+  mQuantizer.clear();
+  
+  if( mMethod != 2 || mFlannIndexType != 1 || mFlannIndex == 0 )
+    return;
+  
+  flann::KMeansIndex< flann::L2< float > >* tree_ = dynamic_cast< flann::KMeansIndex< flann::L2< float > >* >( mFlannIndex->getIndex() );
+  if( tree_ != 0 && mQuantizer.build( *tree_, mClusterCentersFlann.data, (uint32_t) mClusterCentersFlann.rows ) )
+    std::cout << "[Visual_Words_Handler]: Tree flattened for the assignment of unsigned char descriptors. " << std::endl;
+}
+
+//---------------------------------------------------
+
+void visual_words_handler::update_center_norms( )
+{
+  mCenterNorms.resize( mNbVisualWords );
+  for( uint32_t i=0; i<mNbVisualWords; ++i )
+  {
+    const float *center = mClusterCentersFlann.data + 128 * (size_t) i;
+    float norm = 0.0f;
+    for( uint32_t j=0; j<128; ++j )
+      norm += center[j] * center[j];
+    mCenterNorms[i] = norm;
+  }
+}
+
+//---------------------------------------------------
+
+void visual_words_handler::linear_search( uint32_t nb_descriptors, const std::function< void ( uint32_t, float* ) > &get_descriptor, uint32_t *assignments, float *distances )
+{
+  if( mCenterNorms.size() != (size_t) mNbVisualWords )
+    update_center_norms();
+  
+  process_in_parallel( nb_descriptors, mNbThreads, [&]( size_t first, size_t last )
+  {
+    std::vector< float > block_descriptors( VW_LINEAR_DESCRIPTOR_BLOCK * 128 );
+    std::vector< float > dot_products( VW_LINEAR_DESCRIPTOR_BLOCK * VW_LINEAR_WORD_BLOCK );
+    std::vector< float > best_distances( VW_LINEAR_DESCRIPTOR_BLOCK );
+    
+    for( size_t block_start=first; block_start<last; block_start += VW_LINEAR_DESCRIPTOR_BLOCK )
+    {
+      int nb_block = (int) std::min( (size_t) VW_LINEAR_DESCRIPTOR_BLOCK, last - block_start );
+      
+      for( int i=0; i<nb_block; ++i )
+      {
+        get_descriptor( (uint32_t) ( block_start + i ), &block_descriptors[128 * i] );
+        best_distances[i] = 1e20f;
+        assignments[block_start + i] = 0;
+      }
+      
+      for( uint32_t word_start=0; word_start<mNbVisualWords; word_start += VW_LINEAR_WORD_BLOCK )
+      {
+        int nb_words = (int) std::min( (uint32_t) VW_LINEAR_WORD_BLOCK, mNbVisualWords - word_start );
+        
+        // BLAS expects column major matrices: the row major centers and descriptors are their
+        // transposes, so centers^T * descriptors yields the dot products of descriptor i in row i
+        char trans_centers = 'T', trans_descriptors = 'N';
+        int dim = 128;
+        float alpha = 1.0f, beta = 0.0f;
+        sgemm_( &trans_centers, &trans_descriptors, &nb_words, &nb_block, &dim, &alpha, mClusterCentersFlann.data + 128 * (size_t) word_start, &dim, &block_descriptors[0], &dim, &beta, &dot_products[0], &nb_words );
+        
+        // keep the nearest center, in case of ties the one with the smallest id. ||a||^2 is the same
+        // for all centers and is left out
+        for( int i=0; i<nb_block; ++i )
+        {
+          const float *dots = &dot_products[(size_t) nb_words * i];
+          float best_dist = best_distances[i];
+          uint32_t best_word = assignments[block_start + i];
+          for( int j=0; j<nb_words; ++j )
+          {
+            float dist = mCenterNorms[word_start + j] - 2.0f * dots[j];
+            if( dist < best_dist )
+            {
+              best_dist = dist;
+              best_word = word_start + (uint32_t) j;
+            }
+          }
+          best_distances[i] = best_dist;
+          assignments[block_start + i] = best_word;
+        }
+      }
+      
+      // compute the distances to the assigned centers directly to avoid the cancellation of the expansion
+      if( distances != 0 )
+      {
+        for( int i=0; i<nb_block; ++i )
+        {
+          const float *vec = &block_descriptors[128 * i];
+          const float *center = mClusterCentersFlann.data + 128 * (size_t) assignments[block_start + i];
+          float dist = 0.0f;
+          for( uint32_t j=0; j<128; ++j )
+            dist += ( vec[j] - center[j] ) * ( vec[j] - center[j] );
+          distances[block_start + i] = dist;
+        }
+      }
+    }
+  } );
+}
+
 //---------------------------------------------------
 
 void visual_words_handler::resize( uint32_t nb_descriptors )
@@ -44,9 +44,49 @@
 #include <stdint.h>
 #include <cmath>
 #include <time.h>
+#include <functional>
 
 #include <flann/flann.hpp>
 
+#include "SIFT_keypoint.hh"
+#include "vocabulary_tree_quantizer.hh"
+
+
+//! magic number identifying a binary vocabulary file (stored in its trailer)
+#define VOCABULARY_TREE_MAGIC "ACGVOCTR"
+
+//! current version of the binary vocabulary file format
+#define VOCABULARY_TREE_VERSION 1
+
+//! minimal number of descriptors searched by every thread when assigning visual words with flann
+#define VW_MIN_DESCRIPTORS_PER_THREAD 256
+
+//! number of descriptors respectively cluster centers whose dot products are computed by a single
+//! matrix multiplication in the linear search
+#define VW_LINEAR_DESCRIPTOR_BLOCK 128
+#define VW_LINEAR_WORD_BLOCK 1024
+
+/**
+ * Trailer of a binary vocabulary file as written by visual_words_handler::save_vocabulary.
+ * The file starts with the FLANN index (FLANN header + tree, exactly as written by flann::Index::save,
+ * so that it can be loaded with flann::SavedIndexParams), followed by the cluster centers 
+ * (nb_visual_words * 128 floats), the parent tables (for every stored level an int holding the level, 
+ * followed by nb_visual_words ints) and finally this trailer. Offsets are given in bytes from the 
+ * beginning of the file.
+**/
+struct vocabulary_tree_trailer
+{
+  uint64_t centers_offset;
+  uint64_t parents_offset;
+  uint32_t version;
+  uint32_t flann_index_type;
+  uint32_t nb_visual_words;
+  uint32_t branching;
+  uint32_t nb_trees;
+  uint32_t nb_parent_levels;
+  char magic[8];
+};
+
 
 class visual_words_handler
 {
@@ -68,6 +108,9 @@ class visual_words_handler
     //! specifies the number of paths to check
     void set_nb_paths( int nb_path );
     
+    //! specifies the number of threads used for a single flann search (default 1). The results do not depend on it.
+    void set_nb_threads( int nb_threads );
+    
     //! specifies the type of the flann index (call before creating a new one): "hkmeans", "randomkd" (default), "auto".
     void set_flann_type( const std::string &type );
     
@@ -114,18 +157,52 @@ class visual_words_handler
     //! (re-)builds the flann index
     void rebuild_flann_index();
     
-    //! creates a new search index for flann, returns false if index could not be constructed
+    /**
+     * creates a new search index for flann, returns false if index could not be constructed.
+     * cluster_file can either be a text file containing the cluster centers or a binary vocabulary file 
+     * written by save_vocabulary, in which case the stored index is loaded instead of built.
+    **/
     bool create_flann_search_index( std::string &cluster_file );
     bool create_flann_search_index( std::vector< float > &cluster_centers );
     
-    //! if using a vocabulary tree (flann & hkmeans), get the cluster center ids of the parents at level L for all leaves  
+    /**
+     * Saves the cluster centers, the current flann index and (for vocabulary trees) the parents of all
+     * leaves at levels 2 and 3 into a single binary file (see vocabulary_tree_trailer). 
+     * The index has to be created before. Returns false if the file could not be written.
+    **/
+    bool save_vocabulary( const std::string &filename );
+    
+    /**
+     * Loads a binary vocabulary file written by save_vocabulary. The number of visual words stored in the file
+     * has to match the number of visual words set. If the stored index is not of the type specified by set_flann_type,
+     * a new index of that type is built from the stored cluster centers. Returns false if the file could not be loaded.
+    **/
+    bool load_vocabulary( const std::string &filename );
+    
+    //! returns true if the file is a binary vocabulary file written by save_vocabulary
+    static bool is_vocabulary_file( const std::string &filename );
+    
+    /**
+     * If using a vocabulary tree (flann & hkmeans), get the cluster center ids of the parents at level L for all leaves.
+     * Parent tables loaded from a vocabulary file are returned directly, otherwise they are computed from the tree.
+    **/
     void get_parents_at_level_L( int L, int* &ids );
 
     //! assign visual words using the method defined by set_method and stores them in assignments. Returns false if assignments could not be computed
     bool assign_visual_words_uchar( std::vector< unsigned char > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments );
+    //! same as above for nb_descriptors descriptors stored contiguously (128 unsigned chars each), e.g., by SIFT_loader
+    bool assign_visual_words_uchar( const unsigned char *descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments );
     bool assign_visual_words_ucharv( std::vector< unsigned char* > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments );
     bool assign_visual_words_float( std::vector< float > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments );
     
+    /**
+     * assigns visual words to the descriptors of several queries in a single call, using the method defined by set_method.
+     * The assignments of the i-th query are stored in assignments[offsets[i]] to assignments[offsets[i+1]-1], i.e., offsets
+     * has queries.size()+1 entries. The descriptors of all queries are searched together and split across the threads
+     * set by set_nb_threads, the internal arrays are resized at most once. Returns false if assignments could not be computed.
+    **/
+    bool assign_visual_words_batch( const std::vector< SIFT_descriptor_view > &queries, std::vector< uint32_t > &assignments, std::vector< uint32_t > &offsets );
+    
     /** 
      * assign visual words using the method defined by set_method and stores them in assignments. Returns false if assignments could not be computed.
      * Also returns the squared distances to the cluster centers.
@@ -138,6 +215,7 @@ class visual_words_handler
      * the first k entries belong to the first query point (k being set by set_nb_nearest_neighbors).
      **/
     bool k_nn_search_flann_uchar( std::vector< unsigned char > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments, std::vector< float > &distances );
+    bool k_nn_search_flann_uchar( const unsigned char *descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments, std::vector< float > &distances );
     bool k_nn_search_flann_ucharv( std::vector< unsigned char* > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments, std::vector< float > &distances );
     bool k_nn_search_flann_float( std::vector< float > &descriptors, uint32_t nb_descriptors, std::vector< uint32_t > &assignments, std::vector< float > &distances );
     
@@ -161,9 +239,33 @@ class visual_words_handler
     //! resize the datastructures to contain feature and assignment information
     void resize( uint32_t nb_descriptors );
     
+    //! searches the knn nearest neighbors of all descriptors in mFlannFeatures with up to mNbThreads threads
+    void search_flann( flann::Matrix< int > &indices, flann::Matrix< float > &distances, int knn );
+    
+    //! flattens the current flann index into mQuantizer if it is a vocabulary tree (hierarchical k-means)
+    void build_quantizer( );
+    
+    //! returns true if unsigned char descriptors are assigned with mQuantizer instead of flann,
+    //! i.e., for a vocabulary tree that is searched along a single path
+    bool use_quantizer( ) const { return mMethod == 2 && mNbPath == 1 && mQuantizer.is_built(); }
+    
+    //! computes the squared lengths of all cluster centers, needed by linear_search
+    void update_center_norms( );
+    
+    /**
+     * assigns nb_descriptors descriptors to their nearest cluster centers by an exhaustive search, where
+     * get_descriptor( i, vec ) stores the i-th descriptor as floats in vec. The squared distances
+     * ||a||^2 + ||c||^2 - 2 a.c to all centers c are computed blockwise with a matrix multiplication (sgemm).
+     * The squared distances to the assigned centers are stored in distances unless it is 0.
+    **/
+    void linear_search( uint32_t nb_descriptors, const std::function< void ( uint32_t, float* ) > &get_descriptor, uint32_t *assignments, float *distances );
+    
     //! initialize the datastructures to contain feature and assignment information
     void initialize();
     
+    //! release the flann index and the parent tables belonging to it
+    void clear_index();
+    
     
     //! the method to use: 0 (linear search), 2 (flann, default)
     int mMethod;
@@ -174,6 +276,15 @@ class visual_words_handler
 	//! the search index for flann
 	flann::Index< flann::L2< float > > *mFlannIndex;
 	
+	//! the vocabulary tree flattened for the assignment of unsigned char descriptors
+	vocabulary_tree_quantizer mQuantizer;
+	
+	//! squared lengths of the cluster centers, used by the linear search
+	std::vector< float > mCenterNorms;
+	
+	//! parent tables (level, parent id for every visual word) loaded from a vocabulary file
+	std::vector< std::pair< int, std::vector< int > > > mParentsAtLevel;
+	
 	//! FLANN:: datastructure for feature data
 	flann::Matrix< float > mFlannFeatures;
 	
@@ -195,6 +306,9 @@ class visual_words_handler
     //! number of paths (default 1)
     int mNbPath;
     
+    //! number of threads used for a single flann search (default 1)
+    int mNbThreads;
+    
     //! branching of the hierarchical k-means tree (default: 10)
     int mBranching;
     
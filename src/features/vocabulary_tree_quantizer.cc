@@ -0,0 +1,201 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+#include <iostream>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+#include <stdlib.h>
+
+#include "vocabulary_tree_quantizer.hh"
+#include "SIFT_distance.hh"
+
+
+//! alignment (in bytes) of the arrays containing the centers
+#define VOCABULARY_TREE_QUANTIZER_ALIGNMENT 64
+
+// allocates an aligned array of nb_centers * 128 floats, returns 0 if the memory could not be allocated
+static float* allocate_centers( size_t nb_centers )
+{
+  void *data = 0;
+  if( posix_memalign( &data, VOCABULARY_TREE_QUANTIZER_ALIGNMENT, 128 * sizeof( float ) * std::max( nb_centers, (size_t) 1 ) ) != 0 )
+    return 0;
+  return (float*) data;
+}
+
+//---------------------------------------------------
+
+vocabulary_tree_quantizer::vocabulary_tree_quantizer( )
+{
+  mBranching = 0;
+  mNodeCenters = 0;
+  mWordCenters = 0;
+}
+
+//---------------------------------------------------
+
+vocabulary_tree_quantizer::~vocabulary_tree_quantizer( )
+{
+  clear();
+}
+
+//---------------------------------------------------
+
+void vocabulary_tree_quantizer::clear( )
+{
+  mBranching = 0;
+  mFirstChild.clear();
+  mLeafOffsets.clear();
+  mLeafWords.clear();
+  
+  if( mNodeCenters != 0 )
+    free( mNodeCenters );
+  mNodeCenters = 0;
+  
+  if( mWordCenters != 0 )
+    free( mWordCenters );
+  mWordCenters = 0;
+}
+
+//---------------------------------------------------
+
+bool vocabulary_tree_quantizer::build( const flann::KMeansIndex< flann::L2< float > > &tree, const float *word_centers, uint32_t nb_visual_words )
+{
+  clear();
+  
+  int branching, dimension, nb_nodes;
+  std::vector< float > pivots;
+  std::vector< int > children, leaf_ids, leaf_indices;
+  tree.getTreeNodes( branching, dimension, nb_nodes, pivots, children, leaf_ids, leaf_indices );
+  
+  if( dimension != 128 || nb_nodes <= 0 || branching <= 1 )
+    return false;
+  
+  ////
+  // collect the visual words stored in the leaves. Every visual word has to be found exactly once
+  // and every leaf has to contain at least one word, otherwise the tree cannot be used
+  std::vector< int > first_child( children.begin(), children.begin() + nb_nodes );
+  std::vector< uint32_t > leaf_offsets( nb_nodes + 1, 0 );
+  std::vector< uint32_t > leaf_words;
+  leaf_words.reserve( nb_visual_words );
+  std::vector< bool > found( nb_visual_words, false );
+  
+  bool valid = true;
+  for( int i=0; i<nb_nodes && valid; ++i )
+  {
+    leaf_offsets[i] = (uint32_t) leaf_words.size();
+    
+    if( first_child[i] >= 0 )
+    {
+      valid = ( first_child[i] + branching <= nb_nodes );
+      continue;
+    }
+    
+    for( int j=0; j<branching; ++j )
+    {
+      int word = leaf_indices[ leaf_ids[i] * branching + j ];
+      if( word < 0 )
+        break;
+      if( (uint32_t) word >= nb_visual_words || found[word] )
+      {
+        valid = false;
+        break;
+      }
+      found[word] = true;
+      leaf_words.push_back( (uint32_t) word );
+    }
+    
+    valid = valid && ( leaf_words.size() > leaf_offsets[i] );
+  }
+  leaf_offsets[nb_nodes] = (uint32_t) leaf_words.size();
+  
+  if( !valid || leaf_words.size() != (size_t) nb_visual_words )
+  {
+    std::cerr << "[Vocabulary_Tree_Quantizer]: WARNING: The tree cannot be flattened, its leaves do not contain every visual word exactly once " << std::endl;
+    return false;
+  }
+  
+  ////
+  // copy the centers into aligned arrays
+  mNodeCenters = allocate_centers( nb_nodes );
+  mWordCenters = allocate_centers( nb_visual_words );
+  if( mNodeCenters == 0 || mWordCenters == 0 )
+  {
+    std::cerr << "[Vocabulary_Tree_Quantizer]: ERROR: Could not allocate memory for the centers " << std::endl;
+    clear();
+    return false;
+  }
+  
+  memcpy( mNodeCenters, &pivots[0], sizeof( float ) * 128 * (size_t) nb_nodes );
+  for( uint32_t i=0; i<nb_visual_words; ++i )
+    memcpy( mWordCenters + 128 * (size_t) i, word_centers + 128 * (size_t) leaf_words[i], 128 * sizeof( float ) );
+  
+  mBranching = (uint32_t) branching;
+  mFirstChild.swap( first_child );
+  mLeafOffsets.swap( leaf_offsets );
+  mLeafWords.swap( leaf_words );
+  
+  return true;
+}
+
+//---------------------------------------------------
+
+uint32_t vocabulary_tree_quantizer::quantize( const unsigned char *descriptor, float &distance ) const
+{
+  // descend to the closest child until a leaf is reached, the first child wins ties as in FLANN
+  uint32_t node = 0;
+  while( mFirstChild[node] >= 0 )
+  {
+    uint32_t child = (uint32_t) mFirstChild[node];
+    const float *center = mNodeCenters + 128 * (size_t) child;
+    
+    node = child;
+    float best_dist = compute_squared_SIFT_dist_float( descriptor, center );
+    for( uint32_t i=1; i<mBranching; ++i )
+    {
+      center += 128;
+      float dist = compute_squared_SIFT_dist_float( descriptor, center );
+      if( dist < best_dist )
+      {
+        best_dist = dist;
+        node = child + i;
+      }
+    }
+  }
+  
+  // find the closest visual word in the leaf
+  uint32_t best_word = mLeafOffsets[node];
+  distance = FLT_MAX;
+  for( uint32_t i=mLeafOffsets[node]; i<mLeafOffsets[node+1]; ++i )
+  {
+    float dist = compute_squared_SIFT_dist_float( descriptor, mWordCenters + 128 * (size_t) i );
+    if( dist < distance )
+    {
+      distance = dist;
+      best_word = i;
+    }
+  }
+  
+  return mLeafWords[best_word];
+}
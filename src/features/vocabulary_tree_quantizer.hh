@@ -0,0 +1,97 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+#ifndef VOCABULARY_TREE_QUANTIZER_HH
+#define VOCABULARY_TREE_QUANTIZER_HH
+
+/**
+ *    Class to assign SIFT descriptors (stored as unsigned chars) to the visual words
+ *    of a vocabulary tree (a hierarchical k-means tree built by FLANN) without
+ *    converting them to floats first.
+ *
+ *    The tree is flattened in breadth first order, such that the children of a node
+ *    are stored next to each other. The centers of the nodes and of the visual words
+ *    (stored in the order of the leaves) are kept in 64 byte aligned arrays of floats
+ *    and compared to the descriptors with the SIMD distance functions of SIFT_distance.hh.
+ *
+ *    The search descends to the closest child on every level and returns the closest
+ *    visual word in the leaf reached, i.e., it follows the same path as FLANN when
+ *    searching a single path (checks = 1). The results only differ from FLANN if two
+ *    distances are equal up to the order of the floating point summation.
+**/ 
+
+#include <vector>
+#include <stdint.h>
+
+#include <flann/flann.hpp>
+
+
+class vocabulary_tree_quantizer
+{
+  public:
+    //! constructor
+    vocabulary_tree_quantizer( );
+    
+    //! destructor
+    ~vocabulary_tree_quantizer( );
+    
+    /**
+     * Flattens a hierarchical k-means tree built on the nb_visual_words cluster centers word_centers
+     * (nb_visual_words * 128 floats). Returns false (and leaves the quantizer empty) if the tree
+     * does not contain every visual word in exactly one of its leaves.
+    **/
+    bool build( const flann::KMeansIndex< flann::L2< float > > &tree, const float *word_centers, uint32_t nb_visual_words );
+    
+    //! releases all data
+    void clear( );
+    
+    //! returns true if a tree has been flattened
+    bool is_built( ) const { return !mFirstChild.empty(); }
+    
+    //! returns the visual word of a descriptor (128 unsigned chars) and its squared distance to the word
+    uint32_t quantize( const unsigned char *descriptor, float &distance ) const;
+    
+  private:
+    
+    //! the branching factor of the tree
+    uint32_t mBranching;
+    
+    //! for every node (in breadth first order) the id of its first child, or -1 for leaves
+    std::vector< int > mFirstChild;
+    
+    //! for every node the range [mLeafOffsets[i], mLeafOffsets[i+1]) of its visual words in mLeafWords (empty for inner nodes)
+    std::vector< uint32_t > mLeafOffsets;
+    
+    //! the ids of the visual words, ordered by the leaves
+    std::vector< uint32_t > mLeafWords;
+    
+    //! the centers of all nodes (128 floats each, in breadth first order)
+    float *mNodeCenters;
+    
+    //! the centers of the visual words, in the same order as mLeafWords
+    float *mWordCenters;
+};
+
+
+#endif
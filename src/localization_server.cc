@@ -0,0 +1,217 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "localization_server.hh"
+
+
+// reads exactly size bytes, returns false if the connection was closed or an error occured
+static bool read_fully( int fd, void *data, size_t size )
+{
+  char *ptr = (char*) data;
+  while( size > 0 )
+  {
+    ssize_t n = read( fd, ptr, size );
+    if( n < 0 && errno == EINTR )
+      continue;
+    if( n <= 0 )
+      return false;
+    ptr += n;
+    size -= (size_t) n;
+  }
+  return true;
+}
+
+//---------------------------------------------------
+
+// writes exactly size bytes, returns false if the connection was closed or an error occured
+static bool write_fully( int fd, const void *data, size_t size )
+{
+  const char *ptr = (const char*) data;
+  while( size > 0 )
+  {
+    // MSG_NOSIGNAL: do not get killed by SIGPIPE if the client is gone
+    ssize_t n = send( fd, ptr, size, MSG_NOSIGNAL );
+    if( n < 0 && errno == EINTR )
+      continue;
+    if( n <= 0 )
+      return false;
+    ptr += n;
+    size -= (size_t) n;
+  }
+  return true;
+}
+
+//---------------------------------------------------
+
+// answers the requests of a single client until it closes the connection
+static void serve_connection( int fd, const localization_function &localize )
+{
+  localization_request_header header;
+  std::vector< localization_request_feature > features;
+  std::vector< unsigned char > descriptors;
+
+  while( read_fully( fd, &header, sizeof( localization_request_header ) ) )
+  {
+    localization_response response;
+    memset( &response, 0, sizeof( localization_response ) );
+    response.magic = LOCALIZATION_SERVER_MAGIC;
+
+    if( header.magic != LOCALIZATION_SERVER_MAGIC || header.nb_features > LOCALIZATION_SERVER_MAX_FEATURES || header.image_width == 0 || header.image_height == 0 )
+    {
+      std::cerr << " ERROR: Received a malformed request, closing the connection " << std::endl;
+      response.status = LOC_SERVER_BAD_REQUEST;
+      write_fully( fd, &response, sizeof( localization_response ) );
+      break;
+    }
+
+    features.resize( header.nb_features );
+    if( header.nb_features > 0 && !read_fully( fd, &features[0], sizeof( localization_request_feature ) * header.nb_features ) )
+      break;
+
+    // convert the features into the representation used by SIFT_loader, the descriptors are stored contiguously
+    std::vector< SIFT_keypoint > keypoints( header.nb_features );
+    descriptors.resize( 128 * (size_t) std::max( header.nb_features, 1u ) );
+    for( uint32_t i=0; i<header.nb_features; ++i )
+    {
+      keypoints[i] = SIFT_keypoint( features[i].x, features[i].y, features[i].scale, features[i].orientation );
+      memcpy( &descriptors[128 * (size_t) i], features[i].descriptor, 128 );
+    }
+
+    response.status = LOC_SERVER_OK;
+    response.nb_features = header.nb_features;
+    localize( keypoints, SIFT_descriptor_view( &descriptors[0], header.nb_features ), (int) header.image_width, (int) header.image_height, response );
+
+    if( !write_fully( fd, &response, sizeof( localization_response ) ) )
+      break;
+  }
+
+  close( fd );
+}
+
+//---------------------------------------------------
+
+bool run_localization_server( const std::string &socket_path, uint32_t nb_threads, const localization_function &localize )
+{
+  sockaddr_un address;
+  memset( &address, 0, sizeof( sockaddr_un ) );
+  address.sun_family = AF_UNIX;
+
+  if( socket_path.size() >= sizeof( address.sun_path ) )
+  {
+    std::cerr << " ERROR: The socket path " << socket_path << " is too long " << std::endl;
+    return false;
+  }
+  strcpy( address.sun_path, socket_path.c_str() );
+
+  int server_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if( server_fd < 0 )
+  {
+    std::cerr << " ERROR: Could not create a socket: " << strerror( errno ) << std::endl;
+    return false;
+  }
+
+  // remove the socket of a previous run, but never other files or the socket of a running server
+  struct stat path_stat;
+  if( lstat( socket_path.c_str(), &path_stat ) == 0 )
+  {
+    if( !S_ISSOCK( path_stat.st_mode ) )
+    {
+      std::cerr << " ERROR: " << socket_path << " exists and is not a socket, refusing to remove it " << std::endl;
+      close( server_fd );
+      return false;
+    }
+
+    int probe_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    bool in_use = ( probe_fd >= 0 && connect( probe_fd, (sockaddr*) &address, sizeof( sockaddr_un ) ) == 0 );
+    if( probe_fd >= 0 )
+      close( probe_fd );
+    if( in_use )
+    {
+      std::cerr << " ERROR: Another server is listening on " << socket_path << std::endl;
+      close( server_fd );
+      return false;
+    }
+
+    unlink( socket_path.c_str() );
+  }
+
+  if( bind( server_fd, (sockaddr*) &address, sizeof( sockaddr_un ) ) != 0 || listen( server_fd, 16 ) != 0 )
+  {
+    std::cerr << " ERROR: Could not listen on " << socket_path << ": " << strerror( errno ) << std::endl;
+    close( server_fd );
+    return false;
+  }
+
+  // remember the socket created by this process such that only this one is removed at the end
+  struct stat own_stat;
+  bool own_socket = ( lstat( socket_path.c_str(), &own_stat ) == 0 );
+
+  std::cout << " Waiting for requests on " << socket_path << std::endl;
+
+  // every worker accepts a connection and serves it until the client disconnects
+  auto worker = [&]()
+  {
+    while( true )
+    {
+      int client_fd = accept( server_fd, 0, 0 );
+      if( client_fd < 0 )
+      {
+        if( errno == EINTR || errno == ECONNABORTED )
+          continue;
+        std::cerr << " ERROR: Could not accept a connection: " << strerror( errno ) << std::endl;
+        break;
+      }
+      serve_connection( client_fd, localize );
+    }
+  };
+
+  if( nb_threads <= 1 )
+    worker();
+  else
+  {
+    std::vector< std::thread > workers;
+    for( uint32_t t=0; t<nb_threads; ++t )
+      workers.push_back( std::thread( worker ) );
+    for( uint32_t t=0; t<nb_threads; ++t )
+      workers[t].join();
+  }
+
+  close( server_fd );
+
+  // the path might have been replaced in the meantime
+  if( own_socket && lstat( socket_path.c_str(), &path_stat ) == 0 && S_ISSOCK( path_stat.st_mode ) && path_stat.st_dev == own_stat.st_dev && path_stat.st_ino == own_stat.st_ino )
+    unlink( socket_path.c_str() );
+  return true;
+}
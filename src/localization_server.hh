@@ -0,0 +1,122 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+
+#ifndef LOCALIZATION_SERVER_HH
+#define LOCALIZATION_SERVER_HH
+
+/**
+ *    A simple server that accepts localization requests over a Unix domain
+ *    socket, such that a localization method can load its model once and
+ *    answer queries for a long time.
+ *
+ *    A client connects to the socket and sends any number of requests over
+ *    the same connection, every request is answered by exactly one response.
+ *    All values are sent in the byte order of the machine (client and server
+ *    run on the same machine). A request consists of
+ *
+ *      localization_request_header
+ *      nb_features * localization_request_feature
+ *
+ *    where the keypoint positions are given in pixels in the coordinate system
+ *    of the image (origin in the upper left corner, as in the .key files).
+ *    The answer is a single localization_response. If the request is malformed,
+ *    the status of the response is set to LOC_SERVER_BAD_REQUEST and the
+ *    connection is closed.
+**/
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+#include "features/SIFT_keypoint.hh"
+
+
+//! magic number at the beginning of every request and response ("ACGL")
+#define LOCALIZATION_SERVER_MAGIC 0x4c474341u
+
+//! maximal number of features accepted in a single request
+#define LOCALIZATION_SERVER_MAX_FEATURES 1000000u
+
+//! status of a response. LOC_SERVER_DEADLINE_REACHED is a valid answer, but the localization was stopped
+//! at the end of its latency budget and the response contains the best pose found so far.
+enum LOCALIZATION_SERVER_STATUS{ LOC_SERVER_OK = 0, LOC_SERVER_BAD_REQUEST = 1, LOC_SERVER_DEADLINE_REACHED = 2 };
+
+//! header of a request
+struct localization_request_header
+{
+  uint32_t magic;
+  uint32_t nb_features;
+  uint32_t image_width;
+  uint32_t image_height;
+};
+
+//! a single feature of a request (144 bytes)
+struct localization_request_feature
+{
+  float x;
+  float y;
+  float scale;
+  float orientation;
+  unsigned char descriptor[128];
+};
+
+//! the answer to a request. The image is registered if at least 12 inliers were found, in this case
+//! the projection matrix (3x4, row major) maps the 3D points to the centered image coordinate system,
+//! i.e., the origin is the center of the image and the y-axis points upwards.
+//! All timings are given in seconds.
+struct localization_response
+{
+  uint32_t magic;
+  uint32_t status;
+  uint32_t nb_features;
+  uint32_t nb_corr;
+  uint32_t nb_inlier;
+  uint32_t registered;
+  double projection_matrix[12];
+  double calibration[9];
+  double rotation[9];
+  double position[3];
+  double vw_time;
+  double corr_time;
+  double RANSAC_time;
+  double total_time;
+};
+
+//! Localizes the features of a single request and fills in the response (except for magic and status).
+//! The keypoints are given in the coordinate system of the image and may be modified.
+typedef std::function< void ( std::vector< SIFT_keypoint > &, const SIFT_descriptor_view &, int, int, localization_response & ) > localization_function;
+
+/**
+ * Listens on the Unix domain socket socket_path and answers requests by calling localize. A stale socket
+ * of that name is removed, any other existing file (or the socket of a running server) is left untouched
+ * and the server does not start. Up to nb_threads connections are served in parallel, the requests of
+ * a single connection are handled one after another.
+ * Returns false if the socket could not be created, otherwise it only returns if no more connections
+ * can be accepted.
+**/
+bool run_localization_server( const std::string &socket_path, uint32_t nb_threads, const localization_function &localize );
+
+#endif
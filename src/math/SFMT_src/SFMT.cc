@@ -67,20 +67,22 @@ typedef struct W128_T w128_t;
 /*--------------------------------------
   FILE GLOBAL VARIABLES
   internal state, index counter and flag 
+  (ACG Localizer: the state is kept per thread such that 
+  several threads can generate random numbers concurrently)
   --------------------------------------*/
 /** the 128-bit internal state array */
-static w128_t sfmt[N];
+static thread_local w128_t sfmt[N];
 /** the 32bit integer pointer to the 128-bit internal state array */
-static uint32_t *psfmt32 = &sfmt[0].u[0];
+#define psfmt32 (&sfmt[0].u[0])
 #if !defined(BIG_ENDIAN64) || defined(ONLY64)
 /** the 64bit integer pointer to the 128-bit internal state array */
-static uint64_t *psfmt64 = (uint64_t *)&sfmt[0].u[0];
+#define psfmt64 ((uint64_t *)&sfmt[0].u[0])
 #endif
 /** index counter to the 32-bit internal state array */
-static int idx;
+static thread_local int idx;
 /** a flag: it is 0 if and only if the internal state is not yet
  * initialized. */
-static int initialized = 0;
+static thread_local int initialized = 0;
 /** a parity check vector which certificate the period of 2^{MEXP} */
 static uint32_t parity[4] = {PARITY1, PARITY2, PARITY3, PARITY4};
 
@@ -131,14 +131,14 @@ extern "C" {
 
 
 //! Module-wide pointer to working array
-double * p_work_double = 0;
-float * p_work_float = 0;
-long int * p_work_longint = 0;
+thread_local double * p_work_double = 0;
+thread_local float * p_work_float = 0;
+thread_local long int * p_work_longint = 0;
 
 //! Module-wide size of working array
-int m_workSize_double = 0;
-int m_workSize_float = 0;
-int m_workSize_longint = 0;
+thread_local int m_workSize_double = 0;
+thread_local int m_workSize_float = 0;
+thread_local int m_workSize_longint = 0;
 
 
 
@@ -160,6 +160,14 @@ void FreeWorkingArray( void )
     m_workSize_longint = 0;
 }
 
+//! Releases the working arrays of a thread when the thread terminates
+struct working_array_guard
+{
+    ~working_array_guard( ) { FreeWorkingArray(); }
+};
+
+static thread_local working_array_guard g_working_array_guard;
+
 
 
 
@@ -206,6 +214,7 @@ bool SVD( Matrix & _mat_A, Matrix & _mat_U,
 	
 	m_workSize_double = (long int) size;
 	p_work_double = new double[ m_workSize_double ];
+	(void) &g_working_array_guard; // release the array when the thread terminates
     }
     lwork = m_workSize_double;
 
@@ -258,6 +267,7 @@ bool SVD_V( Matrix & _mat_A, Matrix & _mat_VT )
 		  delete [] p_work_double;
 	  m_workSize_double = (long int) size;
 	  p_work_double = new double[ m_workSize_double ];
+	  (void) &g_working_array_guard; // release the array when the thread terminates
     }
     lwork = m_workSize_double;
 
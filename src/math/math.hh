@@ -64,15 +64,15 @@ namespace Math {
 
 
 
-//! Module-wide pointer to working array
-extern double * p_work_double;
-extern float * p_work_float;
-extern long int * p_work_longint;
+//! Module-wide pointer to working array (one per thread)
+extern thread_local double * p_work_double;
+extern thread_local float * p_work_float;
+extern thread_local long int * p_work_longint;
 
-//! Module-wide size of working array
-extern int m_workSize_double;
-extern int m_workSize_float;
-extern int m_workSize_longint;
+//! Module-wide size of working array (one per thread)
+extern thread_local int m_workSize_double;
+extern thread_local int m_workSize_float;
+extern thread_local int m_workSize_longint;
 
 
 
@@ -99,7 +99,7 @@ typedef gmm::dense_matrix< float > MatrixSinglePrecision;
 /////////////////////////////////////////////////////////
 // module functions
 
-//! Function to free memory of working array
+//! Function to free memory of working array of the calling thread
 void FreeWorkingArray( void );
 
 
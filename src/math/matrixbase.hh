@@ -378,11 +378,12 @@ public:
     //! Invert matrix
     bool invert( void )
     {
-	  static double work[ 100 ];
-	  static long int lwork = 100;
-	  static long int ipiv[ DIM ];
-	  static long int info = 0;
-	  static long int n = DIM;
+	  // local workspace, such that matrices can be inverted in parallel threads
+	  double work[ 100 ];
+	  long int lwork = 100;
+	  long int ipiv[ DIM ];
+	  long int info = 0;
+	  long int n = DIM;
 
 	  dgetrf_( &n, &n, Base::mp_data, &n, ipiv, &info );
 
@@ -0,0 +1,164 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "query_processing.hh"
+
+
+bool extract_option( int &argc, char **argv, const std::string &name, std::string &value )
+{
+  for( int i=1; i+1<argc; ++i )
+  {
+    if( name == argv[i] )
+    {
+      value = argv[i+1];
+      for( int j=i+2; j<argc; ++j )
+        argv[j-2] = argv[j];
+      argc -= 2;
+      return true;
+    }
+  }
+  return false;
+}
+
+//---------------------------------------------------
+
+void process_queries( uint32_t nb_queries, uint32_t nb_threads, const query_function &process, const result_function &finish )
+{
+  if( nb_threads <= 1 || nb_queries <= 1 )
+  {
+    for( uint32_t i=0; i<nb_queries; ++i )
+    {
+      process( i, 0 );
+      finish( i );
+    }
+    return;
+  }
+
+  if( nb_threads > nb_queries )
+    nb_threads = nb_queries;
+
+  // the queries are handed out in the order of the list, every worker takes the next
+  // unprocessed query as soon as it is done with its current one
+  std::mutex mutex;
+  std::condition_variable query_done;
+  std::vector< bool > done( nb_queries, false );
+  uint32_t next_query = 0;
+
+  std::vector< std::thread > workers;
+  for( uint32_t t=0; t<nb_threads; ++t )
+  {
+    workers.push_back( std::thread( [&, t]()
+    {
+      while( true )
+      {
+        uint32_t i;
+        {
+          std::lock_guard< std::mutex > lock( mutex );
+          if( next_query >= nb_queries )
+            break;
+          i = next_query++;
+        }
+
+        process( i, t );
+
+        {
+          std::lock_guard< std::mutex > lock( mutex );
+          done[i] = true;
+        }
+        query_done.notify_all();
+      }
+    } ) );
+  }
+
+  // hand the results back in the order of the queries
+  for( uint32_t i=0; i<nb_queries; ++i )
+  {
+    {
+      std::unique_lock< std::mutex > lock( mutex );
+      while( !done[i] )
+        query_done.wait( lock );
+    }
+    finish( i );
+  }
+
+  for( uint32_t t=0; t<nb_threads; ++t )
+    workers[t].join();
+}
+
+//---------------------------------------------------
+
+latency_budget::latency_budget( double budget, double RANSAC_share )
+  : mSearchChecker( Deadline() )
+{
+  mSearchBudget = 0.0;
+  mLastSearchCheck = 0.0;
+  mSearchScale = 1.0;
+  mSearchDeadlineReached = false;
+  if( budget <= 0.0 )
+    return;
+  
+  mDeadline = Deadline::FromNow( budget );
+  mSearchBudget = budget * ( 1.0 - RANSAC_share );
+  mSearchDeadline = Deadline( mDeadline.GetTime() - budget * RANSAC_share );
+  mSearchChecker = DeadlineChecker( mSearchDeadline );
+  mLastSearchCheck = mSearchChecker.GetLastCheck();
+}
+
+//---------------------------------------------------
+
+bool latency_budget::search_time_left( )
+{
+  if( !is_set() )
+    return true;
+  
+  if( mSearchChecker.Expired() )
+  {
+    mSearchDeadlineReached = true;
+    mSearchScale = 0.0;
+    return false;
+  }
+  
+  // the scale only changes when the checker has read the clock
+  double now = mSearchChecker.GetLastCheck();
+  if( now != mLastSearchCheck )
+  {
+    mLastSearchCheck = now;
+    mSearchScale = std::max( 0.0, std::min( 1.0, 2.0 * ( mSearchDeadline.GetTime() - now ) / mSearchBudget ) );
+  }
+  
+  return true;
+}
+
+//---------------------------------------------------
+
+size_t latency_budget::scale_search_effort( size_t max_effort, size_t min_effort ) const
+{
+  return std::min( max_effort, std::max( min_effort, size_t( mSearchScale * double( max_effort ) ) ) );
+}
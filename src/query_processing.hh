@@ -0,0 +1,118 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+
+#ifndef QUERY_PROCESSING_HH
+#define QUERY_PROCESSING_HH
+
+/**
+ *    Helper functions shared by the localization methods: parsing of optional
+ *    command line arguments ("--name value"), the processing of a list of
+ *    query images by a pool of worker threads and the latency budget of a
+ *    single query. The workers only share the (read-only) model, the results
+ *    of the queries are handed back to the calling thread in the order of the
+ *    query list.
+**/
+
+#include <string>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "timer.hh"
+
+
+/**
+ * Looks for the option "name value" (e.g., "--threads 8") in the command line arguments. If it
+ * is found, its value is stored in value and both entries are removed from argv (argc is
+ * decreased accordingly), such that the remaining positional arguments can be parsed as before.
+ * Returns false if the option is not present.
+**/
+bool extract_option( int &argc, char **argv, const std::string &name, std::string &value );
+
+//! processes the query with the given id, the second parameter is the id of the calling thread (in [0, nb_threads) )
+typedef std::function< void ( uint32_t, uint32_t ) > query_function;
+
+//! handles the result of the query with the given id
+typedef std::function< void ( uint32_t ) > result_function;
+
+/**
+ * Calls process( i, thread_id ) for all queries 0 <= i < nb_queries using nb_threads worker threads
+ * and finish( i ) from the calling thread in increasing order of i, as soon as the queries 0, ..., i
+ * have been processed. For nb_threads <= 1, no threads are created and both functions are called
+ * alternately, i.e., the queries are handled exactly as in a sequential loop.
+**/
+void process_queries( uint32_t nb_queries, uint32_t nb_threads, const query_function &process, const result_function &finish );
+
+/**
+ * The latency budget of a single query. All stages of the localization (visual word assignment,
+ * correspondence search and RANSAC) work towards the same deadline, which is fixed when the budget
+ * is created. The correspondence search has to leave a share of the budget to RANSAC. Once it has
+ * used up half of its own share, it should reduce its effort (e.g., the number of correspondences
+ * needed for early termination) by the search scale, which decreases linearly to 0 at the end of
+ * its share.
+ * A budget of 0 or less does not limit the query.
+**/
+class latency_budget
+{
+  public:
+    //! constructor, the budget is given in seconds and starts now
+    latency_budget( double budget = 0.0, double RANSAC_share = 0.25 );
+    
+    //! is the query limited at all?
+    bool is_set( ) const { return mDeadline.IsSet(); }
+    
+    //! the deadline of the whole query, used by RANSAC
+    const Deadline& get_deadline( ) const { return mDeadline; }
+    
+    //! the deadline of the correspondence search
+    const Deadline& get_search_deadline( ) const { return mSearchDeadline; }
+    
+    //! call once per step of the correspondence search, returns false once the deadline of the search
+    //! has passed. The clock is only read every few steps (see DeadlineChecker), the search scale is
+    //! updated whenever it is read.
+    bool search_time_left( );
+    
+    //! has search_time_left() found that the deadline of the search has passed?
+    bool search_deadline_reached( ) const { return mSearchDeadlineReached; }
+    
+    //! the search scale in [0,1] at the last time search_time_left() read the clock
+    double get_search_scale( ) const { return mSearchScale; }
+    
+    //! scales an effort of the search (e.g., the number of correspondences for early termination)
+    //! by the search scale, the result lies in [min_effort, max_effort] (0 if max_effort is 0)
+    size_t scale_search_effort( size_t max_effort, size_t min_effort ) const;
+    
+  private:
+    Deadline mDeadline;
+    Deadline mSearchDeadline;
+    double mSearchBudget;
+    
+    DeadlineChecker mSearchChecker;
+    double mLastSearchCheck;
+    double mSearchScale;
+    bool mSearchDeadlineReached;
+};
+
+#endif
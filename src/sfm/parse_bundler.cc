@@ -23,6 +23,7 @@
 \*===========================================================================*/ 
 
 
+#include <cstring>
 #include "parse_bundler.hh"
 
 
@@ -238,7 +239,7 @@ bool parse_bundler::parse_data( const char* bundle_out_filename_, const char* im
     SIFT_loader key_loader;
     key_loader.load_features( keyfilenames[i].c_str(), LOWE );
     
-    std::vector< unsigned char* >& descriptors = key_loader.get_descriptors();
+    SIFT_descriptor_view descriptors = key_loader.get_descriptor_view();
     std::vector< SIFT_keypoint >& keypoints = key_loader.get_keypoints();
         
     // go through the descriptors and store the ones we are interested in
@@ -267,8 +268,7 @@ bool parse_bundler::parse_data( const char* bundle_out_filename_, const char* im
       }
       else
       {
-        for( uint32_t k=0; k<128; ++k )
-          mFeatureInfos[feature_id].descriptors[feature_descriptor_index+k] = descriptors[feature_id_keyfile][k];
+        memcpy( &( mFeatureInfos[feature_id].descriptors[feature_descriptor_index] ), descriptors[feature_id_keyfile], 128 );
     
         // set scale and orientation of the keypoint in the view list
         mFeatureInfos[feature_id].view_list[view_list_id].scale = keypoints[feature_id_keyfile].scale;
@@ -277,17 +277,7 @@ bool parse_bundler::parse_data( const char* bundle_out_filename_, const char* im
     }
     
     // clean up the reserved space
-    uint32_t nb_keys_file = (uint32_t) key_loader.get_nb_features();
-    
-    for( uint32_t j=0; j<nb_keys_file; ++j )
-    {
-      if( descriptors[j] != 0 )
-        delete [] descriptors[j];
-      descriptors[j] = 0;
-    }
-    
-    descriptors.clear();
-    keypoints.clear();
+    key_loader.clear_data();
     
     std::cout << "   " << i+1 << " / " << mNbCameras << std::endl;
   }
@@ -317,16 +307,87 @@ bool parse_bundler::load_from_binary( const char* filename, const int format )
     
   mNbCameras = mNbPoints = 0;
   
+  bundler_info_reader reader;
+  if( !reader.open( filename, format ) )
+    return false;
+  
+  mNbCameras = reader.get_number_of_cameras();
+  mCameras = reader.get_cameras();
+  
+  // load the points
+  mNbPoints = reader.get_number_of_points();
+  mFeatureInfos.resize(mNbPoints);
+  
+  for( uint32_t i=0; i<mNbPoints; ++i )
+  {
+    if( !reader.read_point( mFeatureInfos[i] ) )
+    {
+      std::cerr << "Could only read " << i << " of " << mNbPoints << " points from " << filename << std::endl;
+      return false;
+    }
+  }
+  
+  reader.close();
+  
+  return true;
+}
+
+
+
+
+//------------------------------    
+
+
+void parse_bundler::clear()
+{
+ 
+  mNbCameras = 0;
+  
+  mNbPoints = (uint32_t) mFeatureInfos.size();
+  
+  for( uint32_t i=0; i<mNbPoints; ++i )
+  {
+    mFeatureInfos[i].view_list.clear();
+    mFeatureInfos[i].descriptors.clear();
+  }  
+  mFeatureInfos.clear();
+  
+  mCameras.clear();
+  
+}
+
+
+
+//------------------------------    
+
+bundler_info_reader::bundler_info_reader( )
+{
+  mNbPoints = mNbCameras = mNbReadPoints = 0;
+}
+
+//------------------------------    
+
+bundler_info_reader::~bundler_info_reader( )
+{
+  close();
+}
+
+//------------------------------    
+
+bool bundler_info_reader::open( const char* filename, const int format )
+{
+  close();
+  
   // open file for reading
-  std::ifstream ifs( filename, std::ios::in | std::ios::binary );
-  if ( !ifs )
+  mIfs.open( filename, std::ios::in | std::ios::binary );
+  if ( !mIfs )
   {
     std::cerr << "Cannot read file " << filename << std::endl;
     return false;
   }
   
   // read the number of cameras
-  ifs.read(( char* ) &mNbCameras, sizeof( uint32_t ) );
+  mIfs.read(( char* ) &mNbCameras, sizeof( uint32_t ) );
   
   // depending on the format, cameras will be loaded
   if( format == 1 )
@@ -337,15 +398,15 @@ bool parse_bundler::load_from_binary( const char* filename, const int format )
     {
       double focal_length, kappa_1, kappa_2;
       int32_t width, height;
-      double *rotation = new double[9];
-      double *translation = new double[3];
-      ifs.read( (char* ) &focal_length, sizeof( double ) );
-      ifs.read( (char* ) &kappa_1, sizeof( double ) );
-      ifs.read( (char* ) &kappa_2, sizeof( double ) );
-      ifs.read( (char* ) &width, sizeof( int32_t ) );
-      ifs.read( (char* ) &height, sizeof( int32_t ) );
-      ifs.read( (char* ) rotation, 9*sizeof( double ) );
-      ifs.read( (char* ) translation, 3*sizeof( double ) );
+      double rotation[9];
+      double translation[3];
+      mIfs.read( (char* ) &focal_length, sizeof( double ) );
+      mIfs.read( (char* ) &kappa_1, sizeof( double ) );
+      mIfs.read( (char* ) &kappa_2, sizeof( double ) );
+      mIfs.read( (char* ) &width, sizeof( int32_t ) );
+      mIfs.read( (char* ) &height, sizeof( int32_t ) );
+      mIfs.read( (char* ) rotation, 9*sizeof( double ) );
+      mIfs.read( (char* ) translation, 3*sizeof( double ) );
       
       mCameras[i].focal_length = focal_length;
       mCameras[i].kappa_1 = kappa_1;
@@ -359,81 +420,102 @@ bool parse_bundler::load_from_binary( const char* filename, const int format )
       }
       for( int j=0; j<3; ++j )
         mCameras[i].translation[j] = translation[j];
-      
-      delete [] rotation;
-      delete [] translation;
     }
   }
   
-  // load the points
-  ifs.read(( char* ) &mNbPoints, sizeof( uint32_t ) );
-  mFeatureInfos.resize(mNbPoints);
+  // read the number of points
+  mIfs.read(( char* ) &mNbPoints, sizeof( uint32_t ) );
   
-  for( uint32_t i=0; i<mNbPoints; ++i )
+  if( !mIfs )
   {
-    float *pos = new float[3];
-    ifs.read( (char* ) pos, 3*sizeof( float ) );
-    mFeatureInfos[i].point.x = pos[0];
-    mFeatureInfos[i].point.y = pos[1];
-    mFeatureInfos[i].point.z = pos[2];
-    delete [] pos;
-    pos = 0;
-
-    uint32_t size_view_list=0;
-    ifs.read(( char* ) &size_view_list, sizeof( uint32_t ) );
-    mFeatureInfos[i].view_list.resize(size_view_list);
-    mFeatureInfos[i].descriptors.resize( 128*size_view_list, 0 );
-    
-    unsigned char *desc = new unsigned char[128];
-    for( uint32_t j=0; j<size_view_list; ++j )
-    {
-      float x,y,scale, orientation;
-      uint32_t cam_id;
-      ifs.read( (char* ) &cam_id, sizeof( uint32_t ) );
-      ifs.read( (char* ) &x, sizeof( float ) );
-      ifs.read( (char* ) &y, sizeof( float ) );
-      ifs.read( (char* ) &scale, sizeof( float ) );
-      ifs.read( (char* ) &orientation, sizeof( float ) );
-      mFeatureInfos[i].view_list[j].camera = cam_id;
-      mFeatureInfos[i].view_list[j].x = x;
-      mFeatureInfos[i].view_list[j].y = y;
-      mFeatureInfos[i].view_list[j].scale = scale;
-      mFeatureInfos[i].view_list[j].orientation = orientation;
-      
-      ifs.read( (char* ) desc, 128*sizeof( unsigned char ) );
-      
-      // store the descriptor
-      for( uint32_t k=0; k<128; ++k )
-        mFeatureInfos[i].descriptors[ 128*j+k] = desc[k];
-    }
-    delete [] desc;
+    std::cerr << "Cannot read the header of " << filename << std::endl;
+    close();
+    return false;
   }
   
-  ifs.close();
-  
   return true;
 }
 
+//------------------------------    
 
+uint32_t bundler_info_reader::get_number_of_points( ) const
+{
+  return mNbPoints;
+}
 
+//------------------------------    
+
+uint32_t bundler_info_reader::get_number_of_cameras( ) const
+{
+  return mNbCameras;
+}
 
 //------------------------------    
 
+std::vector< bundler_camera >& bundler_info_reader::get_cameras( )
+{
+  return mCameras;
+}
 
-void parse_bundler::clear()
+//------------------------------    
+
+uint32_t bundler_info_reader::get_number_of_read_points( ) const
 {
- 
-  mNbCameras = 0;
+  return mNbReadPoints;
+}
+
+//------------------------------    
+
+bool bundler_info_reader::read_point( feature_3D_info &info )
+{
+  if( !mIfs.is_open() || mNbReadPoints >= mNbPoints )
+    return false;
   
-  mNbPoints = (uint32_t) mFeatureInfos.size();
+  float pos[3];
+  mIfs.read( (char* ) pos, 3*sizeof( float ) );
+  info.point.x = pos[0];
+  info.point.y = pos[1];
+  info.point.z = pos[2];
+
+  uint32_t size_view_list=0;
+  mIfs.read(( char* ) &size_view_list, sizeof( uint32_t ) );
+  if( !mIfs )
+    return false;
   
-  for( uint32_t i=0; i<mNbPoints; ++i )
+  info.view_list.resize(size_view_list);
+  info.descriptors.resize( 128*size_view_list, 0 );
+  
+  for( uint32_t j=0; j<size_view_list; ++j )
   {
-    mFeatureInfos[i].view_list.clear();
-    mFeatureInfos[i].descriptors.clear();
-  }  
-  mFeatureInfos.clear();
+    float x,y,scale, orientation;
+    uint32_t cam_id;
+    mIfs.read( (char* ) &cam_id, sizeof( uint32_t ) );
+    mIfs.read( (char* ) &x, sizeof( float ) );
+    mIfs.read( (char* ) &y, sizeof( float ) );
+    mIfs.read( (char* ) &scale, sizeof( float ) );
+    mIfs.read( (char* ) &orientation, sizeof( float ) );
+    info.view_list[j].camera = cam_id;
+    info.view_list[j].x = x;
+    info.view_list[j].y = y;
+    info.view_list[j].scale = scale;
+    info.view_list[j].orientation = orientation;
+    
+    // store the descriptor
+    mIfs.read( (char* ) &(info.descriptors[128*j]), 128*sizeof( unsigned char ) );
+  }
   
-  mCameras.clear();
+  if( !mIfs )
+    return false;
   
-}
\ No newline at end of file
+  ++mNbReadPoints;
+  return true;
+}
+
+//------------------------------    
+
+void bundler_info_reader::close( )
+{
+  if( mIfs.is_open() )
+    mIfs.close();
+  mIfs.clear();
+}
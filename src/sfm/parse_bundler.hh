@@ -188,6 +188,54 @@ class feature_3D_info
     }
 };
 
+////////////////////////////
+// Class to read a binary file constructed with Bundle2Info one 3D point
+// after another, such that models that do not fit into memory can be
+// processed. The file format parameter is the same as for 
+// parse_bundler::load_from_binary.
+////////////////////////////
+class bundler_info_reader
+{
+  public:
+    
+    // standard constructor
+    bundler_info_reader( );
+    
+    // standard destructor
+    ~bundler_info_reader( );
+    
+    // Opens the file and reads the cameras (format=1) and the number of 3D points.
+    // Returns false if the file could not be opened.
+    bool open( const char* filename, const int format );
+    
+    // get the number of 3D points in the file
+    uint32_t get_number_of_points( ) const;
+    
+    // get the number of cameras in the file
+    uint32_t get_number_of_cameras( ) const;
+    
+    // get the cameras (only available for format=1)
+    std::vector< bundler_camera >& get_cameras( );
+    
+    // get the number of 3D points read so far
+    uint32_t get_number_of_read_points( ) const;
+    
+    // Reads the next 3D point together with its views and descriptors.
+    // Returns false if all points have been read or the file is truncated.
+    bool read_point( feature_3D_info &info );
+    
+    // close the file
+    void close( );
+    
+  private:
+    
+    std::ifstream mIfs;
+    
+    std::vector< bundler_camera > mCameras;
+    
+    uint32_t mNbPoints, mNbCameras, mNbReadPoints;
+};
+
 ////////////////////////////
 // Class to parse the output files generated by Bundler.
 // The class is able to further load the .key files of all cameras in
@@ -0,0 +1,277 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#include "point_neighborhoods.hh"
+
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <ANN/ANN.h>
+
+// returns true if the two ascendingly sorted lists share an element
+static bool point_neighborhoods_share_element( const uint32_t *a, uint32_t size_a, const uint32_t *b, uint32_t size_b )
+{
+  const uint32_t *a_end = a + size_a;
+  const uint32_t *b_end = b + size_b;
+  
+  while( ( a != a_end ) && ( b != b_end ) )
+  {
+    if( *a < *b )
+      ++a;
+    else if( *b < *a )
+      ++b;
+    else
+      return true;
+  }
+  
+  return false;
+}
+
+//---------------------------------------------------
+
+point_neighborhoods::point_neighborhoods( )
+{
+  clear();
+}
+
+//---------------------------------------------------
+
+point_neighborhoods::~point_neighborhoods( )
+{
+  clear();
+}
+
+//---------------------------------------------------
+
+void point_neighborhoods::clear( )
+{
+  mNbPoints = mNbNeighbors = 0;
+  mFiltered = false;
+  mUseImageSetCover = false;
+  mNbCamsSetCover = 0;
+  mOffsets.assign( 1, 0 );
+  mNeighbors.clear();
+}
+
+//---------------------------------------------------
+
+bool point_neighborhoods::compute( const float *points, uint32_t nb_points, const scene_graph &graph, uint32_t nb_neighbors, bool filter )
+{
+  clear();
+  
+  if( graph.get_nb_points() != nb_points )
+  {
+    std::cerr << " [point_neighborhoods]: ERROR: The scene graph contains " << graph.get_nb_points() << " points instead of " << nb_points << std::endl;
+    return false;
+  }
+  
+  const std::vector< uint32_t > &component_ids = graph.get_component_ids();
+  uint32_t nb_components = graph.get_nb_components();
+  
+  // the kd-trees require the points in double precision
+  std::vector< ANNcoord > points_double( 3 * (size_t) nb_points );
+  for( size_t i=0; i<3*(size_t)nb_points; ++i )
+    points_double[i] = (ANNcoord) points[i];
+  
+  // for every connected component, get its points (in ascending order of their ids)
+  std::vector< std::vector< uint32_t > > points_per_component( nb_components );
+  for( uint32_t i=0; i<nb_points; ++i )
+    points_per_component[ component_ids[i] ].push_back( i );
+  
+  // the neighbors of every point, in the order of the components
+  std::vector< std::vector< uint32_t > > neighbors( nb_points );
+  
+  ANNidxArray indices = new ANNidx[ std::max( nb_neighbors, 1u ) ];
+  ANNdistArray distances = new ANNdist[ std::max( nb_neighbors, 1u ) ];
+  
+  uint64_t nb_entries = 0;
+  
+  for( uint32_t c=0; c<nb_components; ++c )
+  {
+    const std::vector< uint32_t > &component = points_per_component[c];
+    if( component.empty() )
+      continue;
+    
+    ////
+    // build the kd-tree of the component, the same way as acg_localizer_active_search does
+    std::vector< ANNpoint > component_points( component.size() );
+    for( size_t j=0; j<component.size(); ++j )
+      component_points[j] = &(points_double[ 3 * (size_t) component[j] ]);
+    
+    ANNkd_tree *kd_tree = new ANNkd_tree( &(component_points[0]), (int) component.size(), 3 );
+    
+    int N = (int) std::min( (size_t) nb_neighbors, component.size() );
+    
+    for( size_t j=0; j<component.size(); ++j )
+    {
+      uint32_t point = component[j];
+      kd_tree->annkSearch( component_points[j], N, indices, distances );
+      
+      std::vector< uint32_t > &point_neighbors = neighbors[ point ];
+      point_neighbors.reserve( N );
+      for( int k=0; k<N; ++k )
+      {
+        if( indices[k] < 0 )
+          break;
+        
+        uint32_t candidate = component[ indices[k] ];
+        
+        if( filter && !point_neighborhoods_share_element( graph.get_images_for_point( candidate ), graph.get_nb_images_for_point( candidate ), graph.get_images_for_point( point ), graph.get_nb_images_for_point( point ) ) )
+          continue;
+        
+        point_neighbors.push_back( candidate );
+      }
+      nb_entries += point_neighbors.size();
+    }
+    
+    delete kd_tree;
+    kd_tree = 0;
+    
+    std::cout << "\r  " << c+1 << " / " << nb_components << " components done " << std::flush;
+  }
+  std::cout << std::endl;
+  
+  delete [] indices;
+  delete [] distances;
+  
+  ////
+  // copy the neighbors into the compact representation
+  mOffsets.resize( nb_points + 1 );
+  mOffsets[0] = 0;
+  mNeighbors.clear();
+  mNeighbors.reserve( nb_entries );
+  for( uint32_t i=0; i<nb_points; ++i )
+  {
+    mNeighbors.insert( mNeighbors.end(), neighbors[i].begin(), neighbors[i].end() );
+    mOffsets[i+1] = (uint64_t) mNeighbors.size();
+    std::vector< uint32_t >().swap( neighbors[i] );
+  }
+  
+  mNbPoints = nb_points;
+  mNbNeighbors = nb_neighbors;
+  mFiltered = filter;
+  mUseImageSetCover = graph.uses_image_set_cover();
+  mNbCamsSetCover = graph.get_nb_cams_set_cover();
+  
+  return true;
+}
+
+//---------------------------------------------------
+
+bool point_neighborhoods::save( const std::string &filename ) const
+{
+  FILE *fout = fopen( filename.c_str(), "wb" );
+  if( fout == NULL )
+  {
+    std::cerr << " [point_neighborhoods]: ERROR: Cannot write to " << filename << std::endl;
+    return false;
+  }
+  
+  point_neighborhoods_header header;
+  memset( &header, 0, sizeof( point_neighborhoods_header ) );
+  memcpy( header.magic, POINT_NEIGHBORHOODS_MAGIC, 8 );
+  header.version = POINT_NEIGHBORHOODS_VERSION;
+  header.nb_points = mNbPoints;
+  header.nb_neighbors = mNbNeighbors;
+  header.filtered = mFiltered ? 1 : 0;
+  header.use_image_set_cover = mUseImageSetCover ? 1 : 0;
+  header.nb_cams_set_cover = mNbCamsSetCover;
+  header.nb_entries = (uint64_t) mNeighbors.size();
+  
+  fwrite( &header, sizeof( point_neighborhoods_header ), 1, fout );
+  fwrite( &(mOffsets[0]), sizeof( uint64_t ), mNbPoints + 1, fout );
+  if( !mNeighbors.empty() )
+    fwrite( &(mNeighbors[0]), sizeof( uint32_t ), mNeighbors.size(), fout );
+  
+  bool write_ok = ( ferror( fout ) == 0 );
+  if( fclose( fout ) != 0 )
+    write_ok = false;
+  
+  if( !write_ok )
+    std::cerr << " [point_neighborhoods]: ERROR: Could not write " << filename << std::endl;
+  
+  return write_ok;
+}
+
+//---------------------------------------------------
+
+bool point_neighborhoods::load( const std::string &filename )
+{
+  clear();
+  
+  FILE *fin = fopen( filename.c_str(), "rb" );
+  if( fin == NULL )
+  {
+    std::cerr << " [point_neighborhoods]: ERROR: Cannot read from " << filename << std::endl;
+    return false;
+  }
+  
+  point_neighborhoods_header header;
+  if( fread( &header, sizeof( point_neighborhoods_header ), 1, fin ) != 1 || memcmp( header.magic, POINT_NEIGHBORHOODS_MAGIC, 8 ) != 0 )
+  {
+    std::cerr << " [point_neighborhoods]: ERROR: " << filename << " is not a neighborhood file " << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  if( header.version != POINT_NEIGHBORHOODS_VERSION )
+  {
+    std::cerr << " [point_neighborhoods]: ERROR: Unsupported version " << header.version << " of " << filename << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  mOffsets.resize( (size_t) header.nb_points + 1 );
+  mNeighbors.resize( header.nb_entries );
+  
+  bool read_ok = ( fread( &(mOffsets[0]), sizeof( uint64_t ), mOffsets.size(), fin ) == mOffsets.size() );
+  if( read_ok && header.nb_entries > 0 )
+    read_ok = ( fread( &(mNeighbors[0]), sizeof( uint32_t ), mNeighbors.size(), fin ) == mNeighbors.size() );
+  fclose( fin );
+  
+  // make sure that the offsets and the ids are consistent
+  if( read_ok )
+    read_ok = ( mOffsets[0] == 0 && mOffsets[header.nb_points] == header.nb_entries );
+  for( uint32_t i=0; i<header.nb_points && read_ok; ++i )
+    read_ok = ( mOffsets[i] <= mOffsets[i+1] ) && ( mOffsets[i+1] - mOffsets[i] <= header.nb_neighbors );
+  for( uint64_t i=0; i<header.nb_entries && read_ok; ++i )
+    read_ok = ( mNeighbors[i] < header.nb_points );
+  
+  if( !read_ok )
+  {
+    std::cerr << " [point_neighborhoods]: ERROR: " << filename << " is truncated or corrupted " << std::endl;
+    clear();
+    return false;
+  }
+  
+  mNbPoints = header.nb_points;
+  mNbNeighbors = header.nb_neighbors;
+  mFiltered = ( header.filtered != 0 );
+  mUseImageSetCover = ( header.use_image_set_cover != 0 );
+  mNbCamsSetCover = header.nb_cams_set_cover;
+  
+  return true;
+}
@@ -0,0 +1,126 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#ifndef POINT_NEIGHBORHOODS_HH
+#define POINT_NEIGHBORHOODS_HH
+
+/**
+ * The neighborhoods of the 3D points used by active search: For every 3D point,
+ * the ids of its N nearest neighbors (in 3D, including the point itself) from the
+ * same connected component, sorted by their distance to the point. Optionally,
+ * only the neighbors that are visible together with the point in at least one
+ * image (or set cover image) are kept. The neighborhoods only depend on the model,
+ * so they can be computed by compute_point_neighborhoods once and replace the
+ * nearest neighbor search in the kd-trees while localizing images.
+ *
+ * Layout of the binary file:
+ *   header                  (see point_neighborhoods_header)
+ *   neighbor offsets        (nb_points + 1) uint64_t, CSR offsets into the neighbor lists
+ *   neighbor lists          nb_entries uint32_t
+**/
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "scene_graph.hh"
+
+//! magic number at the beginning of every neighborhood file
+#define POINT_NEIGHBORHOODS_MAGIC "ACGPTNBH"
+
+//! current version of the file format
+#define POINT_NEIGHBORHOODS_VERSION 1
+
+//! header of a neighborhood file
+struct point_neighborhoods_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nb_points;
+  uint32_t nb_neighbors;
+  uint32_t filtered;
+  uint32_t use_image_set_cover;
+  uint32_t nb_cams_set_cover;
+  uint64_t nb_entries;
+};
+
+class point_neighborhoods
+{
+  public:
+    //! constructor
+    point_neighborhoods( );
+    
+    //! destructor
+    ~point_neighborhoods( );
+    
+    /**
+     * Computes the nb_neighbors nearest neighbors of all points (given as 3 * nb_points floats) in their
+     * connected component using exact nearest neighbor search. If filter is true, only the neighbors that
+     * share at least one image with the point in the scene graph are kept.
+     * Returns false if the scene graph does not belong to the points.
+    **/
+    bool compute( const float *points, uint32_t nb_points, const scene_graph &graph, uint32_t nb_neighbors, bool filter );
+    
+    //! load the neighborhoods from a binary file. Returns false if the file could not be loaded.
+    bool load( const std::string &filename );
+    
+    //! save the neighborhoods to a binary file. Returns false if the file could not be written.
+    bool save( const std::string &filename ) const;
+    
+    //! release all data
+    void clear( );
+    
+    //! get the number of 3D points
+    uint32_t get_nb_points( ) const { return mNbPoints; }
+    
+    //! get the number of nearest neighbors computed for every point
+    uint32_t get_nb_neighbors( ) const { return mNbNeighbors; }
+    
+    //! returns true if the neighbors were filtered based on co-visibility
+    bool is_filtered( ) const { return mFiltered; }
+    
+    //! returns true if the scene graph used for filtering used the image set cover
+    bool uses_image_set_cover( ) const { return mUseImageSetCover; }
+    
+    //! get the number of nearest cameras considered for the set cover of the scene graph used for filtering
+    uint32_t get_nb_cams_set_cover( ) const { return mNbCamsSetCover; }
+    
+    //! get the number of neighbors of a point
+    uint32_t get_nb_neighbors_for_point( uint32_t point ) const { return uint32_t( mOffsets[point+1] - mOffsets[point] ); }
+    
+    //! get the neighbors of a point, sorted ascendingly by their distance to the point
+    const uint32_t* get_neighbors_for_point( uint32_t point ) const { return &(mNeighbors[0]) + mOffsets[point]; }
+    
+  private:
+    uint32_t mNbPoints;
+    uint32_t mNbNeighbors;
+    bool mFiltered;
+    bool mUseImageSetCover;
+    uint32_t mNbCamsSetCover;
+    
+    std::vector< uint64_t > mOffsets;
+    std::vector< uint32_t > mNeighbors;
+};
+
+#endif
@@ -0,0 +1,445 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+
+#include "scene_graph.hh"
+
+#include <iostream>
+#include <set>
+#include <queue>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include <OpenMesh/Core/Geometry/VectorT.hh>
+
+// sort pairs ascendingly by their second entry
+template <typename first_type, typename second_type >
+inline bool scene_graph_cmp_second_entry_less( const std::pair< first_type, second_type >& a, const std::pair< first_type, second_type >& b )
+{
+  return (a.second < b.second);
+}
+
+//---------------------------------------------------
+
+scene_graph::scene_graph( )
+{
+  clear();
+}
+
+//---------------------------------------------------
+
+scene_graph::~scene_graph( )
+{
+  clear();
+}
+
+//---------------------------------------------------
+
+void scene_graph::clear( )
+{
+  mNbPoints = mNbCameras = mNbComponents = 0;
+  mUseImageSetCover = false;
+  mNbCamsSetCover = 0;
+  mSetCoverSize = 0;
+  mComponentIds.clear();
+  mImageOffsets.assign( 1, 0 );
+  mImages.clear();
+  mSetCoverIds.clear();
+}
+
+//---------------------------------------------------
+
+bool scene_graph::compute( parse_bundler &parser, bool use_image_set_cover, uint32_t consider_K_nearest_cams )
+{
+  clear();
+  
+  uint32_t nb_cameras = parser.get_number_of_cameras();
+  uint32_t nb_points_bundler = parser.get_number_of_points();
+  std::vector< feature_3D_info >& feature_infos = parser.get_feature_infos();
+  
+  // compute the connected components
+  std::cout << "  Computing connected components " << std::endl;
+  // for every camera, get the corresponding keypoint ids
+  std::vector< std::vector< uint32_t > > cam_keys( nb_cameras );
+  for( uint32_t i=0; i<nb_cameras; ++i )
+    cam_keys[i].clear();
+
+  for( uint32_t i=0; i<nb_points_bundler; ++i )
+  {
+    for( size_t j=0; j<feature_infos[i].view_list.size(); ++j )
+      cam_keys[ feature_infos[i].view_list[j].camera ].push_back( i );
+  }
+    
+  std::vector< int > cam_ccs( nb_cameras, -1 );
+  std::vector< int > point_ccs( nb_points_bundler, -1 );
+  int nb_ccs = 0;
+  
+  for( uint32_t cur_point=0; cur_point<nb_points_bundler; ++cur_point )
+  {
+    if( point_ccs[ cur_point] != -1 )
+      continue;
+    
+    // create a new connected component and collect all points reachable over the cameras
+    // in breadth first order
+    point_ccs[cur_point] = nb_ccs;
+    ++nb_ccs;
+    
+    std::queue< uint32_t > recursive_points;
+    recursive_points.push( cur_point );
+    
+    while( !recursive_points.empty() )
+    {
+      uint32_t c = recursive_points.front();
+      recursive_points.pop();
+      
+      for( size_t j=0; j<feature_infos[c].view_list.size(); ++j )
+      {
+        uint32_t cam_id = feature_infos[c].view_list[j].camera;
+        
+        if( cam_ccs[ cam_id ] != -1 )
+          continue;
+        
+        cam_ccs[ cam_id ] = point_ccs[ cur_point ];
+        for( size_t k=0; k<cam_keys[ cam_id ].size(); ++k )
+        {
+          if( point_ccs[ cam_keys[ cam_id ][k] ] == -1 )
+          {
+            point_ccs[ cam_keys[ cam_id ][k] ] = point_ccs[ cur_point ];
+            recursive_points.push( cam_keys[ cam_id ][k] );
+          }
+        }
+      }
+    }
+  }
+  std::cout << "   Found " << nb_ccs << " connected components " << std::endl;
+    
+  // check if all non-empty images and all points belong to a connected component
+  for( uint32_t i=0; i<nb_cameras; ++i )
+  {
+    if( (cam_ccs[i] == -1 || cam_ccs[i] >= nb_ccs) && (cam_keys[i].size() > 0 ) )
+    {
+      std::cerr << " [scene_graph]: ERROR : Non-empty camera " << i << " has connected component id " << cam_ccs[i] << std::endl;
+      return false;
+    }
+    
+    // check if any of the points visible in this camera has a different conncected component id
+    for( size_t k=0; k<cam_keys[ i ].size(); ++k )
+    {
+      if( point_ccs[ cam_keys[i][k] ] != cam_ccs[i] )
+      {
+        std::cerr << " [scene_graph]: ERROR : Found point " << cam_keys[i][k] << " in camera " << i << " that belongs to component " << point_ccs[ cam_keys[i][k] ] << " while the camera belongs to component " << cam_ccs[i] << std::endl;
+        return false;
+      }
+    }
+  }
+  cam_keys.clear();
+    
+  ////
+  // if we want to represent the set of images with a smaller set, we now compute it
+  
+  // recall for every image by which images of the set cover it is covered
+  std::vector< std::vector< uint32_t > > image_covered_by;
+  image_covered_by.clear();
+  
+  mSetCoverIds.assign( nb_cameras, -1 );
+  int size_set_cover = 0;
+  
+  if( use_image_set_cover )
+  {
+    image_covered_by.resize( nb_cameras );
+    
+    std::vector< std::set< uint32_t > > images_covered_by_image( nb_cameras );
+    
+    std::cout << "  Computing the set cover for all images, each image covers itself and (at most) the " << consider_K_nearest_cams << " images that have the largest number of 3D points in common with it " << std::endl;
+    
+    for( uint32_t i=0; i<nb_cameras; ++i )
+    {
+      images_covered_by_image[i].clear();
+      images_covered_by_image[i].insert(i);
+    }
+    
+    ////
+    // now add cameras that are close in 3D and have a similar viewing direction (angle between directions beneath 60°)
+    std::vector< OpenMesh::Vec3f > camera_positions( nb_cameras );
+    std::vector< OpenMesh::Vec3f > cam_viewing_dirs( nb_cameras );
+    
+    std::vector< bundler_camera > &bundle_cams = parser.get_cameras();
+    
+    for( uint32_t i=0; i<nb_cameras; ++i )
+    {
+      camera_positions[i] = bundle_cams[i].get_cam_position_f();
+      cam_viewing_dirs[i] = bundle_cams[i].get_cam_global_vec_f( OpenMesh::Vec3d( 0.0, 0.0, -1.0 ) );
+    }
+    
+    std::vector< std::pair< uint32_t, float > > cameras_distances( nb_cameras );
+    for( uint32_t i=0; i<nb_cameras; ++i )
+    {
+      for( uint32_t j=0; j<nb_cameras; ++j )
+      {
+        cameras_distances[j].first = j;
+        cameras_distances[j].second = ( camera_positions[i] - camera_positions[j] ).length();
+      }
+      
+      std::sort( cameras_distances.begin(), cameras_distances.end(), scene_graph_cmp_second_entry_less< uint32_t, float > );
+      
+      // now pick the cameras looking in a similar direction out of the K nearest
+      // cameras from the same connected component
+      uint32_t counter = 0;
+      for( uint32_t j=0; j<nb_cameras && counter<consider_K_nearest_cams; ++j )
+      {
+        // take care that the camera we are looking at is not camera i but is in the 
+        // same connected component!
+        if( cameras_distances[j].first == i || cam_ccs[i] != cam_ccs[ cameras_distances[j].first ] )
+          continue;
+        
+        ++counter;
+        
+        if( ( cam_viewing_dirs[i] | cam_viewing_dirs[ cameras_distances[j].first ] ) >= 0.5f )
+          images_covered_by_image[i].insert( cameras_distances[j].first );
+      }
+    }
+    
+    cameras_distances.clear();
+    camera_positions.clear();
+    cam_viewing_dirs.clear();
+    
+    ////
+    // now we compute the set cover
+    
+    // for every image, track how many new images it can cover
+    std::vector< std::pair< uint32_t, uint32_t > > nb_new_images_covered( nb_cameras );
+    
+    for( uint32_t i=0; i<nb_cameras; ++i )
+    {
+      image_covered_by[i].clear();
+      nb_new_images_covered[i].first = i;
+      nb_new_images_covered[i].second = images_covered_by_image[i].size();
+    }
+    
+    while( !nb_new_images_covered.empty() )
+    {
+      std::sort( nb_new_images_covered.begin(), nb_new_images_covered.end(), scene_graph_cmp_second_entry_less< uint32_t, uint32_t > );
+      if( nb_new_images_covered.back().second == 0 )
+        break;
+      
+      uint32_t cam_id_ = nb_new_images_covered.back().first;
+      
+      // add new image to set cover
+      mSetCoverIds[ cam_id_ ] = size_set_cover;
+      
+      // mark its images as covered
+      for( std::set< uint32_t >::const_iterator it = images_covered_by_image[ cam_id_ ].begin(); it != images_covered_by_image[ cam_id_ ].end(); ++it )
+        image_covered_by[ *it ].push_back( (uint32_t) size_set_cover );
+      
+      ++size_set_cover;
+      
+      // pop first element
+      nb_new_images_covered.pop_back();
+      
+      // recompute the nb of new images each image can cover
+      for( std::vector< std::pair< uint32_t, uint32_t > >::iterator it = nb_new_images_covered.begin(); it != nb_new_images_covered.end(); ++it )
+      {
+        it->second = 0;
+        for( std::set< uint32_t >::const_iterator it2 = images_covered_by_image[ it->first ].begin(); it2 != images_covered_by_image[ it->first ].end(); ++it2 )
+        {
+          if( image_covered_by[ *it2 ].empty() )
+            it->second += 1;
+        }
+      }
+    }
+    
+    std::cout << "   Set cover contains " << size_set_cover << " cameras out of " << nb_cameras << std::endl;
+  }
+  
+  ////
+  // copy the information
+  mNbPoints = nb_points_bundler;
+  mNbCameras = nb_cameras;
+  mNbComponents = (uint32_t) nb_ccs;
+  mUseImageSetCover = use_image_set_cover;
+  mNbCamsSetCover = use_image_set_cover ? consider_K_nearest_cams : 0;
+  mSetCoverSize = (uint32_t) size_set_cover;
+  
+  mComponentIds.resize( nb_points_bundler );
+  for( uint32_t i=0; i<nb_points_bundler; ++i )
+    mComponentIds[i] = (uint32_t) point_ccs[i];
+  
+  cam_ccs.clear();
+  point_ccs.clear();
+  
+  std::cout << "  Reading the images per 3D point " << std::endl;
+  mImageOffsets.resize( nb_points_bundler + 1 );
+  mImageOffsets[0] = 0;
+  mImages.clear();
+  std::vector< uint32_t > images_;
+  for( uint32_t i=0; i<nb_points_bundler; ++i )
+  {
+    images_.clear();
+    
+    for( size_t j=0; j<feature_infos[i].view_list.size(); ++j )
+    {
+      uint32_t cam_id_ = feature_infos[i].view_list[j].camera;
+      if( use_image_set_cover )
+        images_.insert( images_.end(), image_covered_by[ cam_id_ ].begin(), image_covered_by[ cam_id_ ].end() );
+      else
+        images_.push_back( cam_id_ );
+    }
+    
+    std::sort( images_.begin(), images_.end() );
+    images_.erase( std::unique( images_.begin(), images_.end() ), images_.end() );
+    
+    if( images_.size() == 0 )
+      std::cout << " WARNING: Point " << i << " is visible in no image!" << std::endl;
+    
+    mImages.insert( mImages.end(), images_.begin(), images_.end() );
+    mImageOffsets[i+1] = (uint32_t) mImages.size();
+  }
+  
+  return true;
+}
+
+//---------------------------------------------------
+
+bool scene_graph::save( const std::string &filename ) const
+{
+  FILE *fout = fopen( filename.c_str(), "wb" );
+  if( fout == NULL )
+  {
+    std::cerr << " [scene_graph]: ERROR: Cannot write to " << filename << std::endl;
+    return false;
+  }
+  
+  scene_graph_header header;
+  memset( &header, 0, sizeof( scene_graph_header ) );
+  memcpy( header.magic, SCENE_GRAPH_MAGIC, 8 );
+  header.version = SCENE_GRAPH_VERSION;
+  header.nb_points = mNbPoints;
+  header.nb_cameras = mNbCameras;
+  header.nb_components = mNbComponents;
+  header.use_image_set_cover = mUseImageSetCover ? 1 : 0;
+  header.nb_cams_set_cover = mNbCamsSetCover;
+  header.set_cover_size = mSetCoverSize;
+  header.nb_image_entries = (uint64_t) mImages.size();
+  
+  fwrite( &header, sizeof( scene_graph_header ), 1, fout );
+  if( mNbPoints > 0 )
+    fwrite( &(mComponentIds[0]), sizeof( uint32_t ), mNbPoints, fout );
+  fwrite( &(mImageOffsets[0]), sizeof( uint32_t ), mNbPoints + 1, fout );
+  if( !mImages.empty() )
+    fwrite( &(mImages[0]), sizeof( uint32_t ), mImages.size(), fout );
+  if( mNbCameras > 0 )
+    fwrite( &(mSetCoverIds[0]), sizeof( int ), mNbCameras, fout );
+  
+  bool write_ok = ( ferror( fout ) == 0 );
+  if( fclose( fout ) != 0 )
+    write_ok = false;
+  
+  if( !write_ok )
+    std::cerr << " [scene_graph]: ERROR: Could not write " << filename << std::endl;
+  
+  return write_ok;
+}
+
+//---------------------------------------------------
+
+bool scene_graph::is_scene_graph_file( const std::string &filename )
+{
+  FILE *fin = fopen( filename.c_str(), "rb" );
+  if( fin == NULL )
+    return false;
+  
+  char magic[8];
+  bool is_scene_graph = ( fread( magic, sizeof( char ), 8, fin ) == 8 ) && ( memcmp( magic, SCENE_GRAPH_MAGIC, 8 ) == 0 );
+  fclose( fin );
+  
+  return is_scene_graph;
+}
+
+//---------------------------------------------------
+
+bool scene_graph::load( const std::string &filename )
+{
+  clear();
+  
+  FILE *fin = fopen( filename.c_str(), "rb" );
+  if( fin == NULL )
+  {
+    std::cerr << " [scene_graph]: ERROR: Cannot read from " << filename << std::endl;
+    return false;
+  }
+  
+  scene_graph_header header;
+  if( fread( &header, sizeof( scene_graph_header ), 1, fin ) != 1 || memcmp( header.magic, SCENE_GRAPH_MAGIC, 8 ) != 0 )
+  {
+    std::cerr << " [scene_graph]: ERROR: " << filename << " is not a scene graph file " << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  if( header.version != SCENE_GRAPH_VERSION )
+  {
+    std::cerr << " [scene_graph]: ERROR: Unsupported version " << header.version << " of " << filename << std::endl;
+    fclose( fin );
+    return false;
+  }
+  
+  mComponentIds.resize( header.nb_points );
+  mImageOffsets.resize( header.nb_points + 1 );
+  mImages.resize( header.nb_image_entries );
+  mSetCoverIds.resize( header.nb_cameras );
+  
+  bool read_ok = true;
+  if( header.nb_points > 0 )
+    read_ok = ( fread( &(mComponentIds[0]), sizeof( uint32_t ), header.nb_points, fin ) == header.nb_points );
+  if( read_ok )
+    read_ok = ( fread( &(mImageOffsets[0]), sizeof( uint32_t ), header.nb_points + 1, fin ) == header.nb_points + 1 );
+  if( read_ok && header.nb_image_entries > 0 )
+    read_ok = ( fread( &(mImages[0]), sizeof( uint32_t ), mImages.size(), fin ) == mImages.size() );
+  if( read_ok && header.nb_cameras > 0 )
+    read_ok = ( fread( &(mSetCoverIds[0]), sizeof( int ), header.nb_cameras, fin ) == header.nb_cameras );
+  fclose( fin );
+  
+  // make sure that the ids and offsets are consistent with each other
+  if( read_ok )
+    read_ok = ( mImageOffsets[0] == 0 && uint64_t( mImageOffsets[header.nb_points] ) == header.nb_image_entries );
+  for( uint32_t i=0; i<header.nb_points && read_ok; ++i )
+    read_ok = ( mComponentIds[i] < header.nb_components ) && ( mImageOffsets[i] <= mImageOffsets[i+1] );
+  
+  if( !read_ok )
+  {
+    std::cerr << " [scene_graph]: ERROR: " << filename << " is truncated or corrupted " << std::endl;
+    clear();
+    return false;
+  }
+  
+  mNbPoints = header.nb_points;
+  mNbCameras = header.nb_cameras;
+  mNbComponents = header.nb_components;
+  mUseImageSetCover = ( header.use_image_set_cover != 0 );
+  mNbCamsSetCover = header.nb_cams_set_cover;
+  mSetCoverSize = header.set_cover_size;
+  
+  return true;
+}
@@ -0,0 +1,146 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#ifndef SCENE_GRAPH_HH
+#define SCENE_GRAPH_HH
+
+/**
+ * Visibility information of a Bundler reconstruction as used by active search:
+ * The connected component every 3D point belongs to, the (greedy) set cover
+ * of the images and for every 3D point the list of images (or set cover ids)
+ * it is visible in. The information can be computed from a parsed
+ * reconstruction or loaded from a binary file written by compute_scene_graph,
+ * which avoids parsing the bundle.out file and computing the components and
+ * the set cover every time a localizer starts.
+ *
+ * Layout of the binary file:
+ *   header                  (see scene_graph_header)
+ *   component ids           nb_points uint32_t
+ *   image offsets           (nb_points + 1) uint32_t, CSR offsets into the image lists
+ *   image lists             nb_image_entries uint32_t, sorted ascendingly per point
+ *   set cover ids           nb_cameras int32_t (-1 if a camera is not part of the set cover)
+**/
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "parse_bundler.hh"
+
+//! magic number at the beginning of every scene graph file
+#define SCENE_GRAPH_MAGIC "ACGSCNGR"
+
+//! current version of the file format
+#define SCENE_GRAPH_VERSION 1
+
+//! header of a scene graph file
+struct scene_graph_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nb_points;
+  uint32_t nb_cameras;
+  uint32_t nb_components;
+  uint32_t use_image_set_cover;
+  uint32_t nb_cams_set_cover;
+  uint32_t set_cover_size;
+  uint32_t reserved;
+  uint64_t nb_image_entries;
+};
+
+class scene_graph
+{
+  public:
+    //! constructor
+    scene_graph( );
+    
+    //! destructor
+    ~scene_graph( );
+    
+    /**
+     * Computes the connected components and the images per point from a parsed reconstruction.
+     * If use_image_set_cover is true, every image covers itself and the images among its 
+     * consider_K_nearest_cams nearest cameras (in the same component) with a similar viewing direction,
+     * a greedy set cover of the images is computed and the images per point are replaced by the 
+     * ids of the set cover images covering them. Returns false if the reconstruction is inconsistent.
+    **/
+    bool compute( parse_bundler &parser, bool use_image_set_cover, uint32_t consider_K_nearest_cams );
+    
+    //! load the information from a binary file. Returns false if the file could not be loaded.
+    bool load( const std::string &filename );
+    
+    //! save the information to a binary file. Returns false if the file could not be written.
+    bool save( const std::string &filename ) const;
+    
+    //! returns true if the file is a scene graph file written by save
+    static bool is_scene_graph_file( const std::string &filename );
+    
+    //! release all data
+    void clear( );
+    
+    //! get the number of 3D points
+    uint32_t get_nb_points( ) const { return mNbPoints; }
+    
+    //! get the number of cameras in the reconstruction
+    uint32_t get_nb_cameras( ) const { return mNbCameras; }
+    
+    //! get the number of connected components
+    uint32_t get_nb_components( ) const { return mNbComponents; }
+    
+    //! returns true if the images per point are set cover ids
+    bool uses_image_set_cover( ) const { return mUseImageSetCover; }
+    
+    //! get the number of nearest cameras considered for the set cover
+    uint32_t get_nb_cams_set_cover( ) const { return mNbCamsSetCover; }
+    
+    //! get the number of images in the set cover
+    uint32_t get_set_cover_size( ) const { return mSetCoverSize; }
+    
+    //! get the connected component ids of all points
+    const std::vector< uint32_t >& get_component_ids( ) const { return mComponentIds; }
+    
+    //! get the number of images (or set cover ids) a point is visible in
+    uint32_t get_nb_images_for_point( uint32_t point ) const { return mImageOffsets[point+1] - mImageOffsets[point]; }
+    
+    //! get the (ascendingly sorted) list of images (or set cover ids) a point is visible in
+    const uint32_t* get_images_for_point( uint32_t point ) const { return &(mImages[0]) + mImageOffsets[point]; }
+    
+    //! get the id of a camera in the set cover, -1 if it is not part of the set cover
+    int get_set_cover_id( uint32_t camera ) const { return mSetCoverIds[camera]; }
+    
+  private:
+    uint32_t mNbPoints;
+    uint32_t mNbCameras;
+    uint32_t mNbComponents;
+    bool mUseImageSetCover;
+    uint32_t mNbCamsSetCover;
+    uint32_t mSetCoverSize;
+    
+    std::vector< uint32_t > mComponentIds;
+    std::vector< uint32_t > mImageOffsets;
+    std::vector< uint32_t > mImages;
+    std::vector< int > mSetCoverIds;
+};
+
+#endif
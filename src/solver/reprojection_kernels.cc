@@ -0,0 +1,205 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+#include "reprojection_kernels.hh"
+
+// GCC would fuse multiplications and additions of the AVX-512F version into FMA instructions,
+// we keep them separate such that all implementations compute identical results
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ( "fp-contract=off" )
+#endif
+
+#ifdef REPROJECTION_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+//---------------------------------------------------
+// scalar implementation
+//---------------------------------------------------
+
+uint32_t reprojection_inliers_scalar( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z )
+{
+  const float *P = h.P;
+  uint32_t mask = 0;
+  for( int i=0; i<REPROJECTION_BLOCK_SIZE; ++i )
+  {
+    float depth = ( X[i] - h.position[0] ) * h.orientation[0] + ( Y[i] - h.position[1] ) * h.orientation[1] + ( Z[i] - h.position[2] ) * h.orientation[2];
+    float w = P[8] * X[i] + P[9] * Y[i] + P[10] * Z[i] + P[11];
+    float dx = x[i] - ( P[0] * X[i] + P[1] * Y[i] + P[2] * Z[i] + P[3] ) / w;
+    float dy = y[i] - ( P[4] * X[i] + P[5] * Y[i] + P[6] * Z[i] + P[7] ) / w;
+    float error = dx * dx + dy * dy;
+    if( depth >= 0.0f && error <= h.threshold )
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+#ifdef REPROJECTION_X86_KERNELS
+
+////
+// The SIMD versions handle 4 (SSE2), 8 (AVX) or 16 (AVX-512F) correspondences at once and
+// compute exactly the same operations in the same order as the scalar version. The 
+// comparisons are ordered, i.e., they are false for NaN values.
+////
+
+//---------------------------------------------------
+// SSE2
+//---------------------------------------------------
+
+__attribute__((target("sse2")))
+uint32_t reprojection_inliers_sse2( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z )
+{
+  __m128 P[12];
+  for( int j=0; j<12; ++j )
+    P[j] = _mm_set1_ps( h.P[j] );
+  const __m128 c0 = _mm_set1_ps( h.position[0] ), c1 = _mm_set1_ps( h.position[1] ), c2 = _mm_set1_ps( h.position[2] );
+  const __m128 o0 = _mm_set1_ps( h.orientation[0] ), o1 = _mm_set1_ps( h.orientation[1] ), o2 = _mm_set1_ps( h.orientation[2] );
+  const __m128 threshold = _mm_set1_ps( h.threshold );
+  const __m128 zero = _mm_setzero_ps();
+  
+  uint32_t mask = 0;
+  for( int i=0; i<REPROJECTION_BLOCK_SIZE; i+=4 )
+  {
+    __m128 pX = _mm_load_ps( X + i );
+    __m128 pY = _mm_load_ps( Y + i );
+    __m128 pZ = _mm_load_ps( Z + i );
+    
+    __m128 depth = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_sub_ps( pX, c0 ), o0 ), _mm_mul_ps( _mm_sub_ps( pY, c1 ), o1 ) ), _mm_mul_ps( _mm_sub_ps( pZ, c2 ), o2 ) );
+    __m128 w = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( P[8], pX ), _mm_mul_ps( P[9], pY ) ), _mm_mul_ps( P[10], pZ ) ), P[11] );
+    __m128 u = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( P[0], pX ), _mm_mul_ps( P[1], pY ) ), _mm_mul_ps( P[2], pZ ) ), P[3] );
+    __m128 v = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( P[4], pX ), _mm_mul_ps( P[5], pY ) ), _mm_mul_ps( P[6], pZ ) ), P[7] );
+    __m128 dx = _mm_sub_ps( _mm_load_ps( x + i ), _mm_div_ps( u, w ) );
+    __m128 dy = _mm_sub_ps( _mm_load_ps( y + i ), _mm_div_ps( v, w ) );
+    __m128 error = _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) );
+    
+    __m128 inlier = _mm_and_ps( _mm_cmpge_ps( depth, zero ), _mm_cmple_ps( error, threshold ) );
+    mask |= uint32_t( _mm_movemask_ps( inlier ) ) << i;
+  }
+  return mask;
+}
+
+//---------------------------------------------------
+// AVX
+//---------------------------------------------------
+
+__attribute__((target("avx")))
+uint32_t reprojection_inliers_avx( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z )
+{
+  __m256 P[12];
+  for( int j=0; j<12; ++j )
+    P[j] = _mm256_set1_ps( h.P[j] );
+  const __m256 c0 = _mm256_set1_ps( h.position[0] ), c1 = _mm256_set1_ps( h.position[1] ), c2 = _mm256_set1_ps( h.position[2] );
+  const __m256 o0 = _mm256_set1_ps( h.orientation[0] ), o1 = _mm256_set1_ps( h.orientation[1] ), o2 = _mm256_set1_ps( h.orientation[2] );
+  const __m256 threshold = _mm256_set1_ps( h.threshold );
+  const __m256 zero = _mm256_setzero_ps();
+  
+  uint32_t mask = 0;
+  for( int i=0; i<REPROJECTION_BLOCK_SIZE; i+=8 )
+  {
+    __m256 pX = _mm256_load_ps( X + i );
+    __m256 pY = _mm256_load_ps( Y + i );
+    __m256 pZ = _mm256_load_ps( Z + i );
+    
+    __m256 depth = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( _mm256_sub_ps( pX, c0 ), o0 ), _mm256_mul_ps( _mm256_sub_ps( pY, c1 ), o1 ) ), _mm256_mul_ps( _mm256_sub_ps( pZ, c2 ), o2 ) );
+    __m256 w = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( P[8], pX ), _mm256_mul_ps( P[9], pY ) ), _mm256_mul_ps( P[10], pZ ) ), P[11] );
+    __m256 u = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( P[0], pX ), _mm256_mul_ps( P[1], pY ) ), _mm256_mul_ps( P[2], pZ ) ), P[3] );
+    __m256 v = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( P[4], pX ), _mm256_mul_ps( P[5], pY ) ), _mm256_mul_ps( P[6], pZ ) ), P[7] );
+    __m256 dx = _mm256_sub_ps( _mm256_load_ps( x + i ), _mm256_div_ps( u, w ) );
+    __m256 dy = _mm256_sub_ps( _mm256_load_ps( y + i ), _mm256_div_ps( v, w ) );
+    __m256 error = _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) );
+    
+    __m256 inlier = _mm256_and_ps( _mm256_cmp_ps( depth, zero, _CMP_GE_OQ ), _mm256_cmp_ps( error, threshold, _CMP_LE_OQ ) );
+    mask |= uint32_t( _mm256_movemask_ps( inlier ) ) << i;
+  }
+  return mask;
+}
+
+//---------------------------------------------------
+// AVX-512F
+//---------------------------------------------------
+
+__attribute__((target("avx512f")))
+uint32_t reprojection_inliers_avx512f( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z )
+{
+  const float *P = h.P;
+  __m512 pX = _mm512_load_ps( X );
+  __m512 pY = _mm512_load_ps( Y );
+  __m512 pZ = _mm512_load_ps( Z );
+  
+  __m512 depth = _mm512_add_ps( _mm512_add_ps( _mm512_mul_ps( _mm512_sub_ps( pX, _mm512_set1_ps( h.position[0] ) ), _mm512_set1_ps( h.orientation[0] ) ), 
+                                               _mm512_mul_ps( _mm512_sub_ps( pY, _mm512_set1_ps( h.position[1] ) ), _mm512_set1_ps( h.orientation[1] ) ) ), 
+                                _mm512_mul_ps( _mm512_sub_ps( pZ, _mm512_set1_ps( h.position[2] ) ), _mm512_set1_ps( h.orientation[2] ) ) );
+  __m512 w = _mm512_add_ps( _mm512_add_ps( _mm512_add_ps( _mm512_mul_ps( _mm512_set1_ps( P[8] ), pX ), _mm512_mul_ps( _mm512_set1_ps( P[9] ), pY ) ), _mm512_mul_ps( _mm512_set1_ps( P[10] ), pZ ) ), _mm512_set1_ps( P[11] ) );
+  __m512 u = _mm512_add_ps( _mm512_add_ps( _mm512_add_ps( _mm512_mul_ps( _mm512_set1_ps( P[0] ), pX ), _mm512_mul_ps( _mm512_set1_ps( P[1] ), pY ) ), _mm512_mul_ps( _mm512_set1_ps( P[2] ), pZ ) ), _mm512_set1_ps( P[3] ) );
+  __m512 v = _mm512_add_ps( _mm512_add_ps( _mm512_add_ps( _mm512_mul_ps( _mm512_set1_ps( P[4] ), pX ), _mm512_mul_ps( _mm512_set1_ps( P[5] ), pY ) ), _mm512_mul_ps( _mm512_set1_ps( P[6] ), pZ ) ), _mm512_set1_ps( P[7] ) );
+  __m512 dx = _mm512_sub_ps( _mm512_load_ps( x ), _mm512_div_ps( u, w ) );
+  __m512 dy = _mm512_sub_ps( _mm512_load_ps( y ), _mm512_div_ps( v, w ) );
+  __m512 error = _mm512_add_ps( _mm512_mul_ps( dx, dx ), _mm512_mul_ps( dy, dy ) );
+  
+  __mmask16 in_front = _mm512_cmp_ps_mask( depth, _mm512_setzero_ps(), _CMP_GE_OQ );
+  return uint32_t( _mm512_mask_cmp_ps_mask( in_front, error, _mm512_set1_ps( h.threshold ), _CMP_LE_OQ ) );
+}
+
+#endif
+
+//---------------------------------------------------
+// selection of the implementation
+//---------------------------------------------------
+
+static const char *g_reprojection_implementation = "scalar";
+
+static reprojection_inlier_fn select_reprojection_kernel( )
+{
+#ifdef REPROJECTION_X86_KERNELS
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx512f" ) )
+  {
+    g_reprojection_implementation = "avx512f";
+    return reprojection_inliers_avx512f;
+  }
+  if( __builtin_cpu_supports( "avx" ) )
+  {
+    g_reprojection_implementation = "avx";
+    return reprojection_inliers_avx;
+  }
+  if( __builtin_cpu_supports( "sse2" ) )
+  {
+    g_reprojection_implementation = "sse2";
+    return reprojection_inliers_sse2;
+  }
+#endif
+  return reprojection_inliers_scalar;
+}
+
+//---------------------------------------------------
+
+reprojection_inlier_fn g_reprojection_inliers = select_reprojection_kernel();
+
+//---------------------------------------------------
+
+const char* get_reprojection_kernel_implementation( )
+{
+  return g_reprojection_implementation;
+}
@@ -0,0 +1,89 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------* 
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/ 
+
+
+#ifndef REPROJECTION_KERNELS_HH
+#define REPROJECTION_KERNELS_HH
+
+/**
+ *    Kernels that classify blocks of 2D-3D correspondences as inliers or 
+ *    outliers to a camera pose, used by RANSAC to evaluate its hypotheses.
+ *    The correspondences are stored as a structure of arrays (one float array
+ *    each for x, y, X, Y and Z), the arrays have to be aligned to 64 bytes.
+ *    There is a scalar, an SSE2, an AVX and an AVX-512F implementation,
+ *    the fastest one supported by the CPU is selected once at program start.
+ *    All implementations perform the same single precision operations.
+**/
+
+#include <stdint.h>
+
+//! number of correspondences handled by a single call of a kernel
+#define REPROJECTION_BLOCK_SIZE 16
+
+//! A camera pose prepared for the kernels: the projection matrix (3x4, row major), the
+//! position and the viewing direction of the camera and the threshold on the squared 
+//! reprojection error, all in single precision.
+struct reprojection_hypothesis
+{
+  float P[12];
+  float position[3];
+  float orientation[3];
+  float threshold;
+};
+
+/**
+ * Type of the kernels. Evaluates the REPROJECTION_BLOCK_SIZE correspondences starting at 
+ * the given (aligned) pointers and returns a bit mask in which bit i is set if the i-th 
+ * correspondence is an inlier, i.e., if the 3D point lies in front of the camera 
+ * ( (X - position) * orientation >= 0 ) and its squared reprojection error is at most the
+ * threshold. Correspondences with NaN coordinates are never inliers (use them for padding).
+**/
+typedef uint32_t (*reprojection_inlier_fn)( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z );
+
+//! the implementation selected for the current CPU
+extern reprojection_inlier_fn g_reprojection_inliers;
+
+//! returns the name of the selected implementation ("scalar", "sse2", "avx" or "avx512f")
+const char* get_reprojection_kernel_implementation( );
+
+//! number of bits set in the mask returned by a kernel
+inline uint32_t count_inliers_in_mask( uint32_t mask )
+{
+  mask = mask - ( ( mask >> 1 ) & 0x55555555u );
+  mask = ( mask & 0x33333333u ) + ( ( mask >> 2 ) & 0x33333333u );
+  return ( ( ( mask + ( mask >> 4 ) ) & 0x0F0F0F0Fu ) * 0x01010101u ) >> 24;
+}
+
+// the different implementations, the SIMD versions must only be called if supported by the CPU
+uint32_t reprojection_inliers_scalar( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z );
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define REPROJECTION_X86_KERNELS
+
+uint32_t reprojection_inliers_sse2( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z );
+uint32_t reprojection_inliers_avx( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z );
+uint32_t reprojection_inliers_avx512f( const reprojection_hypothesis &h, const float *x, const float *y, const float *X, const float *Y, const float *Z );
+#endif
+
+#endif
@@ -0,0 +1,296 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+/*
+ * Definition of the P3P solver for calibrated cameras
+ */
+
+
+#include <math.h>
+#include <algorithm>
+#include <array>
+
+#include "solverp3p.hh"
+
+
+
+using namespace Util::Math;
+
+namespace Util {
+namespace CorrSolver {
+
+
+
+/////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////
+
+
+//! Evaluates the polynomial with coefficients _c (in increasing order of the powers) at _x
+static inline double evalPoly( const double * _c, int _degree, double _x )
+{
+    double val = _c[ _degree ];
+    for( int i = _degree - 1; i >= 0; --i )
+	val = val * _x + _c[ i ];
+    return val;
+}
+
+
+//! Computes the real roots of a polynomial of degree at most 4 with coefficients _c
+//! (in increasing order of the powers) and returns their number. The real roots of the
+//! derivative split the real line into intervals on which the polynomial is monotonic,
+//! each of them contains at most one root that is found by bisection.
+static int realRoots( const double * _c, int _degree, double * _roots )
+{
+    double maxCoeff = 0.0;
+    for( int i = 0; i <= _degree; ++i )
+	maxCoeff = std::max( maxCoeff, fabs( _c[ i ] ) );
+    if( maxCoeff == 0.0 )
+	return 0;
+
+    // ignore vanishing leading coefficients
+    while( _degree > 0 && fabs( _c[ _degree ] ) <= 1e-12 * maxCoeff )
+	--_degree;
+
+    if( _degree == 0 )
+	return 0;
+
+    if( _degree == 1 )
+    {
+	_roots[ 0 ] = - _c[ 0 ] / _c[ 1 ];
+	return 1;
+    }
+
+    // all roots lie within the Cauchy bound
+    double bound = 0.0;
+    for( int i = 0; i < _degree; ++i )
+	bound = std::max( bound, fabs( _c[ i ] / _c[ _degree ] ) );
+    bound += 1.0;
+
+    // the derivative has degree at most 3 and thus at most 3 real roots,
+    // together with the two bounds they give at most 5 interval ends
+    std::array< double, 4 > deriv;
+    std::array< double, 3 > derivRoots;
+    std::array< double, 5 > ends;
+    for( int i = 0; i < _degree; ++i )
+	deriv[ i ] = double( i + 1 ) * _c[ i + 1 ];
+
+    int numDerivRoots = std::min( realRoots( deriv.data(), _degree - 1, derivRoots.data() ), int( derivRoots.size() ) );
+    // insertion sort, there are at most 3 roots
+    for( int i = 1; i < numDerivRoots; ++i )
+    {
+	double root = derivRoots[ i ];
+	int j = i;
+	for( ; j > 0 && derivRoots[ j - 1 ] > root; --j )
+	    derivRoots[ j ] = derivRoots[ j - 1 ];
+	derivRoots[ j ] = root;
+    }
+    int numEnds = 0;
+    ends[ numEnds++ ] = -bound;
+    for( int i = 0; i < numDerivRoots; ++i )
+	ends[ numEnds++ ] = std::min( std::max( derivRoots[ i ], -bound ), bound );
+    ends[ numEnds ] = bound;
+
+    int numRoots = 0;
+    double fLow = evalPoly( _c, _degree, ends[ 0 ] );
+    for( int i = 0; i < numEnds; ++i )
+    {
+	double low = ends[ i ], high = ends[ i + 1 ];
+	double fHigh = evalPoly( _c, _degree, high );
+
+	// a root at the lower end has already been found in the previous interval
+	if( ( fLow < 0.0 && fHigh >= 0.0 ) || ( fLow > 0.0 && fHigh <= 0.0 ) )
+	{
+	    bool increasing = ( fHigh > fLow );
+	    for( int iter = 0; iter < 100; ++iter )
+	    {
+		double mid = 0.5 * ( low + high );
+		if( mid <= low || mid >= high )
+		    break;
+		double fMid = evalPoly( _c, _degree, mid );
+		if( ( fMid < 0.0 ) == increasing )
+		    low = mid;
+		else
+		    high = mid;
+	    }
+	    _roots[ numRoots++ ] = 0.5 * ( low + high );
+	}
+	fLow = fHigh;
+    }
+
+    return numRoots;
+}
+
+
+/////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////
+
+
+SolverP3P::SolverP3P()
+    : m_focal( 0.0 ), m_numCorresp( 0 ), m_numPoses( 0 )
+{
+}
+
+
+SolverP3P::~SolverP3P()
+{
+}
+
+
+void SolverP3P::clear( void )
+{
+    m_numCorresp = 0;
+    m_numPoses = 0;
+}
+
+
+void SolverP3P::addCorrespondence( const Vector2D & _point2D,
+				   const Vector3D & _point3D )
+{
+    if( m_numCorresp < 3 )
+    {
+	m_points2D[ m_numCorresp ] = _point2D;
+	m_points3D[ m_numCorresp ] = _point3D;
+    }
+    ++m_numCorresp;
+}
+
+
+int SolverP3P::computePoses( void )
+{
+    m_numPoses = 0;
+
+    if( m_numCorresp < 3 || m_focal <= 0.0 )
+	return 0;
+
+    // the viewing rays of the three points in the coordinate system of the camera
+    Vector3D ray[ 3 ];
+    for( int i = 0; i < 3; ++i )
+    {
+	ray[ i ] = Vector3D( m_points2D[ i ][ 0 ], m_points2D[ i ][ 1 ], -m_focal );
+	ray[ i ].normalize();
+    }
+
+    // squared lengths of the sides of the triangle opposite to the three points
+    double a2 = ( m_points3D[ 1 ] - m_points3D[ 2 ] ).sqrnorm();
+    double b2 = ( m_points3D[ 0 ] - m_points3D[ 2 ] ).sqrnorm();
+    double c2 = ( m_points3D[ 0 ] - m_points3D[ 1 ] ).sqrnorm();
+
+    if( a2 == 0.0 || b2 == 0.0 || c2 == 0.0 )
+	return 0;
+
+    double cosAlpha = ( ray[ 1 ] | ray[ 2 ] );
+    double cosBeta = ( ray[ 0 ] | ray[ 2 ] );
+    double cosGamma = ( ray[ 0 ] | ray[ 1 ] );
+
+    // With the distances s_2 = u * s_1 and s_3 = v * s_1 of the points to the camera center,
+    // the law of cosines for the three sides yields u = N(v) / D(v) with
+    //   N(v) = (K - 1) v^2 - 2 K cos(beta) v + 1 + K,  D(v) = 2 (cos(gamma) - cos(alpha) v)
+    // and K = (a^2 - c^2) / b^2. Inserting u into
+    //   c^2 / b^2 (1 + v^2 - 2 v cos(beta)) = 1 + u^2 - 2 u cos(gamma)
+    // and multiplying with D(v)^2 gives a polynomial of degree 4 in v.
+    double K = ( a2 - c2 ) / b2;
+    double C = c2 / b2;
+    double N[ 3 ] = { 1.0 + K, -2.0 * K * cosBeta, K - 1.0 };
+    double D[ 2 ] = { 2.0 * cosGamma, -2.0 * cosAlpha };
+    double E[ 3 ] = { C, -2.0 * C * cosBeta, C };
+
+    double DD[ 3 ] = { D[ 0 ] * D[ 0 ], 2.0 * D[ 0 ] * D[ 1 ], D[ 1 ] * D[ 1 ] };
+    double coeffs[ 5 ] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    for( int i = 0; i < 3; ++i )
+    {
+	for( int j = 0; j < 3; ++j )
+	    coeffs[ i + j ] += ( E[ i ] - ( i == 0 ? 1.0 : 0.0 ) ) * DD[ j ] - N[ i ] * N[ j ];
+	for( int j = 0; j < 2; ++j )
+	    coeffs[ i + j ] += 2.0 * cosGamma * N[ i ] * D[ j ];
+    }
+
+    double roots[ 4 ];
+    int numRoots = realRoots( coeffs, 4, roots );
+
+    for( int r = 0; r < numRoots; ++r )
+    {
+	double v = roots[ r ];
+	double denom = D[ 0 ] + D[ 1 ] * v;
+	if( fabs( denom ) < 1e-12 )
+	    continue;
+	double u = ( N[ 0 ] + ( N[ 1 ] + N[ 2 ] * v ) * v ) / denom;
+
+	double q = 1.0 + v * v - 2.0 * v * cosBeta;
+	if( q <= 0.0 )
+	    continue;
+
+	// all points have to lie in front of the camera
+	double s1 = sqrt( b2 / q );
+	double s2 = u * s1;
+	double s3 = v * s1;
+	if( s2 <= 0.0 || s3 <= 0.0 )
+	    continue;
+
+	Vector3D cam[ 3 ] = { ray[ 0 ] * s1, ray[ 1 ] * s2, ray[ 2 ] * s3 };
+
+	// The rotation maps an orthonormal frame spanned by the triangle in world
+	// coordinates onto the frame spanned by the triangle in camera coordinates
+	Vector3D w1 = m_points3D[ 1 ] - m_points3D[ 0 ];
+	Vector3D w3 = w1 % ( m_points3D[ 2 ] - m_points3D[ 0 ] );
+	Vector3D c1 = cam[ 1 ] - cam[ 0 ];
+	Vector3D c3 = c1 % ( cam[ 2 ] - cam[ 0 ] );
+	if( w3.sqrnorm() == 0.0 || c3.sqrnorm() == 0.0 )
+	    continue;
+	w1.normalize();
+	w3.normalize();
+	c1.normalize();
+	c3.normalize();
+	Vector3D w2 = w3 % w1;
+	Vector3D c2 = c3 % c1;
+
+	double R[ 3 ][ 3 ];
+	for( int i = 0; i < 3; ++i )
+	    for( int j = 0; j < 3; ++j )
+		R[ i ][ j ] = c1[ i ] * w1[ j ] + c2[ i ] * w2[ j ] + c3[ i ] * w3[ j ];
+
+	// P = diag( -f, -f, 1 ) * [R | t] projects into the centered image coordinate system
+	ProjMatrix & P = m_poses[ m_numPoses ];
+	double scale[ 3 ] = { -m_focal, -m_focal, 1.0 };
+	for( int i = 0; i < 3; ++i )
+	{
+	    double t = cam[ 0 ][ i ];
+	    for( int j = 0; j < 3; ++j )
+	    {
+		P( i, j ) = scale[ i ] * R[ i ][ j ];
+		t -= R[ i ][ j ] * m_points3D[ 0 ][ j ];
+	    }
+	    P( i, 3 ) = scale[ i ] * t;
+	}
+	++m_numPoses;
+    }
+
+    return m_numPoses;
+}
+
+
+}
+
+}
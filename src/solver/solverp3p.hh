@@ -0,0 +1,119 @@
+/*===========================================================================*\
+ *                                                                           *
+ *                            ACG Localizer                                  *
+ *      Copyright (C) 2011-2012 by Computer Graphics Group, RWTH Aachen      *
+ *                           www.rwth-graphics.de                            *
+ *                                                                           *
+ *---------------------------------------------------------------------------*
+ *  This file is part of ACG Localizer                                       *
+ *                                                                           *
+ *  ACG Localizer is free software: you can redistribute it and/or modify    *
+ *  it under the terms of the GNU General Public License as published by     *
+ *  the Free Software Foundation, either version 3 of the License, or        *
+ *  (at your option) any later version.                                      *
+ *                                                                           *
+ *  ACG Localizer is distributed in the hope that it will be useful,         *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *  GNU General Public License for more details.                             *
+ *                                                                           *
+ *  You should have received a copy of the GNU General Public License        *
+ *  along with ACG Localizer.  If not, see <http://www.gnu.org/licenses/>.   *
+ *                                                                           *
+\*===========================================================================*/
+
+/*
+ * Declaration of a minimal solver for the pose of a calibrated camera
+ * from three 2D-3D correspondences (P3P)
+ */
+
+
+
+#ifndef _FT_SOLVER_P3P_HH_
+#define _FT_SOLVER_P3P_HH_
+
+
+#include "../math/math.hh"
+#include "../math/matrix3x3.hh"
+#include "../math/projmatrix.hh"
+#include "solverbase.hh"
+
+
+using namespace Util::Math;
+
+namespace Util {
+namespace CorrSolver {
+
+
+
+//! Solver that computes the pose of a camera with known focal length from three
+//! 2D-3D correspondences, following Grunert's formulation of the P3P problem
+//! (see Haralick et al., Review and Analysis of Solutions of the Three Point
+//! Perspective Pose Estimation Problem, IJCV 1994). The image points are expected
+//! in the centered coordinate system of the localizers (y-axis pointing upwards),
+//! the camera looks down the negative z-axis as in reconstructions computed by Bundler.
+class SolverP3P {
+
+public:
+
+    //! Default constructor
+    SolverP3P();
+
+    //! Destructor
+    virtual ~SolverP3P();
+
+
+    //! Set the focal length (in pixels) of the camera
+    void setFocalLength( double _focal )
+	{ m_focal = _focal; }
+
+    //! Get the focal length (in pixels) of the camera
+    double getFocalLength( void ) const
+	{ return m_focal; }
+
+
+    //! Clear all point correspondences
+    void clear( void );
+
+    //! Add a point correspondence, only the first three correspondences are used
+    void addCorrespondence( const Vector2D & _point2D,
+			    const Vector3D & _point3D );
+
+
+    //! Compute all poses (at most 4) consistent with the three correspondences
+    //! that place the points in front of the camera. Returns the number of poses.
+    int computePoses( void );
+
+    //! Get the number of poses found by computePoses
+    int getNumPoses( void ) const
+	{ return m_numPoses; }
+
+    //! Get the projection matrix K * [R|t] of the _i-th pose
+    void getProjectionMatrix( int _i, ProjMatrix & _mat ) const
+	{ _mat = m_poses[ _i ]; }
+
+
+protected:
+
+    //! Focal length in pixels
+    double m_focal;
+
+    //! Number of correspondences added so far
+    int m_numCorresp;
+
+    //! The three correspondences
+    Vector2D m_points2D[ 3 ];
+    Vector3D m_points3D[ 3 ];
+
+    //! The computed poses
+    int m_numPoses;
+    ProjMatrix m_poses[ 4 ];
+};
+
+
+}
+
+}
+
+
+#endif // _FT_SOLVER_P3P_HH_
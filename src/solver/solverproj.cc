@@ -34,6 +34,7 @@
 #include <vector>
 #include <float.h>
 #include <math.h>
+#include <algorithm>
 
 #include "solverproj.hh"
 
@@ -51,10 +52,100 @@ namespace CorrSolver {
 /////////////////////////////////////////////////////////////////
 
 
-//! Global pointer to correspondences used by fcn_dist()
-static SolverProj::CorrespondenceVec * gp_corresp;
+//! Adds a row of the linear system A * p = 0 to the upper triangular matrix
+//! R of the QR decomposition of A, using Givens rotations. Afterwards,
+//! R^T * R = A^T * A still holds, i.e., A and R have the same right singular vectors.
+static inline void addRowToR( double _R[ 12 ][ 12 ], double _row[ 12 ] )
+{
+    for( int k = 0; k < 12; ++k )
+    {
+	  if( _row[ k ] == 0.0 )
+		  continue;
+
+	  double a = _R[ k ][ k ];
+	  double b = _row[ k ];
+	  double h = sqrt( a * a + b * b );
+	  double c = a / h;
+	  double s = b / h;
+
+	  _R[ k ][ k ] = h;
+	  _row[ k ] = 0.0;
+
+	  for( int j = k + 1; j < 12; ++j )
+	  {
+		  double t1 = _R[ k ][ j ];
+		  double t2 = _row[ j ];
+		  _R[ k ][ j ] = c * t1 + s * t2;
+		  _row[ j ] = - s * t1 + c * t2;
+	  }
+    }
+}
+
+
+//! Computes the right singular vector of the upper triangular 12x12 matrix _R
+//! belonging to its smallest singular value, i.e., the eigenvector of R^T * R
+//! belonging to its smallest eigenvalue, using inverse iteration. Every step
+//! solves R^T * R * z = v with two triangular solves. Pivots that are (close to)
+//! zero, e.g., for a minimal sample, are replaced by a tiny value, which makes
+//! the iteration converge immediately to the null-space.
+//! Returns false if _R is zero.
+static bool smallestRightSingularVector( double _R[ 12 ][ 12 ], double _vec[ 12 ] )
+{
+    double maxPivot = 0.0;
+    for( int i = 0; i < 12; ++i )
+	  maxPivot = std::max( maxPivot, fabs( _R[ i ][ i ] ) );
+
+    if( maxPivot == 0.0 )
+	  return false;
+
+    double minPivot = maxPivot * 1e-14;
+    for( int i = 0; i < 12; ++i )
+    {
+	  if( fabs( _R[ i ][ i ] ) < minPivot )
+		  _R[ i ][ i ] = ( _R[ i ][ i ] < 0.0 ) ? -minPivot : minPivot;
+    }
+
+    double y[ 12 ];
+    for( int i = 0; i < 12; ++i )
+	  _vec[ i ] = 1.0 / sqrt( 12.0 );
+
+    double lastNorm = 0.0;
+    for( int iter = 0; iter < 50; ++iter )
+    {
+	  // forward substitution: R^T * y = vec
+	  for( int i = 0; i < 12; ++i )
+	  {
+		  double sum = _vec[ i ];
+		  for( int k = 0; k < i; ++k )
+			sum -= _R[ k ][ i ] * y[ k ];
+		  y[ i ] = sum / _R[ i ][ i ];
+	  }
+
+	  // backward substitution: R * vec = y
+	  for( int i = 11; i >= 0; --i )
+	  {
+		  double sum = y[ i ];
+		  for( int k = i + 1; k < 12; ++k )
+			sum -= _R[ i ][ k ] * _vec[ k ];
+		  _vec[ i ] = sum / _R[ i ][ i ];
+	  }
+
+	  double norm = 0.0;
+	  for( int i = 0; i < 12; ++i )
+		  norm += _vec[ i ] * _vec[ i ];
+	  norm = sqrt( norm );
 
+	  for( int i = 0; i < 12; ++i )
+		  _vec[ i ] /= norm;
 
+	  // the norm converges to the inverse of the smallest eigenvalue of R^T * R
+	  if( fabs( norm - lastNorm ) <= 1e-12 * norm )
+		  break;
+	  lastNorm = norm;
+    }
+
+    return true;
+}
 
 
 /////////////////////////////////////////////////////////////////
@@ -339,16 +430,19 @@ bool SolverProj::computeLinear( void )
 
 bool SolverProj::computeLinearNew( void )
 {
-    int nrows, ncols;
-
-    nrows = 3 * mv_corresp.size();
-    ncols = 12;
-
-    Matrix mat_A( nrows, ncols );
-    Matrix mat_VT( ncols, ncols );
-    Vector vec_point( 4 );
-
-    gmm::clear( mat_A );
+    // The system A * p = 0 (3 rows per correspondence, 12 unknowns) is not stored
+    // explicitly. Every row is directly merged into the triangular factor R of A,
+    // such that only fixed-size matrices on the stack are needed, independent of
+    // the number of correspondences.
+    double mat_R[ 12 ][ 12 ];
+    double row[ 12 ];
+    double vec_P[ 12 ];
+
+    for( int i = 0; i < 12; ++i )
+    {
+	  for( int j = 0; j < 12; ++j )
+		  mat_R[ i ][ j ] = 0.0;
+    }
 
 
     ///////////////////////////////////////////////////
@@ -362,82 +456,56 @@ bool SolverProj::computeLinearNew( void )
     int corr, endCorr = mv_correspScaled.size();
 
     ///////////////////////////////////////////////////
-    // generate matrix A
+    // generate the rows of matrix A
 
     for( corr = 0; corr < endCorr; ++corr )
     {
-	  vec_point[ 0 ] = mv_correspScaled[ corr ].m_point3D[ 0 ];
-	  vec_point[ 1 ] = mv_correspScaled[ corr ].m_point3D[ 1 ];
-	  vec_point[ 2 ] = mv_correspScaled[ corr ].m_point3D[ 2 ];
-	  vec_point[ 3 ] = 1.0;
-
-	  mat_A( 3*corr, 0 ) = - vec_point[ 0 ];
-	  mat_A( 3*corr, 1 ) = - vec_point[ 1 ];
-	  mat_A( 3*corr, 2 ) = - vec_point[ 2 ];
-	  mat_A( 3*corr, 3 ) = - vec_point[ 3 ];
-
-	  mat_A( 3*corr, 8 ) = vec_point[ 0 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-	  mat_A( 3*corr, 9 ) = vec_point[ 1 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-	  mat_A( 3*corr, 10 ) = vec_point[ 2 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-	  mat_A( 3*corr, 11 ) = vec_point[ 3 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-
-
-	  mat_A( 3*corr + 1, 4  ) = - vec_point[ 0 ];
-	  mat_A( 3*corr + 1, 5  ) = - vec_point[ 1 ];
-	  mat_A( 3*corr + 1, 6  ) = - vec_point[ 2 ];
-	  mat_A( 3*corr + 1, 7  ) = - vec_point[ 3 ];
-
-	  mat_A( 3*corr + 1, 8  ) = vec_point[ 0 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-	  mat_A( 3*corr + 1, 9  ) = vec_point[ 1 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-	  mat_A( 3*corr + 1, 10  ) = vec_point[ 2 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-	  mat_A( 3*corr + 1, 11  ) = vec_point[ 3 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-
+	  const Vector3D & X = mv_correspScaled[ corr ].m_point3D;
+	  const Vector2D & x = mv_correspScaled[ corr ].m_point2D;
+	  const double vec_point[ 4 ] = { X[ 0 ], X[ 1 ], X[ 2 ], 1.0 };
 
+	  for( int i = 0; i < 4; ++i )
+	  {
+		  row[ i ] = - vec_point[ i ];
+		  row[ 4 + i ] = 0.0;
+		  row[ 8 + i ] = vec_point[ i ] * x[ 0 ];
+	  }
+	  addRowToR( mat_R, row );
 
-	  mat_A( 3*corr + 2, 0  ) = -vec_point[ 0 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-	  mat_A( 3*corr + 2, 1  ) = -vec_point[ 1 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-	  mat_A( 3*corr + 2, 2  ) = -vec_point[ 2 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
-	  mat_A( 3*corr + 2, 3  ) = -vec_point[ 3 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 1 ];
+	  for( int i = 0; i < 4; ++i )
+	  {
+		  row[ i ] = 0.0;
+		  row[ 4 + i ] = - vec_point[ i ];
+		  row[ 8 + i ] = vec_point[ i ] * x[ 1 ];
+	  }
+	  addRowToR( mat_R, row );
 
-	  mat_A( 3*corr + 2, 4  ) = vec_point[ 0 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-	  mat_A( 3*corr + 2, 5  ) = vec_point[ 1 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-	  mat_A( 3*corr + 2, 6  ) = vec_point[ 2 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
-	  mat_A( 3*corr + 2, 7  ) = vec_point[ 3 ]
-		  * mv_correspScaled[ corr ].m_point2D[ 0 ];
+	  for( int i = 0; i < 4; ++i )
+	  {
+		  row[ i ] = - vec_point[ i ] * x[ 1 ];
+		  row[ 4 + i ] = vec_point[ i ] * x[ 0 ];
+		  row[ 8 + i ] = 0.0;
+	  }
+	  addRowToR( mat_R, row );
     }
 
 
     ////////////////////////////////////////////////////
-    // solve system A * p = 0
+    // solve system A * p = 0, the solution is the right singular
+    // vector belonging to the smallest singular value
 
-    if( ! SVD_V( mat_A, mat_VT ) )
+    if( ! smallestRightSingularVector( mat_R, vec_P ) )
     {
 	  return false;
     }
 
 
-    // last column of V is solution ( = last row of VT)
-    int col, row;
-    for( row = 0; row < 3; ++row )
+    int col, row_;
+    for( row_ = 0; row_ < 3; ++row_ )
     {
 	  for( col = 0; col < 4; ++col )
 	  {
-		  m_projectionMatrix( row, col ) = mat_VT( 11, 4*row + col  );
+		  m_projectionMatrix( row_, col ) = vec_P[ 4*row_ + col ];
 	  }
     }
 
@@ -456,7 +524,7 @@ bool SolverProj::computeLinearNew( void )
 double SolverProj::evaluateCorrespondence( const Vector2D & _point2D,
 					   const Vector3D & _point3D )
 {
-    static double retval, val;
+    double retval, val;
     Vector2D imgPoint;
 
     m_projectionMatrix.project( _point3D, imgPoint );
@@ -473,21 +541,32 @@ double SolverProj::evaluateCorrespondence( const Vector2D & _point2D,
 bool SolverProj::getPositionAndOrientation( Vector3D &position, Vector3D &orientation )
 {
   // get the position of the camera as the vector spanning the right null-space of the 
-  // projection matrix, see Hartley & Zisserman, 2nd edition, pages 158-159
-  Matrix mat_VT( 4, 4 ), mat_P( 3, 4 );
-  for( int i=0; i<3; ++i )
+  // projection matrix, see Hartley & Zisserman, 2nd edition, pages 158-159.
+  // The null-space is spanned by the vector of (signed) determinants of the 3x3 submatrices
+  // obtained by removing one column, the last entry is -det of the left 3x3 part.
+  const ProjMatrix & P = m_projectionMatrix;
+  double det_minor[ 4 ];
+  for( int k = 0; k < 4; ++k )
   {
-    for( int j=0; j<4; ++j )
-      mat_P(i,j) = m_projectionMatrix(i,j);
+    int c[ 3 ], n = 0;
+    for( int j = 0; j < 4; ++j )
+    {
+      if( j != k )
+        c[ n++ ] = j;
+    }
+    
+    det_minor[ k ] = P(0,c[0]) * ( P(1,c[1]) * P(2,c[2]) - P(1,c[2]) * P(2,c[1]) ) 
+                   - P(0,c[1]) * ( P(1,c[0]) * P(2,c[2]) - P(1,c[2]) * P(2,c[0]) ) 
+                   + P(0,c[2]) * ( P(1,c[0]) * P(2,c[1]) - P(1,c[1]) * P(2,c[0]) );
   }
   
-  if( ! SVD_V( mat_P, mat_VT ) )
-  {
-      return false;
-  }
+  // the camera center is at infinity
+  if( det_minor[ 3 ] == 0.0 )
+    return false;
   
-  for( int i=0; i<3; ++i )
-    position[i] = mat_VT( 3,i ) / mat_VT( 3,3 );
+  position[0] = - det_minor[ 0 ] / det_minor[ 3 ];
+  position[1] = det_minor[ 1 ] / det_minor[ 3 ];
+  position[2] = - det_minor[ 2 ] / det_minor[ 3 ];
   
   // get the viewing direction of the camera, see Hartley & Zisserman, 2nd ed., pages 160 - 161
   // compute the determinant of the 3x3 part of the projection matrix
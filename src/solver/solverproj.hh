@@ -107,7 +107,8 @@ public:
     //! Compute projection matrix using SVD
     bool computeLinear( void );
     
-    //! Compute projection matrix with extended linear matrix
+    //! Compute projection matrix with extended linear matrix, using only fixed-size
+    //! matrices on the stack (no heap allocation, no LAPACK call)
     bool computeLinearNew( void );
 
     //! Get computed projection matrix
@@ -134,7 +135,8 @@ public:
     virtual double evaluateCorrespondence( const Vector2D & _point2D,
 					   const Vector3D & _point3D );
 					   
-    //! get the position and orientation of the camera as two 3D vectors
+    //! get the position and orientation of the camera as two 3D vectors (computed in closed form).
+    //! Returns false if the camera center lies at infinity.
     bool getPositionAndOrientation( Vector3D &position, Vector3D &orientation );
 
 
@@ -25,6 +25,8 @@
 #include "timer.hh"
 
 #include <cmath>
+#include <limits>
+#include <algorithm>
 
 Timer::Timer()
 {
@@ -47,7 +49,7 @@ void Timer::Init()
 
 void Timer::Start()
 {
-  gettimeofday( &time_start, 0 );
+  clock_gettime( CLOCK_MONOTONIC, &time_start );
   elapsed_time = 0.0;
 }
 
@@ -55,17 +57,17 @@ void Timer::Start()
 
 void Timer::Restart()
 {
-  gettimeofday( &time_start, 0 );
+  clock_gettime( CLOCK_MONOTONIC, &time_start );
 }
 
 //-----------------------------------
 
 void Timer::Stop()
 {
-  gettimeofday( & time_end, 0 );
+  clock_gettime( CLOCK_MONOTONIC, &time_end );
   
-  // compute the elapsed time in seconds, i.e. we have to convert from microseconds to seconds
-  elapsed_time += ( (double) time_end.tv_sec - (double) time_start.tv_sec + ( (double) time_end.tv_usec - (double) time_start.tv_usec)/1e6 );
+  // compute the elapsed time in seconds, i.e. we have to convert from nanoseconds to seconds
+  elapsed_time += ( (double) time_end.tv_sec - (double) time_start.tv_sec + ( (double) time_end.tv_nsec - (double) time_start.tv_nsec)/1e9 );
 }
 
 //-----------------------------------
@@ -88,4 +90,112 @@ std::string Timer::GetElapsedTimeAsString()
   return s.str();
 }
 
+//-----------------------------------
+
+double Timer::Now()
+{
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+//-----------------------------------
+
+Deadline::Deadline()
+{
+  time = std::numeric_limits< double >::infinity();
+}
+
+//-----------------------------------
+
+Deadline::Deadline( double time_ )
+{
+  time = time_;
+}
+
+//-----------------------------------
+
+Deadline Deadline::FromNow( double seconds )
+{
+  return Deadline( Timer::Now() + seconds );
+}
+
+//-----------------------------------
+
+Deadline Deadline::Earliest( const Deadline &a, const Deadline &b )
+{
+  return Deadline( std::min( a.time, b.time ) );
+}
+
+//-----------------------------------
+
+bool Deadline::IsSet() const
+{
+  return time != std::numeric_limits< double >::infinity();
+}
 
+//-----------------------------------
+
+double Deadline::GetTime() const
+{
+  return time;
+}
+
+//-----------------------------------
+
+double Deadline::GetRemainingTime() const
+{
+  return time - Timer::Now();
+}
+
+//-----------------------------------
+
+bool Deadline::Expired() const
+{
+  return IsSet() && Timer::Now() >= time;
+}
+
+//-----------------------------------
+
+DeadlineChecker::DeadlineChecker( const Deadline &deadline_, double check_interval_ )
+  : deadline( deadline_ ), check_interval( check_interval_ ), iterations_per_check( 1 ), countdown( 1 ), expired( false )
+{
+  last_check = Timer::Now();
+  
+  // without a deadline, we never need to read the clock
+  if( !deadline.IsSet() )
+    countdown = std::numeric_limits< uint32_t >::max();
+}
+
+//-----------------------------------
+
+bool DeadlineChecker::Check()
+{
+  if( expired || !deadline.IsSet() )
+  {
+    countdown = expired ? 1 : std::numeric_limits< uint32_t >::max();
+    return expired;
+  }
+  
+  double now = Timer::Now();
+  if( now >= deadline.GetTime() )
+  {
+    expired = true;
+    countdown = 1;
+    return true;
+  }
+  
+  // adapt the number of iterations between two checks to the measured time per iteration,
+  // but do not check later than the deadline (approximately). The number of iterations at most
+  // doubles from one check to the next, such that a single fast iteration cannot disable the checks
+  double time_per_iteration = ( now - last_check ) / double( iterations_per_check );
+  double interval = std::min( check_interval, deadline.GetTime() - now );
+  double iterations = 2.0 * double( iterations_per_check );
+  if( time_per_iteration > 0.0 )
+    iterations = std::min( iterations, interval / time_per_iteration );
+  iterations_per_check = (uint32_t) std::max( 1.0, std::min( iterations, 65536.0 ) );
+  countdown = iterations_per_check;
+  last_check = now;
+  
+  return false;
+}
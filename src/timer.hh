@@ -28,8 +28,9 @@
 /**
  *    Class to get timing results (basic stopwatch).
  *    Note that this implementation only works for Linux and Mac OS since
- *    Windows has not gettimeofday function.
- *    Reports time in seconds, accurate up to microseconds
+ *    Windows has not clock_gettime function.
+ *    Reports time in seconds, measured with the monotonic clock, i.e., the
+ *    results are not affected by changes of the system time.
  *
  *    Based on the timer implementation of Darko Pavic.
  *  
@@ -41,6 +42,8 @@
 #include <sys/time.h>
 #include <sys/times.h>
 #include <sys/types.h>
+#include <time.h>
+#include <stdint.h>
 
 #include <string>
 #include <sstream>
@@ -73,13 +76,86 @@ class Timer
 	// get the elapsed time in seconds in a string
 	std::string GetElapsedTimeAsString();
 	
+	// current time of the monotonic clock in seconds (counted from an arbitrary starting point)
+	static double Now();
+	
   private:
-	struct timeval time_start;
-	struct timeval time_end;
+	struct timespec time_start;
+	struct timespec time_end;
 	
 	double elapsed_time;
   
 };
 
+/**
+ *    A point in time on the monotonic clock (see Timer::Now()) until which a
+ *    computation should be finished. A default constructed deadline is not set,
+ *    i.e., it never expires.
+**/
+class Deadline
+{
+  public:
+	// no deadline
+	Deadline();
+	
+	// deadline at the given time of the monotonic clock
+	explicit Deadline( double time );
+	
+	// deadline in the given number of seconds from now
+	static Deadline FromNow( double seconds );
+	
+	// the earlier of both deadlines
+	static Deadline Earliest( const Deadline &a, const Deadline &b );
+	
+	// is there a deadline at all?
+	bool IsSet() const;
+	
+	// time of the deadline on the monotonic clock
+	double GetTime() const;
+	
+	// seconds until the deadline, negative if it has passed (reads the clock)
+	double GetRemainingTime() const;
+	
+	// has the deadline passed? (reads the clock)
+	bool Expired() const;
+	
+  private:
+	double time;
+};
+
+/**
+ *    Checks a deadline once per iteration of a loop. Reading the clock for every
+ *    iteration would be too expensive for short iterations, so the clock is only
+ *    read every K iterations, where K is adapted to the measured time per iteration
+ *    such that the clock is read about every check_interval seconds.
+**/
+class DeadlineChecker
+{
+  public:
+	DeadlineChecker( const Deadline &deadline, double check_interval = 0.001 );
+	
+	// call once per iteration, returns true if the deadline has passed
+	inline bool Expired()
+	{
+	  if( --countdown > 0 )
+		return false;
+	  return Check();
+	}
+	
+	// time on the monotonic clock at which the clock was read last (by the constructor or a check)
+	double GetLastCheck() const { return last_check; }
+	
+  private:
+	// reads the clock and adapts the number of iterations until the next check
+	bool Check();
+	
+	Deadline deadline;
+	double check_interval;
+	double last_check;
+	uint32_t iterations_per_check;
+	uint32_t countdown;
+	bool expired;
+};
+
 #endif
 